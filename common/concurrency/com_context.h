@@ -43,7 +43,7 @@ class com_context : public executor
 {
 	std::unique_ptr<T> instance_;
 public:
-	com_context(const std::wstring& name) : executor(name)
+	com_context(const std::wstring& name) : executor(name, thread_backend)
 	{
 		executor::begin_invoke([]
 		{
@@ -29,11 +29,14 @@
 
 #include <tbb/atomic.h>
 #include <tbb/concurrent_queue.h>
+#include <tbb/spin_mutex.h>
+#include <tbb/task.h>
 
 #include <boost/thread.hpp>
 #include <boost/optional.hpp>
 #include <boost/noncopyable.hpp>
 
+#include <algorithm>
 #include <functional>
 
 namespace caspar {
@@ -53,14 +56,71 @@ enum thread_priority
 	below_normal_priority_class
 };
 
+enum executor_backend
+{
+	default_backend,	// See executor::set_default_backend.
+	thread_backend,		// Dedicated thread, required by thread affine work such as opengl, com and device sdks.
+	pool_backend		// Strand on the shared tbb work-stealing scheduler.
+};
+
 class executor : boost::noncopyable
 {
+	enum strand_state
+	{
+		idle,
+		queued,
+		running
+	};
+
+	static const size_t strand_batch_size = 16;
+
+	struct strand_task : public tbb::task
+	{
+		executor& self;
+
+		strand_task(executor& self) : self(self){}
+
+		tbb::task* execute()
+		{
+			if(self.state_.compare_and_swap(running, queued) == queued)
+				self.drain(strand_batch_size);
+
+			// The executor may be destroyed as soon as this returns.
+			self.release_enqueued();
+
+			return nullptr;
+		}
+	};
+
 	const std::string name_;
+	const executor_backend backend_;
 	boost::thread thread_;
 	tbb::atomic<bool> is_running_;
 	
 	typedef tbb::concurrent_bounded_queue<std::function<void()>> function_queue;
 	function_queue execution_queue_[priority_count];
+
+	// pool_backend
+	tbb::atomic<int> state_;
+	tbb::atomic<int> enqueued_;
+	mutable tbb::spin_mutex drain_thread_mutex_;
+	boost::thread::id drain_thread_;
+	boost::mutex idle_mutex_;
+	boost::condition_variable idle_cond_;
+
+	static tbb::atomic<int>& default_backend_storage()
+	{
+		static tbb::atomic<int> backend;
+		return backend;
+	}
+
+	static executor_backend resolve(executor_backend backend)
+	{
+		if(backend != default_backend)
+			return backend;
+
+		return default_backend_storage() == pool_backend ? pool_backend : thread_backend;
+	}
 		
 	template<typename Func>
 	auto create_task(Func&& func) -> boost::packaged_task<decltype(func())> // noexcept
@@ -73,8 +133,10 @@ class executor : boost::noncopyable
 		{
 			try
 			{
-				if(boost::this_thread::get_id() == thread_.get_id())  // Avoids potential deadlock.
+				if(is_current())  // Avoids potential deadlock.
 					my_task();
+				else if(backend_ == pool_backend)
+					help();
 			}
 			catch(boost::task_already_started&){}
 		}));
@@ -84,10 +146,16 @@ class executor : boost::noncopyable
 
 public:
 		
-	explicit executor(const std::wstring& name) : name_(narrow(name)) // noexcept
+	explicit executor(const std::wstring& name, executor_backend backend = default_backend) // noexcept
+		: name_(narrow(name))
+		, backend_(resolve(backend))
 	{
 		is_running_ = true;
-		thread_ = boost::thread([this]{run();});
+		state_ = idle;
+		enqueued_ = 0;
+
+		if(backend_ == thread_backend)
+			thread_ = boost::thread([this]{run();});
 	}
 	
 	virtual ~executor() // noexcept
@@ -96,6 +164,17 @@ public:
 		join();
 	}
 
+	// Applies to executors created afterwards with default_backend.
+	static void set_default_backend(executor_backend backend)
+	{
+		default_backend_storage() = backend;
+	}
+
+	static executor_backend get_default_backend()
+	{
+		return resolve(default_backend);
+	}
+
 	void set_capacity(size_t capacity) // noexcept
 	{
 		execution_queue_[normal_priority].set_capacity(capacity);
@@ -103,6 +182,9 @@ public:
 
 	void set_priority_class(thread_priority p)
 	{
+		if(backend_ != thread_backend) // Pool threads are shared.
+			return;
+
 		begin_invoke([=]
 		{
 			if(p == high_priority_class)
@@ -126,7 +208,9 @@ public:
 	void stop() // noexcept
 	{
 		is_running_ = false;	
-		execution_queue_[normal_priority].try_push([]{}); // Wake the execution thread.
+
+		if(backend_ == thread_backend)
+			execution_queue_[normal_priority].try_push([]{}); // Wake the execution thread.
 	}
 
 	void wait() // noexcept
@@ -136,8 +220,18 @@ public:
 
 	void join()
 	{
-		if(boost::this_thread::get_id() != thread_.get_id())
+		if(is_current())
+			return;
+
+		if(backend_ == thread_backend)
+		{
 			thread_.join();
+			return;
+		}
+
+		boost::unique_lock<boost::mutex> lock(idle_mutex_);
+		while(enqueued_ > 0 || state_ != idle || !execution_queue_[normal_priority].empty() || !execution_queue_[high_priority].empty())
+			idle_cond_.wait(lock);
 	}
 				
 	template<typename Func>
@@ -166,7 +260,9 @@ public:
 			}
 		});
 
-		if(priority != normal_priority)
+		if(backend_ == pool_backend)
+			schedule();
+		else if(priority != normal_priority)
 			execution_queue_[normal_priority].push(nullptr);
 					
 		return std::move(future);		
@@ -175,7 +271,7 @@ public:
 	template<typename Func>
 	auto invoke(Func&& func, task_priority prioriy = normal_priority) -> decltype(func()) // noexcept
 	{
-		if(boost::this_thread::get_id() == thread_.get_id())  // Avoids potential deadlock.
+		if(is_current())  // Avoids potential deadlock.
 			return func();
 		
 		return begin_invoke(std::forward<Func>(func), prioriy).get();
@@ -183,7 +279,7 @@ public:
 	
 	void yield() // noexcept
 	{
-		if(boost::this_thread::get_id() != thread_.get_id())  // Only yield when calling from execution thread.
+		if(!is_current())  // Only yield when calling from execution thread.
 			return;
 
 		std::function<void()> func;
@@ -199,8 +295,95 @@ public:
 	bool empty() const /*noexcept*/	{ return execution_queue_[normal_priority].empty();	}
 	bool is_running() const /*noexcept*/ { return is_running_; }	
 	const std::string& name() const { return name_; }
+	executor_backend backend() const { return backend_; }
+
+	bool is_current() const /*noexcept*/
+	{
+		if(backend_ == thread_backend)
+			return boost::this_thread::get_id() == thread_.get_id();
+
+		tbb::spin_mutex::scoped_lock lock(drain_thread_mutex_);
+		return boost::this_thread::get_id() == drain_thread_;
+	}
 		
 private:
+
+	void schedule() // noexcept
+	{
+		// Counted before the strand is queued so that join cannot see an idle
+		// executor while a strand is on its way.
+		++enqueued_;
+
+		if(state_.compare_and_swap(queued, idle) != idle)
+		{
+			release_enqueued();
+			return;
+		}
+
+		tbb::task::enqueue(*new(tbb::task::allocate_root()) strand_task(*this));
+	}
+
+	void release_enqueued() // noexcept
+	{
+		boost::lock_guard<boost::mutex> lock(idle_mutex_);
+
+		if(--enqueued_ == 0)
+			idle_cond_.notify_all();
+	}
+
+	// Called by a thread waiting on one of our futures. Runs the strand on the
+	// waiting thread if no pool thread has picked it up yet, so that waits do
+	// not deadlock when every pool thread is blocked.
+	void help() // noexcept
+	{
+		if(state_.compare_and_swap(running, queued) == queued)
+			drain(std::max<std::ptrdiff_t>(0, execution_queue_[normal_priority].size()) + 1);
+	}
+
+	void drain(size_t max_tasks) // noexcept
+	{
+		boost::thread::id previous_thread;
+		{
+			tbb::spin_mutex::scoped_lock lock(drain_thread_mutex_);
+			previous_thread = drain_thread_;
+			drain_thread_ = boost::this_thread::get_id();
+		}
+
+		for(size_t n = 0; n < max_tasks; ++n)
+		{
+			yield();
+
+			std::function<void()> func;
+			if(!execution_queue_[normal_priority].try_pop(func))
+				break;
+
+			if(func)
+				func();
+		}
+
+		yield();
+
+		{
+			tbb::spin_mutex::scoped_lock lock(drain_thread_mutex_);
+			drain_thread_ = previous_thread;
+		}
+
+		bool reschedule;
+		{
+			boost::lock_guard<boost::mutex> lock(idle_mutex_);
+
+			state_ = idle;
+
+			reschedule = !execution_queue_[normal_priority].empty() || !execution_queue_[high_priority].empty();
+			if(!reschedule)
+				idle_cond_.notify_all();
+		}
+
+		// join waits while the queues are not empty, nothing else drains them
+		// until the strand is scheduled again.
+		if(reschedule)
+			schedule();
+	}
 	
 	void execute() // noexcept
 	{
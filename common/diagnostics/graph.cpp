@@ -101,7 +101,7 @@ public:
 	}
 				
 private:
-	context() : executor_(L"diagnostics")
+	context() : executor_(L"diagnostics", thread_backend)
 	{
 		executor_.set_priority_class(below_normal_priority_class);
 	}
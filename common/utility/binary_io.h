@@ -0,0 +1,158 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include "../exception/exceptions.h"
+#include "string.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+
+// Helpers for the small binary index files kept in the data folder. Values
+// are stored in native byte order, the files are caches that are rebuilt
+// when they can not be read.
+
+namespace caspar {
+
+template<typename T>
+void write_value(std::ostream& stream, const T& value)
+{
+	stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+T read_value(std::istream& stream)
+{
+	T value = T();
+	stream.read(reinterpret_cast<char*>(&value), sizeof(T));
+	return value;
+}
+
+inline void write_string(std::ostream& stream, const std::wstring& value)
+{
+	write_value(stream, static_cast<uint32_t>(value.size()));
+	stream.write(reinterpret_cast<const char*>(value.data()), value.size() * sizeof(wchar_t));
+}
+
+// Fails the stream on strings longer than max_size, which only a corrupt
+// file contains.
+inline std::wstring read_string(std::istream& stream, uint32_t max_size = 32768)
+{
+	auto size = read_value<uint32_t>(stream);
+
+	if(!stream || size > max_size)
+	{
+		stream.setstate(std::ios::failbit);
+		return std::wstring();
+	}
+
+	std::wstring value(size, L'\0');
+	if(size > 0)
+		stream.read(reinterpret_cast<char*>(&value[0]), size * sizeof(wchar_t));
+	return value;
+}
+
+// Identifies the version of a file that an index entry was made from.
+struct file_stamp
+{
+	uint64_t	size;
+	int64_t		write_time;
+
+	file_stamp()
+		: size(0)
+		, write_time(0)
+	{
+	}
+
+	bool operator==(const file_stamp& other) const
+	{
+		return size == other.size && write_time == other.write_time;
+	}
+};
+
+inline bool try_get_file_stamp(const boost::filesystem::path& file, file_stamp& stamp)
+{
+	boost::system::error_code ec;
+
+	stamp.size			= boost::filesystem::file_size(file, ec);
+	if(ec)
+		return false;
+
+	stamp.write_time	= boost::filesystem::last_write_time(file, ec);
+	return !ec;
+}
+
+inline void write_file_stamp(std::ostream& stream, const file_stamp& stamp)
+{
+	write_value(stream, stamp.size);
+	write_value(stream, stamp.write_time);
+}
+
+inline file_stamp read_file_stamp(std::istream& stream)
+{
+	file_stamp stamp;
+	stamp.size			= read_value<uint64_t>(stream);
+	stamp.write_time	= read_value<int64_t>(stream);
+	return stamp;
+}
+
+// Writes magic, version and then write_body(stream) to a temporary file,
+// which replaces file once it has been written completely.
+template<typename F>
+void save_index_file(const boost::filesystem::path& file, uint32_t magic, uint32_t version, const F& write_body)
+{
+	boost::filesystem::create_directories(file.parent_path());
+
+	auto temp_file = file.wstring() + L".tmp";
+	{
+		boost::filesystem::ofstream stream(temp_file, std::ios::binary | std::ios::trunc);
+		write_value(stream, magic);
+		write_value(stream, version);
+
+		write_body(static_cast<std::ostream&>(stream));
+
+		if(!stream)
+			BOOST_THROW_EXCEPTION(io_error() << msg_info(narrow(temp_file)));
+	}
+
+	if(boost::filesystem::exists(file))
+		boost::filesystem::remove(file);
+
+	boost::filesystem::rename(temp_file, file);
+}
+
+// Opens a file written by save_index_file, false if it is missing or has
+// another magic or version.
+inline bool open_index_file(boost::filesystem::ifstream& stream, const boost::filesystem::path& file, uint32_t magic, uint32_t version)
+{
+	stream.open(file, std::ios::binary);
+	if(!stream)
+		return false;
+
+	return read_value<uint32_t>(stream) == magic && read_value<uint32_t>(stream) == version;
+}
+
+}
@@ -132,6 +132,11 @@ public:
 		return consumer_->has_synchronization_clock();
 	}
 
+	virtual consumer_send_policy::type send_policy() const override
+	{
+		return consumer_->send_policy();
+	}
+
 	virtual int buffer_depth() const override
 	{
 		return consumer_->buffer_depth();
@@ -157,6 +162,7 @@ const safe_ptr<frame_consumer>& frame_consumer::empty()
 		virtual int64_t presentation_frame_age_millis() const { return 0; }
 		virtual std::wstring print() const override {return L"empty";}
 		virtual bool has_synchronization_clock() const override {return false;}
+		virtual consumer_send_policy::type send_policy() const override {return consumer_send_policy::drop;}
 		virtual int buffer_depth() const override {return 0;};
 		virtual int index() const{return -1;}
 		virtual boost::property_tree::wptree info() const override
@@ -38,6 +38,16 @@ class parameters;
 struct video_format_desc;
 struct channel_layout;
 
+struct consumer_send_policy
+{
+	enum type
+	{
+		automatic = 0,	// The consumer's own send_policy().
+		block,			// The channel waits for the consumer when its queue is full.
+		drop			// Frames are dropped for the consumer when its queue is full.
+	};
+};
+
 struct frame_consumer : boost::noncopyable
 {
 	virtual ~frame_consumer() {}
@@ -48,6 +58,7 @@ struct frame_consumer : boost::noncopyable
 	virtual std::wstring print() const = 0;
 	virtual boost::property_tree::wptree info() const = 0;
 	virtual bool has_synchronization_clock() const {return true;}
+	virtual consumer_send_policy::type send_policy() const {return consumer_send_policy::block;} // What output does when the consumer falls behind.
 	virtual int buffer_depth() const = 0; // -1 to not participate in frame presentation synchronization
 	virtual int index() const = 0;
 
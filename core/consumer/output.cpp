@@ -37,15 +37,206 @@
 #include <common/memory/memshfl.h>
 #include <common/env.h>
 
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/circular_buffer.hpp>
 #include <boost/timer.hpp>
 #include <boost/range/algorithm.hpp>
 #include <boost/range/adaptors.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <tbb/atomic.h>
 
 namespace caspar { namespace core {
 
 const long SEND_TIMEOUT_MILLIS = 10000L;
+
+consumer_send_policy::type get_consumer_send_policy(const std::wstring& str)
+{
+	if(boost::iequals(str, L"block"))
+		return consumer_send_policy::block;
+	else if(boost::iequals(str, L"drop"))
+		return consumer_send_policy::drop;
+
+	return consumer_send_policy::automatic;
+}
+
+std::wstring get_consumer_send_policy(consumer_send_policy::type policy)
+{
+	switch(policy)
+	{
+	case consumer_send_policy::block:
+		return L"block";
+	case consumer_send_policy::drop:
+		return L"drop";
+	default:
+		return L"auto";
+	}
+}
+
+// Sends frames to one consumer on its own executor, so that a slow consumer
+// only holds back the channel when its policy is block.
+class consumer_port : boost::noncopyable
+{
+	const std::wstring					print_;
+	const safe_ptr<frame_consumer>		consumer_;
+	const consumer_send_policy::type	policy_;
+	const int							queue_depth_;
+	const channel_layout				audio_channel_layout_;
+	const int							channel_index_;
+	video_format_desc					format_desc_;
+
+	tbb::atomic<int>					queued_;
+	tbb::atomic<int>					max_queued_;
+	tbb::atomic<int64_t>				dropped_;
+	tbb::atomic<bool>					failed_;
+	boost::mutex						mutex_;
+	boost::condition_variable			cond_;
+
+	executor							executor_;
+public:
+	consumer_port(
+			const std::wstring& print,
+			const safe_ptr<frame_consumer>& consumer,
+			consumer_send_policy::type policy,
+			int queue_depth,
+			const video_format_desc& format_desc,
+			const channel_layout& audio_channel_layout,
+			int channel_index)
+		: print_(print)
+		, consumer_(consumer)
+		, policy_(policy != consumer_send_policy::automatic ? policy : consumer->send_policy())
+		, queue_depth_(std::max(1, queue_depth))
+		, audio_channel_layout_(audio_channel_layout)
+		, channel_index_(channel_index)
+		, format_desc_(format_desc)
+		, executor_(print + L" " + consumer->print())
+	{
+		queued_		= 0;
+		max_queued_	= 0;
+		dropped_	= 0;
+		failed_		= false;
+	}
+
+	~consumer_port()
+	{
+		executor_.clear();
+		failed_ = true;
+		cond_.notify_all();
+	}
+
+	// Block consumers keep the ticket until the frame has been sent, which
+	// is what paces the channel.
+	void push(const safe_ptr<read_frame>& frame, const std::shared_ptr<void>& ticket)
+	{
+		if(failed_)
+			return;
+
+		if(policy_ == consumer_send_policy::drop)
+		{
+			if(queued_ >= queue_depth_)
+			{
+				++dropped_;
+				return;
+			}
+		}
+		else
+		{
+			// A send that hangs times out and fails the consumer, the wait
+			// for room is bounded the same way.
+			auto deadline = boost::get_system_time() + boost::posix_time::milliseconds(SEND_TIMEOUT_MILLIS);
+
+			boost::unique_lock<boost::mutex> lock(mutex_);
+			while(queued_ >= queue_depth_ && !failed_)
+			{
+				if(!cond_.timed_wait(lock, deadline))
+				{
+					CASPAR_LOG(warning) << print_ << L" " << consumer_->print() << L" Timed out waiting for room, dropping frame.";
+					++dropped_;
+					return;
+				}
+			}
+		}
+
+		int queued = ++queued_;
+		int max_queued = max_queued_;
+		while(queued > max_queued && max_queued_.compare_and_swap(queued, max_queued) != max_queued)
+			max_queued = max_queued_;
+
+		auto held_ticket = policy_ == consumer_send_policy::block ? ticket : nullptr;
+
+		executor_.begin_invoke([=]() mutable
+		{
+			send(frame);
+			held_ticket.reset();
+
+			{
+				boost::lock_guard<boost::mutex> lock(mutex_);
+				--queued_;
+			}
+			cond_.notify_all();
+		});
+	}
+
+	void initialize(const video_format_desc& format_desc)
+	{
+		executor_.invoke([&]
+		{
+			consumer_->initialize(format_desc, audio_channel_layout_, channel_index_);
+			format_desc_ = format_desc;
+		}, high_priority);
+	}
+
+	const safe_ptr<frame_consumer>& consumer() const	{return consumer_;}
+	consumer_send_policy::type policy() const			{return policy_;}
+	int queue_depth() const								{return queue_depth_;}
+	int queued() const									{return queued_;}
+	int max_queued() const								{return max_queued_;}
+	int64_t dropped() const								{return dropped_;}
+	bool failed() const									{return failed_;}
+
+private:
+	void send(const safe_ptr<read_frame>& frame)
+	{
+		if(failed_)
+			return;
+
+		try
+		{
+			if(!wait(consumer_->send(frame), " Timed out during send"))
+				failed_ = true;
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+			try
+			{
+				consumer_->initialize(format_desc_, audio_channel_layout_, channel_index_);
+
+				if(!wait(consumer_->send(frame), " Timed out during retry"))
+					failed_ = true;
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+				CASPAR_LOG(error) << "Failed to recover consumer: " << consumer_->print() << L". Removing it.";
+				failed_ = true;
+			}
+		}
+
+		if(failed_)
+			cond_.notify_all();
+	}
+
+	bool wait(boost::unique_future<bool>&& result, const std::string& timeout_message)
+	{
+		if(!result.timed_wait(boost::posix_time::milliseconds(SEND_TIMEOUT_MILLIS)))
+			BOOST_THROW_EXCEPTION(timed_out() << msg_info(narrow(print_) + " " + narrow(consumer_->print()) + timeout_message));
+
+		return result.get();
+	}
+};
 	
 struct output::implementation
 {		
@@ -57,7 +248,7 @@ struct output::implementation
 	video_format_desc								format_desc_;
 	channel_layout									audio_channel_layout_;
 
-	std::map<int, safe_ptr<frame_consumer>>			consumers_;
+	std::map<int, safe_ptr<consumer_port>>			ports_;
 	
 	high_prec_timer									sync_timer_;
 
@@ -82,43 +273,48 @@ public:
 		graph_->set_color("consume-time", diagnostics::color(1.0f, 0.4f, 0.0f, 0.8));
 	}
 
-	void add(int index, safe_ptr<frame_consumer> consumer)
+	void add(int index, safe_ptr<frame_consumer> consumer, consumer_send_policy::type policy, int queue_depth)
 	{		
 		remove(index);
 
 		consumer = create_consumer_cadence_guard(consumer);
 		consumer->initialize(format_desc_, audio_channel_layout_, channel_index_);
 
+		auto port = make_safe<consumer_port>(print(), consumer, policy, queue_depth, format_desc_, audio_channel_layout_, channel_index_);
+
 		executor_.invoke([&]
 		{
-			consumers_.insert(std::make_pair(index, consumer));
-			CASPAR_LOG(info) << print() << L" " << consumer->print() << L" Added.";
+			ports_.insert(std::make_pair(index, port));
+			CASPAR_LOG(info) << print() << L" " << consumer->print() << L" Added. Send policy: " << get_consumer_send_policy(port->policy()) << L".";
 		}, high_priority);
 	}
 
-	void add(const safe_ptr<frame_consumer>& consumer)
+	void add(const safe_ptr<frame_consumer>& consumer, consumer_send_policy::type policy, int queue_depth)
 	{
-		add(consumer->index(), consumer);
+		add(consumer->index(), consumer, policy, queue_depth);
 	}
 
 	void remove(int index)
 	{		
 		// Destroy  consumer on calling thread:
-		std::shared_ptr<frame_consumer> old_consumer;
+		std::shared_ptr<consumer_port> old_port;
 
 		executor_.invoke([&]
 		{
-			auto it = consumers_.find(index);
-			if(it != consumers_.end())
+			auto it = ports_.find(index);
+			if(it != ports_.end())
 			{
-				old_consumer = it->second;
+				old_port = it->second;
 				send_to_consumers_delays_.erase(it->first);
-				consumers_.erase(it);
+				ports_.erase(it);
 			}
 		}, high_priority);
 
-		if(old_consumer)
+		if(old_port)
 		{
+			std::shared_ptr<frame_consumer> old_consumer = old_port->consumer();
+			old_port.reset();
+
 			auto str = old_consumer->print();
 			old_consumer.reset();
 			CASPAR_LOG(info) << print() << L" " << str << L" Removed.";
@@ -134,20 +330,20 @@ public:
 	{
 		executor_.invoke([&]
 		{
-			auto it = consumers_.begin();
-			while(it != consumers_.end())
+			auto it = ports_.begin();
+			while(it != ports_.end())
 			{						
 				try
 				{
-					it->second->initialize(format_desc, audio_channel_layout_, channel_index_);
+					it->second->initialize(format_desc);
 					++it;
 				}
 				catch(...)
 				{
 					CASPAR_LOG_CURRENT_EXCEPTION();
-					CASPAR_LOG(info) << print() << L" " << it->second->print() << L" Removed.";
+					CASPAR_LOG(info) << print() << L" " << it->second->consumer()->print() << L" Removed.";
 					send_to_consumers_delays_.erase(it->first);
-					consumers_.erase(it++);
+					ports_.erase(it++);
 				}
 			}
 			
@@ -160,10 +356,10 @@ public:
 	{
 		std::map<int, int> result;
 
-		BOOST_FOREACH(auto& consumer, consumers_)
+		BOOST_FOREACH(auto& port, ports_)
 			result.insert(std::make_pair(
-					consumer.first,
-					consumer.second->buffer_depth()));
+					port.first,
+					port.second->consumer()->buffer_depth()));
 
 		return result;
 	}
@@ -171,7 +367,7 @@ public:
 	std::pair<int, int> minmax_buffer_depth(
 			const std::map<int, int>& buffer_depths) const
 	{		
-		if(consumers_.empty())
+		if(ports_.empty())
 			return std::make_pair(0, 0);
 		
 		auto depths = buffer_depths
@@ -188,7 +384,22 @@ public:
 
 	bool has_synchronization_clock() const
 	{
-		return boost::range::count_if(consumers_ | boost::adaptors::map_values, [](const safe_ptr<frame_consumer>& x){return x->has_synchronization_clock();}) > 0;
+		return boost::range::count_if(ports_ | boost::adaptors::map_values, [](const safe_ptr<consumer_port>& x){return x->consumer()->has_synchronization_clock();}) > 0;
+	}
+
+	void remove_failed_ports()
+	{
+		for (auto it = ports_.begin(); it != ports_.end();)
+		{
+			if (it->second->failed())
+			{
+				CASPAR_LOG(info) << print() << L" " << it->second->consumer()->print() << L" Removed.";
+				send_to_consumers_delays_.erase(it->first);
+				it = ports_.erase(it);
+			}
+			else
+				++it;
+		}
 	}
 
 	void send(const std::pair<safe_ptr<read_frame>, std::shared_ptr<void>>& packet)
@@ -199,6 +410,8 @@ public:
 			{
 				consume_timer_.restart();
 
+				remove_failed_ports();
+
 				auto input_frame = packet.first;
 
 				if(!has_synchronization_clock())
@@ -219,90 +432,14 @@ public:
 				if(!frames_.full())
 					return;
 
-				std::map<int, boost::unique_future<bool>> send_results;
-
-				// Start invocations
-				for (auto it = consumers_.begin(); it != consumers_.end();)
+				BOOST_FOREACH(auto& port, ports_)
 				{
-					auto consumer	= it->second;
-					auto depth		= buffer_depths[it->first];
+					auto depth		= buffer_depths[port.first];
 					auto frame		= depth < 0 ? frames_.back() : frames_.at(depth - minmax.first);
 
-					send_to_consumers_delays_[it->first] = frame->get_age_millis();
-						
-					try
-					{
-						send_results.insert(std::make_pair(it->first, consumer->send(frame)));
-						++it;
-					}
-					catch(...)
-					{
-						CASPAR_LOG_CURRENT_EXCEPTION();
-						try
-						{
-							send_results.insert(std::make_pair(it->first, consumer->send(frame)));
-							++it;
-						}
-						catch(...)
-						{
-							CASPAR_LOG_CURRENT_EXCEPTION();
-							CASPAR_LOG(error) << "Failed to recover consumer: " << consumer->print() << L". Removing it.";
-							send_to_consumers_delays_.erase(it->first);
-							it = consumers_.erase(it);
-						}
-					}
-				}
+					send_to_consumers_delays_[port.first] = frame->get_age_millis();
 
-				// Retrieve results
-				for (auto result_it = send_results.begin(); result_it != send_results.end(); ++result_it)
-				{
-					auto consumer		= consumers_.at(result_it->first);
-					auto depth			= buffer_depths[result_it->first];
-					auto frame			= depth < 0 ? frames_.back() : frames_.at(depth - minmax.first);
-					auto& result_future	= result_it->second;
-						
-					try
-					{
-						if (!result_future.timed_wait(boost::posix_time::seconds(SEND_TIMEOUT_MILLIS)))
-						{
-							BOOST_THROW_EXCEPTION(timed_out() << msg_info(narrow(print()) + " " + narrow(consumer->print()) + " Timed out during send"));
-						}
-
-						if (!result_future.get())
-						{
-							CASPAR_LOG(info) << print() << L" " << consumer->print() << L" Removed.";
-							send_to_consumers_delays_.erase(result_it->first);
-							consumers_.erase(result_it->first);
-						}
-					}
-					catch (...)
-					{
-						CASPAR_LOG_CURRENT_EXCEPTION();
-						try
-						{
-							consumer->initialize(format_desc_, audio_channel_layout_, channel_index_);
-							auto retry_future = consumer->send(frame);
-
-							if (!retry_future.timed_wait(boost::posix_time::seconds(SEND_TIMEOUT_MILLIS)))
-							{
-								BOOST_THROW_EXCEPTION(timed_out() << msg_info(narrow(print()) + " " + narrow(consumer->print()) + " Timed out during retry"));
-							}
-
-							if (!retry_future.get())
-							{
-								CASPAR_LOG(info) << print() << L" " << consumer->print() << L" Removed.";
-								send_to_consumers_delays_.erase(result_it->first);
-								consumers_.erase(result_it->first);
-							}
-						}
-						catch (...)
-						{
-							CASPAR_LOG_CURRENT_EXCEPTION();
-							CASPAR_LOG(error) << "Failed to recover consumer: " << consumer->print() << L". Removing it.";
-							send_to_consumers_delays_.erase(result_it->first);
-							consumers_.erase(result_it->first);
-						}
-					}
+					port.second->push(frame, packet.second);
 				}
 						
 				graph_->set_value("consume-time", consume_timer_.elapsed()*format_desc_.fps*0.5);
@@ -325,10 +462,10 @@ public:
 		return std::move(executor_.begin_invoke([&]() -> boost::property_tree::wptree
 		{			
 			boost::property_tree::wptree info;
-			BOOST_FOREACH(auto& consumer, consumers_)
+			BOOST_FOREACH(auto& port, ports_)
 			{
-				info.add_child(L"consumers.consumer", consumer.second->info())
-					.add(L"index", consumer.first); 
+				info.add_child(L"consumers.consumer", port.second->consumer()->info())
+					.add(L"index", port.first); 
 			}
 			return info;
 		}, high_priority));
@@ -339,18 +476,23 @@ public:
 		return std::move(executor_.begin_invoke([&]() -> boost::property_tree::wptree
 		{			
 			boost::property_tree::wptree info;
-			BOOST_FOREACH(auto& consumer, consumers_)
+			BOOST_FOREACH(auto& port, ports_)
 			{
 				auto total_age =
-						consumer.second->presentation_frame_age_millis();
-				auto sendoff_age = send_to_consumers_delays_[consumer.first];
+						port.second->consumer()->presentation_frame_age_millis();
+				auto sendoff_age = send_to_consumers_delays_[port.first];
 				auto presentation_time = total_age - sendoff_age;
 
 				boost::property_tree::wptree child;
-				child.add(L"name", consumer.second->print());
+				child.add(L"name", port.second->consumer()->print());
 				child.add(L"age-at-arrival", sendoff_age);
 				child.add(L"presentation-time", presentation_time);
 				child.add(L"age-at-presentation", total_age);
+				child.add(L"send-policy", get_consumer_send_policy(port.second->policy()));
+				child.add(L"queue-depth", port.second->queue_depth());
+				child.add(L"queued-frames", port.second->queued());
+				child.add(L"max-queued-frames", port.second->max_queued());
+				child.add(L"dropped-frames", port.second->dropped());
 
 				info.add_child(L"consumer", child);
 			}
@@ -362,7 +504,7 @@ public:
 	{
 		return executor_.invoke([this]
 		{
-			return consumers_.empty();
+			return ports_.empty();
 		});
 	}
 
@@ -373,8 +515,8 @@ public:
 };
 
 output::output(const safe_ptr<diagnostics::graph>& graph, const video_format_desc& format_desc, const channel_layout& audio_channel_layout, int channel_index) : impl_(new implementation(graph, format_desc, audio_channel_layout, channel_index)){}
-void output::add(int index, const safe_ptr<frame_consumer>& consumer){impl_->add(index, consumer);}
-void output::add(const safe_ptr<frame_consumer>& consumer){impl_->add(consumer);}
+void output::add(int index, const safe_ptr<frame_consumer>& consumer, consumer_send_policy::type policy, int queue_depth){impl_->add(index, consumer, policy, queue_depth);}
+void output::add(const safe_ptr<frame_consumer>& consumer, consumer_send_policy::type policy, int queue_depth){impl_->add(consumer, policy, queue_depth);}
 void output::remove(int index){impl_->remove(index);}
 void output::remove(const safe_ptr<frame_consumer>& consumer){impl_->remove(consumer);}
 void output::send(const std::pair<safe_ptr<read_frame>, std::shared_ptr<void>>& frame) {impl_->send(frame); }
@@ -383,4 +525,4 @@ boost::unique_future<boost::property_tree::wptree> output::info() const{return i
 boost::unique_future<boost::property_tree::wptree> output::delay_info() const{return impl_->delay_info();}
 bool output::empty() const{return impl_->empty();}
 monitor::subject& output::monitor_output() { return impl_->monitor_output(); }
-}}
\ No newline at end of file
+}}
@@ -32,7 +32,12 @@
 #include <boost/property_tree/ptree_fwd.hpp>
 #include <boost/thread/future.hpp>
 
+#include <string>
+
 namespace caspar { namespace core {
+
+consumer_send_policy::type get_consumer_send_policy(const std::wstring& str);
+std::wstring get_consumer_send_policy(consumer_send_policy::type policy);
 	
 class output : public target<std::pair<safe_ptr<read_frame>, std::shared_ptr<void>>>
 			 , boost::noncopyable
@@ -46,8 +51,8 @@ public:
 
 	// output
 	
-	void add(const safe_ptr<frame_consumer>& consumer);
-	void add(int index, const safe_ptr<frame_consumer>& consumer);
+	void add(const safe_ptr<frame_consumer>& consumer, consumer_send_policy::type policy = consumer_send_policy::automatic, int queue_depth = 2);
+	void add(int index, const safe_ptr<frame_consumer>& consumer, consumer_send_policy::type policy = consumer_send_policy::automatic, int queue_depth = 2);
 	void remove(const safe_ptr<frame_consumer>& consumer);
 	void remove(int index);
 	
@@ -0,0 +1,586 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "stdafx.h"
+
+#include "media_library.h"
+
+#include "producer/media_info/media_info.h"
+#include "producer/media_info/media_info_repository.h"
+
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+#include <common/utility/binary_io.h>
+#include <common/utility/string.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/timer.hpp>
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace caspar { namespace core {
+
+static const uint32_t INDEX_MAGIC		= 0x58494c4d; // "MLIX"
+static const uint32_t INDEX_VERSION		= 1;
+static const double SAVE_INTERVAL_SECS	= 10.0;
+
+struct media_entry
+{
+	std::wstring	clip_type; // Empty for files that are not media, so that they are not probed again.
+	uint64_t		size;
+	int64_t			write_time;
+	media_info		info;
+	std::wstring	line;
+};
+
+struct media_library::implementation : public filesystem_monitor_factory
+{
+	struct subscriber
+	{
+		filesystem_event			events_mask;
+		bool						report_already_existing;
+		filesystem_monitor_handler	handler;
+		initial_files_handler		on_initial_files;
+	};
+
+	// A monitor handed out by the library, see media_library::monitor_factory().
+	class subscription : public filesystem_monitor
+	{
+		implementation&				library_;
+		std::shared_ptr<subscriber>	subscriber_;
+	public:
+		subscription(implementation& library, const std::shared_ptr<subscriber>& subscriber)
+			: library_(library)
+			, subscriber_(subscriber)
+		{
+		}
+
+		~subscription()
+		{
+			library_.unsubscribe(subscriber_);
+		}
+
+		virtual void reemmit_all() override
+		{
+			library_.monitor_->reemmit_all();
+		}
+
+		virtual void reemmit(const boost::filesystem::path& file) override
+		{
+			library_.monitor_->reemmit(file);
+		}
+	};
+
+	const std::wstring									media_path_;
+	const boost::filesystem::path						index_file_;
+	const media_classifier								classifier_;
+	const safe_ptr<media_info_repository>				media_info_repo_;
+
+	mutable boost::mutex								mutex_;
+	std::map<std::wstring, media_entry>					entries_;
+	std::unordered_multimap<std::wstring, std::wstring>	files_by_name_;
+	mutable std::wstring								listing_;
+	mutable bool										listing_valid_;
+	bool												ready_;
+	bool												dirty_;
+	boost::timer										since_saved_;
+
+	boost::mutex										subscribers_mutex_; // Held while subscribers are called.
+	std::list<std::shared_ptr<subscriber>>				subscribers_;
+	bool												scanned_;
+
+	std::shared_ptr<filesystem_monitor>					monitor_;
+public:
+	implementation(
+			filesystem_monitor_factory& monitor_factory,
+			const boost::filesystem::path& media_path,
+			const boost::filesystem::path& index_file,
+			const media_classifier& classifier,
+			const safe_ptr<media_info_repository>& media_info_repo)
+		: media_path_(media_path.wstring())
+		, index_file_(index_file)
+		, classifier_(classifier)
+		, media_info_repo_(media_info_repo)
+		, listing_valid_(false)
+		, ready_(false)
+		, dirty_(false)
+		, scanned_(false)
+	{
+		try
+		{
+			ready_ = load();
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+
+		if(ready_)
+			CASPAR_LOG(info) << L"Loaded media index of " << entries_.size() << L" files.";
+		else
+		{
+			entries_.clear();
+			files_by_name_.clear();
+		}
+
+		monitor_ = monitor_factory.create(
+				media_path,
+				ALL,
+				true,
+				[this] (filesystem_event event, const boost::filesystem::path& file)
+				{
+					this->on_file_event(event, file);
+				},
+				[this] (const std::set<boost::filesystem::path>& initial_files)
+				{
+					this->on_initial_files(initial_files);
+				});
+	}
+
+	~implementation()
+	{
+		monitor_.reset();
+
+		save_if_dirty(true);
+	}
+
+	bool is_ready() const
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		return ready_;
+	}
+
+	std::wstring list() const
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		if(!listing_valid_)
+		{
+			listing_.clear();
+
+			BOOST_FOREACH(auto& entry, entries_)
+				listing_ += entry.second.line;
+
+			boost::to_upper(listing_);
+			listing_valid_ = true;
+		}
+
+		return listing_;
+	}
+
+	std::wstring find(const std::wstring& name) const
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		std::vector<std::wstring> files;
+
+		auto range = files_by_name_.equal_range(boost::to_upper_copy(name));
+		for(auto it = range.first; it != range.second; ++it)
+			files.push_back(it->second);
+
+		std::sort(files.begin(), files.end());
+
+		std::wstring result;
+
+		BOOST_FOREACH(auto& file, files)
+		{
+			auto it = entries_.find(file);
+
+			if(it != entries_.end())
+				result += it->second.line;
+		}
+
+		return result;
+	}
+
+	bool contains(const std::wstring& clip) const
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		auto normalized = boost::replace_all_copy(boost::to_upper_copy(clip), L"\\", L"/");
+
+		auto range = files_by_name_.equal_range(boost::to_upper_copy(boost::filesystem::path(clip).filename().wstring()));
+		for(auto it = range.first; it != range.second; ++it)
+		{
+			if(boost::replace_all_copy(boost::to_upper_copy(clip_of(it->second)), L"\\", L"/") == normalized)
+				return true;
+		}
+
+		return false;
+	}
+
+	virtual filesystem_monitor::ptr create(
+			const boost::filesystem::path& folder_to_watch,
+			filesystem_event events_of_interest_mask,
+			bool report_already_existing,
+			const filesystem_monitor_handler& handler,
+			const initial_files_handler& initial_files_handler) override
+	{
+		if(!boost::filesystem::equivalent(folder_to_watch, media_path_))
+			BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Only the media folder can be monitored through the media library."));
+
+		auto sub = std::make_shared<subscriber>();
+		sub->events_mask				= events_of_interest_mask;
+		sub->report_already_existing	= report_already_existing;
+		sub->handler					= handler;
+		sub->on_initial_files			= initial_files_handler;
+
+		boost::mutex::scoped_lock lock(subscribers_mutex_);
+
+		subscribers_.push_back(sub);
+
+		// Late subscribers get what the first scan reported.
+		if(scanned_)
+		{
+			std::set<boost::filesystem::path> files;
+			{
+				boost::mutex::scoped_lock entries_lock(mutex_);
+				BOOST_FOREACH(auto& entry, entries_)
+					files.insert(entry.first);
+			}
+
+			if(report_already_existing && (events_of_interest_mask & CREATED))
+			{
+				BOOST_FOREACH(auto& file, files)
+					call(*sub, CREATED, file);
+			}
+
+			sub->on_initial_files(files);
+		}
+
+		return filesystem_monitor::ptr(new subscription(*this, sub));
+	}
+private:
+	void unsubscribe(const std::shared_ptr<subscriber>& sub)
+	{
+		boost::mutex::scoped_lock lock(subscribers_mutex_);
+		subscribers_.remove(sub);
+	}
+
+	static void call(const subscriber& sub, filesystem_event event, const boost::filesystem::path& file)
+	{
+		try
+		{
+			sub.handler(event, file);
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+	}
+
+	void notify(filesystem_event event, const boost::filesystem::path& file)
+	{
+		boost::mutex::scoped_lock lock(subscribers_mutex_);
+
+		BOOST_FOREACH(auto& sub, subscribers_)
+		{
+			if((sub->events_mask & event) == 0)
+				continue;
+
+			// Files found by the first scan are reported as CREATED.
+			if(event == CREATED && !scanned_ && !sub->report_already_existing)
+				continue;
+
+			call(*sub, event, file);
+		}
+	}
+
+	void notify_initial_files(const std::set<boost::filesystem::path>& initial_files)
+	{
+		boost::mutex::scoped_lock lock(subscribers_mutex_);
+
+		scanned_ = true;
+
+		BOOST_FOREACH(auto& sub, subscribers_)
+		{
+			try
+			{
+				sub->on_initial_files(initial_files);
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+			}
+		}
+	}
+
+	static std::wstring name_of(const std::wstring& file)
+	{
+		return boost::to_upper_copy(boost::filesystem::path(file).stem().wstring());
+	}
+
+	// The path relative to the media folder, without extension.
+	std::wstring clip_of(const std::wstring& file) const
+	{
+		auto relative_path = file.substr(std::min(media_path_.size(), file.size()));
+		boost::trim_left_if(relative_path, boost::is_any_of(L"\\/"));
+
+		return boost::filesystem::path(relative_path).replace_extension(L"").wstring();
+	}
+
+	std::wstring format_line(const std::wstring& file, const media_entry& entry) const
+	{
+		auto is_not_digit = [](wchar_t c){ return c < L'0' || c > L'9'; };
+
+		auto str = clip_of(file);
+
+		auto write_time = widen(boost::posix_time::to_iso_string(boost::posix_time::from_time_t(static_cast<std::time_t>(entry.write_time))));
+		write_time.erase(std::remove_if(write_time.begin(), write_time.end(), is_not_digit), write_time.end());
+
+		return std::wstring()
+				+ L"\""		+ str
+				+ L"\"  "	+ entry.clip_type
+				+ L"  "		+ boost::lexical_cast<std::wstring>(entry.size)
+				+ L" "		+ write_time
+				+ L" "		+ boost::lexical_cast<std::wstring>(entry.info.duration)
+				+ L" "		+ boost::lexical_cast<std::wstring>(entry.info.time_base.numerator()) + L"/" + boost::lexical_cast<std::wstring>(entry.info.time_base.denominator())
+				+ L"\r\n";
+	}
+
+	void insert(const std::wstring& file, media_entry entry)
+	{
+		if(!entry.clip_type.empty())
+			entry.line = format_line(file, entry);
+
+		auto it = entries_.find(file);
+
+		if(it == entries_.end())
+			files_by_name_.insert(std::make_pair(name_of(file), file));
+
+		entries_[file] = std::move(entry);
+		listing_valid_ = false;
+	}
+
+	void erase(const std::wstring& file)
+	{
+		if(entries_.erase(file) == 0)
+			return;
+
+		auto range = files_by_name_.equal_range(name_of(file));
+		for(auto it = range.first; it != range.second; ++it)
+		{
+			if(it->second == file)
+			{
+				files_by_name_.erase(it);
+				break;
+			}
+		}
+
+		listing_valid_ = false;
+		dirty_ = true;
+	}
+
+	void on_file_event(filesystem_event event, const boost::filesystem::path& path)
+	{
+		auto file = path.wstring();
+
+		if(event == REMOVED)
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			erase(file);
+		}
+		else
+			update(file, event == MODIFIED);
+
+		save_if_dirty(false);
+
+		notify(event, path);
+	}
+
+	void update(const std::wstring& file, bool modified)
+	{
+		media_entry entry;
+
+		try
+		{
+			entry.size			= boost::filesystem::file_size(file);
+			entry.write_time	= boost::filesystem::last_write_time(file);
+		}
+		catch(...)
+		{
+			// Probably removed.
+			return;
+		}
+
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+
+			auto it = entries_.find(file);
+
+			if(it != entries_.end() && it->second.size == entry.size && it->second.write_time == entry.write_time)
+				return;
+		}
+
+		entry.clip_type = classifier_(file);
+
+		if(!entry.clip_type.empty())
+		{
+			if(modified)
+				media_info_repo_->remove(file);
+
+			entry.info = media_info_repo_->get(file);
+		}
+
+		boost::mutex::scoped_lock lock(mutex_);
+		insert(file, std::move(entry));
+		dirty_ = true;
+	}
+
+	void on_initial_files(const std::set<boost::filesystem::path>& initial_files)
+	{
+		std::set<std::wstring> files;
+		BOOST_FOREACH(auto& file, initial_files)
+			files.insert(file.wstring());
+
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+
+			std::vector<std::wstring> removed;
+			BOOST_FOREACH(auto& entry, entries_)
+			{
+				if(files.find(entry.first) == files.end())
+					removed.push_back(entry.first);
+			}
+
+			BOOST_FOREACH(auto& file, removed)
+				erase(file);
+
+			ready_ = true;
+		}
+
+		CASPAR_LOG(info) << L"Media index up to date.";
+
+		save_if_dirty(true);
+
+		notify_initial_files(initial_files);
+	}
+
+	void save_if_dirty(bool force)
+	{
+		std::vector<std::pair<std::wstring, media_entry>> entries;
+
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+
+			if(!dirty_ || (!force && since_saved_.elapsed() < SAVE_INTERVAL_SECS))
+				return;
+
+			entries.assign(entries_.begin(), entries_.end());
+			dirty_ = false;
+			since_saved_.restart();
+		}
+
+		try
+		{
+			save(entries);
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+	}
+
+	void save(const std::vector<std::pair<std::wstring, media_entry>>& entries) const
+	{
+		save_index_file(index_file_, INDEX_MAGIC, INDEX_VERSION, [&](std::ostream& stream)
+		{
+			write_string(stream, media_path_);
+			write_value(stream, static_cast<uint32_t>(entries.size()));
+
+			BOOST_FOREACH(auto& entry, entries)
+			{
+				write_string(stream, entry.first);
+				write_string(stream, entry.second.clip_type);
+				write_value(stream, entry.second.size);
+				write_value(stream, entry.second.write_time);
+				write_value(stream, entry.second.info.duration);
+				write_value(stream, entry.second.info.time_base.numerator());
+				write_value(stream, entry.second.info.time_base.denominator());
+			}
+		});
+	}
+
+	bool load()
+	{
+		boost::filesystem::ifstream stream;
+		if(!open_index_file(stream, index_file_, INDEX_MAGIC, INDEX_VERSION))
+			return false;
+
+		// An index of another media folder is of no use.
+		if(read_string(stream) != media_path_)
+			return false;
+
+		auto count = read_value<uint32_t>(stream);
+
+		for(uint32_t n = 0; n < count && stream; ++n)
+		{
+			auto file = read_string(stream);
+
+			media_entry entry;
+			entry.clip_type		= read_string(stream);
+			entry.size			= read_value<uint64_t>(stream);
+			entry.write_time	= read_value<int64_t>(stream);
+			entry.info.duration	= read_value<int64_t>(stream);
+
+			auto numerator		= read_value<int64_t>(stream);
+			auto denominator	= read_value<int64_t>(stream);
+
+			if(!stream || denominator == 0)
+				break;
+
+			entry.info.time_base.assign(numerator, denominator);
+
+			insert(file, std::move(entry));
+		}
+
+		return !stream.fail();
+	}
+};
+
+media_library::media_library(
+		filesystem_monitor_factory& monitor_factory,
+		const boost::filesystem::path& media_path,
+		const boost::filesystem::path& index_file,
+		const media_classifier& classifier,
+		const safe_ptr<media_info_repository>& media_info_repo)
+	: impl_(new implementation(monitor_factory, media_path, index_file, classifier, media_info_repo))
+{
+}
+
+media_library::~media_library(){}
+bool media_library::is_ready() const{return impl_->is_ready();}
+std::wstring media_library::list() const{return impl_->list();}
+std::wstring media_library::find(const std::wstring& name) const{return impl_->find(name);}
+bool media_library::contains(const std::wstring& clip) const{return impl_->contains(clip);}
+filesystem_monitor_factory& media_library::monitor_factory(){return *impl_;}
+
+}}
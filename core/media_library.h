@@ -0,0 +1,99 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <common/memory/safe_ptr.h>
+#include <common/filesystem/filesystem_monitor.h>
+
+#include <functional>
+#include <string>
+
+namespace caspar { namespace core {
+
+struct media_info_repository;
+
+/**
+ * Determines the clip type of a file.
+ *
+ * @param file The file.
+ *
+ * @return STILL, AUDIO or MOVIE, or an empty string if the file is not media.
+ */
+typedef std::function<std::wstring (const boost::filesystem::path& file)> media_classifier;
+
+/**
+ * An index of the media folder, kept up to date by a filesystem monitor and
+ * saved between runs, so that clips can be listed and looked up without
+ * touching the filesystem.
+ */
+class media_library : boost::noncopyable
+{
+public:
+	media_library(
+			filesystem_monitor_factory& monitor_factory,
+			const boost::filesystem::path& media_path,
+			const boost::filesystem::path& index_file,
+			const media_classifier& classifier,
+			const safe_ptr<media_info_repository>& media_info_repo);
+	~media_library();
+
+	/**
+	 * Whether the index can be used, that is whether it was loaded from disk
+	 * or the media folder has been scanned once.
+	 */
+	bool is_ready() const;
+
+	/**
+	 * @return The CLS listing of every clip, one line per clip.
+	 */
+	std::wstring list() const;
+
+	/**
+	 * @param name The file name of a clip, without extension. Case
+	 *             insensitive.
+	 *
+	 * @return The CLS lines of the clips with that name.
+	 */
+	std::wstring find(const std::wstring& name) const;
+
+	/**
+	 * @param clip The path of a clip relative to the media folder, without
+	 *             extension. Case insensitive.
+	 *
+	 * @return Whether the library has a clip at exactly that path.
+	 */
+	bool contains(const std::wstring& clip) const;
+
+	/**
+	 * Creates monitors of the media folder that follow the library's own
+	 * monitor instead of scanning the folder again. Handlers are called
+	 * after the library has seen the change, never concurrently. The
+	 * monitors must not outlive the library.
+	 */
+	filesystem_monitor_factory& monitor_factory();
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}}
@@ -31,9 +31,15 @@
 
 #include <tbb/cache_aligned_allocator.h>
 
+#include <boost/foreach.hpp>
 #include <boost/range/adaptors.hpp>
+#include <boost/range/algorithm.hpp>
 #include <boost/range/distance.hpp>
 
+#include <intrin.h>
+
+#include <algorithm>
+#include <cmath>
 #include <map>
 #include <stack>
 #include <vector>
@@ -58,20 +64,189 @@ struct audio_item
 	}
 };
 
-typedef std::vector<double, tbb::cache_aligned_allocator<double>> audio_buffer_ps;
+typedef std::vector<float, tbb::cache_aligned_allocator<float>> audio_buffer_ps;
+
+// Samples of a stream that are carried over between frames, e.g. due to
+// audio cadence. The storage is kept between frames and the remaining
+// samples are only moved to the front when the space at the back runs out.
+class sample_fifo
+{
+	audio_buffer_ps	samples_;
+	size_t			begin_;
+	size_t			end_;
+public:
+	sample_fifo()
+		: begin_(0)
+		, end_(0)
+	{
+	}
+
+	size_t size() const
+	{
+		return end_ - begin_;
+	}
+
+	const float* data() const
+	{
+		return samples_.data() + begin_;
+	}
+
+	float* push(size_t count)
+	{
+		if(end_ + count > samples_.size())
+		{
+			std::copy(samples_.begin() + begin_, samples_.begin() + end_, samples_.begin());
+			end_ -= begin_;
+			begin_ = 0;
+
+			if(end_ + count > samples_.size())
+				samples_.resize(std::max(end_ + count, samples_.size() * 2));
+		}
+
+		auto ptr = samples_.data() + end_;
+		end_ += count;
+		return ptr;
+	}
+
+	void pop(size_t count)
+	{
+		begin_ += std::min(count, size());
+
+		if(begin_ == end_)
+			begin_ = end_ = 0;
+	}
+};
 	
 struct audio_stream
 {
 	frame_transform prev_transform;
-	audio_buffer_ps audio_data;
+	sample_fifo		samples;
+	bool			active;
+
+	audio_stream()
+		: active(false)
+	{
+	}
 };
 
+namespace simd {
+
+// dest = src * gain
+static void scale(float* dest, const int32_t* src, size_t count, float gain)
+{
+	const __m128 gain_ps = _mm_set1_ps(gain);
+
+	size_t n = 0;
+	for(; n + 4 <= count; n += 4)
+	{
+		auto src_ps = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n)));
+		_mm_storeu_ps(dest + n, _mm_mul_ps(src_ps, gain_ps));
+	}
+
+	for(; n < count; ++n)
+		dest[n] = static_cast<float>(src[n]) * gain;
+}
+
+// dest = src * gains
+static void scale(float* dest, const int32_t* src, size_t count, const float* gains)
+{
+	size_t n = 0;
+	for(; n + 4 <= count; n += 4)
+	{
+		auto src_ps = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n)));
+		_mm_storeu_ps(dest + n, _mm_mul_ps(src_ps, _mm_load_ps(gains + n)));
+	}
+
+	for(; n < count; ++n)
+		dest[n] = static_cast<float>(src[n]) * gains[n];
+}
+
+// Linear volume ramp with one step per sample frame.
+static void ramp(float* gains, size_t num_frames, size_t num_channels, float from, float to)
+{
+	const float step = (to - from) / static_cast<float>(num_frames);
+
+	if(num_channels % 4 == 0)
+	{
+		for(size_t frame = 0; frame < num_frames; ++frame)
+		{
+			const __m128 gain_ps = _mm_set1_ps(from + step * static_cast<float>(frame));
+			for(size_t ch = 0; ch < num_channels; ch += 4)
+				_mm_store_ps(gains + frame * num_channels + ch, gain_ps);
+		}
+	}
+	else
+	{
+		for(size_t frame = 0; frame < num_frames; ++frame)
+			std::fill_n(gains + frame * num_channels, num_channels, from + step * static_cast<float>(frame));
+	}
+}
+
+// dest += src
+static void accumulate(float* dest, const float* src, size_t count)
+{
+	size_t n = 0;
+	for(; n + 4 <= count; n += 4)
+		_mm_store_ps(dest + n, _mm_add_ps(_mm_load_ps(dest + n), _mm_loadu_ps(src + n)));
+
+	for(; n < count; ++n)
+		dest[n] += src[n];
+}
+
+// Converts to saturated int32 and collects the peak of each channel in the
+// same pass. lane_peaks must hold lcm(num_channels, 4) floats.
+static void convert(int32_t* dest, const float* src, size_t count, size_t num_channels, float* lane_peaks, std::vector<float>& peaks)
+{
+	static const float MAX_SAMPLE = 2147483520.0f; // Largest float below 2^31.
+	static const float MIN_SAMPLE = -2147483648.0f;
+
+	const size_t period = num_channels % 4 == 0 ? num_channels : num_channels % 2 == 0 ? num_channels * 2 : num_channels * 4;
+
+	const __m128 max_ps		= _mm_set1_ps(MAX_SAMPLE);
+	const __m128 min_ps		= _mm_set1_ps(MIN_SAMPLE);
+	const __m128 sign_ps	= _mm_set1_ps(-0.0f);
+
+	std::fill_n(lane_peaks, period, 0.0f);
+
+	size_t n = 0;
+	for(; n + period <= count; n += period)
+	{
+		for(size_t lane = 0; lane < period; lane += 4)
+		{
+			auto sample_ps = _mm_loadu_ps(src + n + lane);
+			sample_ps = _mm_min_ps(_mm_max_ps(sample_ps, min_ps), max_ps);
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n + lane), _mm_cvttps_epi32(sample_ps));
+			_mm_store_ps(lane_peaks + lane, _mm_max_ps(_mm_load_ps(lane_peaks + lane), _mm_andnot_ps(sign_ps, sample_ps)));
+		}
+	}
+
+	peaks.assign(num_channels, 0.0f);
+
+	for(size_t lane = 0; lane < period; ++lane)
+		peaks[lane % num_channels] = std::max(peaks[lane % num_channels], lane_peaks[lane]);
+
+	for(; n < count; ++n)
+	{
+		auto sample = std::min(std::max(src[n], MIN_SAMPLE), MAX_SAMPLE);
+		dest[n] = static_cast<int32_t>(sample);
+		peaks[n % num_channels] = std::max(peaks[n % num_channels], std::abs(sample));
+	}
+}
+
+}
+
 struct audio_mixer::implementation
 {
 	safe_ptr<diagnostics::graph>		graph_;
 	std::stack<core::frame_transform>	transform_stack_;
 	std::map<const void*, audio_stream>	audio_streams_;
 	std::vector<audio_item>				items_;
+	audio_buffer_ps						gains_;
+	audio_buffer_ps						mix_buffer_;
+	audio_buffer_ps						lane_peaks_;
+	std::vector<float>					peaks_;
+	std::vector<std::string>			peak_paths_;
 	std::vector<size_t>					audio_cadence_;
 	video_format_desc					format_desc_;
 	channel_layout						channel_layout_;
@@ -166,111 +341,123 @@ public:
 			format_desc_ = format_desc;
 			channel_layout_ = layout;
 		}
-		
-		std::map<const void*, audio_stream>	next_audio_streams;
 
+		const size_t num_channels = channel_layout_.num_channels;
+
+		BOOST_FOREACH(auto& stream, audio_streams_ | boost::adaptors::map_values)
+			stream.active = false;
+		
 		BOOST_FOREACH(auto& item, items_)
 		{
-			if (next_audio_streams.find(item.tag) != next_audio_streams.end())
-				continue;
+			auto it = audio_streams_.find(item.tag);
+			const bool is_new = it == audio_streams_.end();
 
-			audio_buffer_ps next_audio;
+			if(is_new)
+			{
+				it = audio_streams_.insert(std::make_pair(item.tag, audio_stream())).first;
+				it->second.prev_transform = item.transform;
+			}
+			else if(it->second.active)
+				continue;
 
-			auto next_transform = item.transform;
-			auto prev_transform = next_transform;
+			auto& stream = it->second;
 
-			const auto it = audio_streams_.find(item.tag);
-			if(it != audio_streams_.end())
-			{	
-				prev_transform	= it->second.prev_transform;
-				next_audio		= std::move(it->second.audio_data);
+			if(stream.prev_transform.volume < 0.001 && item.transform.volume < 0.001)
+			{
+				if(is_new)
+					audio_streams_.erase(it);
+				continue;
 			}
 
-			if(prev_transform.volume < 0.001 && next_transform.volume < 0.001)
-				continue;
-			
-			const double prev_volume = prev_transform.volume * previous_master_volume_;
-			const double next_volume = next_transform.volume * master_volume_;
-									
-			auto alpha = (next_volume-prev_volume)/static_cast<double>(item.audio_data.size()/channel_layout_.num_channels);
-			
-			for(size_t n = 0; n < item.audio_data.size(); ++n)
+			const float prev_volume = static_cast<float>(stream.prev_transform.volume * previous_master_volume_);
+			const float next_volume = static_cast<float>(item.transform.volume * master_volume_);
+
+			const size_t count = item.audio_data.size();
+			auto dest = stream.samples.push(count);
+
+			if(prev_volume == next_volume)
+				simd::scale(dest, item.audio_data.data(), count, next_volume);
+			else
 			{
-				auto sample_multiplier = (prev_volume + (n/channel_layout_.num_channels) * alpha);
-				next_audio.push_back(item.audio_data[n] * sample_multiplier);
+				if(gains_.size() < count)
+					gains_.resize(count);
+
+				simd::ramp(gains_.data(), count / num_channels, num_channels, prev_volume, next_volume);
+				simd::scale(dest, item.audio_data.data(), count, gains_.data());
 			}
-										
-			next_audio_streams[item.tag].prev_transform  = std::move(next_transform); // Store all active tags, inactive tags will be removed at the end.
-			next_audio_streams[item.tag].audio_data		 = std::move(next_audio);			
+
+			stream.prev_transform	= item.transform;
+			stream.active			= true;
 		}
 
 		previous_master_volume_ = master_volume_;
 		items_.clear();
 
-		audio_streams_ = std::move(next_audio_streams);
-		
-		if(audio_streams_.empty())		
-			audio_streams_[nullptr].audio_data = audio_buffer_ps(audio_size(audio_cadence_.front()), 0.0f);
-				
-		{ // sanity check
+		// Remove inactive streams.
+		for(auto it = audio_streams_.begin(); it != audio_streams_.end();)
+		{
+			if(it->second.active)
+				++it;
+			else
+				it = audio_streams_.erase(it);
+		}
 
-			auto nb_invalid_streams = boost::count_if(audio_streams_ | boost::adaptors::map_values, [&](const audio_stream& x)
-			{
-				return x.audio_data.size() < audio_size(audio_cadence_.front());
-			});
+		const size_t result_size = audio_size(audio_cadence_.front());
 
-			if(nb_invalid_streams > 0)		
-				CASPAR_LOG(trace) << "[audio_mixer] Incorrect frame audio cadence detected.";			
-		}
+		mix_buffer_.resize(result_size);
+		std::fill(mix_buffer_.begin(), mix_buffer_.end(), 0.0f);
 
-		audio_buffer_ps result_ps(audio_size(audio_cadence_.front()), 0.0f);
+		bool has_invalid_streams = false;
 
 		BOOST_FOREACH(auto& stream, audio_streams_ | boost::adaptors::map_values)
 		{
-			//CASPAR_LOG(debug) << stream.audio_data.size() << L" : " << result_ps.size();
+			auto count = std::min(stream.samples.size(), result_size);
 
-			if(stream.audio_data.size() < result_ps.size())
-			{
-				stream.audio_data.resize(result_ps.size(), 0.0f);
-				CASPAR_LOG(trace) << L"[audio_mixer] Appended zero samples";
-			}
+			if(count < result_size)
+				has_invalid_streams = true;
 
-			auto out = boost::range::transform(result_ps, stream.audio_data, std::begin(result_ps), std::plus<double>());
-			stream.audio_data.erase(std::begin(stream.audio_data), std::begin(stream.audio_data) + std::distance(std::begin(result_ps), out));
+			simd::accumulate(mix_buffer_.data(), stream.samples.data(), count);
+			stream.samples.pop(result_size);
 		}
-		
-		boost::range::rotate(audio_cadence_, std::begin(audio_cadence_)+1);
-		
 
-		audio_buffer result;
-		result.reserve(result_ps.size());
-		boost::range::transform(result_ps, std::back_inserter(result), [](double sample){return static_cast<int32_t>(sample);});		
+		if(has_invalid_streams)
+			CASPAR_LOG(trace) << "[audio_mixer] Incorrect frame audio cadence detected. Appended zero samples.";
 		
-		const int num_channels = channel_layout_.num_channels;
-		monitor_subject_ << monitor::message("/nb_channels") % num_channels;
+		boost::range::rotate(audio_cadence_, std::begin(audio_cadence_)+1);
 
-		auto max = std::vector<int32_t>(num_channels, std::numeric_limits<int32_t>::min());
+		lane_peaks_.resize(num_channels * 4);
 
-		for (size_t n = 0; n < result.size(); n += num_channels)
-			for (int ch = 0; ch < num_channels; ++ch)
-				max[ch] = std::max(max[ch], std::abs(result[n + ch]));
+		audio_buffer result(result_size);
+		simd::convert(result.data(), mix_buffer_.data(), result_size, num_channels, lane_peaks_.data(), peaks_);
+		
+		monitor_subject_ << monitor::message("/nb_channels") % static_cast<int>(num_channels);
 		
 		// Makes the dBFS of silence => -dynamic range of 32bit LPCM => about -192 dBFS
 		// Otherwise it would be -infinity
 		static const auto MIN_PFS = 0.5f / static_cast<float>(std::numeric_limits<int32_t>::max());
 
-		for (int i = 0; i < num_channels; ++i)
+		float max_pfs = 0.0f;
+
+		while (peak_paths_.size() < num_channels * 2)
 		{
-			const auto pFS  = max[i] / static_cast<float>(std::numeric_limits<int32_t>::max());
+			auto chan_str = boost::lexical_cast<std::string>(peak_paths_.size() / 2 + 1);
+
+			peak_paths_.push_back("/" + chan_str + "/pFS");
+			peak_paths_.push_back("/" + chan_str + "/dBFS");
+		}
+
+		for (size_t i = 0; i < num_channels; ++i)
+		{
+			const auto pFS  = std::min(1.0f, peaks_[i] / static_cast<float>(std::numeric_limits<int32_t>::max()));
 			const auto dBFS = 20.0f * std::log10(std::max(MIN_PFS, pFS));
-			
-			auto chan_str = boost::lexical_cast<std::string>(i + 1);
 
-			monitor_subject_ << monitor::message("/" + chan_str + "/pFS") % pFS;
-			monitor_subject_ << monitor::message("/" + chan_str + "/dBFS") % dBFS;
+			max_pfs = std::max(max_pfs, pFS);
+
+			monitor_subject_ << monitor::message(peak_paths_[i * 2].c_str()) % pFS;
+			monitor_subject_ << monitor::message(peak_paths_[i * 2 + 1].c_str()) % dBFS;
 		}
 
-		graph_->set_value("volume", static_cast<double>(*boost::max_element(max)) / std::numeric_limits<int32_t>::max());
+		graph_->set_value("volume", static_cast<double>(max_pfs));
 
 		return result;
 	}
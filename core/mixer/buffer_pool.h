@@ -0,0 +1,164 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <tbb/atomic.h>
+#include <tbb/concurrent_queue.h>
+
+#include <boost/foreach.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace caspar { namespace core {
+
+// Buffers of one size, shared by the device and system memory pools. The
+// pools are trimmed periodically, each trim being a generation.
+template<typename T>
+struct buffer_pool
+{
+	tbb::atomic<int>		in_use;
+	tbb::atomic<int>		high_water;	// Highest in_use since the last trim.
+	tbb::atomic<int64_t>	last_used;	// Trim generation of the last request.
+	tbb::atomic<size_t>		hits;
+	tbb::atomic<size_t>		misses;
+	tbb::atomic<size_t>		evictions;
+	tbb::concurrent_bounded_queue<std::shared_ptr<T>> items;
+
+	buffer_pool()
+	{
+		in_use		= 0;
+		high_water	= 0;
+		last_used	= 0;
+		hits		= 0;
+		misses		= 0;
+		evictions	= 0;
+	}
+};
+
+namespace buffer_pools {
+
+static const int64_t IDLE_TRIM_GENERATIONS = 10; // Trims a size may go unrequested before it is released.
+
+template<typename T>
+void record_request(buffer_pool<T>& pool, bool hit, int64_t generation)
+{
+	++(hit ? pool.hits : pool.misses);
+	pool.last_used = generation;
+
+	int in_use		= ++pool.in_use;
+	int high_water	= pool.high_water;
+	while(in_use > high_water)
+	{
+		int previous = pool.high_water.compare_and_swap(in_use, high_water);
+		if(previous == high_water)
+			break;
+		high_water = previous;
+	}
+}
+
+template<typename T>
+size_t evict(buffer_pool<T>& pool, size_t count)
+{
+	size_t evicted = 0;
+	std::shared_ptr<T> buffer;
+	while(evicted < count && pool.items.try_pop(buffer))
+	{
+		buffer.reset();
+		++evicted;
+	}
+	pool.evictions += evicted;
+	return evicted;
+}
+
+template<typename T>
+size_t pooled_count(const buffer_pool<T>& pool)
+{
+	return static_cast<size_t>(std::max<std::ptrdiff_t>(0, pool.items.size()));
+}
+
+// Releases the buffers the last period did not need at its peak, or all of 
+// them once the size has not been requested for a while.
+template<typename T>
+void trim_pool(buffer_pool<T>& pool, int64_t generation)
+{
+	size_t in_use		= std::max(0, static_cast<int>(pool.in_use));
+	size_t high_water	= std::max(0, pool.high_water.fetch_and_store(static_cast<int>(in_use)));
+	size_t pooled		= pooled_count(pool);
+
+	if(generation - pool.last_used > IDLE_TRIM_GENERATIONS)
+		evict(pool, pooled);
+	else if(in_use + pooled > high_water)
+		evict(pool, in_use + pooled - high_water);
+}
+
+struct pool_ref
+{
+	int64_t							last_used;
+	size_t							item_size;
+	std::function<size_t()>			pooled;
+	std::function<size_t(size_t)>	evict;
+};
+
+template<typename T>
+pool_ref make_pool_ref(const safe_ptr<buffer_pool<T>>& pool, size_t item_size)
+{
+	pool_ref ref;
+	ref.last_used	= pool->last_used;
+	ref.item_size	= item_size;
+	ref.pooled		= [=]{return pooled_count(*pool);};
+	ref.evict		= [=](size_t count){return buffer_pools::evict(*pool, count);};
+	return ref;
+}
+
+// Evicts from the least recently used sizes until the pooled memory fits.
+inline void enforce_budget(std::vector<pool_ref>& pools, size_t budget)
+{
+	size_t total = 0;
+	BOOST_FOREACH(auto& pool, pools)
+		total += pool.item_size * pool.pooled();
+
+	if(total <= budget)
+		return;
+
+	std::sort(pools.begin(), pools.end(), [](const pool_ref& lhs, const pool_ref& rhs)
+	{
+		return lhs.last_used < rhs.last_used;
+	});
+
+	BOOST_FOREACH(auto& pool, pools)
+	{
+		if(total <= budget)
+			break;
+
+		auto count = (total - budget + pool.item_size - 1) / pool.item_size;
+		total -= pool.item_size * pool.evict(count);
+	}
+}
+
+}
+
+}}
@@ -0,0 +1,167 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../../stdafx.h"
+
+#include "cpu_buffer.h"
+
+#include "../buffer_pool.h"
+
+#include <common/env.h>
+#include <common/utility/assert.h>
+
+#include <tbb/atomic.h>
+#include <tbb/cache_aligned_allocator.h>
+#include <tbb/concurrent_queue.h>
+#include <tbb/concurrent_unordered_map.h>
+
+#include <boost/foreach.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <array>
+#include <vector>
+
+namespace caspar { namespace core {
+
+static size_t get_pool_budget()
+{
+	return static_cast<size_t>(env::properties().get(L"configuration.mixer.cpu-pool-budget", 512)) * 1024 * 1024;
+}
+
+static tbb::atomic<int> g_total_count;
+static tbb::atomic<int> g_total_size;
+static tbb::atomic<int64_t> g_trim_generation;
+
+static std::array<tbb::concurrent_unordered_map<size_t, safe_ptr<buffer_pool<cpu_buffer>>>, 4> g_pools;
+
+struct cpu_buffer::implementation : boost::noncopyable
+{
+	const size_t	width_;
+	const size_t	height_;
+	const size_t	stride_;
+	const size_t	size_;
+
+	std::vector<uint8_t, tbb::cache_aligned_allocator<uint8_t>> data_;
+
+	implementation(size_t width, size_t height, size_t stride) 
+		: width_(width)
+		, height_(height)
+		, stride_(stride)
+		, size_(width * height * stride)
+		, data_(size_, 0)
+	{
+		g_total_size += size_;
+		++g_total_count;
+		CASPAR_LOG(trace) << "[cpu_buffer] allocated size:" << size_ << " for a total of: " << g_total_size;
+	}
+
+	~implementation()
+	{
+		g_total_size -= size_;
+		--g_total_count;
+	}
+};
+
+cpu_buffer::cpu_buffer(size_t width, size_t height, size_t stride) : impl_(new implementation(width, height, stride)){}
+size_t cpu_buffer::stride() const { return impl_->stride_; }
+size_t cpu_buffer::width() const { return impl_->width_; }
+size_t cpu_buffer::height() const { return impl_->height_; }
+size_t cpu_buffer::size() const { return impl_->size_; }
+const uint8_t* cpu_buffer::data() const { return impl_->data_.data(); }
+uint8_t* cpu_buffer::data() { return impl_->data_.data(); }
+
+safe_ptr<cpu_buffer> cpu_buffer::create(size_t width, size_t height, size_t stride)
+{
+	CASPAR_VERIFY(stride > 0 && stride < 5);
+	CASPAR_VERIFY(width > 0 && height > 0);
+	auto pool = g_pools[stride-1][((width << 16) & 0xFFFF0000) | (height & 0x0000FFFF)];
+	std::shared_ptr<cpu_buffer> buffer;
+	bool hit = pool->items.try_pop(buffer);
+	if(!hit)
+		buffer.reset(new cpu_buffer(width, height, stride));
+
+	buffer_pools::record_request(*pool, hit, g_trim_generation);
+
+	return safe_ptr<cpu_buffer>(buffer.get(), [=](cpu_buffer*) mutable
+	{
+		pool->items.push(buffer);
+		--pool->in_use;
+	});
+}
+
+boost::property_tree::wptree cpu_buffer::info()
+{
+	boost::property_tree::wptree info;
+
+	size_t pooled_count = 0;
+	size_t pooled_size = 0;
+	size_t evictions = 0;
+
+	for (size_t i = 0; i < g_pools.size(); ++i)
+	{
+		BOOST_FOREACH(auto& pool, g_pools[i])
+		{
+			auto size = (pool.first >> 16) * (pool.first & 0x0000FFFF) * (i + 1);
+			auto count = buffer_pools::pooled_count(*pool.second);
+
+			pooled_count += count;
+			pooled_size += size * count;
+			evictions += pool.second->evictions;
+		}
+	}
+
+	info.add(L"total_count", g_total_count);
+	info.add(L"total_size", g_total_size);
+	info.add(L"pooled_count", pooled_count);
+	info.add(L"pooled_size", pooled_size);
+	info.add(L"evictions", evictions);
+	info.add(L"budget", get_pool_budget());
+
+	return info;
+}
+
+// Same policy as the pools of the ogl_device, which calls this.
+void cpu_buffer::trim()
+{
+	auto generation = ++g_trim_generation;
+
+	std::vector<buffer_pools::pool_ref> refs;
+	for (size_t i = 0; i < g_pools.size(); ++i)
+	{
+		BOOST_FOREACH(auto& pool, g_pools[i])
+		{
+			buffer_pools::trim_pool(*pool.second, generation);
+			refs.push_back(buffer_pools::make_pool_ref(pool.second, (pool.first >> 16) * (pool.first & 0x0000FFFF) * (i + 1)));
+		}
+	}
+
+	buffer_pools::enforce_budget(refs, get_pool_budget());
+}
+
+void cpu_buffer::gc()
+{
+	BOOST_FOREACH(auto& pools, g_pools)
+	{
+		BOOST_FOREACH(auto& pool, pools)
+			pool.second->items.clear();
+	}
+}
+
+}}
@@ -0,0 +1,58 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
+
+#include <cstdint>
+
+namespace caspar { namespace core {
+
+// System memory counterpart of device_buffer, used by the cpu image mixer.
+// Rows are tightly packed (linesize == width * stride) and the memory is
+// 64 byte aligned.
+class cpu_buffer : boost::noncopyable
+{
+public:
+	static safe_ptr<cpu_buffer> create(size_t width, size_t height, size_t stride);
+
+	size_t stride() const;
+	size_t width() const;
+	size_t height() const;
+	size_t size() const;
+
+	const uint8_t* data() const;
+	uint8_t* data();
+
+	static boost::property_tree::wptree info();
+	static void trim(); // Releases pooled buffers that are no longer needed.
+	static void gc();
+private:
+	cpu_buffer(size_t width, size_t height, size_t stride);
+
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}}
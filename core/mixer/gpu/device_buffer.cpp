@@ -149,6 +149,20 @@ public:
 		unbind();
 		fence_.set();
 	}
+
+	void begin_read(const void* data)
+	{
+		bind();
+		GL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+		GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width_, height_, FORMAT[stride_], GL_UNSIGNED_BYTE, data));
+		GL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+
+		if (mipmapped_)
+			GL(glGenerateMipmap(GL_TEXTURE_2D));
+
+		unbind();
+		fence_.set();
+	}
 	
 	bool ready() const
 	{
@@ -164,6 +178,7 @@ size_t device_buffer::size() const { return impl_->size_; }
 void device_buffer::bind(int index){impl_->bind(index);}
 void device_buffer::unbind(){impl_->unbind();}
 void device_buffer::begin_read(){impl_->begin_read();}
+void device_buffer::begin_read(const void* data){impl_->begin_read(data);}
 bool device_buffer::ready() const{return impl_->ready();}
 int device_buffer::id() const{ return impl_->id_;}
 
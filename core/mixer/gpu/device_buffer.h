@@ -44,6 +44,7 @@ public:
 	void unbind();
 		
 	void begin_read();
+	void begin_read(const void* data); // Uploads from client memory, no pixel unpack buffer may be bound.
 	bool ready() const;
 
 	static boost::property_tree::wptree info();
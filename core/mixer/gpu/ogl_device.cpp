@@ -19,14 +19,14 @@
 * Author: Robert Nagy, ronag89@gmail.com
 */
 
-// TODO: Smart GC
-
 #include "../../stdafx.h"
 
 #include "ogl_device.h"
 
 #include "shader.h"
+#include "../cpu/cpu_buffer.h"
 
+#include <common/env.h>
 #include <common/exception/exceptions.h>
 #include <common/utility/assert.h>
 #include <common/gl/gl_check.h>
@@ -36,10 +36,19 @@
 
 #include <gl/glew.h>
 
+#include <algorithm>
+#include <functional>
+#include <vector>
+
 namespace caspar { namespace core {
 
+using namespace buffer_pools;
+
 ogl_device::ogl_device() 
-	: executor_(L"ogl_device")
+	: executor_(L"ogl_device", thread_backend)
+	, device_pool_budget_(static_cast<size_t>(env::properties().get(L"configuration.mixer.device-pool-budget", 1024)) * 1024 * 1024)
+	, host_pool_budget_(static_cast<size_t>(env::properties().get(L"configuration.mixer.host-pool-budget", 512)) * 1024 * 1024)
+	, trim_running_(true)
 	, pattern_(nullptr)
 	, attached_texture_(0)
 	, attached_fbo_(0)
@@ -52,6 +61,8 @@ ogl_device::ogl_device()
 	std::fill(viewport_.begin(), viewport_.end(), 0);
 	std::fill(scissor_.begin(), scissor_.end(), 0);
 	std::fill(blend_func_.begin(), blend_func_.end(), 0);
+
+	trim_generation_ = 0;
 	
 	invoke([=]
 	{
@@ -70,10 +81,21 @@ ogl_device::ogl_device()
 		
 		CASPAR_LOG(info) << L"Successfully initialized OpenGL Device.";
 	});
+
+	// Trimming is not tied to flush() since channels on the cpu mixer or in
+	// pass-through never flush but still allocate from the pools.
+	trim_thread_ = boost::thread([this]{run_trim();});
 }
 
 ogl_device::~ogl_device()
 {
+	{
+		boost::lock_guard<boost::mutex> lock(trim_mutex_);
+		trim_running_ = false;
+	}
+	trim_cond_.notify_all();
+	trim_thread_.join();
+
 	invoke([=]
 	{
 		BOOST_FOREACH(auto& pool, device_pools_)
@@ -118,14 +140,16 @@ safe_ptr<device_buffer> ogl_device::create_device_buffer(size_t width, size_t he
 	CASPAR_VERIFY(width > 0 && height > 0);
 	auto& pool = device_pools_[stride-1 + (mipmapped ? 4 : 0)][((width << 16) & 0xFFFF0000) | (height & 0x0000FFFF)];
 	std::shared_ptr<device_buffer> buffer;
-	if(!pool->items.try_pop(buffer))		
+	bool hit = pool->items.try_pop(buffer);
+	if(!hit)		
 		buffer = executor_.invoke([&]{return allocate_device_buffer(width, height, stride, mipmapped);}, high_priority);			
 	
-	//++pool->usage_count;
+	record_request(*pool, hit, trim_generation_);
 
 	return safe_ptr<device_buffer>(buffer.get(), [=](device_buffer*) mutable
 	{		
 		pool->items.push(buffer);	
+		--pool->in_use;
 	});
 }
 
@@ -173,10 +197,11 @@ safe_ptr<host_buffer> ogl_device::create_host_buffer(size_t size, host_buffer::u
 	CASPAR_VERIFY(size > 0);
 	auto& pool = host_pools_[usage][size];
 	std::shared_ptr<host_buffer> buffer;
-	if(!pool->items.try_pop(buffer))	
+	bool hit = pool->items.try_pop(buffer);
+	if(!hit)	
 		buffer = executor_.invoke([=]{return allocate_host_buffer(size, usage);}, high_priority);	
 	
-	//++pool->usage_count;
+	record_request(*pool, hit, trim_generation_);
 
 	auto self = shared_from_this();
 	return safe_ptr<host_buffer>(buffer.get(), [=](host_buffer*) mutable
@@ -189,6 +214,7 @@ safe_ptr<host_buffer> ogl_device::create_host_buffer(size_t size, host_buffer::u
 				buffer->unmap();
 
 			pool->items.push(buffer);
+			--pool->in_use;
 		}, high_priority);	
 	});
 }
@@ -198,43 +224,62 @@ safe_ptr<ogl_device> ogl_device::create()
 	return safe_ptr<ogl_device>(new ogl_device());
 }
 
-//template<typename T>
-//void flush_pool(buffer_pool<T>& pool)
-//{	
-//	if(pool.flush_count.fetch_and_increment() < 16)
-//		return;
-//
-//	if(pool.usage_count.fetch_and_store(0) < pool.items.size())
-//	{
-//		std::shared_ptr<T> buffer;
-//		pool.items.try_pop(buffer);
-//	}
-//
-//	pool.flush_count = 0;
-//	pool.usage_count = 0;
-//}
-
 void ogl_device::flush()
 {
 	GL(glFlush());	
-		
-	//try
-	//{
-	//	BOOST_FOREACH(auto& pools, device_pools_)
-	//	{
-	//		BOOST_FOREACH(auto& pool, pools)
-	//			flush_pool(*pool.second);
-	//	}
-	//	BOOST_FOREACH(auto& pools, host_pools_)
-	//	{
-	//		BOOST_FOREACH(auto& pool, pools)
-	//			flush_pool(*pool.second);
-	//	}
-	//}
-	//catch(...)
-	//{
-	//	CASPAR_LOG_CURRENT_EXCEPTION();
-	//}
+}
+
+void ogl_device::run_trim()
+{
+	boost::unique_lock<boost::mutex> lock(trim_mutex_);
+	while(trim_running_)
+	{
+		trim_cond_.timed_wait(lock, boost::posix_time::seconds(1));
+		if(!trim_running_)
+			break;
+
+		lock.unlock();
+		try
+		{
+			invoke([this]{trim_pools();});
+			cpu_buffer::trim();
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+		lock.lock();
+	}
+}
+
+void ogl_device::trim_pools()
+{
+	auto generation = ++trim_generation_;
+
+	std::vector<pool_ref> device_refs;
+	for (size_t i = 0; i < device_pools_.size(); ++i)
+	{
+		int stride = i > 3 ? i - 3 : i + 1;
+
+		BOOST_FOREACH(auto& pool, device_pools_[i])
+		{
+			trim_pool(*pool.second, generation);
+			device_refs.push_back(make_pool_ref(pool.second, (pool.first >> 16) * (pool.first & 0x0000FFFF) * stride));
+		}
+	}
+
+	std::vector<pool_ref> host_refs;
+	BOOST_FOREACH(auto& pools, host_pools_)
+	{
+		BOOST_FOREACH(auto& pool, pools)
+		{
+			trim_pool(*pool.second, generation);
+			host_refs.push_back(make_pool_ref(pool.second, pool.first));
+		}
+	}
+
+	enforce_budget(device_refs, device_pool_budget_);
+	enforce_budget(host_refs, host_pool_budget_);
 }
 
 void ogl_device::yield()
@@ -242,9 +287,53 @@ void ogl_device::yield()
 	executor_.yield();
 }
 
+namespace {
+
+template<typename T>
+void add_pool_stats(boost::property_tree::wptree& info, const buffer_pool<T>& pool)
+{
+	info.add(L"in_use", static_cast<int>(pool.in_use));
+	info.add(L"high_water", static_cast<int>(pool.high_water));
+	info.add(L"hits", static_cast<size_t>(pool.hits));
+	info.add(L"misses", static_cast<size_t>(pool.misses));
+	info.add(L"evictions", static_cast<size_t>(pool.evictions));
+}
+
+struct pool_totals
+{
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+
+	pool_totals() : hits(0), misses(0), evictions(0){}
+
+	template<typename T>
+	void add(const buffer_pool<T>& pool)
+	{
+		hits		+= pool.hits;
+		misses		+= pool.misses;
+		evictions	+= pool.evictions;
+	}
+
+	boost::property_tree::wptree info(size_t budget) const
+	{
+		boost::property_tree::wptree info;
+		info.add(L"hits", hits);
+		info.add(L"misses", misses);
+		info.add(L"hit_rate", hits + misses > 0 ? static_cast<double>(hits) / static_cast<double>(hits + misses) : 0.0);
+		info.add(L"evictions", evictions);
+		info.add(L"budget", budget);
+		return info;
+	}
+};
+
+}
+
 boost::property_tree::wptree ogl_device::info() const
 {
 	boost::property_tree::wptree info;
+	pool_totals device_totals;
+	pool_totals host_totals;
 
 	boost::property_tree::wptree pooled_device_buffers;
 	size_t total_pooled_device_buffer_size = 0;
@@ -263,7 +352,9 @@ boost::property_tree::wptree ogl_device::info() const
 			auto size = width * height * stride;
 			auto count = pool.second->items.size();
 
-			if (count == 0)
+			device_totals.add(*pool.second);
+
+			if (count == 0 && pool.second->in_use == 0)
 				continue;
 
 			boost::property_tree::wptree pool_info;
@@ -274,6 +365,7 @@ boost::property_tree::wptree ogl_device::info() const
 			pool_info.add(L"height", height);
 			pool_info.add(L"size", size);
 			pool_info.add(L"count", count);
+			add_pool_stats(pool_info, *pool.second);
 
 			total_pooled_device_buffer_size += size * count;
 			total_pooled_device_buffer_count += count;
@@ -300,7 +392,9 @@ boost::property_tree::wptree ogl_device::info() const
 			auto size = pool.first;
 			auto count = pool.second->items.size();
 
-			if (count == 0)
+			host_totals.add(*pool.second);
+
+			if (count == 0 && pool.second->in_use == 0)
 				continue;
 
 			boost::property_tree::wptree pool_info;
@@ -309,6 +403,7 @@ boost::property_tree::wptree ogl_device::info() const
 				? L"read_only" : L"write_only");
 			pool_info.add(L"size", size);
 			pool_info.add(L"count", count);
+			add_pool_stats(pool_info, *pool.second);
 
 			pooled_host_buffers.add_child(L"host_buffer_pool", pool_info);
 
@@ -329,6 +424,8 @@ boost::property_tree::wptree ogl_device::info() const
 	info.add(L"gl.summary.pooled_host_buffers.total_read_size", total_read_size);
 	info.add(L"gl.summary.pooled_host_buffers.total_write_size", total_write_size);
 	info.add_child(L"gl.summary.all_host_buffers", host_buffer::info());
+	info.add_child(L"gl.summary.device_buffer_pools", device_totals.info(device_pool_budget_));
+	info.add_child(L"gl.summary.host_buffer_pools", host_totals.info(host_pool_budget_));
 
 	return info;
 }
@@ -344,12 +441,12 @@ boost::unique_future<void> ogl_device::gc()
 			BOOST_FOREACH(auto& pools, device_pools_)
 			{
 				BOOST_FOREACH(auto& pool, pools)
-					pool.second->items.clear();
+					evict(*pool.second, pooled_count(*pool.second));
 			}
 			BOOST_FOREACH(auto& pools, host_pools_)
 			{
 				BOOST_FOREACH(auto& pool, pools)
-					pool.second->items.clear();
+					evict(*pool.second, pooled_count(*pool.second));
 			}
 		}
 		catch(...)
@@ -23,6 +23,7 @@
 
 #include "host_buffer.h"
 #include "device_buffer.h"
+#include "../buffer_pool.h"
 
 #include <common/concurrency/executor.h>
 #include <common/memory/safe_ptr.h>
@@ -36,6 +37,9 @@
 
 #include <boost/noncopyable.hpp>
 #include <boost/thread/future.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/property_tree/ptree_fwd.hpp>
 
 #include <array>
@@ -45,20 +49,6 @@ namespace caspar { namespace core {
 
 class shader;
 
-template<typename T>
-struct buffer_pool
-{
-	tbb::atomic<int> usage_count;
-	tbb::atomic<int> flush_count;
-	tbb::concurrent_bounded_queue<std::shared_ptr<T>> items;
-
-	buffer_pool()
-	{
-		usage_count = 0;
-		flush_count = 0;
-	}
-};
-
 class ogl_device : public std::enable_shared_from_this<ogl_device>, boost::noncopyable
 {	
 	std::unordered_map<GLenum, bool> caps_;
@@ -76,6 +66,15 @@ class ogl_device : public std::enable_shared_from_this<ogl_device>, boost::nonco
 	
 	std::array<tbb::concurrent_unordered_map<size_t, safe_ptr<buffer_pool<device_buffer>>>, 8> device_pools_;
 	std::array<tbb::concurrent_unordered_map<size_t, safe_ptr<buffer_pool<host_buffer>>>, 2> host_pools_;
+
+	const size_t			device_pool_budget_;
+	const size_t			host_pool_budget_;
+	tbb::atomic<int64_t>	trim_generation_;
+
+	bool						trim_running_;
+	boost::mutex				trim_mutex_;
+	boost::condition_variable	trim_cond_;
+	boost::thread				trim_thread_;
 	
 	GLuint fbo_;
 
@@ -130,6 +129,8 @@ public:
 private:
 	safe_ptr<device_buffer> allocate_device_buffer(size_t width, size_t height, size_t stride, bool mipmapped);
 	safe_ptr<host_buffer> allocate_host_buffer(size_t size, host_buffer::usage_t usage);
+	void trim_pools();
+	void run_trim();
 };
 
 }}
\ No newline at end of file
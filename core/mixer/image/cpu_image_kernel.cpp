@@ -0,0 +1,1005 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../../stdafx.h"
+
+#include "cpu_image_kernel.h"
+
+#include "../cpu/cpu_buffer.h"
+
+#include <common/env.h>
+#include <common/utility/assert.h>
+
+#include <core/producer/frame/pixel_format.h>
+#include <core/producer/frame/frame_transform.h>
+
+#include <boost/array.hpp>
+
+#include <tbb/parallel_for.h>
+
+#include <intrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace caspar { namespace core {
+
+// The kernel mirrors the image shader. Colors are kept in the same channel
+// order as the shader's working color, which is the memory order of the
+// output buffer (b, g, r, a), so that every formula can be ported verbatim.
+
+namespace cpu {
+
+typedef boost::array<float, 4> color;
+
+static const float alpha_epsilon = 0.0000001f;
+
+static float clamp01(float value)
+{
+	return std::min(std::max(value, 0.0f), 1.0f);
+}
+
+static float mix(float x, float y, float a)
+{
+	return x + (y - x) * a;
+}
+
+static float smoothstep(float edge0, float edge1, float x)
+{
+	auto t = clamp01((x - edge0) / (edge1 - edge0));
+	return t * t * (3.0f - 2.0f * t);
+}
+
+static uint8_t to_byte(float value)
+{
+	return static_cast<uint8_t>(clamp01(value) * 255.0f + 0.5f);
+}
+
+struct plane_sampler
+{
+	const uint8_t*	data;
+	int				width;
+	int				height;
+	int				channels;
+
+	// GL_LINEAR with GL_CLAMP_TO_EDGE.
+	void sample(float s, float t, float* result) const
+	{
+		float u = s * width  - 0.5f;
+		float v = t * height - 0.5f;
+
+		float fu = std::floor(u);
+		float fv = std::floor(v);
+		float a  = u - fu;
+		float b  = v - fv;
+
+		int x0 = std::min(std::max(static_cast<int>(fu),	 0), width  - 1);
+		int x1 = std::min(std::max(static_cast<int>(fu) + 1, 0), width  - 1);
+		int y0 = std::min(std::max(static_cast<int>(fv),	 0), height - 1);
+		int y1 = std::min(std::max(static_cast<int>(fv) + 1, 0), height - 1);
+
+		auto p00 = data + (y0 * width + x0) * channels;
+		auto p01 = data + (y0 * width + x1) * channels;
+		auto p10 = data + (y1 * width + x0) * channels;
+		auto p11 = data + (y1 * width + x1) * channels;
+
+		for(int n = 0; n < channels; ++n)
+		{
+			auto top	= mix(p00[n], p01[n], a);
+			auto bottom	= mix(p10[n], p11[n], a);
+			result[n]	= mix(top, bottom, b) / 255.0f;
+		}
+	}
+};
+
+static color ycbcra_to_rgba(float y, float cb, float cr, float a, bool is_hd)
+{
+	color rgba;
+	if(is_hd)
+	{
+		rgba[2] = (1.164f*(y*255 - 16) + 1.793f*(cr*255 - 128))/255;
+		rgba[1] = (1.164f*(y*255 - 16) - 0.534f*(cr*255 - 128) - 0.213f*(cb*255 - 128))/255;
+		rgba[0] = (1.164f*(y*255 - 16) + 2.115f*(cb*255 - 128))/255;
+	}
+	else
+	{
+		rgba[2] = (1.164f*(y*255 - 16) + 1.596f*(cr*255 - 128))/255;
+		rgba[1] = (1.164f*(y*255 - 16) - 0.813f*(cr*255 - 128) - 0.391f*(cb*255 - 128))/255;
+		rgba[0] = (1.164f*(y*255 - 16) + 2.018f*(cb*255 - 128))/255;
+	}
+	rgba[3] = a;
+	return rgba;
+}
+
+static color get_rgba_color(pixel_format::type pix_fmt, const std::vector<plane_sampler>& planes, bool is_hd, float s, float t)
+{
+	float m[4];
+	color c = {0.0f, 0.0f, 0.0f, 0.0f};
+
+	switch(pix_fmt)
+	{
+	case pixel_format::gray:
+		planes[0].sample(s, t, m);
+		c[0] = c[1] = c[2] = m[0]; c[3] = 1.0f;
+		break;
+	case pixel_format::bgra:
+		planes[0].sample(s, t, m);
+		c[0] = m[0]; c[1] = m[1]; c[2] = m[2]; c[3] = m[3];
+		break;
+	case pixel_format::rgba:
+		planes[0].sample(s, t, m);
+		c[0] = m[2]; c[1] = m[1]; c[2] = m[0]; c[3] = m[3];
+		break;
+	case pixel_format::argb:
+		planes[0].sample(s, t, m);
+		c[0] = m[3]; c[1] = m[2]; c[2] = m[1]; c[3] = m[0];
+		break;
+	case pixel_format::abgr:
+		planes[0].sample(s, t, m);
+		c[0] = m[1]; c[1] = m[0]; c[2] = m[3]; c[3] = m[2];
+		break;
+	case pixel_format::ycbcr:
+	case pixel_format::ycbcra:
+		{
+			float y, cb, cr, a = 1.0f;
+			planes[0].sample(s, t, &y);
+			planes[1].sample(s, t, &cb);
+			planes[2].sample(s, t, &cr);
+			if(pix_fmt == pixel_format::ycbcra)
+				planes[3].sample(s, t, &a);
+			c = ycbcra_to_rgba(y, cb, cr, a, is_hd);
+			break;
+		}
+	case pixel_format::luma:
+		planes[0].sample(s, t, m);
+		c[0] = c[1] = c[2] = (m[0] - 0.065f) / 0.859f; c[3] = 1.0f;
+		break;
+	}
+
+	return c;
+}
+
+// Chroma keying, see get_chroma_glsl(). The shader keys on the rgba
+// swizzle of the working color, i.e. r = c[2] and b = c[0].
+
+static color chroma_key(color c, const chroma& params)
+{
+	float d;
+	if(params.key == chroma::green)
+		d = (2.0f * c[1] - c[2] - c[0]) / 2.0f;
+	else if(params.key == chroma::blue)
+		d = (2.0f * c[0] - c[2] - c[1]) / 2.0f;
+	else
+		return c;
+
+	auto alpha = 1.0f - smoothstep(params.threshold, params.softness, d);
+	for(int n = 0; n < 4; ++n)
+		c[n] *= alpha;
+
+	auto ds = smoothstep(params.spill, 1.0f, d / params.softness);
+	auto gl = 0.3f * c[2] + 0.59f * c[1] + 0.11f * c[0];
+	c[0] = mix(c[0], gl * gl, ds);
+	c[1] = mix(c[1], gl * gl, ds);
+	c[2] = mix(c[2], gl * gl, ds);
+	c[3] = mix(c[3], gl, ds);
+
+	return c;
+}
+
+// Image adjustments, see get_adjustement_glsl().
+
+static void levels_control(color& c, const core::levels& l)
+{
+	for(int n = 0; n < 3; ++n)
+	{
+		auto value = std::min(std::max(c[n] - static_cast<float>(l.min_input), 0.0f) / static_cast<float>(l.max_input - l.min_input), 1.0f);
+		value = std::pow(value, static_cast<float>(1.0 / l.gamma));
+		c[n] = mix(static_cast<float>(l.min_output), static_cast<float>(l.max_output), value);
+	}
+}
+
+static void contrast_saturation_brightness(color& c, float brt, float sat, float con)
+{
+	bool demultiply_remultiply = con < 1.0f;
+
+	float rgb[3] = {c[0], c[1], c[2]};
+
+	if(demultiply_remultiply)
+	{
+		for(int n = 0; n < 3; ++n)
+			rgb[n] /= c[3] + alpha_epsilon;
+	}
+
+	float brt_color[3] = {rgb[0] * brt, rgb[1] * brt, rgb[2] * brt};
+	auto intensity = brt_color[0] * 0.2125f + brt_color[1] * 0.7154f + brt_color[2] * 0.0721f;
+
+	for(int n = 0; n < 3; ++n)
+	{
+		auto sat_color = mix(intensity, brt_color[n], sat);
+		auto con_color = mix(0.5f, sat_color, con);
+
+		if(demultiply_remultiply)
+			con_color *= c[3] + alpha_epsilon;
+
+		c[n] = con_color;
+	}
+}
+
+// Blend modes, see get_blend_glsl().
+
+static float blend_add(float base, float blend)			{ return std::min(base + blend, 1.0f); }
+static float blend_subtract(float base, float blend)	{ return std::max(base + blend - 1.0f, 0.0f); }
+static float blend_lighten(float base, float blend)		{ return std::max(blend, base); }
+static float blend_darken(float base, float blend)		{ return std::min(blend, base); }
+static float blend_screen(float base, float blend)		{ return 1.0f - ((1.0f - base) * (1.0f - blend)); }
+static float blend_overlay(float base, float blend)		{ return base < 0.5f ? (2.0f * base * blend) : (1.0f - 2.0f * (1.0f - base) * (1.0f - blend)); }
+static float blend_color_dodge(float base, float blend)	{ return blend == 1.0f ? blend : std::min(base / (1.0f - blend), 1.0f); }
+static float blend_color_burn(float base, float blend)	{ return blend == 0.0f ? blend : std::max(1.0f - ((1.0f - base) / blend), 0.0f); }
+static float blend_linear_light(float base, float blend){ return blend < 0.5f ? blend_subtract(base, 2.0f * blend) : blend_add(base, 2.0f * (blend - 0.5f)); }
+static float blend_vivid_light(float base, float blend)	{ return blend < 0.5f ? blend_color_burn(base, 2.0f * blend) : blend_color_dodge(base, 2.0f * (blend - 0.5f)); }
+static float blend_pin_light(float base, float blend)	{ return blend < 0.5f ? blend_darken(base, 2.0f * blend) : blend_lighten(base, 2.0f * (blend - 0.5f)); }
+static float blend_hard_mix(float base, float blend)	{ return blend_vivid_light(base, blend) < 0.5f ? 0.0f : 1.0f; }
+static float blend_reflect(float base, float blend)		{ return blend == 1.0f ? blend : std::min(base * base / (1.0f - blend), 1.0f); }
+
+static void rgb_to_hsl(const float* color, float* hsl)
+{
+	auto fmin = std::min(std::min(color[0], color[1]), color[2]);
+	auto fmax = std::max(std::max(color[0], color[1]), color[2]);
+	auto delta = fmax - fmin;
+
+	hsl[2] = (fmax + fmin) / 2.0f;
+
+	if(delta == 0.0f)
+	{
+		hsl[0] = 0.0f;
+		hsl[1] = 0.0f;
+		return;
+	}
+
+	if(hsl[2] < 0.5f)
+		hsl[1] = delta / (fmax + fmin);
+	else
+		hsl[1] = delta / (2.0f - fmax - fmin);
+
+	auto delta_r = (((fmax - color[0]) / 6.0f) + (delta / 2.0f)) / delta;
+	auto delta_g = (((fmax - color[1]) / 6.0f) + (delta / 2.0f)) / delta;
+	auto delta_b = (((fmax - color[2]) / 6.0f) + (delta / 2.0f)) / delta;
+
+	if(color[0] == fmax)
+		hsl[0] = delta_b - delta_g;
+	else if(color[1] == fmax)
+		hsl[0] = (1.0f / 3.0f) + delta_r - delta_b;
+	else
+		hsl[0] = (2.0f / 3.0f) + delta_g - delta_r;
+
+	if(hsl[0] < 0.0f)
+		hsl[0] += 1.0f;
+	else if(hsl[0] > 1.0f)
+		hsl[0] -= 1.0f;
+}
+
+static float hue_to_rgb(float f1, float f2, float hue)
+{
+	if(hue < 0.0f)
+		hue += 1.0f;
+	else if(hue > 1.0f)
+		hue -= 1.0f;
+
+	if((6.0f * hue) < 1.0f)
+		return f1 + (f2 - f1) * 6.0f * hue;
+	else if((2.0f * hue) < 1.0f)
+		return f2;
+	else if((3.0f * hue) < 2.0f)
+		return f1 + (f2 - f1) * ((2.0f / 3.0f) - hue) * 6.0f;
+	else
+		return f1;
+}
+
+static void hsl_to_rgb(const float* hsl, float* rgb)
+{
+	if(hsl[1] == 0.0f)
+	{
+		rgb[0] = rgb[1] = rgb[2] = hsl[2];
+		return;
+	}
+
+	auto f2 = hsl[2] < 0.5f ? hsl[2] * (1.0f + hsl[1]) : (hsl[2] + hsl[1]) - (hsl[1] * hsl[2]);
+	auto f1 = 2.0f * hsl[2] - f2;
+
+	rgb[0] = hue_to_rgb(f1, f2, hsl[0] + (1.0f/3.0f));
+	rgb[1] = hue_to_rgb(f1, f2, hsl[0]);
+	rgb[2] = hue_to_rgb(f1, f2, hsl[0] - (1.0f/3.0f));
+}
+
+// Replaces component h, s or l of base with the matching components of blend.
+static void blend_hsl(const float* base, const float* blend, bool h, bool s, bool l, float* result)
+{
+	float base_hsl[3];
+	float blend_hsl[3];
+	rgb_to_hsl(base, base_hsl);
+	rgb_to_hsl(blend, blend_hsl);
+
+	float hsl[3] = 
+	{
+		h ? blend_hsl[0] : base_hsl[0],
+		s ? blend_hsl[1] : base_hsl[1],
+		l ? blend_hsl[2] : base_hsl[2]
+	};
+
+	hsl_to_rgb(hsl, result);
+}
+
+static void get_blend_color(blend_mode::type mode, const float* back, const float* fore, float* result)
+{
+	switch(mode)
+	{
+	case blend_mode::contrast:		blend_hsl(back, fore, true,  false, false, result);	return; // BlendHue
+	case blend_mode::saturation:	blend_hsl(back, fore, false, true,  false, result);	return;
+	case blend_mode::color:			blend_hsl(back, fore, true,  true,  false, result);	return;
+	case blend_mode::luminosity:	blend_hsl(back, fore, false, false, true,  result);	return;
+	}
+
+	for(int n = 0; n < 3; ++n)
+	{
+		auto base  = back[n];
+		auto blend = fore[n];
+
+		switch(mode)
+		{
+		case blend_mode::lighten:		result[n] = blend_lighten(base, blend);					break;
+		case blend_mode::darken:		result[n] = blend_darken(base, blend);					break;
+		case blend_mode::multiply:		result[n] = base * blend;								break;
+		case blend_mode::average:		result[n] = (base + blend) / 2.0f;						break;
+		case blend_mode::add:			result[n] = blend_add(base, blend);						break;
+		case blend_mode::subtract:		result[n] = blend_subtract(base, blend);				break;
+		case blend_mode::difference:	result[n] = std::abs(base - blend);						break;
+		case blend_mode::negation:		result[n] = 1.0f - std::abs(1.0f - base - blend);		break;
+		case blend_mode::exclusion:		result[n] = base + blend - 2.0f * base * blend;			break;
+		case blend_mode::screen:		result[n] = blend_screen(base, blend);					break;
+		case blend_mode::overlay:		result[n] = blend_overlay(base, blend);					break;
+		case blend_mode::hard_light:	result[n] = blend_overlay(blend, base);					break;
+		case blend_mode::color_dodge:	result[n] = blend_color_dodge(base, blend);				break;
+		case blend_mode::color_burn:	result[n] = blend_color_burn(base, blend);				break;
+		case blend_mode::linear_dodge:	result[n] = blend_add(base, blend);						break;
+		case blend_mode::linear_burn:	result[n] = blend_subtract(base, blend);				break;
+		case blend_mode::linear_light:	result[n] = blend_linear_light(base, blend);			break;
+		case blend_mode::vivid_light:	result[n] = blend_vivid_light(base, blend);				break;
+		case blend_mode::pin_light:		result[n] = blend_pin_light(base, blend);				break;
+		case blend_mode::hard_mix:		result[n] = blend_hard_mix(base, blend);				break;
+		case blend_mode::reflect:		result[n] = blend_reflect(base, blend);					break;
+		case blend_mode::glow:			result[n] = blend_reflect(blend, base);					break;
+		case blend_mode::phoenix:		result[n] = std::min(base, blend) - std::max(base, blend) + 1.0f; break;
+		default:						result[n] = blend;										break; // normal, soft_light, mix
+		}
+	}
+}
+
+// Maps the unit square onto the quad ul, ur, lr, ll, see Heckbert,
+// "Fundamentals of Texture Mapping and Image Warping" (1989). The inverse
+// mapping is stored so that each destination pixel can be traced back to
+// its texture coordinate.
+struct projection
+{
+	double a, b, c, d, e, f, g, h, i;
+
+	bool set(const double* x, const double* y)
+	{
+		auto dx1 = x[1] - x[2];
+		auto dx2 = x[3] - x[2];
+		auto dx3 = x[0] - x[1] + x[2] - x[3];
+		auto dy1 = y[1] - y[2];
+		auto dy2 = y[3] - y[2];
+		auto dy3 = y[0] - y[1] + y[2] - y[3];
+
+		double m[9];
+
+		if(std::abs(dx3) < 1e-12 && std::abs(dy3) < 1e-12) // affine
+		{
+			m[0] = x[1] - x[0]; m[1] = x[3] - x[0]; m[2] = x[0];
+			m[3] = y[1] - y[0]; m[4] = y[3] - y[0]; m[5] = y[0];
+			m[6] = 0.0;			m[7] = 0.0;			m[8] = 1.0;
+		}
+		else
+		{
+			auto det = dx1 * dy2 - dx2 * dy1;
+			if(std::abs(det) < 1e-12)
+				return false;
+
+			m[6] = (dx3 * dy2 - dx2 * dy3) / det;
+			m[7] = (dx1 * dy3 - dx3 * dy1) / det;
+			m[0] = x[1] - x[0] + m[6] * x[1]; m[1] = x[3] - x[0] + m[7] * x[3]; m[2] = x[0];
+			m[3] = y[1] - y[0] + m[6] * y[1]; m[4] = y[3] - y[0] + m[7] * y[3]; m[5] = y[0];
+			m[8] = 1.0;
+		}
+
+		// Adjugate, scale does not matter for a projective mapping.
+		a = m[4] * m[8] - m[5] * m[7];
+		b = m[2] * m[7] - m[1] * m[8];
+		c = m[1] * m[5] - m[2] * m[4];
+		d = m[5] * m[6] - m[3] * m[8];
+		e = m[0] * m[8] - m[2] * m[6];
+		f = m[2] * m[3] - m[0] * m[5];
+		g = m[3] * m[7] - m[4] * m[6];
+		h = m[1] * m[6] - m[0] * m[7];
+		i = m[0] * m[4] - m[1] * m[3];
+
+		return std::abs(i) > 1e-12 || std::abs(g) > 1e-12 || std::abs(h) > 1e-12;
+	}
+};
+
+// Linear "over" (or additive) composition of a premultiplied bgra row onto
+// another, 4 pixels at a time. Used when an item covers the background 1:1.
+static void composite_row(uint8_t* dest, const uint8_t* source, size_t count, int opacity, keyer::type mode)
+{
+	const __m128i zero		= _mm_setzero_si128();
+	const __m128i round		= _mm_set1_epi16(128);
+	const __m128i full		= _mm_set1_epi16(255);
+	const __m128i opacity16	= _mm_set1_epi16(static_cast<short>(opacity));
+
+	// (x*y + 128 + ((x*y + 128) >> 8)) >> 8 == round(x*y/255) for 8 bit x, y.
+	auto mul_div_255 = [&](__m128i x, __m128i y) -> __m128i
+	{
+		auto t = _mm_add_epi16(_mm_mullo_epi16(x, y), round);
+		return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+	};
+
+	auto scale = [&](__m128i x, __m128i y) -> __m128i
+	{
+		return _mm_packus_epi16(mul_div_255(_mm_unpacklo_epi8(x, zero), y), mul_div_255(_mm_unpackhi_epi8(x, zero), y));
+	};
+
+	size_t n = 0;
+	for(; n + 4 <= count; n += 4)
+	{
+		auto src = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + n*4));
+		auto dst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + n*4));
+
+		if(opacity < 255)
+			src = scale(src, opacity16);
+
+		if(mode == keyer::linear)
+		{
+			auto src_lo = _mm_unpacklo_epi8(src, zero);
+			auto src_hi = _mm_unpackhi_epi8(src, zero);
+			auto inv_lo = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(src_lo, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3)));
+			auto inv_hi = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(src_hi, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3)));
+
+			dst = _mm_packus_epi16(mul_div_255(_mm_unpacklo_epi8(dst, zero), inv_lo), mul_div_255(_mm_unpackhi_epi8(dst, zero), inv_hi));
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n*4), _mm_adds_epu8(src, dst));
+	}
+
+	for(; n < count; ++n)
+	{
+		int src[4];
+		for(int c = 0; c < 4; ++c)
+			src[c] = opacity < 255 ? (source[n*4+c] * opacity + 127) / 255 : source[n*4+c];
+
+		auto inv = mode == keyer::linear ? 255 - src[3] : 255;
+		for(int c = 0; c < 4; ++c)
+			dest[n*4+c] = static_cast<uint8_t>(std::min(255, src[c] + (dest[n*4+c] * inv + 127) / 255));
+	}
+}
+
+static __m128 load_ps(const uint8_t* source)
+{
+	int value;
+	std::memcpy(&value, source, sizeof(value));
+	auto x = _mm_unpacklo_epi8(_mm_cvtsi32_si128(value), _mm_setzero_si128());
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(x, _mm_setzero_si128()));
+}
+
+// Vertical pass of the bilinear chroma sampling, see plane_sampler. Values
+// are kept in 0-255.
+static void lerp_rows(float* result, const uint8_t* top, const uint8_t* bottom, size_t count, float weight)
+{
+	const __m128 weight4 = _mm_set1_ps(weight);
+
+	size_t n = 0;
+	for(; n + 4 <= count; n += 4)
+	{
+		auto t = load_ps(top + n);
+		_mm_storeu_ps(result + n, _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(load_ps(bottom + n), t), weight4)));
+	}
+
+	for(; n < count; ++n)
+		result[n] = mix(top[n], bottom[n], weight);
+}
+
+// ycbcr(a) to bgra conversion of a row drawn 1:1, composited onto the
+// background like the generic path, 4 pixels at a time. cb and cr are
+// already resampled to the luma width, alpha is null for ycbcr.
+static void composite_ycbcra_row(uint8_t* dest, const uint8_t* luma, const float* cb, const float* cr, const uint8_t* alpha, size_t count, float opacity, bool is_hd, keyer::type mode)
+{
+	const float kr	= is_hd ? 1.793f : 1.596f;
+	const float kgr	= is_hd ? 0.534f : 0.813f;
+	const float kgb	= is_hd ? 0.213f : 0.391f;
+	const float kb	= is_hd ? 2.115f : 2.018f;
+
+	const __m128i zero	= _mm_setzero_si128();
+	const __m128 min4	= _mm_setzero_ps();
+	const __m128 max4	= _mm_set1_ps(255.0f);
+	const __m128 half4	= _mm_set1_ps(0.5f);
+	const __m128 one4	= _mm_set1_ps(1.0f);
+	const __m128 inv255	= _mm_set1_ps(1.0f / 255.0f);
+	const __m128 y_off4	= _mm_set1_ps(16.0f);
+	const __m128 c_off4	= _mm_set1_ps(128.0f);
+	const __m128 y_mul4	= _mm_set1_ps(1.164f);
+	const __m128 kr4	= _mm_set1_ps(kr);
+	const __m128 kgr4	= _mm_set1_ps(kgr);
+	const __m128 kgb4	= _mm_set1_ps(kgb);
+	const __m128 kb4	= _mm_set1_ps(kb);
+	const __m128 opacity4 = _mm_set1_ps(opacity);
+
+	size_t n = 0;
+	for(; n + 4 <= count; n += 4)
+	{
+		auto y4  = _mm_mul_ps(_mm_sub_ps(load_ps(luma + n), y_off4), y_mul4);
+		auto cb4 = _mm_sub_ps(_mm_loadu_ps(cb + n), c_off4);
+		auto cr4 = _mm_sub_ps(_mm_loadu_ps(cr + n), c_off4);
+
+		__m128 src[4];
+		src[0] = _mm_mul_ps(_mm_add_ps(y4, _mm_mul_ps(kb4, cb4)), opacity4);
+		src[1] = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(y4, _mm_mul_ps(kgr4, cr4)), _mm_mul_ps(kgb4, cb4)), opacity4);
+		src[2] = _mm_mul_ps(_mm_add_ps(y4, _mm_mul_ps(kr4, cr4)), opacity4);
+		src[3] = _mm_mul_ps(alpha ? load_ps(alpha + n) : max4, opacity4);
+
+		auto inv = mode == keyer::additive ? one4 : _mm_sub_ps(one4, _mm_mul_ps(src[3], inv255));
+
+		auto dst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + n*4));
+		auto dst_lo = _mm_unpacklo_epi8(dst, zero);
+		auto dst_hi = _mm_unpackhi_epi8(dst, zero);
+
+		__m128 back[4];
+		back[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(dst_lo, zero));
+		back[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(dst_lo, zero));
+		back[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(dst_hi, zero));
+		back[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(dst_hi, zero));
+		_MM_TRANSPOSE4_PS(back[0], back[1], back[2], back[3]);
+
+		for(int c = 0; c < 4; ++c)
+			src[c] = _mm_add_ps(_mm_min_ps(_mm_max_ps(_mm_add_ps(src[c], _mm_mul_ps(inv, back[c])), min4), max4), half4);
+		_MM_TRANSPOSE4_PS(src[0], src[1], src[2], src[3]);
+
+		auto lo = _mm_packs_epi32(_mm_cvttps_epi32(src[0]), _mm_cvttps_epi32(src[1]));
+		auto hi = _mm_packs_epi32(_mm_cvttps_epi32(src[2]), _mm_cvttps_epi32(src[3]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n*4), _mm_packus_epi16(lo, hi));
+	}
+
+	for(; n < count; ++n)
+	{
+		auto y = 1.164f * (luma[n] - 16.0f);
+
+		float src[4];
+		src[0] = (y + kb * (cb[n] - 128.0f)) * opacity;
+		src[1] = (y - kgr * (cr[n] - 128.0f) - kgb * (cb[n] - 128.0f)) * opacity;
+		src[2] = (y + kr * (cr[n] - 128.0f)) * opacity;
+		src[3] = (alpha ? alpha[n] : 255.0f) * opacity;
+
+		auto inv = mode == keyer::additive ? 1.0f : 1.0f - src[3] / 255.0f;
+		for(int c = 0; c < 4; ++c)
+			dest[n*4+c] = to_byte((src[c] + inv * dest[n*4+c]) / 255.0f);
+	}
+}
+
+}
+
+struct cpu_image_kernel::implementation : boost::noncopyable
+{	
+	const bool blend_modes_;
+	const bool chroma_key_;
+	const bool post_processing_;
+
+	implementation()
+		: blend_modes_(env::properties().get(L"configuration.mixer.blend-modes", false))
+		, chroma_key_(env::properties().get(L"configuration.mixer.chroma-key", false))
+		, post_processing_(env::properties().get(L"configuration.mixer.straight-alpha", false))
+	{
+	}
+
+	void draw(cpu_draw_params&& params)
+	{
+		static const double epsilon = 0.001;
+
+		CASPAR_ASSERT(params.pix_desc.planes.size() == params.textures.size());
+
+		if(params.textures.empty() || !params.background)
+			return;
+
+		if(params.transform.opacity < epsilon)
+			return;
+
+		// Geometry, see image_kernel.
+
+		auto f_p = params.transform.fill_translation;
+		auto f_s = params.transform.fill_scale;
+		auto aspect = params.aspect_ratio;
+		auto angle = params.transform.angle;
+
+		auto rotate = [angle, aspect](double orig_x, double orig_y) -> boost::array<double, 2>
+		{
+			boost::array<double, 2> result;
+			result[0] = orig_x * std::cos(angle) - orig_y * std::sin(angle);
+			result[1] = orig_x * std::sin(angle) + orig_y * std::cos(angle);
+			result[1] *= aspect;
+
+			return result;
+		};
+
+		auto anchor = params.transform.anchor;
+		auto crop = params.transform.crop;
+		auto pers = params.transform.perspective;
+
+		auto ul = rotate((-anchor[0] + pers.ul[0] + crop.ul[0]      ) * f_s[0], (-anchor[1] + pers.ul[1] + crop.ul[1]      ) * f_s[1] / aspect);
+		auto ur = rotate((-anchor[0] + pers.ur[0] + crop.lr[0] - 1.0) * f_s[0], (-anchor[1] + pers.ur[1] + crop.ul[1]      ) * f_s[1] / aspect);
+		auto lr = rotate((-anchor[0] + pers.lr[0] + crop.lr[0] - 1.0) * f_s[0], (-anchor[1] + pers.lr[1] + crop.lr[1] - 1.0) * f_s[1] / aspect);
+		auto ll = rotate((-anchor[0] + pers.ll[0] + crop.ul[0]      ) * f_s[0], (-anchor[1] + pers.ll[1] + crop.lr[1] - 1.0) * f_s[1] / aspect);
+
+		double x[4] = {f_p[0] + ul[0], f_p[0] + ur[0], f_p[0] + lr[0], f_p[0] + ll[0]};
+		double y[4] = {f_p[1] + ul[1], f_p[1] + ur[1], f_p[1] + lr[1], f_p[1] + ll[1]};
+
+		auto min_x = *std::min_element(x, x + 4);
+		auto max_x = *std::max_element(x, x + 4);
+		auto min_y = *std::min_element(y, y + 4);
+		auto max_y = *std::max_element(y, y + 4);
+
+		// Skip drawing if the QUAD will be outside the screen.
+		if(max_x < 0.0 || min_x > 1.0 || max_y < 0.0 || min_y > 1.0)
+			return;
+
+		// Drawing area, in pixels.
+
+		const int width  = static_cast<int>(params.background->width());
+		const int height = static_cast<int>(params.background->height());
+
+		int x0 = 0;
+		int y0 = 0;
+		int x1 = width;
+		int y1 = height;
+
+		auto m_p = params.transform.clip_translation;
+		auto m_s = params.transform.clip_scale;
+
+		bool scissor = m_p[0] > std::numeric_limits<double>::epsilon()			|| m_p[1] > std::numeric_limits<double>::epsilon() ||
+					   m_s[0] < (1.0 - std::numeric_limits<double>::epsilon())	|| m_s[1] < (1.0 - std::numeric_limits<double>::epsilon());
+
+		if(scissor)
+		{
+			x0 = static_cast<int>(m_p[0]*width);
+			y0 = static_cast<int>(m_p[1]*height);
+			x1 = x0 + static_cast<int>(m_s[0]*width);
+			y1 = y0 + static_cast<int>(m_s[1]*height);
+		}
+
+		x0 = std::max(x0, static_cast<int>(std::floor(min_x * width)));
+		y0 = std::max(y0, static_cast<int>(std::floor(min_y * height)));
+		x1 = std::min(std::min(x1, width),  static_cast<int>(std::ceil(max_x * width)));
+		y1 = std::min(std::min(y1, height), static_cast<int>(std::ceil(max_y * height)));
+
+		if(x0 >= x1 || y0 >= y1)
+			return;
+
+		// Setup image-adjustements
+
+		bool levels = 
+			params.transform.levels.min_input  > epsilon		||
+			params.transform.levels.max_input  < 1.0-epsilon	||
+			params.transform.levels.min_output > epsilon		||
+			params.transform.levels.max_output < 1.0-epsilon	||
+			std::abs(params.transform.levels.gamma - 1.0) > epsilon;
+
+		bool csb = 
+			std::abs(params.transform.brightness - 1.0) > epsilon ||
+			std::abs(params.transform.saturation - 1.0) > epsilon ||
+			std::abs(params.transform.contrast - 1.0)   > epsilon;
+
+		bool chroma_enabled = chroma_key_ && params.blend_mode.chroma.key != chroma::none;
+
+		if(params.transform.is_key)
+			params.blend_mode = blend_mode::normal;
+
+		auto mode = blend_modes_ ? params.blend_mode.mode : blend_mode::normal;
+		auto opacity = static_cast<float>(params.transform.is_key ? 1.0 : params.transform.opacity);
+		auto fields = params.transform.field_mode;
+
+		auto row_in_field = [fields](int row) -> bool
+		{
+			if(fields == field_mode::upper)
+				return row % 2 == 0;
+			if(fields == field_mode::lower)
+				return row % 2 == 1;
+			return true;
+		};
+
+		auto background = params.background->data();
+		auto background_stride = static_cast<int>(params.background->stride());
+
+		// Fast path, premultiplied bgra drawn 1:1 onto the background.
+
+		auto is_identity = [&]() -> bool
+		{
+			static const double tolerance = 0.000001;
+			return std::abs(x[0])		< tolerance && std::abs(y[0])		< tolerance
+				&& std::abs(x[2] - 1.0) < tolerance && std::abs(y[2] - 1.0) < tolerance
+				&& std::abs(x[1] - 1.0) < tolerance && std::abs(y[1])		< tolerance
+				&& std::abs(x[3])		< tolerance && std::abs(y[3] - 1.0) < tolerance
+				&& std::abs(crop.ul[0]) < tolerance && std::abs(crop.ul[1]) < tolerance
+				&& std::abs(crop.lr[0] - 1.0) < tolerance && std::abs(crop.lr[1] - 1.0) < tolerance;
+		};
+
+		if(params.pix_desc.pix_fmt == pixel_format::bgra &&
+		   params.textures[0]->width() == params.background->width() &&
+		   params.textures[0]->height() == params.background->height() &&
+		   background_stride == 4 &&
+		   !params.local_key && !params.layer_key &&
+		   !levels && !csb && !chroma_enabled &&
+		   mode == blend_mode::normal &&
+		   is_identity())
+		{
+			auto source = params.textures[0]->data();
+			auto opacity8 = static_cast<int>(opacity * 255.0f + 0.5f);
+			auto keyer_mode = params.keyer;
+
+			tbb::parallel_for(tbb::blocked_range<int>(y0, y1), [&](const tbb::blocked_range<int>& r)
+			{
+				for(int row = r.begin(); row < r.end(); ++row)
+				{
+					if(row_in_field(row))
+						cpu::composite_row(background + (row*width + x0)*4, source + (row*width + x0)*4, x1 - x0, opacity8, keyer_mode);
+				}
+			});
+
+			return;
+		}
+
+		// Fast path, ycbcr(a) drawn 1:1 onto the background. Luma and alpha
+		// map to pixels, chroma is resampled bilinearly like the generic path.
+
+		auto is_ycbcra = params.pix_desc.pix_fmt == pixel_format::ycbcra;
+
+		if((params.pix_desc.pix_fmt == pixel_format::ycbcr || is_ycbcra) &&
+		   params.textures[0]->width() == params.background->width() &&
+		   params.textures[0]->height() == params.background->height() &&
+		   params.textures[1]->width() == params.textures[2]->width() &&
+		   params.textures[1]->height() == params.textures[2]->height() &&
+		   (!is_ycbcra || (params.textures[3]->width() == params.background->width() && params.textures[3]->height() == params.background->height())) &&
+		   background_stride == 4 &&
+		   !params.local_key && !params.layer_key &&
+		   !levels && !csb && !chroma_enabled &&
+		   mode == blend_mode::normal &&
+		   is_identity())
+		{
+			auto luma		= params.textures[0]->data();
+			auto cb_plane	= params.textures[1]->data();
+			auto cr_plane	= params.textures[2]->data();
+			auto alpha		= is_ycbcra ? params.textures[3]->data() : nullptr;
+			auto is_hd		= params.pix_desc.planes.at(0).height > 700;
+			auto keyer_mode	= params.keyer;
+
+			const int chroma_width	= static_cast<int>(params.textures[1]->width());
+			const int chroma_height	= static_cast<int>(params.textures[1]->height());
+
+			std::vector<int>	chroma_x0(width);
+			std::vector<int>	chroma_x1(width);
+			std::vector<float>	chroma_a(width);
+			for(int column = 0; column < width; ++column)
+			{
+				auto u  = (column + 0.5f) / width * chroma_width - 0.5f;
+				auto fu = std::floor(u);
+				chroma_x0[column] = std::min(std::max(static_cast<int>(fu),	 0), chroma_width - 1);
+				chroma_x1[column] = std::min(std::max(static_cast<int>(fu) + 1, 0), chroma_width - 1);
+				chroma_a[column]  = u - fu;
+			}
+
+			tbb::parallel_for(tbb::blocked_range<int>(y0, y1), [&](const tbb::blocked_range<int>& r)
+			{
+				std::vector<float> cb_line(chroma_width);
+				std::vector<float> cr_line(chroma_width);
+				std::vector<float> cb(width);
+				std::vector<float> cr(width);
+
+				for(int row = r.begin(); row < r.end(); ++row)
+				{
+					if(!row_in_field(row))
+						continue;
+
+					auto v  = (row + 0.5f) / height * chroma_height - 0.5f;
+					auto fv = std::floor(v);
+					auto top	= std::min(std::max(static_cast<int>(fv),	  0), chroma_height - 1) * chroma_width;
+					auto bottom	= std::min(std::max(static_cast<int>(fv) + 1, 0), chroma_height - 1) * chroma_width;
+
+					cpu::lerp_rows(cb_line.data(), cb_plane + top, cb_plane + bottom, chroma_width, v - fv);
+					cpu::lerp_rows(cr_line.data(), cr_plane + top, cr_plane + bottom, chroma_width, v - fv);
+
+					for(int column = x0; column < x1; ++column)
+					{
+						cb[column] = cpu::mix(cb_line[chroma_x0[column]], cb_line[chroma_x1[column]], chroma_a[column]);
+						cr[column] = cpu::mix(cr_line[chroma_x0[column]], cr_line[chroma_x1[column]], chroma_a[column]);
+					}
+
+					cpu::composite_ycbcra_row(
+						background + (row*width + x0)*4, 
+						luma + row*width + x0, 
+						cb.data() + x0, 
+						cr.data() + x0, 
+						alpha ? alpha + row*width + x0 : nullptr, 
+						x1 - x0, 
+						opacity, 
+						is_hd, 
+						keyer_mode);
+				}
+			});
+
+			return;
+		}
+
+		// Generic path, traces every destination pixel back to the texture.
+
+		cpu::projection projection;
+		if(!projection.set(x, y))
+			return;
+
+		std::vector<cpu::plane_sampler> planes;
+		BOOST_FOREACH(auto& texture, params.textures)
+		{
+			cpu::plane_sampler plane = {texture->data(), static_cast<int>(texture->width()), static_cast<int>(texture->height()), static_cast<int>(texture->stride())};
+			planes.push_back(plane);
+		}
+
+		auto pix_fmt	= params.pix_desc.pix_fmt;
+		auto is_hd		= params.pix_desc.planes.at(0).height > 700;
+		auto local_key	= params.local_key ? params.local_key->data() : nullptr;
+		auto layer_key	= params.layer_key ? params.layer_key->data() : nullptr;
+		auto& transform = params.transform;
+		auto& chroma_params = params.blend_mode.chroma;
+		auto keyer_mode	= params.keyer;
+
+		auto brt = static_cast<float>(transform.brightness);
+		auto sat = static_cast<float>(transform.saturation);
+		auto con = static_cast<float>(transform.contrast);
+
+		tbb::parallel_for(tbb::blocked_range<int>(y0, y1), [&](const tbb::blocked_range<int>& r)
+		{
+			for(int row = r.begin(); row < r.end(); ++row)
+			{
+				if(!row_in_field(row))
+					continue;
+
+				double screen_y = (row + 0.5) / height;
+
+				for(int column = x0; column < x1; ++column)
+				{
+					double screen_x = (column + 0.5) / width;
+
+					auto w = projection.g * screen_x + projection.h * screen_y + projection.i;
+					auto u = (projection.a * screen_x + projection.b * screen_y + projection.c) / w;
+					auto v = (projection.d * screen_x + projection.e * screen_y + projection.f) / w;
+
+					if(u < 0.0 || u >= 1.0 || v < 0.0 || v >= 1.0)
+						continue;
+
+					auto s = static_cast<float>(crop.ul[0] + u * (crop.lr[0] - crop.ul[0]));
+					auto t = static_cast<float>(crop.ul[1] + v * (crop.lr[1] - crop.ul[1]));
+
+					auto color = cpu::get_rgba_color(pix_fmt, planes, is_hd, s, t);
+
+					if(chroma_enabled)
+						color = cpu::chroma_key(color, chroma_params);
+					if(levels)
+						cpu::levels_control(color, transform.levels);
+					if(csb)
+						cpu::contrast_saturation_brightness(color, brt, sat, con);
+
+					auto pixel = row * width + column;
+
+					auto factor = opacity;
+					if(local_key)
+						factor *= local_key[pixel] / 255.0f;
+					if(layer_key)
+						factor *= layer_key[pixel] / 255.0f;
+
+					for(int n = 0; n < 4; ++n)
+						color[n] *= factor;
+
+					// Blend
+
+					auto dest = background + pixel * background_stride;
+
+					cpu::color back = {0.0f, 0.0f, 0.0f, 1.0f};
+					if(background_stride == 4)
+					{
+						for(int n = 0; n < 4; ++n)
+							back[n] = dest[n] / 255.0f;
+					}
+					else
+						back[2] = dest[0] / 255.0f;
+
+					if(mode != blend_mode::normal)
+					{
+						float back_rgb[3];
+						float fore_rgb[3];
+						for(int n = 0; n < 3; ++n)
+						{
+							back_rgb[n] = back[n] / (back[3] + cpu::alpha_epsilon);
+							fore_rgb[n] = color[n] / (color[3] + cpu::alpha_epsilon);
+						}
+
+						float result[3];
+						cpu::get_blend_color(mode, back_rgb, fore_rgb, result);
+
+						for(int n = 0; n < 3; ++n)
+							color[n] = result[n] * color[3];
+					}
+
+					auto inv = keyer_mode == keyer::additive ? 1.0f : 1.0f - color[3];
+					for(int n = 0; n < 4; ++n)
+						color[n] += inv * back[n];
+
+					if(background_stride == 4)
+					{
+						for(int n = 0; n < 4; ++n)
+							dest[n] = cpu::to_byte(color[n]);
+					}
+					else
+						dest[0] = cpu::to_byte(color[2]);
+				}
+			}
+		});
+	}
+
+	void post_process(
+			const safe_ptr<cpu_buffer>& background, bool straighten_alpha)
+	{
+		if(!straighten_alpha || !post_processing_)
+			return;
+
+		auto data = background->data();
+		auto pixels = static_cast<int>(background->width() * background->height());
+
+		tbb::parallel_for(tbb::blocked_range<int>(0, pixels), [&](const tbb::blocked_range<int>& r)
+		{
+			for(int n = r.begin(); n < r.end(); ++n)
+			{
+				auto pixel = data + n*4;
+				auto alpha = pixel[3] / 255.0f;
+
+				for(int c = 0; c < 3; ++c)
+					pixel[c] = cpu::to_byte(pixel[c] / 255.0f / (alpha + cpu::alpha_epsilon));
+			}
+		});
+	}
+};
+
+cpu_image_kernel::cpu_image_kernel() : impl_(new implementation()){}
+void cpu_image_kernel::draw(cpu_draw_params&& params)
+{
+	impl_->draw(std::move(params));
+}
+
+void cpu_image_kernel::post_process(
+		const safe_ptr<cpu_buffer>& background, bool straighten_alpha)
+{
+	impl_->post_process(background, straighten_alpha);
+}
+
+}}
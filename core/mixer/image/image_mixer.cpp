@@ -24,11 +24,15 @@
 #include "image_mixer.h"
 
 #include "image_kernel.h"
+#include "cpu_image_kernel.h"
 #include "../write_frame.h"
+#include "../cpu/cpu_buffer.h"
 #include "../gpu/ogl_device.h"
 #include "../gpu/host_buffer.h"
 #include "../gpu/device_buffer.h"
 
+#include <common/env.h>
+#include <common/concurrency/future_util.h>
 #include <common/exception/exceptions.h>
 #include <common/gl/gl_check.h>
 #include <common/utility/move_on_copy.h>
@@ -39,79 +43,195 @@
 
 #include <gl/glew.h>
 
+#include <boost/algorithm/string.hpp>
 #include <boost/foreach.hpp>
+#include <boost/property_tree/ptree.hpp>
 #include <boost/range/algorithm_ext/erase.hpp>
 
+#include <tbb/atomic.h>
+
 #include <algorithm>
 #include <deque>
 
 using namespace boost::assign;
 
 namespace caspar { namespace core {
+
+image_mixer_backend::type get_image_mixer_backend(const std::wstring& str)
+{
+	if(boost::iequals(str, L"cpu"))
+		return image_mixer_backend::cpu;
+
+	return image_mixer_backend::gpu;
+}
+
+std::wstring get_image_mixer_backend(image_mixer_backend::type backend)
+{
+	switch(backend)
+	{
+	case image_mixer_backend::cpu:
+		return L"cpu";
+	default:
+		return L"gpu";
+	}
+}
 	
 struct item
 {
 	pixel_format_desc						pix_desc;
 	std::vector<safe_ptr<device_buffer>>	textures;
+	std::vector<safe_ptr<cpu_buffer>>		cpu_textures;
 	frame_transform							transform;
+	std::shared_ptr<tbb::atomic<bool>>		pass_through_hint;
 };
 
 typedef std::pair<blend_mode, std::vector<item>> layer;
 
+bool is_identity(const frame_transform& transform) // volume is ignored
+{
+	static const frame_transform identity;
+
+	return	transform.opacity					== identity.opacity &&
+			transform.contrast					== identity.contrast &&
+			transform.brightness				== identity.brightness &&
+			transform.saturation				== identity.saturation &&
+			transform.anchor					== identity.anchor &&
+			transform.fill_translation			== identity.fill_translation &&
+			transform.fill_scale				== identity.fill_scale &&
+			transform.clip_translation			== identity.clip_translation &&
+			transform.clip_scale				== identity.clip_scale &&
+			transform.angle						== identity.angle &&
+			transform.crop.ul					== identity.crop.ul &&
+			transform.crop.lr					== identity.crop.lr &&
+			transform.perspective.ul			== identity.perspective.ul &&
+			transform.perspective.ur			== identity.perspective.ur &&
+			transform.perspective.lr			== identity.perspective.lr &&
+			transform.perspective.ll			== identity.perspective.ll &&
+			transform.levels.min_input			== identity.levels.min_input &&
+			transform.levels.max_input			== identity.levels.max_input &&
+			transform.levels.gamma				== identity.levels.gamma &&
+			transform.levels.min_output			== identity.levels.min_output &&
+			transform.levels.max_output			== identity.levels.max_output &&
+			transform.field_mode				== identity.field_mode &&
+			transform.is_key					== identity.is_key &&
+			transform.is_mix					== identity.is_mix;
+}
+
+// A single untransformed full frame bgra item on a normal layer is already
+// the final image, mixing it would only copy it.
+bool is_pass_through(const item& item, const blend_mode& blend_mode, const video_format_desc& format_desc)
+{
+	if(blend_mode.mode != blend_mode::normal || blend_mode.chroma.key != chroma::none)
+		return false;
+
+	if(item.pix_desc.pix_fmt != pixel_format::bgra || item.pix_desc.planes.size() != 1)
+		return false;
+
+	if(item.pix_desc.planes[0].width != format_desc.width || item.pix_desc.planes[0].height != format_desc.height)
+		return false;
+
+	return is_identity(item.transform);
+}
+
+template<typename Func>
+void draw_fields(std::vector<layer>&& layers, const video_format_desc& format_desc, const Func& draw)
+{
+	if(format_desc.field_mode != field_mode::progressive)
+	{
+		auto upper = layers;
+		auto lower = std::move(layers);
+
+		BOOST_FOREACH(auto& layer, upper)
+		{
+			BOOST_FOREACH(auto& item, layer.second)
+				item.transform.field_mode = static_cast<field_mode::type>(item.transform.field_mode & field_mode::upper);
+		}
+
+		BOOST_FOREACH(auto& layer, lower)
+		{
+			BOOST_FOREACH(auto& item, layer.second)
+				item.transform.field_mode = static_cast<field_mode::type>(item.transform.field_mode & field_mode::lower);
+		}
+
+		draw(std::move(upper));
+		draw(std::move(lower));
+	}
+	else
+	{
+		draw(std::move(layers));
+	}
+}
+
 class image_renderer
 {
-	safe_ptr<ogl_device>			ogl_;
-	image_kernel					kernel_;	
-	std::shared_ptr<device_buffer>	transferring_buffer_;
+	typedef boost::shared_future<std::shared_ptr<host_buffer>> readback_t;
+
+	safe_ptr<ogl_device>					ogl_;
+	image_kernel							kernel_;	
+	const size_t							readback_depth_;
+	std::deque<safe_ptr<device_buffer>>		transferring_buffers_;	// ogl thread
+	std::deque<readback_t>					readbacks_;				// mixer thread
+	tbb::atomic<size_t>						readbacks_in_flight_;
 public:
-	image_renderer(const safe_ptr<ogl_device>& ogl)
+	image_renderer(const safe_ptr<ogl_device>& ogl, size_t readback_depth)
 		: ogl_(ogl)
 		, kernel_(ogl_)
+		, readback_depth_(std::max<size_t>(1, readback_depth))
 	{
+		readbacks_in_flight_ = 0;
 	}
 	
-	boost::unique_future<safe_ptr<host_buffer>> operator()(
+	boost::unique_future<image_buffer> operator()(
 			std::vector<layer>&& layers,
 			const video_format_desc& format_desc,
 			bool straighten_alpha)
 	{		
+		// Only block once readback_depth_ frames are queued, the pixels of
+		// a frame are not waited for until a consumer reads them.
+		while(!readbacks_.empty() && (readbacks_.front().is_ready() || readbacks_.size() >= readback_depth_))
+		{
+			readbacks_.front().wait();
+			readbacks_.pop_front();
+		}
+
 		auto layers2 = make_move_on_copy(std::move(layers));
-		return ogl_->begin_invoke([=]
+		readback_t readback(ogl_->begin_invoke([=]
 		{
 			return do_render(
 					std::move(layers2.value), format_desc, straighten_alpha);
-		});
+		}));
+
+		readbacks_.push_back(readback);
+		readbacks_in_flight_ = readbacks_.size();
+
+		return wrap_as_future(image_buffer(ogl_, format_desc.size, std::move(readback)));
 	}
 
-private:
-	safe_ptr<host_buffer> do_render(std::vector<layer>&& layers, const video_format_desc& format_desc, bool straighten_alpha)
+	size_t readback_depth() const
 	{
-		auto draw_buffer = create_mixer_buffer(4, format_desc);
+		return readback_depth_;
+	}
 
-		if(format_desc.field_mode != field_mode::progressive)
-		{
-			auto upper = layers;
-			auto lower = std::move(layers);
+	size_t readbacks_in_flight() const
+	{
+		return readbacks_in_flight_;
+	}
 
-			BOOST_FOREACH(auto& layer, upper)
-			{
-				BOOST_FOREACH(auto& item, layer.second)
-					item.transform.field_mode = static_cast<field_mode::type>(item.transform.field_mode & field_mode::upper);
-			}
+private:
+	std::shared_ptr<host_buffer> do_render(std::vector<layer>&& layers, const video_format_desc& format_desc, bool straighten_alpha)
+	{
+		BOOST_FOREACH(auto& layer, layers)
+		{
+			BOOST_FOREACH(auto& item, layer.second)
+				upload(item);
+		}
 
-			BOOST_FOREACH(auto& layer, lower)
-			{
-				BOOST_FOREACH(auto& item, layer.second)
-					item.transform.field_mode = static_cast<field_mode::type>(item.transform.field_mode & field_mode::lower);
-			}
+		auto draw_buffer = create_mixer_buffer(4, format_desc);
 
-			draw(std::move(upper), draw_buffer, format_desc);
-			draw(std::move(lower), draw_buffer, format_desc);
-		}
-		else
+		draw_fields(std::move(layers), format_desc, [&](std::vector<layer>&& field_layers)
 		{
-			draw(std::move(layers), draw_buffer, format_desc);
-		}
+			draw(std::move(field_layers), draw_buffer, format_desc);
+		});
 
 		kernel_.post_process(draw_buffer, straighten_alpha);
 
@@ -120,13 +240,33 @@ private:
 		ogl_->read_buffer(*draw_buffer);
 		host_buffer->begin_read(draw_buffer->width(), draw_buffer->height(), format(draw_buffer->stride()));
 		
-		transferring_buffer_ = std::move(draw_buffer);
+		// Keep the draw buffers of the in-flight read-backs out of the pool.
+		transferring_buffers_.push_back(std::move(draw_buffer));
+		while(transferring_buffers_.size() > readback_depth_)
+			transferring_buffers_.pop_front();
 
 		ogl_->flush(); // NOTE: This is important, otherwise fences will deadlock.
 			
 		return host_buffer;
 	}
 
+	// Frames allocated in system memory for pass-through that could not be
+	// passed through after all.
+	void upload(item& item)
+	{
+		if(!item.textures.empty())
+			return;
+
+		BOOST_FOREACH(auto& buffer, item.cpu_textures)
+		{
+			auto texture = ogl_->create_device_buffer(buffer->width(), buffer->height(), buffer->stride(), false);
+			texture->begin_read(buffer->data());
+			item.textures.push_back(texture);
+		}
+
+		item.cpu_textures.clear();
+	}
+
 	void draw(std::vector<layer>&&		layers, 
 			  safe_ptr<device_buffer>&	draw_buffer, 
 			  const video_format_desc& format_desc)
@@ -243,19 +383,177 @@ private:
 		return buffer;
 	}
 };
+
+class cpu_image_renderer
+{
+	cpu_image_kernel kernel_;
+public:
+	boost::unique_future<image_buffer> operator()(
+			std::vector<layer>&& layers,
+			const video_format_desc& format_desc,
+			bool straighten_alpha)
+	{
+		return wrap_as_future(do_render(std::move(layers), format_desc, straighten_alpha));
+	}
+
+private:
+	image_buffer do_render(std::vector<layer>&& layers, const video_format_desc& format_desc, bool straighten_alpha)
+	{
+		auto draw_buffer = create_mixer_buffer(4, format_desc);
+
+		draw_fields(std::move(layers), format_desc, [&](std::vector<layer>&& field_layers)
+		{
+			draw(std::move(field_layers), draw_buffer, format_desc);
+		});
+
+		kernel_.post_process(draw_buffer, straighten_alpha);
+
+		return image_buffer(std::move(draw_buffer));
+	}
+
+	void draw(std::vector<layer>&&		layers, 
+			  safe_ptr<cpu_buffer>&		draw_buffer, 
+			  const video_format_desc&	format_desc)
+	{
+		std::shared_ptr<cpu_buffer> layer_key_buffer;
+
+		BOOST_FOREACH(auto& layer, layers)
+			draw_layer(std::move(layer), draw_buffer, layer_key_buffer, format_desc);
+	}
+
+	void draw_layer(layer&&							layer, 
+					safe_ptr<cpu_buffer>&			draw_buffer,
+					std::shared_ptr<cpu_buffer>&	layer_key_buffer,
+					const video_format_desc&		format_desc)
+	{				
+		boost::remove_erase_if(layer.second, [](const item& item){return item.transform.field_mode == field_mode::empty;});
+
+		if(layer.second.empty())
+			return;
+
+		std::shared_ptr<cpu_buffer> local_key_buffer;
+		std::shared_ptr<cpu_buffer> local_mix_buffer;
+				
+		if(layer.first.mode != blend_mode::normal || layer.first.chroma.key != chroma::none)
+		{
+			auto layer_draw_buffer = create_mixer_buffer(4, format_desc);
+
+			BOOST_FOREACH(auto& item, layer.second)
+				draw_item(std::move(item), layer_draw_buffer, layer_key_buffer, local_key_buffer, local_mix_buffer, format_desc);	
+		
+			draw_mixer_buffer(layer_draw_buffer, std::move(local_mix_buffer), blend_mode::normal);							
+			draw_mixer_buffer(draw_buffer, std::move(layer_draw_buffer), layer.first);
+		}
+		else // fast path
+		{
+			BOOST_FOREACH(auto& item, layer.second)		
+				draw_item(std::move(item), draw_buffer, layer_key_buffer, local_key_buffer, local_mix_buffer, format_desc);		
+					
+			draw_mixer_buffer(draw_buffer, std::move(local_mix_buffer), layer.first);
+		}					
+
+		layer_key_buffer = std::move(local_key_buffer);
+	}
+
+	void draw_item(item&&							item, 
+				   safe_ptr<cpu_buffer>&			draw_buffer, 
+				   std::shared_ptr<cpu_buffer>&		layer_key_buffer, 
+				   std::shared_ptr<cpu_buffer>&		local_key_buffer, 
+				   std::shared_ptr<cpu_buffer>&		local_mix_buffer,
+				   const video_format_desc&			format_desc)
+	{			
+		cpu_draw_params draw_params;
+		draw_params.pix_desc				= std::move(item.pix_desc);
+		draw_params.textures				= std::move(item.cpu_textures);
+		draw_params.transform				= std::move(item.transform);
+		draw_params.aspect_ratio			= static_cast<double>(format_desc.square_width) / static_cast<double>(format_desc.square_height);
+
+		if(item.transform.is_key)
+		{
+			local_key_buffer = local_key_buffer ? local_key_buffer : create_mixer_buffer(1, format_desc);
+
+			draw_params.background			= local_key_buffer;
+			draw_params.local_key			= nullptr;
+			draw_params.layer_key			= nullptr;
+
+			kernel_.draw(std::move(draw_params));
+		}
+		else if(item.transform.is_mix)
+		{
+			local_mix_buffer = local_mix_buffer ? local_mix_buffer : create_mixer_buffer(4, format_desc);
+
+			draw_params.background			= local_mix_buffer;
+			draw_params.local_key			= std::move(local_key_buffer);
+			draw_params.layer_key			= layer_key_buffer;
+
+			draw_params.keyer				= keyer::additive;
+
+			kernel_.draw(std::move(draw_params));
+		}
+		else
+		{
+			draw_mixer_buffer(draw_buffer, std::move(local_mix_buffer), blend_mode::normal);
+			
+			draw_params.background			= draw_buffer;
+			draw_params.local_key			= std::move(local_key_buffer);
+			draw_params.layer_key			= layer_key_buffer;
+
+			kernel_.draw(std::move(draw_params));
+		}	
+	}
+
+	void draw_mixer_buffer(safe_ptr<cpu_buffer>&			draw_buffer, 
+						   std::shared_ptr<cpu_buffer>&&	source_buffer, 
+						   blend_mode   			        blend_mode = blend_mode::normal)
+	{
+		if(!source_buffer)
+			return;
+
+		cpu_draw_params draw_params;
+		draw_params.pix_desc.pix_fmt	= pixel_format::bgra;
+		draw_params.pix_desc.planes		= list_of(pixel_format_desc::plane(source_buffer->width(), source_buffer->height(), 4));
+		draw_params.textures			= list_of(make_safe_ptr(source_buffer));
+		draw_params.transform			= frame_transform();
+		draw_params.blend_mode			= blend_mode;
+		draw_params.background			= draw_buffer;
+
+		kernel_.draw(std::move(draw_params));
+	}
+			
+	safe_ptr<cpu_buffer> create_mixer_buffer(size_t stride, const video_format_desc& format_desc)
+	{
+		auto buffer = cpu_buffer::create(format_desc.width, format_desc.height, stride);
+		std::memset(buffer->data(), 0, buffer->size());
+		return buffer;
+	}
+};
 		
 struct image_mixer::implementation : boost::noncopyable
 {	
-	safe_ptr<ogl_device>			ogl_;
-	image_renderer					renderer_;
-	std::vector<frame_transform>	transform_stack_;
-	std::vector<layer>				layers_; // layer/stream/items
+	safe_ptr<ogl_device>				ogl_;
+	const image_mixer_backend::type		backend_;
+	std::unique_ptr<image_renderer>		renderer_;
+	std::unique_ptr<cpu_image_renderer>	cpu_renderer_;
+	std::vector<frame_transform>		transform_stack_;
+	std::vector<layer>					layers_; // layer/stream/items
+	const bool							pass_through_;
+	const size_t						readback_depth_;
+	bool								warned_drop_;
+	bool								warned_download_;
 public:
-	implementation(const safe_ptr<ogl_device>& ogl) 
+	implementation(const safe_ptr<ogl_device>& ogl, image_mixer_backend::type backend) 
 		: ogl_(ogl)
-		, renderer_(ogl)
+		, backend_(backend)
 		, transform_stack_(1)	
+		, pass_through_(env::properties().get(L"configuration.mixer.pass-through", true))
+		, readback_depth_(env::properties().get(L"configuration.mixer.readback-depth", 2))
+		, warned_drop_(false)
+		, warned_download_(false)
 	{
+		if(backend_ == image_mixer_backend::cpu)
+			cpu_renderer_.reset(new cpu_image_renderer());
+		else
+			renderer_.reset(new image_renderer(ogl, readback_depth_));
 	}
 
 	void begin_layer(blend_mode blend_mode)
@@ -271,13 +569,60 @@ public:
 	void visit(write_frame& frame)
 	{			
 		item item;
-		item.pix_desc	= frame.get_pixel_format_desc();
-		item.textures	= frame.get_textures();
-		item.transform	= transform_stack_.back();
+		item.pix_desc		= frame.get_pixel_format_desc();
+		item.textures		= frame.get_textures();
+		item.cpu_textures	= frame.get_cpu_buffers();
+		item.transform		= transform_stack_.back();
+		item.pass_through_hint	= frame.get_pass_through_hint();
+
+		// Frames created by the other backend (e.g. a producer moved between
+		// channels) are read back for the cpu backend. The gpu backend uploads
+		// system memory frames itself.
+		auto planes = item.pix_desc.planes.size();
+		if(backend_ == image_mixer_backend::cpu && item.cpu_textures.size() != planes && item.textures.size() == planes)
+			download(item);
+
+		if(item.cpu_textures.size() != planes && item.textures.size() != planes)
+		{
+			if(!warned_drop_)
+				CASPAR_LOG(warning) << L"[image_mixer] Dropped frame without image data.";
+			warned_drop_ = true;
+			return;
+		}
 
 		layers_.back().second.push_back(item);
 	}
 
+	void download(item& item)
+	{
+		if(!warned_download_)
+			CASPAR_LOG(warning) << L"[image_mixer] Reading back gpu frames for the cpu mixer. Expect reduced performance.";
+		warned_download_ = true;
+
+		BOOST_FOREACH(auto& texture, item.textures)
+		{
+			auto host_buffer = ogl_->create_host_buffer(texture->size(), host_buffer::read_only);
+			ogl_->invoke([&]
+			{
+				ogl_->attach(*texture);
+				ogl_->read_buffer(*texture);
+				GL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+				host_buffer->begin_read(texture->width(), texture->height(), format(texture->stride()));
+				GL(glPixelStorei(GL_PACK_ALIGNMENT, 4));
+				ogl_->flush();
+			}, high_priority);
+
+			host_buffer->wait(*ogl_);
+			ogl_->invoke([&]{host_buffer->map();}, high_priority);
+
+			auto buffer = cpu_buffer::create(texture->width(), texture->height(), texture->stride());
+			std::memcpy(buffer->data(), host_buffer->data(), buffer->size());
+			item.cpu_textures.push_back(buffer);
+		}
+
+		item.textures.clear();
+	}
+
 	void end()
 	{
 		transform_stack_.pop_back();
@@ -286,19 +631,80 @@ public:
 	void end_layer()
 	{		
 	}
+
+	std::shared_ptr<cpu_buffer> try_pass_through(const video_format_desc& format_desc, bool straighten_alpha)
+	{
+		const item* candidate = nullptr;
+		size_t count = 0;
+		bool eligible = false;
+
+		BOOST_FOREACH(auto& layer, layers_)
+		{
+			BOOST_FOREACH(auto& item, layer.second)
+			{
+				if(item.transform.field_mode == field_mode::empty)
+					continue;
+
+				candidate = &item;
+				eligible = ++count == 1 && is_pass_through(item, layer.first, format_desc);
+			}
+		}
+
+		eligible = eligible && count == 1 && pass_through_ && !straighten_alpha;
+
+		// Let the frame factories know whether their next frames should be
+		// allocated in system memory.
+		BOOST_FOREACH(auto& layer, layers_)
+		{
+			BOOST_FOREACH(auto& item, layer.second)
+			{
+				if(item.pass_through_hint)
+					*item.pass_through_hint = eligible && &item == candidate;
+			}
+		}
+
+		if(!eligible || candidate->cpu_textures.empty())
+			return nullptr;
+
+		return candidate->cpu_textures.front();
+	}
 	
-	boost::unique_future<safe_ptr<host_buffer>> render(const video_format_desc& format_desc, bool straighten_alpha)
+	boost::unique_future<image_buffer> render(const video_format_desc& format_desc, bool straighten_alpha)
 	{
-		return renderer_(std::move(layers_), format_desc, straighten_alpha);
+		auto buffer = try_pass_through(format_desc, straighten_alpha);
+		if(buffer)
+		{
+			layers_.clear();
+			return wrap_as_future(image_buffer(make_safe_ptr(buffer)));
+		}
+
+		if(cpu_renderer_)
+			return (*cpu_renderer_)(std::move(layers_), format_desc, straighten_alpha);
+
+		return (*renderer_)(std::move(layers_), format_desc, straighten_alpha);
+	}
+
+	boost::property_tree::wptree info() const
+	{
+		boost::property_tree::wptree info;
+
+		if(renderer_)
+		{
+			info.add(L"readback-depth", renderer_->readback_depth());
+			info.add(L"readbacks-in-flight", renderer_->readbacks_in_flight());
+		}
+
+		return info;
 	}
 };
 
-image_mixer::image_mixer(const safe_ptr<ogl_device>& ogl) : impl_(new implementation(ogl)){}
+image_mixer::image_mixer(const safe_ptr<ogl_device>& ogl, image_mixer_backend::type backend) : impl_(new implementation(ogl, backend)){}
 void image_mixer::begin(basic_frame& frame){impl_->begin(frame);}
 void image_mixer::visit(write_frame& frame){impl_->visit(frame);}
 void image_mixer::end(){impl_->end();}
-boost::unique_future<safe_ptr<host_buffer>> image_mixer::operator()(const video_format_desc& format_desc, bool straighten_alpha){return impl_->render(format_desc, straighten_alpha);}
+boost::unique_future<image_buffer> image_mixer::operator()(const video_format_desc& format_desc, bool straighten_alpha){return impl_->render(format_desc, straighten_alpha);}
 void image_mixer::begin_layer(blend_mode blend_mode){impl_->begin_layer(blend_mode);}
 void image_mixer::end_layer(){impl_->end_layer();}
+boost::property_tree::wptree image_mixer::info() const{return impl_->info();}
 
 }}
\ No newline at end of file
@@ -23,26 +23,42 @@
 
 #include "blend_modes.h"
 
+#include "../image_buffer.h"
+
 #include <common/memory/safe_ptr.h>
 
 #include <core/producer/frame/frame_visitor.h>
 
 #include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
 
 #include <boost/thread/future.hpp>
 
+#include <string>
+
 namespace caspar { namespace core {
 
 class write_frame;
-class host_buffer;
 class ogl_device;
 struct video_format_desc;
 struct pixel_format_desc;
 
+struct image_mixer_backend
+{
+	enum type
+	{
+		gpu = 0,
+		cpu
+	};
+};
+
+image_mixer_backend::type get_image_mixer_backend(const std::wstring& str);
+std::wstring get_image_mixer_backend(image_mixer_backend::type backend);
+
 class image_mixer : public core::frame_visitor, boost::noncopyable
 {
 public:
-	image_mixer(const safe_ptr<ogl_device>& ogl);
+	image_mixer(const safe_ptr<ogl_device>& ogl, image_mixer_backend::type backend = image_mixer_backend::gpu);
 	
 	virtual void begin(core::basic_frame& frame);
 	virtual void visit(core::write_frame& frame);
@@ -51,8 +67,10 @@ public:
 	void begin_layer(blend_mode blend_mode);
 	void end_layer();
 		
-	boost::unique_future<safe_ptr<host_buffer>> operator()(
+	boost::unique_future<image_buffer> operator()(
 			const video_format_desc& format_desc, bool straighten_alpha);
+
+	boost::property_tree::wptree info() const;
 		
 private:
 	struct implementation;
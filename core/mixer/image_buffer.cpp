@@ -0,0 +1,91 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../stdafx.h"
+
+#include "image_buffer.h"
+
+#include "cpu/cpu_buffer.h"
+#include "gpu/fence.h"
+#include "gpu/host_buffer.h"
+#include "gpu/ogl_device.h"
+
+#include <tbb/mutex.h>
+
+namespace caspar { namespace core {
+
+struct image_buffer::implementation : boost::noncopyable
+{
+	std::shared_ptr<ogl_device>							ogl_;
+	const size_t										size_;
+	boost::shared_future<std::shared_ptr<host_buffer>>	future_;
+	std::shared_ptr<host_buffer>						host_buffer_;
+	std::shared_ptr<cpu_buffer>							cpu_buffer_;
+	tbb::mutex											mutex_;
+
+	implementation(const safe_ptr<ogl_device>& ogl, size_t size, boost::shared_future<std::shared_ptr<host_buffer>>&& buffer)
+		: ogl_(ogl)
+		, size_(size)
+		, future_(std::move(buffer))
+	{
+	}
+
+	implementation(safe_ptr<cpu_buffer>&& buffer)
+		: size_(buffer->size())
+		, cpu_buffer_(std::move(buffer))
+	{
+	}
+
+	const boost::iterator_range<const uint8_t*> data()
+	{
+		if(cpu_buffer_)
+			return boost::iterator_range<const uint8_t*>(cpu_buffer_->data(), cpu_buffer_->data() + cpu_buffer_->size());
+
+		{
+			tbb::mutex::scoped_lock lock(mutex_);
+
+			if(!host_buffer_)
+				host_buffer_ = future_.get();
+
+			if(!host_buffer_->data())
+			{
+				auto buffer = host_buffer_;
+				buffer->wait(*ogl_);
+				ogl_->invoke([=]{buffer->map();}, high_priority);
+			}
+		}
+
+		auto ptr = static_cast<const uint8_t*>(host_buffer_->data());
+		return boost::iterator_range<const uint8_t*>(ptr, ptr + host_buffer_->size());
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+};
+
+image_buffer::image_buffer(){}
+image_buffer::image_buffer(const safe_ptr<ogl_device>& ogl, size_t size, boost::shared_future<std::shared_ptr<host_buffer>>&& buffer) : impl_(new implementation(ogl, size, std::move(buffer))){}
+image_buffer::image_buffer(safe_ptr<cpu_buffer>&& buffer) : impl_(new implementation(std::move(buffer))){}
+const boost::iterator_range<const uint8_t*> image_buffer::data() const{return impl_ ? impl_->data() : boost::iterator_range<const uint8_t*>();}
+size_t image_buffer::size() const{return impl_ ? impl_->size() : 0;}
+
+}}
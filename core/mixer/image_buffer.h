@@ -0,0 +1,54 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/range/iterator_range.hpp>
+#include <boost/thread/future.hpp>
+
+#include <cstdint>
+#include <memory>
+
+namespace caspar { namespace core {
+
+class host_buffer;
+class cpu_buffer;
+class ogl_device;
+
+// Result of an image_mixer render, either a gpu read-back or a frame mixed in
+// system memory. Copies share the same underlying buffer.
+class image_buffer
+{
+public:
+	image_buffer();
+	image_buffer(const safe_ptr<ogl_device>& ogl, size_t size, boost::shared_future<std::shared_ptr<host_buffer>>&& buffer);
+	explicit image_buffer(safe_ptr<cpu_buffer>&& buffer);
+
+	// Blocks until a gpu render and read-back has completed.
+	const boost::iterator_range<const uint8_t*> data() const;
+	size_t size() const;
+private:
+	struct implementation;
+	std::shared_ptr<implementation> impl_;
+};
+
+}}
@@ -63,16 +63,21 @@ namespace caspar { namespace core {
 
 class layer_specific_frame_factory : public frame_factory
 {
-	safe_ptr<ogl_device>	ogl_;
-	mutable tbb::spin_mutex	format_desc_mutex_;
-	video_format_desc		format_desc_;
-	tbb::atomic<bool>		mipmapping_;
+	safe_ptr<ogl_device>				ogl_;
+	const image_mixer_backend::type		backend_;
+	mutable tbb::spin_mutex				format_desc_mutex_;
+	video_format_desc					format_desc_;
+	tbb::atomic<bool>					mipmapping_;
+	std::shared_ptr<tbb::atomic<bool>>	pass_through_;
 public:
-	layer_specific_frame_factory(const safe_ptr<ogl_device>& ogl, const video_format_desc& format_desc)
+	layer_specific_frame_factory(const safe_ptr<ogl_device>& ogl, image_mixer_backend::type backend, const video_format_desc& format_desc)
 		: ogl_(ogl)
+		, backend_(backend)
 		, format_desc_(format_desc)
+		, pass_through_(std::make_shared<tbb::atomic<bool>>())
 	{
 		mipmapping_ = env::properties().get(L"configuration.mixer.mipmapping_default_on", false);
+		*pass_through_ = false;
 	}
 
 	void set_mipmapping(bool mipmapping)
@@ -96,8 +101,19 @@ public:
 			const core::pixel_format_desc& desc,
 			const channel_layout& audio_channel_layout) override
 	{
-		return make_safe<write_frame>(
+		// While the previous frames of this layer were forwarded without
+		// mixing, allocate in system memory so that the gpu never sees them.
+		if(backend_ == image_mixer_backend::cpu || *pass_through_)
+		{
+			auto frame = make_safe<write_frame>(tag, desc, audio_channel_layout);
+			frame->set_pass_through_hint(pass_through_);
+			return frame;
+		}
+
+		auto frame = make_safe<write_frame>(
 				ogl_, tag, desc, audio_channel_layout, mipmapping_);
+		frame->set_pass_through_hint(pass_through_);
+		return frame;
 	}
 
 	video_format_desc get_video_format_desc() const override
@@ -105,6 +121,11 @@ public:
 		tbb::spin_mutex::scoped_lock lock(format_desc_mutex_);
 		return format_desc_;
 	}
+
+	bool requires_cpu_frames() const override
+	{
+		return backend_ == image_mixer_backend::cpu;
+	}
 };
 		
 struct mixer::implementation : boost::noncopyable
@@ -116,6 +137,7 @@ struct mixer::implementation : boost::noncopyable
 	safe_ptr<mixer::target_t>		target_;
 	video_format_desc				format_desc_;
 	safe_ptr<ogl_device>			ogl_;
+	const image_mixer_backend::type	image_mixer_backend_;
 	channel_layout					audio_channel_layout_;
 	bool							straighten_alpha_;
 	
@@ -135,15 +157,17 @@ public:
 			const video_format_desc& format_desc,
 			const safe_ptr<ogl_device>& ogl,
 			const channel_layout& audio_channel_layout,
-			int channel_index) 
+			int channel_index,
+			image_mixer_backend::type image_mixer_backend) 
 		: graph_(graph)
 		, target_(target)
 		, format_desc_(format_desc)
 		, ogl_(ogl)
+		, image_mixer_backend_(image_mixer_backend)
 		, audio_channel_layout_(audio_channel_layout)
 		, straighten_alpha_(false)
 		, audio_mixer_(graph_)
-		, image_mixer_(ogl)
+		, image_mixer_(ogl, image_mixer_backend)
 		, executor_(L"mixer " + boost::lexical_cast<std::wstring>(channel_index))
 		, monitor_subject_(make_safe<monitor::subject>("/mixer"))
 	{
@@ -182,13 +206,12 @@ public:
 
 				auto image = image_mixer_(format_desc_, straighten_alpha_);
 				auto audio = audio_mixer_(format_desc_, audio_channel_layout_);
-				image.wait();
 
 				auto mix_time = mix_timer_.elapsed();
 				graph_->set_value("mix-time", mix_time*format_desc_.fps*0.5);
 				current_mix_time_ = static_cast<int64_t>(mix_time * 1000.0);
 
-				target_->send(std::make_pair(make_safe<read_frame>(ogl_, format_desc_.size, std::move(image.get()), std::move(audio), audio_channel_layout_), packet.second));
+				target_->send(std::make_pair(make_safe<read_frame>(format_desc_.size, std::move(image.get()), std::move(audio), audio_channel_layout_), packet.second));
 			}
 			catch(...)
 			{
@@ -205,7 +228,7 @@ public:
 
 			if (found == frame_factories_.end())
 			{
-				auto factory = make_safe<layer_specific_frame_factory>(ogl_, format_desc_);
+				auto factory = make_safe<layer_specific_frame_factory>(ogl_, image_mixer_backend_, format_desc_);
 
 				frame_factories_.insert(std::make_pair(layer_index, factory));
 
@@ -340,6 +363,9 @@ public:
 	{
 		boost::property_tree::wptree info;
 		info.add(L"mix-time", current_mix_time_);
+		info.add(L"image-mixer", get_image_mixer_backend(image_mixer_backend_));
+		BOOST_FOREACH(auto& child, image_mixer_.info())
+			info.add_child(child.first, child.second);
 
 		return wrap_as_future(std::move(info));
 	}
@@ -359,8 +385,9 @@ mixer::mixer(
 		const video_format_desc& format_desc,
 		const safe_ptr<ogl_device>& ogl,
 		const channel_layout& audio_channel_layout,
-		int channel_index)
-	: impl_(new implementation(graph, target, format_desc, ogl, audio_channel_layout, channel_index)){}
+		int channel_index,
+		image_mixer_backend::type image_mixer_backend)
+	: impl_(new implementation(graph, target, format_desc, ogl, audio_channel_layout, channel_index, image_mixer_backend)){}
 void mixer::send(const std::pair<std::map<int, safe_ptr<core::basic_frame>>, std::shared_ptr<void>>& frames){ impl_->send(frames);}
 safe_ptr<frame_factory> mixer::get_frame_factory(int layer_index) { return impl_->get_frame_factory(layer_index); }
 blend_mode::type mixer::get_blend_mode(int index) { return impl_->get_blend_mode(index); }
@@ -22,6 +22,7 @@
 #pragma once
 
 #include "image/blend_modes.h"
+#include "image/image_mixer.h"
 
 #include "../producer/frame/frame_factory.h"
 #include "../monitor/monitor.h"
@@ -60,7 +61,8 @@ public:
 			const video_format_desc& format_desc,
 			const safe_ptr<ogl_device>& ogl,
 			const channel_layout& audio_channel_layout,
-			int channel_index);
+			int channel_index,
+			image_mixer_backend::type image_mixer_backend = image_mixer_backend::gpu);
 		
 	// target
 
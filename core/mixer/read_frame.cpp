@@ -23,12 +23,6 @@
 
 #include "read_frame.h"
 
-#include "gpu/fence.h"
-#include "gpu/host_buffer.h"	
-#include "gpu/ogl_device.h"
-
-#include <tbb/mutex.h>
-
 #include <boost/chrono.hpp>
 
 namespace caspar { namespace core {
@@ -43,23 +37,19 @@ int64_t get_current_time_millis()
 																																							
 struct read_frame::implementation : boost::noncopyable
 {
-	safe_ptr<ogl_device>		ogl_;
 	size_t						size_;
-	safe_ptr<host_buffer>		image_data_;
-	tbb::mutex					mutex_;
+	image_buffer				image_data_;
 	audio_buffer				audio_data_;
 	channel_layout				audio_channel_layout_;
 	int64_t						created_timestamp_;
 
 public:
 	implementation(
-			const safe_ptr<ogl_device>& ogl,
 			size_t size,
-			safe_ptr<host_buffer>&& image_data,
+			image_buffer&& image_data,
 			audio_buffer&& audio_data,
 			const channel_layout& audio_channel_layout) 
-		: ogl_(ogl)
-		, size_(size)
+		: size_(size)
 		, image_data_(std::move(image_data))
 		, audio_data_(std::move(audio_data))
 		, audio_channel_layout_(audio_channel_layout)
@@ -69,18 +59,7 @@ public:
 	
 	const boost::iterator_range<const uint8_t*> image_data()
 	{
-		{
-			tbb::mutex::scoped_lock lock(mutex_);
-
-			if(!image_data_->data())
-			{
-				image_data_.get()->wait(*ogl_);
-				ogl_->invoke([=]{image_data_.get()->map();}, high_priority);
-			}
-		}
-
-		auto ptr = static_cast<const uint8_t*>(image_data_->data());
-		return boost::iterator_range<const uint8_t*>(ptr, ptr + image_data_->size());
+		return image_data_.data();
 	}
 	const boost::iterator_range<const int32_t*> audio_data()
 	{
@@ -89,12 +68,11 @@ public:
 };
 
 read_frame::read_frame(
-		const safe_ptr<ogl_device>& ogl,
 		size_t size,
-		safe_ptr<host_buffer>&& image_data,
+		image_buffer&& image_data,
 		audio_buffer&& audio_data,
 		const channel_layout& audio_channel_layout) 
-	: impl_(new implementation(ogl, size, std::move(image_data), std::move(audio_data), audio_channel_layout))
+	: impl_(new implementation(size, std::move(image_data), std::move(audio_data), audio_channel_layout))
 {
 }
 
@@ -23,6 +23,7 @@
 
 #include <common/memory/safe_ptr.h>
 
+#include <core/mixer/image_buffer.h>
 #include <core/mixer/audio/audio_mixer.h>
 #include <core/mixer/audio/audio_util.h>
 
@@ -35,17 +36,13 @@
 
 namespace caspar { namespace core {
 	
-class host_buffer;
-class ogl_device;
-
 class read_frame : boost::noncopyable
 {
 public:
 	read_frame();
 	read_frame(
-			const safe_ptr<ogl_device>& ogl,
 			size_t size,
-			safe_ptr<host_buffer>&& image_data,
+			image_buffer&& image_data,
 			audio_buffer&& audio_data,
 			const channel_layout& audio_channel_layout);
 
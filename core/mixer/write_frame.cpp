@@ -23,6 +23,7 @@
 
 #include "write_frame.h"
 
+#include "cpu/cpu_buffer.h"
 #include "gpu/ogl_device.h"
 #include "gpu/host_buffer.h"
 #include "gpu/device_buffer.h"
@@ -43,6 +44,8 @@ struct write_frame::implementation
 	std::shared_ptr<ogl_device>					ogl_;
 	std::vector<std::shared_ptr<host_buffer>>	buffers_;
 	std::vector<safe_ptr<device_buffer>>		textures_;
+	std::vector<safe_ptr<cpu_buffer>>			cpu_buffers_;
+	std::shared_ptr<tbb::atomic<bool>>			pass_through_hint_;
 	audio_buffer								audio_data_;
 	const core::pixel_format_desc				desc_;
 	const channel_layout						channel_layout_;
@@ -76,6 +79,20 @@ struct write_frame::implementation
 
 		recorded_frame_age_ = -1;
 	}
+
+	implementation(const void* tag, const core::pixel_format_desc& desc, const channel_layout& channel_layout) 
+		: desc_(desc)
+		, channel_layout_(channel_layout)
+		, tag_(tag)
+		, mode_(core::field_mode::progressive)
+	{
+		std::transform(desc.planes.begin(), desc.planes.end(), std::back_inserter(cpu_buffers_), [&](const core::pixel_format_desc::plane& plane)
+		{
+			return cpu_buffer::create(plane.width, plane.height, plane.channels);
+		});
+
+		recorded_frame_age_ = -1;
+	}
 			
 	void accept(write_frame& self, core::frame_visitor& visitor)
 	{
@@ -95,6 +112,14 @@ struct write_frame::implementation
 
 	boost::iterator_range<uint8_t*> image_data(size_t index)
 	{
+		if(!cpu_buffers_.empty())
+		{
+			if(index >= cpu_buffers_.size())
+				return boost::iterator_range<uint8_t*>();
+			auto ptr = cpu_buffers_[index]->data();
+			return boost::iterator_range<uint8_t*>(ptr, ptr+cpu_buffers_[index]->size());
+		}
+
 		if(index >= buffers_.size() || !buffers_[index]->data())
 			return boost::iterator_range<uint8_t*>();
 		auto ptr = static_cast<uint8_t*>(buffers_[index]->data());
@@ -142,6 +167,13 @@ write_frame::write_frame(
 	: impl_(new implementation(ogl, tag, desc, channel_layout, mipmapping))
 {
 }
+write_frame::write_frame(
+		const void* tag,
+		const core::pixel_format_desc& desc,
+		const channel_layout& channel_layout)
+	: impl_(new implementation(tag, desc, channel_layout))
+{
+}
 write_frame::write_frame(const write_frame& other) : impl_(new implementation(*other.impl_)){}
 write_frame::write_frame(write_frame&& other) : impl_(std::move(other.impl_)){}
 write_frame& write_frame::operator=(const write_frame& other)
@@ -161,6 +193,13 @@ void write_frame::swap(write_frame& other){impl_.swap(other.impl_);}
 boost::iterator_range<uint8_t*> write_frame::image_data(size_t index){return impl_->image_data(index);}
 audio_buffer& write_frame::audio_data() { return impl_->audio_data_; }
 const void* write_frame::tag() const {return impl_->tag_;}
+safe_ptr<write_frame> write_frame::retag(const void* tag) const
+{
+	auto frame = make_safe<write_frame>(*this);
+	frame->impl_->tag_ = tag;
+	frame->impl_->pass_through_hint_.reset();
+	return frame;
+}
 const core::pixel_format_desc& write_frame::get_pixel_format_desc() const{return impl_->desc_;}
 const channel_layout& write_frame::get_channel_layout() const{return impl_->channel_layout_;}
 multichannel_view<int32_t, audio_buffer::iterator> write_frame::get_multichannel_view()
@@ -168,6 +207,9 @@ multichannel_view<int32_t, audio_buffer::iterator> write_frame::get_multichannel
 	return make_multichannel_view<int32_t>(impl_->audio_data_.begin(), impl_->audio_data_.end(), impl_->channel_layout_);
 }
 const std::vector<safe_ptr<device_buffer>>& write_frame::get_textures() const{return impl_->textures_;}
+const std::vector<safe_ptr<cpu_buffer>>& write_frame::get_cpu_buffers() const{return impl_->cpu_buffers_;}
+void write_frame::set_pass_through_hint(const std::shared_ptr<tbb::atomic<bool>>& hint){impl_->pass_through_hint_ = hint;}
+const std::shared_ptr<tbb::atomic<bool>>& write_frame::get_pass_through_hint() const{return impl_->pass_through_hint_;}
 void write_frame::commit(size_t plane_index){impl_->commit(plane_index);}
 void write_frame::commit(){impl_->commit();}
 void write_frame::set_type(const field_mode::type& mode){impl_->mode_ = mode;}
@@ -31,12 +31,16 @@
 #include <boost/noncopyable.hpp>
 #include <boost/range/iterator_range.hpp>
 
+#include <tbb/atomic.h>
+
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 namespace caspar { namespace core {
 
 class device_buffer;
+class cpu_buffer;
 struct frame_visitor;
 struct pixel_format_desc;
 class ogl_device;	
@@ -46,6 +50,7 @@ class write_frame : public core::basic_frame, boost::noncopyable
 public:	
 	explicit write_frame(const void* tag, const channel_layout& channel_layout);
 	explicit write_frame(const safe_ptr<ogl_device>& ogl, const void* tag, const core::pixel_format_desc& desc, const channel_layout& channel_layout, bool mipmapping);
+	explicit write_frame(const void* tag, const core::pixel_format_desc& desc, const channel_layout& channel_layout);
 
 	write_frame(const write_frame& other);
 	write_frame(write_frame&& other);
@@ -73,13 +78,25 @@ public:
 	
 	const void* tag() const;
 
+	// A frame with the same image and audio that is mixed as a frame of tag,
+	// for when more than one producer plays the same decoded frame. It has
+	// no pass through hint, that belongs to the frame_factory that created
+	// this frame.
+	safe_ptr<write_frame> retag(const void* tag) const;
+
 	const core::pixel_format_desc& get_pixel_format_desc() const;
 	const channel_layout& get_channel_layout() const;
 	multichannel_view<int32_t, audio_buffer::iterator> get_multichannel_view();
+
+	// Shared with the frame_factory that created the frame. The image_mixer sets
+	// it when the frame could be forwarded to the output without mixing.
+	void set_pass_through_hint(const std::shared_ptr<tbb::atomic<bool>>& hint);
 private:
 	friend class image_mixer;
 	
 	const std::vector<safe_ptr<device_buffer>>& get_textures() const;
+	const std::vector<safe_ptr<cpu_buffer>>& get_cpu_buffers() const;
+	const std::shared_ptr<tbb::atomic<bool>>& get_pass_through_hint() const;
 
 	struct implementation;
 	safe_ptr<implementation> impl_;
@@ -25,6 +25,7 @@
 
 #include <boost/variant.hpp>
 #include <boost/chrono/duration.hpp>
+#include <boost/range/iterator_range.hpp>
 
 #include <cstdint>
 #include <string>
@@ -41,56 +42,122 @@ typedef boost::variant<bool,
 					   std::wstring,
 					   std::vector<std::int8_t>> data_t;
 
+// Holds up to max_data values inline, so that building and propagating a
+// message does not allocate. Messages with more values move them to the heap.
 class message
 {
 public:
+	static const int max_data = 4;
 
-	message(std::string path, std::vector<data_t> data = std::vector<data_t>())
-		: path_(std::move(path))
-		, data_ptr_(std::make_shared<std::vector<data_t>>(std::move(data)))
-	{
-		CASPAR_ASSERT(path.empty() || path[0] == '/');
-	}
-	
-	message(std::string path, safe_ptr<std::vector<data_t>> data_ptr)
-		: path_(std::move(path))
-		, data_ptr_(std::move(data_ptr))
+	// The path is expected to outlive the message, as string literals do.
+	message(const char* path)
+		: path_(path)
+		, size_(0)
 	{
-		CASPAR_ASSERT(path.empty() || path[0] == '/');
+		CASPAR_ASSERT(path_[0] == '\0' || path_[0] == '/');
 	}
 
-	const std::string& path() const
+	message(std::string path)
+		: path_(nullptr)
+		, owned_path_(std::move(path))
+		, size_(0)
 	{
-		return path_;
+		CASPAR_ASSERT(owned_path_.empty() || owned_path_[0] == '/');
 	}
 
-	const std::vector<data_t>& data() const
+	const char* path() const
 	{
-		return *data_ptr_;
+		return path_ ? path_ : owned_path_.c_str();
 	}
 
-	message propagate(const std::string& path) const
+	boost::iterator_range<const data_t*> data() const
 	{
-		return message(path + path_, data_ptr_);
+		if(!overflow_.empty())
+			return boost::make_iterator_range(overflow_.data(), overflow_.data() + overflow_.size());
+
+		return boost::make_iterator_range(data_, data_ + size_);
 	}
 
 	template<typename T>
 	message& operator%(T&& data)
 	{
-		data_ptr_->push_back(std::forward<T>(data));
+		if(size_ < max_data && overflow_.empty())
+			data_[size_++] = std::forward<T>(data);
+		else
+		{
+			if(overflow_.empty())
+				overflow_.assign(data_, data_ + size_);
+
+			overflow_.push_back(std::forward<T>(data));
+		}
+
 		return *this;
 	}
 
 private:
-	std::string						path_;
-	safe_ptr<std::vector<data_t>>	data_ptr_;
+	const char*				path_;
+	std::string				owned_path_;
+	data_t					data_[max_data];
+	int						size_;
+	std::vector<data_t>		overflow_; // All values, once there are more than max_data.
+};
+
+// The address of a message as a chain of path segments, from the subject
+// closest to the sink down to the message itself. Each subject adds its own
+// segment on the stack as the message passes, instead of concatenating.
+class address
+{
+public:
+	explicit address(const char* segment, const address* inner = nullptr)
+		: segment_(segment)
+		, inner_(inner)
+	{
+	}
+
+	// Writes the address as a null-terminated string. Returns false if it does
+	// not fit.
+	bool write(char* destination, std::size_t capacity) const
+	{
+		std::size_t size = 0;
+
+		for(auto node = this; node; node = node->inner_)
+		{
+			for(auto c = node->segment_; *c; ++c)
+			{
+				if(size + 1 >= capacity)
+					return false;
+
+				destination[size++] = *c;
+			}
+		}
+
+		if(capacity == 0)
+			return false;
+
+		destination[size] = '\0';
+		return true;
+	}
+
+	std::string str() const
+	{
+		std::string result;
+
+		for(auto node = this; node; node = node->inner_)
+			result += node->segment_;
+
+		return result;
+	}
+
+private:
+	const char*		segment_;
+	const address*	inner_;
 };
 
 struct sink
 {
 	virtual ~sink() { }
 
-	virtual void propagate(const message& msg) = 0;
+	virtual void propagate(const address& path, const message& msg) = 0;
 };
 
 class subject : public sink
@@ -102,7 +169,7 @@ public:
 	subject(std::string path = "")
 		: path_(std::move(path))
 	{
-		CASPAR_ASSERT(path.empty() || path[0] == '/');
+		CASPAR_ASSERT(path_.empty() || path_[0] == '/');
 	}
 
 	void attach_parent(const safe_ptr<sink>& parent)
@@ -117,17 +184,17 @@ public:
 
 	subject& operator<<(const message& msg)
 	{
-		propagate(msg);
+		propagate(address(msg.path()), msg);
 
 		return *this;
 	}
 
-	virtual void propagate(const message& msg) override
+	virtual void propagate(const address& inner, const message& msg) override
 	{
 		auto parent = parent_.lock();
 
 		if (parent)
-			parent->propagate(msg.propagate(path_));
+			parent->propagate(address(path_.c_str(), &inner), msg);
 	}
 };
 
@@ -131,6 +131,11 @@ public:
 		return false;
 	}
 
+	virtual consumer_send_policy::type send_policy() const override
+	{
+		return consumer_send_policy::drop;
+	}
+
 	virtual int buffer_depth() const override
 	{
 		return -1;
@@ -43,6 +43,11 @@ struct frame_factory : boost::noncopyable
 			const channel_layout& audio_channel_layout = channel_layout::stereo()) = 0;	
 
 	virtual video_format_desc get_video_format_desc() const = 0; // nothrow
+
+	// True if frames have to be in system memory to be mixed by the consumer
+	// of this factory, i.e. frames created by a gpu backed factory can not be
+	// handed to it.
+	virtual bool requires_cpu_frames() const { return false; } // nothrow
 };
 
 }}
\ No newline at end of file
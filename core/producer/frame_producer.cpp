@@ -30,11 +30,20 @@
 #include "color/color_producer.h"
 #include "separated/separated_producer.h"
 
+#include <common/env.h>
 #include <common/memory/safe_ptr.h>
 #include <common/concurrency/executor.h>
 #include <common/exception/exceptions.h>
+#include <common/filesystem/filesystem_monitor.h>
 #include <common/utility/move_on_copy.h>
 
+#include <boost/algorithm/string.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <unordered_map>
+
 namespace caspar { namespace core {
 	
 std::vector<const producer_factory_t> g_factories;
@@ -92,7 +101,7 @@ public:
 			std::shared_ptr<executor> destroyer;
 			if(!destroyers->try_pop(destroyer))
 			{
-				destroyer.reset(new executor(L"destroyer"));
+				destroyer.reset(new executor(L"destroyer", thread_backend));
 				destroyer->set_priority_class(below_normal_priority_class);
 				if(++destroyer_count > 16)
 					CASPAR_LOG(warning) << L"Potential destroyer dead-lock detected.";
@@ -276,13 +285,171 @@ void register_thumbnail_producer_factory(const producer_factory_t& factory)
 	g_thumbnail_factories.push_back(factory);
 }
 
-safe_ptr<core::frame_producer> do_create_producer(const safe_ptr<frame_factory>& my_frame_factory, const core::parameters& params, const std::vector<const producer_factory_t>& factories, bool throw_on_fail = false)
+static const int NO_FACTORY		= -1;
+static const int UNRESOLVED		= -2; // Not known, or a factory failed so that the outcome is not reliable.
+
+// Which factory handles a set of parameters depends on the parameters
+// (SPEED selects the scroll producer, [HTML] takes an url) and on the files
+// in the media and template folders, so resolutions are keyed by all
+// parameters and grouped by resource name to be forgotten when a file with
+// that name changes.
+struct resolution_cache
+{
+	boost::mutex																mutex;
+	int																			enabled;
+	std::unordered_map<std::wstring, std::map<std::wstring, int>>				factory_by_params_by_name;
+
+	resolution_cache()
+		: enabled(0)
+	{
+	}
+};
+
+resolution_cache g_resolution_cache;
+
+static const size_t MAX_RESOLVED_NAMES = 4096;
+
+std::wstring resolution_name(const std::wstring& resource)
+{
+	auto name = boost::to_upper_copy(resource);
+	boost::replace_all(name, L"\\", L"/");
+	boost::trim_left_if(name, boost::is_any_of(L"/"));
+	return name;
+}
+
+std::wstring resolution_params(const core::parameters& params)
+{
+	std::wstring result;
+
+	for(size_t n = 1; n < params.size(); ++n)
+		result += params.at_original(n) + L'\n';
+
+	return result;
+}
+
+int find_resolution(const core::parameters& params)
+{
+	boost::mutex::scoped_lock lock(g_resolution_cache.mutex);
+
+	if(g_resolution_cache.enabled == 0)
+		return UNRESOLVED;
+
+	auto by_params = g_resolution_cache.factory_by_params_by_name.find(resolution_name(params.at_original(0)));
+
+	if(by_params == g_resolution_cache.factory_by_params_by_name.end())
+		return UNRESOLVED;
+
+	auto factory = by_params->second.find(resolution_params(params));
+
+	return factory != by_params->second.end() ? factory->second : UNRESOLVED;
+}
+
+void remember_resolution(const core::parameters& params, int factory)
+{
+	boost::mutex::scoped_lock lock(g_resolution_cache.mutex);
+
+	if(g_resolution_cache.enabled == 0)
+		return;
+
+	auto& names = g_resolution_cache.factory_by_params_by_name;
+	auto name = resolution_name(params.at_original(0));
+
+	if(factory == UNRESOLVED)
+	{
+		auto by_params = names.find(name);
+
+		if(by_params != names.end())
+			by_params->second.erase(resolution_params(params));
+
+		return;
+	}
+
+	if(names.size() >= MAX_RESOLVED_NAMES && names.find(name) == names.end())
+		names.clear();
+
+	names[name][resolution_params(params)] = factory;
+}
+
+void forget_resolutions(const boost::filesystem::path& file, const std::wstring& folder)
+{
+	auto relative = resolution_name(file.wstring());
+	auto prefix = resolution_name(folder);
+
+	if(boost::starts_with(relative, prefix))
+		relative = resolution_name(relative.substr(prefix.size()));
+
+	// Resources are named both with and without extension.
+	auto without_extension = relative;
+	auto dot = without_extension.find_last_of(L'.');
+
+	if(dot != std::wstring::npos && without_extension.find(L'/', dot) == std::wstring::npos)
+		without_extension.resize(dot);
+
+	boost::mutex::scoped_lock lock(g_resolution_cache.mutex);
+
+	g_resolution_cache.factory_by_params_by_name.erase(relative);
+	g_resolution_cache.factory_by_params_by_name.erase(without_extension);
+}
+
+std::shared_ptr<void> enable_producer_resolution_cache(
+		filesystem_monitor_factory& media_monitor_factory,
+		filesystem_monitor_factory& template_monitor_factory)
+{
+	std::vector<std::pair<std::wstring, filesystem_monitor_factory*>> folders;
+	folders.push_back(std::make_pair(env::media_folder(), &media_monitor_factory));
+	folders.push_back(std::make_pair(env::template_folder(), &template_monitor_factory));
+
+	std::vector<std::shared_ptr<filesystem_monitor>> monitors;
+
+	BOOST_FOREACH(auto& folder, folders)
+	{
+		auto path = folder.first;
+
+		monitors.push_back(folder.second->create(
+				path,
+				ALL,
+				false,
+				[path](filesystem_event event, const boost::filesystem::path& file)
+				{
+					forget_resolutions(file, path);
+				}));
+	}
+
+	{
+		boost::mutex::scoped_lock lock(g_resolution_cache.mutex);
+		++g_resolution_cache.enabled;
+	}
+
+	return std::shared_ptr<void>(nullptr, [monitors](void*) mutable
+	{
+		monitors.clear();
+
+		boost::mutex::scoped_lock lock(g_resolution_cache.mutex);
+
+		if(--g_resolution_cache.enabled == 0)
+			g_resolution_cache.factory_by_params_by_name.clear();
+	});
+}
+
+bool is_producer_resolved(const core::parameters& params)
+{
+	if(params.empty())
+		return false;
+
+	// Parameters that no factory handled are only remembered when the
+	// colour producer took them.
+	auto resolution = find_resolution(params);
+	return resolution >= 0 || resolution == NO_FACTORY;
+}
+
+safe_ptr<core::frame_producer> do_create_producer(const safe_ptr<frame_factory>& my_frame_factory, const core::parameters& params, const std::vector<const producer_factory_t>& factories, bool throw_on_fail = false, int* resolution = nullptr)
 {
 	if(params.empty())
 		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("params") << arg_value_info(""));
 	
 	auto producer = frame_producer::empty();
-	std::any_of(factories.begin(), factories.end(), [&](const producer_factory_t& factory) -> bool
+	bool failed = false;
+	auto factory = std::find_if(factories.begin(), factories.end(), [&](const producer_factory_t& factory) -> bool
 		{
 			try
 			{
@@ -294,18 +461,60 @@ safe_ptr<core::frame_producer> do_create_producer(const safe_ptr<frame_factory>&
 					throw;
 				else
 					CASPAR_LOG_CURRENT_EXCEPTION();
+
+				failed = true;
 			}
 			return producer != frame_producer::empty();
 		});
 
+	if(resolution)
+	{
+		if(factory != factories.end())
+			*resolution = static_cast<int>(factory - factories.begin());
+		else
+			*resolution = failed ? UNRESOLVED : NO_FACTORY;
+	}
+
 	if(producer == frame_producer::empty())
 		producer = create_color_producer(my_frame_factory, params);
 	return producer;
 }
 
+safe_ptr<core::frame_producer> resolve_and_create_producer(const safe_ptr<frame_factory>& my_frame_factory, const core::parameters& params)
+{
+	if(params.empty())
+		BOOST_THROW_EXCEPTION(invalid_argument() << arg_name_info("params") << arg_value_info(""));
+
+	auto resolution = find_resolution(params);
+
+	if(resolution == NO_FACTORY)
+		return create_color_producer(my_frame_factory, params);
+
+	if(resolution >= 0 && resolution < static_cast<int>(g_factories.size()))
+	{
+		auto producer = frame_producer::empty();
+
+		try
+		{
+			producer = g_factories[resolution](my_frame_factory, params);
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+
+		if(producer != frame_producer::empty())
+			return producer;
+	}
+
+	auto producer = do_create_producer(my_frame_factory, params, g_factories, false, &resolution);
+	remember_resolution(params, resolution);
+	return producer;
+}
+
 safe_ptr<core::frame_producer> create_producer(const safe_ptr<frame_factory>& my_frame_factory, const core::parameters& params)
 {	
-	auto producer = do_create_producer(my_frame_factory, params, g_factories);
+	auto producer = resolve_and_create_producer(my_frame_factory, params);
 	auto key_producer = frame_producer::empty();
 	
 	std::wstring resource_name = L"";
@@ -323,11 +532,11 @@ safe_ptr<core::frame_producer> create_producer(const safe_ptr<frame_factory>& my
 		{
 			auto resource_name = params_copy.at_original(0);
 			params_copy.set(0, resource_name + L"_A");
-			key_producer = do_create_producer(my_frame_factory, params_copy, g_factories);			
+			key_producer = resolve_and_create_producer(my_frame_factory, params_copy);			
 			if(key_producer == frame_producer::empty())
 			{
 				params_copy.set(0, resource_name + L"_ALPHA");
-				key_producer = do_create_producer(my_frame_factory, params_copy, g_factories);	
+				key_producer = resolve_and_create_producer(my_frame_factory, params_copy);	
 			}
 		}
 	}
@@ -339,6 +548,9 @@ safe_ptr<core::frame_producer> create_producer(const safe_ptr<frame_factory>& my
 	
 	if(producer == frame_producer::empty())
 	{
+		// Not remembered, the file may be about to be copied in.
+		remember_resolution(params, UNRESOLVED);
+
 		std::wstring str = params.get_original_string();
 		BOOST_THROW_EXCEPTION(file_not_found() << msg_info("No match found for supplied commands. Check syntax.") << arg_value_info(narrow(str)));
 	}
@@ -41,6 +41,7 @@
 namespace caspar { 
 	
 class executor;
+class filesystem_monitor_factory;
 	
 namespace core {
 
@@ -89,6 +90,24 @@ void register_producer_factory(const producer_factory_t& factory); // Not thread
 void register_thumbnail_producer_factory(const producer_factory_t& factory); // Not thread-safe.
 safe_ptr<core::frame_producer> create_producer(const safe_ptr<frame_factory>&, const core::parameters& params);
 safe_ptr<core::frame_producer> create_producer(const safe_ptr<frame_factory>&, const std::wstring& params);
+
+/**
+ * Makes create_producer() remember which factory handled which parameters,
+ * including the parameters no factory handled, for as long as the returned
+ * handle is alive. Everything known about a resource is forgotten when a
+ * file with its name changes in the media or template folder, as reported
+ * by monitors from media_monitor_factory and template_monitor_factory.
+ */
+std::shared_ptr<void> enable_producer_resolution_cache(
+		filesystem_monitor_factory& media_monitor_factory,
+		filesystem_monitor_factory& template_monitor_factory);
+
+/**
+ * Whether create_producer() is known, from the resolution cache, to have
+ * created a producer for params the last time. Never touches the
+ * filesystem.
+ */
+bool is_producer_resolved(const core::parameters& params);
 safe_ptr<core::frame_producer> create_producer_destroy_proxy(safe_ptr<core::frame_producer> producer);
 safe_ptr<core::frame_producer> create_producer_print_proxy(safe_ptr<core::frame_producer> producer);
 safe_ptr<core::frame_producer> create_thumbnail_producer(const safe_ptr<frame_factory>& factory, const std::wstring& media_file);
@@ -37,6 +37,7 @@ struct layer::implementation
 	int64_t						frame_number_;
 	int32_t						auto_play_delta_;
 	bool						is_paused_;
+	bool						is_loading_;
 	int64_t						current_frame_age_;
 	safe_ptr<monitor::subject>	monitor_subject_;
 
@@ -47,6 +48,7 @@ public:
 		, frame_number_(0)
 		, auto_play_delta_(-1)
 		, is_paused_(false)
+		, is_loading_(false)
 		, monitor_subject_(make_safe<monitor::subject>("/layer/" + boost::lexical_cast<std::string>(index)))
 	{
 	}
@@ -65,6 +67,7 @@ public:
 	{		
 		background_		 = producer;
 		auto_play_delta_ = auto_play_delta;
+		is_loading_		 = false;
 
 		if(auto_play_delta_ > -1 && foreground_ == frame_producer::empty())
 			play();
@@ -109,6 +112,8 @@ public:
 		try
 		{
 			*monitor_subject_ << monitor::message("/paused") % is_paused_;
+			*monitor_subject_ << monitor::message("/background/loading") % is_loading_;
+			*monitor_subject_ << monitor::message("/background/ready") % (background_ != frame_producer::empty());
 
 			if(is_paused_)
 			{
@@ -175,6 +180,7 @@ public:
 		info.add(L"frames-left", nb_frames == std::numeric_limits<int64_t>::max() ? -1 : (foreground_->nb_frames() - frame_number_ - auto_play_delta_));
 		info.add(L"frame-age", current_frame_age_);
 		info.add_child(L"foreground.producer", foreground_->info());
+		info.add(L"background.status", is_loading_ ? L"loading" : (background_ == frame_producer::empty() ? L"empty" : L"ready"));
 		info.add_child(L"background.producer", background_->info());
 		return info;
 	}
@@ -211,6 +217,7 @@ void layer::play(){impl_->play();}
 void layer::pause(){impl_->pause();}
 void layer::resume(){impl_->resume();}
 void layer::stop(){impl_->stop();}
+void layer::set_loading(bool loading){impl_->is_loading_ = loading;}
 bool layer::is_paused() const{return impl_->is_paused_;}
 int64_t layer::frame_number() const{return impl_->frame_number_;}
 safe_ptr<basic_frame> layer::receive(int hints) {return impl_->receive(hints);}
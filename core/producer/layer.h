@@ -54,6 +54,10 @@ public:
 	void stop(); // nothrow
 	boost::unique_future<std::wstring> call(bool foreground, const std::wstring& param);
 
+	// Set while a background producer is being created for the layer, until
+	// the next load.
+	void set_loading(bool loading); // nothrow
+
 	bool is_paused() const;
 	int64_t frame_number() const;
 	
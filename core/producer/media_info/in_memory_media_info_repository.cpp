@@ -26,58 +26,318 @@
 #include <map>
 #include <vector>
 
-#include <boost/thread/mutex.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread/future.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/timer.hpp>
+
+#include <tbb/atomic.h>
+
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+#include <common/utility/binary_io.h>
+#include <common/utility/string.h>
 
 #include "media_info.h"
 #include "media_info_repository.h"
 
 namespace caspar { namespace core {
 
+namespace {
+
+const uint32_t INDEX_MAGIC			= 0x58494d4d; // "MMIX"
+const uint32_t INDEX_VERSION		= 1;
+const double SAVE_INTERVAL_SECS		= 10.0;
+
+}
+
 class in_memory_media_info_repository : public media_info_repository
 {
-	boost::mutex mutex_;
-	std::map<std::wstring, media_info> info_by_file_;
-	std::vector<media_info_extractor> extractors_;
+	struct entry
+	{
+		media_info	info;
+		file_stamp	stamp;
+		bool		verified; // Loaded entries are checked against the file once before use.
+	};
+
+	typedef boost::shared_future<media_info> extraction;
+
+	// Lookups only contend with lookups of files hashing to the same shard,
+	// and extraction runs without any lock held.
+	struct shard
+	{
+		boost::mutex								mutex;
+		std::map<std::wstring, entry>				entries;
+		std::map<std::wstring, extraction>			in_flight;
+	};
+
+	enum { SHARD_COUNT = 16 };
+
+	boost::mutex						extractors_mutex_;
+	std::vector<media_info_extractor>	extractors_;
+	shard								shards_[SHARD_COUNT];
+
+	const boost::filesystem::path		index_file_;
+	boost::mutex						save_mutex_;
+	boost::timer						since_saved_;
+	tbb::atomic<bool>					dirty_;
 public:
+	in_memory_media_info_repository(const boost::filesystem::path& index_file = boost::filesystem::path())
+		: index_file_(index_file)
+	{
+		dirty_ = false;
+
+		if(index_file_.empty())
+			return;
+
+		try
+		{
+			auto count = load();
+			CASPAR_LOG(info) << L"Loaded media information about " << count << L" files from " << index_file_.wstring();
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+	}
+
+	~in_memory_media_info_repository()
+	{
+		save_if_dirty(true);
+	}
+
 	virtual void register_extractor(media_info_extractor extractor) override
 	{
-		boost::mutex::scoped_lock lock(mutex_);
+		boost::mutex::scoped_lock lock(extractors_mutex_);
 
 		extractors_.push_back(extractor);
 	}
 
 	virtual media_info get(const std::wstring& file) override
 	{
-		boost::mutex::scoped_lock lock(mutex_);
+		auto& shard = shard_of(file);
 
-		auto iter = info_by_file_.find(file);
+		std::shared_ptr<boost::promise<media_info>> promise;
 
-		if (iter == info_by_file_.end())
 		{
-			media_info info;
+			boost::mutex::scoped_lock lock(shard.mutex);
+
+			auto it = shard.entries.find(file);
 
-			BOOST_FOREACH(auto& extractor, extractors_)
+			if(it != shard.entries.end())
 			{
-				if (extractor(file, info))
+				if(it->second.verified)
+					return it->second.info;
+
+				auto loaded = it->second;
+
+				lock.unlock();
+				file_stamp stamp;
+				bool unchanged = try_get_file_stamp(file, stamp) && stamp == loaded.stamp;
+				lock.lock();
+
+				it = shard.entries.find(file);
+
+				if(it != shard.entries.end() && !it->second.verified)
 				{
-					break;
+					if(unchanged)
+					{
+						it->second.verified = true;
+						return it->second.info;
+					}
+
+					shard.entries.erase(it);
+					dirty_ = true;
 				}
+				else if(it != shard.entries.end())
+					return it->second.info;
+			}
+
+			auto pending = shard.in_flight.find(file);
+
+			if(pending != shard.in_flight.end())
+			{
+				auto result = pending->second;
+				lock.unlock();
+
+				return result.get();
+			}
+
+			promise = std::make_shared<boost::promise<media_info>>();
+			shard.in_flight.insert(std::make_pair(file, extraction(promise->get_future())));
+		}
+
+		// Stamped before extraction, so that a file modified while being
+		// probed is probed again after a restart.
+		entry result;
+		result.verified = true;
+		bool stamped = try_get_file_stamp(file, result.stamp);
+
+		try
+		{
+			result.info = extract(file);
+		}
+		catch(...)
+		{
+			{
+				boost::mutex::scoped_lock lock(shard.mutex);
+				shard.in_flight.erase(file);
 			}
 
-			info_by_file_.insert(std::make_pair(file, info));
+			promise->set_exception(boost::current_exception());
+			throw;
+		}
+
+		{
+			boost::mutex::scoped_lock lock(shard.mutex);
+
+			// Only keep the result if the file was not removed in the meantime.
+			auto pending = shard.in_flight.find(file);
+
+			if(pending != shard.in_flight.end())
+			{
+				shard.in_flight.erase(pending);
 
-			return info;
+				if(stamped)
+				{
+					shard.entries[file] = result;
+					dirty_ = true;
+				}
+			}
 		}
 
-		return iter->second;
+		promise->set_value(result.info);
+
+		save_if_dirty(false);
+
+		return result.info;
 	}
 
 	virtual void remove(const std::wstring& file) override
 	{
-		boost::mutex::scoped_lock lock(mutex_);
+		auto& shard = shard_of(file);
+
+		boost::mutex::scoped_lock lock(shard.mutex);
 
-		info_by_file_.erase(file);
+		if(shard.entries.erase(file) > 0)
+			dirty_ = true;
+
+		shard.in_flight.erase(file);
+	}
+private:
+	shard& shard_of(const std::wstring& file)
+	{
+		return shards_[boost::hash<std::wstring>()(file) % SHARD_COUNT];
+	}
+
+	media_info extract(const std::wstring& file)
+	{
+		std::vector<media_info_extractor> extractors;
+
+		{
+			boost::mutex::scoped_lock lock(extractors_mutex_);
+			extractors = extractors_;
+		}
+
+		media_info info;
+
+		BOOST_FOREACH(auto& extractor, extractors)
+		{
+			if (extractor(file, info))
+			{
+				break;
+			}
+		}
+
+		return info;
+	}
+
+	void save_if_dirty(bool force)
+	{
+		if(index_file_.empty() || !dirty_)
+			return;
+
+		boost::mutex::scoped_lock save_lock(save_mutex_, boost::defer_lock);
+
+		if(force)
+			save_lock.lock();
+		else if(!save_lock.try_lock() || since_saved_.elapsed() < SAVE_INTERVAL_SECS)
+			return;
+
+		if(!dirty_.fetch_and_store(false))
+			return;
+
+		since_saved_.restart();
+
+		std::vector<std::pair<std::wstring, entry>> entries;
+
+		BOOST_FOREACH(auto& shard, shards_)
+		{
+			boost::mutex::scoped_lock lock(shard.mutex);
+			entries.insert(entries.end(), shard.entries.begin(), shard.entries.end());
+		}
+
+		try
+		{
+			save(entries);
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+	}
+
+	void save(const std::vector<std::pair<std::wstring, entry>>& entries) const
+	{
+		save_index_file(index_file_, INDEX_MAGIC, INDEX_VERSION, [&](std::ostream& stream)
+		{
+			write_value(stream, static_cast<uint32_t>(entries.size()));
+
+			BOOST_FOREACH(auto& entry, entries)
+			{
+				write_string(stream, entry.first);
+				write_file_stamp(stream, entry.second.stamp);
+				write_value(stream, entry.second.info.duration);
+				write_value(stream, entry.second.info.time_base.numerator());
+				write_value(stream, entry.second.info.time_base.denominator());
+			}
+		});
+	}
+
+	uint32_t load()
+	{
+		boost::filesystem::ifstream stream;
+		if(!open_index_file(stream, index_file_, INDEX_MAGIC, INDEX_VERSION))
+			return 0;
+
+		auto count = read_value<uint32_t>(stream);
+		uint32_t loaded = 0;
+
+		for(; loaded < count && stream; ++loaded)
+		{
+			auto file = read_string(stream);
+
+			entry loaded_entry;
+			loaded_entry.verified			= false;
+			loaded_entry.stamp				= read_file_stamp(stream);
+			loaded_entry.info.duration		= read_value<int64_t>(stream);
+
+			auto numerator					= read_value<int64_t>(stream);
+			auto denominator				= read_value<int64_t>(stream);
+
+			if(!stream || denominator == 0)
+				break;
+
+			loaded_entry.info.time_base.assign(numerator, denominator);
+
+			shard_of(file).entries[file] = loaded_entry;
+		}
+
+		return loaded;
 	}
 };
 
@@ -86,4 +346,10 @@ safe_ptr<struct media_info_repository> create_in_memory_media_info_repository()
 	return make_safe<in_memory_media_info_repository>();
 }
 
+safe_ptr<struct media_info_repository> create_persistent_media_info_repository(
+		const boost::filesystem::path& index_file)
+{
+	return make_safe<in_memory_media_info_repository>(index_file);
+}
+
 }}
@@ -25,8 +25,18 @@
 
 #include <common/memory/safe_ptr.h>
 
+#include <boost/filesystem/path.hpp>
+
 namespace caspar { namespace core {
 
 safe_ptr<struct media_info_repository> create_in_memory_media_info_repository();
 
+/**
+ * Like the in memory repository, but the information is also saved to
+ * index_file and reused after a restart as long as the size and the last
+ * write time of the file are unchanged.
+ */
+safe_ptr<struct media_info_repository> create_persistent_media_info_repository(
+		const boost::filesystem::path& index_file);
+
 }}
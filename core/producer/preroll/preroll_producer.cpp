@@ -0,0 +1,157 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../../stdafx.h"
+
+#include "preroll_producer.h"
+
+#include <core/producer/frame/basic_frame.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/thread.hpp>
+#include <boost/timer.hpp>
+
+#include <deque>
+
+namespace caspar { namespace core {
+
+struct preroll_producer : public frame_producer
+{
+	const safe_ptr<frame_producer>		producer_;
+	const int							hints_;
+	std::deque<safe_ptr<basic_frame>>	frames_;
+	safe_ptr<basic_frame>				last_frame_;
+
+	preroll_producer(const safe_ptr<frame_producer>& producer, int frames, int hints, int timeout_millis)
+		: producer_(producer)
+		, hints_(hints)
+		, last_frame_(basic_frame::empty())
+	{
+		boost::timer timer;
+
+		while(static_cast<int>(frames_.size()) < frames && timer.elapsed()*1000.0 < timeout_millis)
+		{
+			auto frame = producer_->receive(hints_);
+
+			if(frame == basic_frame::late())
+			{
+				boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+				continue;
+			}
+
+			frames_.push_back(frame);
+
+			if(frame == basic_frame::eof() || frame == basic_frame::empty() || frame == basic_frame::pause())
+				break;
+		}
+
+		CASPAR_LOG(debug) << print() << L" Prerolled " << frames_.size() << L" frames in " << static_cast<int>(timer.elapsed()*1000.0) << L" ms.";
+	}
+
+	// frame_producer
+
+	virtual safe_ptr<basic_frame> receive(int hints) override
+	{
+		// The layer changed, e.g. it was keyed, after the frames were
+		// received. They would show the wrong image.
+		if(!frames_.empty() && hints != hints_)
+		{
+			CASPAR_LOG(debug) << print() << L" Dropping " << frames_.size() << L" prerolled frames received with other hints.";
+			frames_.clear();
+		}
+
+		if(frames_.empty())
+			return producer_->receive(hints);
+
+		auto frame = frames_.front();
+		frames_.pop_front();
+
+		if(frame != basic_frame::eof() && frame != basic_frame::empty() && frame != basic_frame::pause())
+			last_frame_ = frame;
+
+		return frame;
+	}
+
+	virtual safe_ptr<basic_frame> last_frame() const override
+	{
+		// The producer is ahead of what has been handed out.
+		if(!frames_.empty())
+			return disable_audio(last_frame_);
+
+		return producer_->last_frame();
+	}
+
+	virtual boost::unique_future<std::wstring> call(const std::wstring& param) override
+	{
+		// The prerolled frames are from before the seek.
+		if(boost::istarts_with(param, L"SEEK"))
+			frames_.clear();
+
+		return producer_->call(param);
+	}
+
+	virtual safe_ptr<frame_producer> get_following_producer() const override
+	{
+		return producer_->get_following_producer();
+	}
+
+	virtual void set_leading_producer(const safe_ptr<frame_producer>& producer) override
+	{
+		producer_->set_leading_producer(producer);
+	}
+
+	virtual uint32_t nb_frames() const override
+	{
+		return producer_->nb_frames();
+	}
+
+	virtual safe_ptr<basic_frame> create_thumbnail_frame() override
+	{
+		return producer_->create_thumbnail_frame();
+	}
+
+	virtual std::wstring print() const override
+	{
+		return producer_->print();
+	}
+
+	virtual boost::property_tree::wptree info() const override
+	{
+		auto info = producer_->info();
+		info.add(L"prerolled-frames", frames_.size());
+		return info;
+	}
+
+	virtual monitor::subject& monitor_output() override
+	{
+		return producer_->monitor_output();
+	}
+};
+
+safe_ptr<frame_producer> create_preroll_producer(const safe_ptr<frame_producer>& producer, int frames, int hints, int timeout_millis)
+{
+	if(frames < 1 || producer == frame_producer::empty())
+		return producer;
+
+	return make_safe<preroll_producer>(producer, frames, hints, timeout_millis);
+}
+
+}}
@@ -0,0 +1,38 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include "../frame_producer.h"
+
+namespace caspar { namespace core {
+
+/**
+ * Receives up to frames frames from producer right away and hands them out
+ * before receiving any more, so that the first frames are ready when the
+ * producer starts playing. Gives up on frames that are not ready within
+ * timeout_millis.
+ *
+ * The frames are received with hints, the hints of the layer the producer
+ * is loaded into. They are dropped if the layer receives with other hints.
+ */
+safe_ptr<frame_producer> create_preroll_producer(const safe_ptr<frame_producer>& producer, int frames, int hints, int timeout_millis = 1000);
+
+}}
@@ -29,6 +29,7 @@
 #include "frame/frame_factory.h"
 
 #include <common/concurrency/executor.h>
+#include <common/env.h>
 
 #include <core/producer/frame/frame_transform.h>
 #include <core/consumer/frame_consumer.h>
@@ -36,6 +37,7 @@
 
 #include <boost/foreach.hpp>
 #include <boost/timer.hpp>
+#include <boost/thread.hpp>
 
 #include <tbb/parallel_for_each.h>
 #include <tbb/concurrent_unordered_map.h>
@@ -105,8 +107,20 @@ struct stage::implementation : public std::enable_shared_from_this<implementatio
 	
 	safe_ptr<monitor::subject>													 monitor_subject_;
 
+	typedef std::shared_ptr<boost::promise<std::shared_ptr<void>>>				 hold_promise;
+
+	int64_t																		 frame_number_;
+	std::multimap<int64_t, hold_promise>										 pending_holds_;
+	int																			 holds_;
+	std::vector<std::weak_ptr<implementation>>									 held_ticks_;
+
 	executor																	 executor_;
 
+	boost::mutex																 loads_mutex_;
+	typedef std::pair<std::shared_ptr<boost::promise<void>>, boost::shared_future<void>> pending_load;
+	std::map<int, pending_load>													 pending_loads_;
+	std::vector<std::unique_ptr<executor>>										 loaders_;
+
 public:
 	implementation(
 			const safe_ptr<diagnostics::graph>& graph,
@@ -117,10 +131,16 @@ public:
 		, format_desc_(format_desc)
 		, target_(target)
 		, monitor_subject_(make_safe<monitor::subject>("/stage"))
+		, frame_number_(0)
+		, holds_(0)
 		, executor_(L"stage " + boost::lexical_cast<std::wstring>(channel_index))
 	{
 		graph_->set_color("tick-time", diagnostics::color(0.0f, 0.6f, 0.9f, 0.8));	
 		graph_->set_color("produce-time", diagnostics::color(0.0f, 1.0f, 0.0f));
+
+		const int loader_threads = std::max(1, env::properties().get(L"configuration.loadbg.loader-threads", 2));
+		for(int n = 0; n < loader_threads; ++n)
+			loaders_.push_back(std::unique_ptr<executor>(new executor(L"stage " + boost::lexical_cast<std::wstring>(channel_index) + L" loader " + boost::lexical_cast<std::wstring>(n))));
 	}
 
 	void spawn_token()
@@ -150,8 +170,55 @@ public:
 		}, high_priority);
 	}
 
+	boost::unique_future<std::shared_ptr<void>> hold(int delay)
+	{
+		auto promise = std::make_shared<boost::promise<std::shared_ptr<void>>>();
+		auto future = promise->get_future();
+
+		executor_.begin_invoke([=]
+		{
+			if(delay > 0)
+				pending_holds_.insert(std::make_pair(frame_number_ + delay, promise));
+			else
+				engage_hold(promise);
+		});
+
+		return std::move(future);
+	}
+
+	void engage_hold(const hold_promise& promise)
+	{
+		++holds_;
+
+		std::weak_ptr<implementation> self = shared_from_this();
+		promise->set_value(std::shared_ptr<void>(nullptr, [self](void*)
+		{
+			auto self2 = self.lock();
+			if(self2)
+				self2->executor_.begin_invoke([=]{self2->release_hold();});
+		}));
+	}
+
+	void release_hold()
+	{
+		if(--holds_ > 0)
+			return;
+
+		std::vector<std::weak_ptr<implementation>> ticks;
+		ticks.swap(held_ticks_);
+
+		BOOST_FOREACH(auto& self, ticks)
+			tick(self);
+	}
+
 	void tick(const std::weak_ptr<implementation>& self)
 	{		
+		if(holds_ > 0)
+		{
+			held_ticks_.push_back(self);
+			return;
+		}
+
 		try
 		{
 			produce_timer_.restart();
@@ -165,17 +232,7 @@ public:
 			{
 				auto transform = transforms_[layer.first].fetch_and_tick(1);
 
-				int hints = frame_producer::NO_HINT;
-				if(format_desc_.field_mode != field_mode::progressive)
-				{
-					hints |= std::abs(transform.fill_scale[1]  - 1.0) > 0.0001 ? frame_producer::DEINTERLACE_HINT : frame_producer::NO_HINT;
-					hints |= std::abs(transform.fill_translation[1]) > 0.0001 ? frame_producer::DEINTERLACE_HINT : frame_producer::NO_HINT;
-				}
-
-				if(transform.is_key)
-					hints |= frame_producer::ALPHA_HINT;
-
-				auto frame = layer.second->receive(hints);	
+				auto frame = layer.second->receive(hints_of(transform));	
 				auto layer_consumers_it = layer_consumers_.find(layer.first);
 				if (layer_consumers_it != layer_consumers_.end())
 				{
@@ -217,6 +274,14 @@ public:
 
 			graph_->set_value("tick-time", tick_timer_.elapsed()*format_desc_.fps*0.5);
 			tick_timer_.restart();
+
+			++frame_number_;
+
+			while(!pending_holds_.empty() && pending_holds_.begin()->first <= frame_number_)
+			{
+				engage_hold(pending_holds_.begin()->second);
+				pending_holds_.erase(pending_holds_.begin());
+			}
 		}
 		catch(...)
 		{
@@ -225,6 +290,21 @@ public:
 		}		
 	}
 		
+	int hints_of(const frame_transform& transform) const
+	{
+		int hints = frame_producer::NO_HINT;
+		if(format_desc_.field_mode != field_mode::progressive)
+		{
+			hints |= std::abs(transform.fill_scale[1]  - 1.0) > 0.0001 ? frame_producer::DEINTERLACE_HINT : frame_producer::NO_HINT;
+			hints |= std::abs(transform.fill_translation[1]) > 0.0001 ? frame_producer::DEINTERLACE_HINT : frame_producer::NO_HINT;
+		}
+
+		if(transform.is_key)
+			hints |= frame_producer::ALPHA_HINT;
+
+		return hints;
+	}
+		
 	void set_transform(int index, const frame_transform& transform, unsigned int mix_duration, const std::wstring& tween)
 	{
 		executor_.begin_invoke([=]
@@ -294,16 +374,102 @@ public:
 		return *it->second;
 	}
 
+	// Commands on a layer apply after any load that is still being created
+	// for it.
+	void wait_for_load(int index)
+	{
+		boost::shared_future<void> pending;
+		{
+			boost::lock_guard<boost::mutex> lock(loads_mutex_);
+			auto it = pending_loads_.find(index);
+			if(it == pending_loads_.end())
+				return;
+			pending = it->second.second;
+		}
+		pending.wait();
+	}
+
+	void wait_for_loads()
+	{
+		std::vector<boost::shared_future<void>> pending;
+		{
+			boost::lock_guard<boost::mutex> lock(loads_mutex_);
+			BOOST_FOREACH(auto& load, pending_loads_)
+				pending.push_back(load.second.second);
+		}
+		BOOST_FOREACH(auto& load, pending)
+			load.wait();
+	}
+
 	void load(int index, const safe_ptr<frame_producer>& producer, bool preview, int auto_play_delta)
 	{
+		wait_for_load(index);
+
 		executor_.begin_invoke([=]
 		{
 			get_layer(index).load(producer, preview, auto_play_delta);
 		}, high_priority);
 	}
 
+	// Loads of the same layer run in order on the same loader.
+	void load_async(int index, const std::function<safe_ptr<frame_producer>(int hints)>& factory, bool preview, int auto_play_delta)
+	{
+		wait_for_load(index);
+
+		auto promise = std::make_shared<boost::promise<void>>();
+		{
+			boost::lock_guard<boost::mutex> lock(loads_mutex_);
+			pending_loads_[index] = pending_load(promise, boost::shared_future<void>(promise->get_future()));
+		}
+
+		executor_.begin_invoke([=]
+		{
+			get_layer(index).set_loading(true);
+		}, high_priority);
+
+		loaders_[index % loaders_.size()]->begin_invoke([=]
+		{
+			try
+			{
+				// The hints the layer would receive the producer with now.
+				auto hints = executor_.invoke([=]
+				{
+					return hints_of(transforms_[index].fetch());
+				}, high_priority);
+
+				auto producer = factory(hints);
+
+				executor_.invoke([=]
+				{
+					get_layer(index).load(producer, preview, auto_play_delta);
+				}, high_priority);
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+				CASPAR_LOG(error) << L"[stage] Failed to load layer " << index << L".";
+
+				executor_.begin_invoke([=]
+				{
+					get_layer(index).set_loading(false);
+				}, high_priority);
+			}
+
+			{
+				// A later load of the layer may have taken its place.
+				boost::lock_guard<boost::mutex> lock(loads_mutex_);
+				auto it = pending_loads_.find(index);
+				if(it != pending_loads_.end() && it->second.first == promise)
+					pending_loads_.erase(it);
+			}
+			promise->set_value();
+		});
+	}
+
 	void pause(int index)
 	{		
+		wait_for_load(index);
+
 		executor_.begin_invoke([=]
 		{
 			get_layer(index).pause();
@@ -312,6 +478,8 @@ public:
 
 	void resume(int index)
 	{		
+		wait_for_load(index);
+
 		executor_.begin_invoke([=]
 		{
 			get_layer(index).resume();
@@ -320,6 +488,8 @@ public:
 
 	void play(int index)
 	{		
+		wait_for_load(index);
+
 		executor_.begin_invoke([=]
 		{
 			get_layer(index).play();
@@ -328,6 +498,8 @@ public:
 
 	void stop(int index)
 	{		
+		wait_for_load(index);
+
 		executor_.begin_invoke([=]
 		{
 			get_layer(index).stop();
@@ -336,6 +508,8 @@ public:
 
 	void clear(int index)
 	{
+		wait_for_load(index);
+
 		executor_.begin_invoke([=]
 		{
 			layers_.erase(index);
@@ -344,6 +518,8 @@ public:
 		
 	void clear()
 	{
+		wait_for_loads();
+
 		executor_.begin_invoke([=]
 		{
 			layers_.clear();
@@ -352,6 +528,8 @@ public:
 	
 	boost::unique_future<std::wstring> call(int index, bool foreground, const std::wstring& param)
 	{
+		wait_for_load(index);
+
 		return std::move(*executor_.invoke([=]
 		{
 			return std::make_shared<boost::unique_future<std::wstring>>(std::move(get_layer(index).call(foreground, param)));
@@ -364,6 +542,9 @@ public:
 
 		if(other_impl.get() == this)
 			return;
+
+		wait_for_loads();
+		other_impl->wait_for_loads();
 		
 		auto func = [=]
 		{
@@ -393,6 +574,9 @@ public:
 
 	void swap_layer(int index, int other_index)
 	{
+		wait_for_load(index);
+		wait_for_load(other_index);
+
 		executor_.begin_invoke([=]
 		{
 			std::swap(get_layer(index), get_layer(other_index));
@@ -407,6 +591,9 @@ public:
 			swap_layer(index, other_index);
 		else
 		{
+			wait_for_load(index);
+			other_impl->wait_for_load(other_index);
+
 			auto func = [=]
 			{
 				auto& my_layer		= get_layer(index);
@@ -430,6 +617,8 @@ public:
 		
 	boost::unique_future<safe_ptr<frame_producer>> foreground(int index)
 	{
+		wait_for_load(index);
+
 		return executor_.begin_invoke([=]
 		{
 			return get_layer(index).foreground();
@@ -438,6 +627,8 @@ public:
 	
 	boost::unique_future<safe_ptr<frame_producer>> background(int index)
 	{
+		wait_for_load(index);
+
 		return executor_.begin_invoke([=]
 		{
 			return get_layer(index).background();
@@ -505,7 +696,10 @@ void stage::clear_transforms(int index){impl_->clear_transforms(index);}
 void stage::clear_transforms(){impl_->clear_transforms();}
 frame_transform stage::get_current_transform(int index) { return impl_->get_current_transform(index); }
 void stage::spawn_token(){impl_->spawn_token();}
+boost::unique_future<std::shared_ptr<void>> stage::hold(int delay){return impl_->hold(delay);}
 void stage::load(int index, const safe_ptr<frame_producer>& producer, bool preview, int auto_play_delta){impl_->load(index, producer, preview, auto_play_delta);}
+void stage::load_async(int index, const std::function<safe_ptr<frame_producer>(int hints)>& factory, bool preview, int auto_play_delta){impl_->load_async(index, factory, preview, auto_play_delta);}
+void stage::wait_for_loads(){impl_->wait_for_loads();}
 void stage::pause(int index){impl_->pause(index);}
 void stage::resume(int index){impl_->resume(index);}
 void stage::play(int index){impl_->play(index);}
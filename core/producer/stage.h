@@ -68,8 +68,21 @@ public:
 	frame_transform get_current_transform(int index);
 
 	void spawn_token();
+
+	// Holds back the frames of the stage, starting delay frames from now,
+	// until the returned token is released. Changes made while the hold is
+	// in effect show up on the same frame. The future is ready once it is.
+	boost::unique_future<std::shared_ptr<void>> hold(int delay = 0);
 			
 	void load(int index, const safe_ptr<frame_producer>& producer, bool preview = false, int auto_play_delta = -1);
+
+	// Creates the producer on a loader thread and then loads it. Later
+	// commands on the layer wait for the load to finish. factory is given
+	// the hints the layer currently receives frames with.
+	void load_async(int index, const std::function<safe_ptr<frame_producer>(int hints)>& factory, bool preview = false, int auto_play_delta = -1);
+
+	// Waits for the loads started with load_async to finish.
+	void wait_for_loads();
 	void pause(int index);
 	void resume(int index);
 	void play(int index);
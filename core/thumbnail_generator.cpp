@@ -23,15 +23,18 @@
 
 #include "thumbnail_generator.h"
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <set>
 
 #include <boost/thread.hpp>
 #include <boost/range/algorithm/transform.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 
-#include <tbb/atomic.h>
+#include <common/exception/win32_exception.h>
 
 #include "producer/frame_producer.h"
 #include "consumer/frame_consumer.h"
@@ -71,26 +74,50 @@ std::wstring get_relative_without_extension(
 
 struct thumbnail_output : public mixer::target_t
 {
-	tbb::atomic<int> sleep_millis;
 	std::function<void (const safe_ptr<read_frame>& frame)> on_send;
 
-	thumbnail_output(int sleep_millis)
-	{
-		this->sleep_millis = sleep_millis;
-	}
-
 	void send(const std::pair<safe_ptr<read_frame>, std::shared_ptr<void>>& frame_and_ticket)
 	{
-		int current_sleep = sleep_millis;
-
-		if (current_sleep > 0)
-			boost::this_thread::sleep(boost::posix_time::milliseconds(current_sleep));
-
 		on_send(frame_and_ticket.first);
 		on_send = nullptr;
 	}
 };
 
+// Renders one thumbnail at a time through a mixer of its own.
+struct thumbnail_worker : boost::noncopyable
+{
+	safe_ptr<thumbnail_output>	output;
+	safe_ptr<mixer>				mixer;
+
+	thumbnail_worker(
+			const safe_ptr<diagnostics::graph>& graph,
+			const video_format_desc& format_desc,
+			const safe_ptr<ogl_device>& ogl,
+			image_mixer_backend::type image_mixer_backend,
+			bool mipmap)
+		: output(new thumbnail_output())
+		, mixer(new core::mixer(
+				graph,
+				output,
+				format_desc,
+				ogl,
+				channel_layout::stereo(),
+				0,
+				image_mixer_backend))
+	{
+		mixer->set_mipmap(0, mipmap);
+	}
+};
+
+// Lower values are generated first.
+enum thumbnail_priority
+{
+	explicit_request = 0,
+	changed_file,
+	rebuild,
+	priority_count
+};
+
 struct thumbnail_generator::implementation
 {
 private:
@@ -98,13 +125,24 @@ private:
 	boost::filesystem::path thumbnails_path_;
 	int width_;
 	int height_;
-	safe_ptr<ogl_device> ogl_;
 	safe_ptr<diagnostics::graph> graph_;
 	video_format_desc format_desc_;
-	safe_ptr<thumbnail_output> output_;
-	safe_ptr<mixer> mixer_;
+	const int generate_delay_millis_;
 	thumbnail_creator thumbnail_creator_;
 	safe_ptr<media_info_repository> media_info_repo_;
+
+	boost::mutex queue_mutex_;
+	boost::condition_variable queue_cond_;
+	std::deque<boost::filesystem::path> queues_[priority_count];
+	std::map<boost::filesystem::path, thumbnail_priority> queued_;
+	std::set<boost::filesystem::path> in_progress_;
+	std::map<boost::filesystem::path, thumbnail_priority> deferred_; // Events for files in progress.
+	boost::condition_variable in_progress_cond_;
+	bool running_;
+
+	std::vector<std::shared_ptr<thumbnail_worker>> workers_;
+	boost::thread_group threads_;
+
 	filesystem_monitor::ptr monitor_;
 public:
 	implementation(
@@ -118,23 +156,18 @@ public:
 			int generate_delay_millis,
 			const thumbnail_creator& thumbnail_creator,
 			safe_ptr<media_info_repository> media_info_repo,
-			bool mipmap)
+			bool mipmap,
+			int workers,
+			image_mixer_backend::type image_mixer_backend)
 		: media_path_(media_path)
 		, thumbnails_path_(thumbnails_path)
 		, width_(width)
 		, height_(height)
-		, ogl_(ogl)
 		, format_desc_(render_video_mode)
-		, output_(new thumbnail_output(generate_delay_millis))
-		, mixer_(new mixer(
-				graph_,
-				output_,
-				format_desc_,
-				ogl,
-				channel_layout::stereo(),
-				0))
+		, generate_delay_millis_(generate_delay_millis)
 		, thumbnail_creator_(thumbnail_creator)
 		, media_info_repo_(std::move(media_info_repo))
+		, running_(true)
 		, monitor_(monitor_factory.create(
 				media_path,
 				ALL,
@@ -151,7 +184,26 @@ public:
 		graph_->set_text(L"thumbnail-channel");
 		graph_->auto_reset();
 		diagnostics::register_graph(graph_);
-		mixer_->set_mipmap(0, mipmap);
+
+		try
+		{
+			for (int n = 0; n < std::max(1, workers); ++n)
+			{
+				auto worker = std::make_shared<thumbnail_worker>(graph_, format_desc_, ogl, image_mixer_backend, mipmap);
+				workers_.push_back(worker);
+				threads_.create_thread([=] { run(*worker); });
+			}
+		}
+		catch (...)
+		{
+			stop();
+			throw;
+		}
+	}
+
+	~implementation()
+	{
+		stop();
 	}
 
 	void on_initial_files(const std::set<boost::filesystem::path>& initial_files)
@@ -193,13 +245,19 @@ public:
 			auto stem = iter->path().stem().wstring();
 
 			if (boost::iequals(stem, base_file.filename().wstring()))
-				monitor_->reemmit(iter->path());
+				enqueue(iter->path(), explicit_request);
 		}
 	}
 
 	void generate_all()
 	{
-		monitor_->reemmit_all();
+		using namespace boost::filesystem;
+
+		for (recursive_directory_iterator iter(media_path_); iter != recursive_directory_iterator(); ++iter)
+		{
+			if (is_regular_file(iter->path()))
+				enqueue(iter->path(), rebuild);
+		}
 	}
 
 	void on_file_event(filesystem_event event, const boost::filesystem::path& file)
@@ -208,14 +266,17 @@ public:
 		{
 		case CREATED:
 			if (needs_to_be_generated(file))
-				generate_thumbnail(file);
+				enqueue(file, changed_file);
 
 			break;
 		case MODIFIED:
-			generate_thumbnail(file);
+			enqueue(file, changed_file);
 
 			break;
 		case REMOVED:
+			// Waits for a worker that may be writing the thumbnail.
+			dequeue(file);
+
 			auto relative_without_extension = get_relative_without_extension(file, media_path_);
 			boost::filesystem::remove(thumbnails_path_ / (relative_without_extension + L".png"));
 			media_info_repo_->remove(file.wstring());
@@ -255,8 +316,154 @@ public:
 			return true;
 		}
 	}
+private:
+	void stop()
+	{
+		{
+			boost::mutex::scoped_lock lock(queue_mutex_);
+			running_ = false;
+		}
+
+		queue_cond_.notify_all();
+		threads_.join_all();
+	}
+
+	void enqueue(const boost::filesystem::path& file, thumbnail_priority priority)
+	{
+		{
+			boost::mutex::scoped_lock lock(queue_mutex_);
+
+			if (in_progress_.find(file) != in_progress_.end())
+			{
+				// Queued again when the current generation is done.
+				auto it = deferred_.find(file);
+
+				if (it == deferred_.end())
+					deferred_.insert(std::make_pair(file, priority));
+				else
+					it->second = std::min(it->second, priority);
+
+				return;
+			}
+
+			auto it = queued_.find(file);
+
+			if (it != queued_.end())
+			{
+				if (it->second <= priority)
+					return;
+
+				// Left in the lower priority queue, but skipped there.
+				it->second = priority;
+			}
+			else
+				queued_.insert(std::make_pair(file, priority));
+
+			queues_[priority].push_back(file);
+		}
+
+		queue_cond_.notify_one();
+	}
+
+	void dequeue(const boost::filesystem::path& file)
+	{
+		boost::mutex::scoped_lock lock(queue_mutex_);
+
+		queued_.erase(file);
+		deferred_.erase(file);
+
+		while (in_progress_.find(file) != in_progress_.end())
+			in_progress_cond_.wait(lock);
+	}
+
+	void finish(const boost::filesystem::path& file)
+	{
+		in_progress_.erase(file);
+		in_progress_cond_.notify_all();
+
+		auto it = deferred_.find(file);
+
+		if (it == deferred_.end())
+			return;
+
+		auto priority = it->second;
+		deferred_.erase(it);
+
+		if (queued_.insert(std::make_pair(file, priority)).second)
+		{
+			queues_[priority].push_back(file);
+			queue_cond_.notify_one();
+		}
+	}
 
-	void generate_thumbnail(const boost::filesystem::path& file)
+	bool try_pop(boost::filesystem::path& file, thumbnail_priority& priority)
+	{
+		for (int n = 0; n < priority_count; ++n)
+		{
+			auto& queue = queues_[n];
+
+			while (!queue.empty())
+			{
+				auto candidate = queue.front();
+				queue.pop_front();
+
+				auto it = queued_.find(candidate);
+
+				if (it == queued_.end() || it->second != n)
+					continue;
+
+				queued_.erase(it);
+				in_progress_.insert(candidate);
+				file = candidate;
+				priority = static_cast<thumbnail_priority>(n);
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void run(thumbnail_worker& worker)
+	{
+		win32_exception::ensure_handler_installed_for_thread("thumbnail-worker");
+
+		boost::mutex::scoped_lock lock(queue_mutex_);
+
+		while (running_)
+		{
+			boost::filesystem::path file;
+			thumbnail_priority priority;
+
+			if (!try_pop(file, priority))
+			{
+				queue_cond_.wait(lock);
+				continue;
+			}
+
+			lock.unlock();
+
+			try
+			{
+				generate_thumbnail(worker, file);
+			}
+			catch (...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+			}
+
+			lock.lock();
+
+			finish(file);
+
+			// Background work is throttled so that it does not compete with
+			// the channels, explicit requests are not.
+			if (priority != explicit_request && generate_delay_millis_ > 0 && running_)
+				queue_cond_.timed_wait(lock, boost::posix_time::milliseconds(generate_delay_millis_));
+		}
+	}
+
+	void generate_thumbnail(thumbnail_worker& worker, const boost::filesystem::path& file)
 	{
 		auto media_file = get_relative_without_extension(file, media_path_);
 		auto png_file = thumbnails_path_ / (media_file + L".png");
@@ -267,11 +474,7 @@ public:
 
 			try
 			{
-				producer = create_thumbnail_producer(mixer_->get_frame_factory(0), media_file);
-			}
-			catch (const boost::thread_interrupted&)
-			{
-				throw;
+				producer = create_thumbnail_producer(worker.mixer->get_frame_factory(0), media_file);
 			}
 			catch (...)
 			{
@@ -286,7 +489,7 @@ public:
 			}
 
 			boost::filesystem::create_directories(png_file.parent_path());
-			output_->on_send = [this, &png_file] (const safe_ptr<read_frame>& frame)
+			worker.output->on_send = [this, &png_file] (const safe_ptr<read_frame>& frame)
 			{
 				thumbnail_creator_(frame, format_desc_, png_file, width_, height_);
 			};
@@ -300,10 +503,6 @@ public:
 				media_info_repo_->remove(file.wstring());
 				media_info_repo_->get(file.wstring());
 			}
-			catch (const boost::thread_interrupted&)
-			{
-				throw;
-			}
 			catch (...)
 			{
 				CASPAR_LOG(debug) << L"Thumbnail producer failed to create thumbnail for " << media_file;
@@ -329,7 +528,7 @@ public:
 				thumbnail_ready.set_value();
 			});
 
-			mixer_->send(std::make_pair(frames, ticket));
+			worker.mixer->send(std::make_pair(frames, ticket));
 			ticket.reset();
 		}
 		thumbnail_ready.get_future().get();
@@ -363,7 +562,9 @@ thumbnail_generator::thumbnail_generator(
 		int generate_delay_millis,
 		const thumbnail_creator& thumbnail_creator,
 		safe_ptr<media_info_repository> media_info_repo,
-		bool mipmap)
+		bool mipmap,
+		int workers,
+		image_mixer_backend::type image_mixer_backend)
 		: impl_(new implementation(
 				monitor_factory,
 				media_path,
@@ -374,7 +575,9 @@ thumbnail_generator::thumbnail_generator(
 				generate_delay_millis,
 				thumbnail_creator,
 				media_info_repo,
-				mipmap))
+				mipmap,
+				workers,
+				image_mixer_backend))
 {
 }
 
@@ -26,6 +26,8 @@
 #include <common/memory/safe_ptr.h>
 #include <common/filesystem/filesystem_monitor.h>
 
+#include "mixer/image/image_mixer.h"
+
 namespace caspar { namespace core {
 
 class ogl_device;
@@ -54,9 +56,20 @@ public:
 			int generate_delay_millis,
 			const thumbnail_creator& thumbnail_creator,
 			safe_ptr<media_info_repository> media_info_repo,
-			bool mipmap);
+			bool mipmap,
+			int workers,
+			image_mixer_backend::type image_mixer_backend);
 	~thumbnail_generator();
+
+	/**
+	 * Generates the thumbnails of the files with the given name before any
+	 * other pending work.
+	 */
 	void generate(const std::wstring& media_file);
+
+	/**
+	 * Regenerates every thumbnail, after all other pending work.
+	 */
 	void generate_all();
 private:
 	struct implementation;
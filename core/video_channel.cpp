@@ -27,6 +27,7 @@
 
 #include "consumer/output.h"
 #include "mixer/mixer.h"
+#include "mixer/cpu/cpu_buffer.h"
 #include "mixer/gpu/ogl_device.h"
 #include "mixer/audio/audio_util.h"
 #include "producer/stage.h"
@@ -52,23 +53,28 @@ struct video_channel::implementation : boost::noncopyable
 	const safe_ptr<caspar::core::mixer>		mixer_;
 	const safe_ptr<caspar::core::stage>		stage_;
 
+	// Number of frames that may be in flight between stage and output, so
+	// that producing, mixing and consuming of consecutive frames overlap.
+	const int								pipeline_depth_;
+
 	safe_ptr<monitor::subject>				monitor_subject_;
 	
 public:
-	implementation(video_channel& self, int index, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout)  
+	implementation(video_channel& self, int index, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout, image_mixer_backend::type image_mixer_backend, int pipeline_depth)  
 		: self_(self)
 		, index_(index)
 		, format_desc_(format_desc)
 		, ogl_(ogl)
 		, output_(new caspar::core::output(graph_, format_desc, audio_channel_layout, index))
-		, mixer_(new caspar::core::mixer(graph_, output_, format_desc, ogl, audio_channel_layout, index))
+		, mixer_(new caspar::core::mixer(graph_, output_, format_desc, ogl, audio_channel_layout, index, image_mixer_backend))
 		, stage_(new caspar::core::stage(graph_, mixer_, format_desc, index))
+		, pipeline_depth_(std::max(1, pipeline_depth > 0 ? pipeline_depth : env::properties().get(L"configuration.pipeline-tokens", 2)))
 		, monitor_subject_(make_safe<monitor::subject>("/channel/" + boost::lexical_cast<std::string>(index)))
 	{
 		graph_->set_text(print());
 		diagnostics::register_graph(graph_);
 
-		for(int n = 0; n < std::max(1, env::properties().get(L"configuration.pipeline-tokens", 2)); ++n)
+		for(int n = 0; n < pipeline_depth_; ++n)
 			stage_->spawn_token();
 
 		stage_->monitor_output().attach_parent(monitor_subject_);
@@ -89,6 +95,7 @@ public:
 			mixer_->set_video_format_desc(format_desc);
 			stage_->set_video_format_desc(format_desc);
 			ogl_->gc();
+			cpu_buffer::gc();
 		}
 		catch(...)
 		{
@@ -114,6 +121,9 @@ public:
 		auto output_info = output_->info();
 
 		info.add(L"video-mode", format_desc_.name);
+		info.add(L"pipeline-depth", pipeline_depth_);
+		info.add(L"pipeline-latency-frames", pipeline_depth_ - 1);
+		info.add(L"pipeline-latency-millis", static_cast<int>((pipeline_depth_ - 1) * 1000.0 / format_desc_.fps));
 
 		if (stage_info.timed_wait(boost::posix_time::seconds(2)))
 			info.add_child(L"stage", stage_info.get());
@@ -148,8 +158,8 @@ public:
 	}
 };
 
-video_channel::video_channel(int index, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout) 
-	: impl_(new implementation(*this, index, format_desc, ogl, audio_channel_layout)){}
+video_channel::video_channel(int index, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout, image_mixer_backend::type image_mixer_backend, int pipeline_depth) 
+	: impl_(new implementation(*this, index, format_desc, ogl, audio_channel_layout, image_mixer_backend, pipeline_depth)){}
 safe_ptr<stage> video_channel::stage() { return impl_->stage_;} 
 safe_ptr<mixer> video_channel::mixer() { return impl_->mixer_;} 
 safe_ptr<output> video_channel::output() { return impl_->output_;} 
@@ -22,6 +22,7 @@
 #pragma once
 
 #include "monitor/monitor.h"
+#include "mixer/image/image_mixer.h"
 
 #include <common/memory/safe_ptr.h>
 
@@ -47,7 +48,7 @@ public:
 
 	// Constructors
 
-	explicit video_channel(int index, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout);
+	explicit video_channel(int index, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout, image_mixer_backend::type image_mixer_backend = image_mixer_backend::gpu, int pipeline_depth = -1);
 
 	// Methods
 
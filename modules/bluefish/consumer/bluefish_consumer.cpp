@@ -95,7 +95,7 @@ public:
 		, vid_fmt_(get_video_mode(*blue_, format_desc))
 		, embedded_audio_(embedded_audio)
 		, key_only_(key_only)
-		, executor_(print())
+		, executor_(print(), thread_backend)
 	{
 		executor_.set_capacity(1);
 		presentation_delay_millis_ = 0;
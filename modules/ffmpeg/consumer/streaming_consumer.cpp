@@ -22,6 +22,7 @@
 #include <boost/rational.hpp>
 #include <boost/format.hpp>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/timer.hpp>
 
 #pragma warning(push)
 #pragma warning(disable: 4244)
@@ -35,12 +36,15 @@
 #include <tbb/parallel_for.h>
 
 #include <agents.h>
+#include <deque>
+#include <functional>
+#include <map>
 #include <numeric>
 
 #pragma warning(push)
 #pragma warning(disable: 4244)
 
-extern "C" 
+extern "C"
 {
 	#define __STDC_CONSTANT_MACROS
 	#define __STDC_LIMIT_MACROS
@@ -71,106 +75,1149 @@ int crc16(const std::string& str)
 	return result.checksum();
 }
 
+template<typename T>
+boost::optional<T> try_remove_arg(
+	std::map<std::string, std::string>& options,
+	const boost::regex& expr)
+{
+	for(auto it = options.begin(); it != options.end(); ++it)
+	{
+		if(boost::regex_search(it->first, expr))
+		{
+			auto arg = it->second;
+			options.erase(it);
+			return boost::lexical_cast<T>(arg);
+		}
+	}
+
+	return boost::optional<T>();
+}
+
+std::map<std::string, std::string> remove_options(
+	std::map<std::string, std::string>& options,
+	const boost::regex& expr)
+{
+	std::map<std::string, std::string> result;
+
+	auto it = options.begin();
+	while(it != options.end())
+	{
+		boost::smatch what;
+		if(boost::regex_search(it->first, what, expr))
+		{
+			result[
+				what.size() > 0 && what[1].matched
+					? what[1].str()
+					: it->first] = it->second;
+			it = options.erase(it);
+		}
+		else
+			++it;
+	}
+
+	return result;
+}
+
+void to_dict(AVDictionary** dest, const std::map<std::string, std::string>& c)
+{
+	BOOST_FOREACH(const auto& entry, c)
+	{
+		av_dict_set(
+			dest,
+			entry.first.c_str(),
+			entry.second.c_str(), 0);
+	}
+}
+
+std::map<std::string, std::string> to_map(AVDictionary* dict)
+{
+	std::map<std::string, std::string> result;
+
+	for(auto t = dict
+			? av_dict_get(
+				dict,
+				"",
+				nullptr,
+				AV_DICT_IGNORE_SUFFIX)
+			: nullptr;
+		t;
+		t = av_dict_get(
+			dict,
+			"",
+			t,
+			AV_DICT_IGNORE_SUFFIX))
+	{
+		result[t->key] = t->value;
+	}
+
+	return result;
+}
+
+// True if name, without a stream specifier, is an option of the encoders
+// rather than of the muxer.
+bool is_codec_option(
+	const std::string& name,
+	const AVCodec& video_codec,
+	const AVCodec& audio_codec)
+{
+	auto base = name;
+	if(base.size() > 2 && base[base.size() - 2] == ':')
+		base.resize(base.size() - 2);
+
+	const AVClass* classes[] = {avcodec_get_class(), video_codec.priv_class, audio_codec.priv_class};
+
+	BOOST_FOREACH(auto av_class, classes)
+	{
+		if(av_class && av_opt_find(&av_class, base.c_str(), nullptr, 0, AV_OPT_SEARCH_FAKE_OBJ))
+			return true;
+	}
+
+	return false;
+}
+
+void configure_filtergraph(
+	AVFilterGraph& graph,
+	const std::string& filtergraph,
+	AVFilterContext& source_ctx,
+	AVFilterContext& sink_ctx)
+{
+	AVFilterInOut* outputs = nullptr;
+	AVFilterInOut* inputs = nullptr;
+
+	try
+	{
+		if(!filtergraph.empty())
+		{
+			outputs = avfilter_inout_alloc();
+			inputs  = avfilter_inout_alloc();
+
+			CASPAR_VERIFY(outputs && inputs);
+
+			outputs->name       = av_strdup("in");
+			outputs->filter_ctx = &source_ctx;
+			outputs->pad_idx    = 0;
+			outputs->next       = nullptr;
+
+			inputs->name        = av_strdup("out");
+			inputs->filter_ctx  = &sink_ctx;
+			inputs->pad_idx     = 0;
+			inputs->next        = nullptr;
+
+			FF(avfilter_graph_parse(
+				&graph,
+				filtergraph.c_str(),
+				inputs,
+				outputs,
+				nullptr));
+		}
+		else
+		{
+			FF(avfilter_link(
+				&source_ctx,
+				0,
+				&sink_ctx,
+				0));
+		}
+
+		FF(avfilter_graph_config(
+			&graph,
+			nullptr));
+	}
+	catch(...)
+	{
+		avfilter_inout_free(&outputs);
+		avfilter_inout_free(&inputs);
+		throw;
+	}
+}
+
+// Filters and encodes the frames of a channel once for all streaming
+// consumers that use the same codecs, filters and codec options. Each
+// consumer muxes the shared packets into its own output. The first
+// consumer to attach feeds the frames.
+class encoder_session sealed : boost::noncopyable
+{
+public:
+	// Packets are in the time base of the encoder, stream_index 0 is video
+	// and 1 is audio.
+	typedef std::function<void (const AVPacket& packet, const std::shared_ptr<void>& token)> packet_sink;
+
+private:
+	const std::wstring							name_;
+	const core::video_format_desc				in_video_format_;
+	const core::channel_layout					in_channel_layout_;
+
+	std::int64_t								video_pts_;
+	std::int64_t								audio_pts_;
+
+    AVFilterContext*							audio_graph_in_;
+    AVFilterContext*							audio_graph_out_;
+    std::shared_ptr<AVFilterGraph>				audio_graph_;
+
+    AVFilterContext*							video_graph_in_;
+    AVFilterContext*							video_graph_out_;
+    std::shared_ptr<AVFilterGraph>				video_graph_;
+
+	std::shared_ptr<AVCodecContext>				video_enc_;
+	std::shared_ptr<AVCodecContext>				audio_enc_;
+
+	boost::mutex								mutex_;
+	std::map<int, packet_sink>					sinks_;
+	int											next_sink_id_;
+	int											members_;
+	bool										flushed_;
+	bool										delivered_;
+
+	executor									video_encoder_executor_;
+	executor									audio_encoder_executor_;
+
+public:
+
+	encoder_session(
+		const core::video_format_desc& format_desc,
+		const core::channel_layout& channel_layout,
+		const AVCodec& video_codec,
+		const AVCodec& audio_codec,
+		const std::string& video_filter,
+		const std::string& audio_filter,
+		std::map<std::string, std::string>& options)
+		: name_(L"encoder_session[" + widen(std::string(video_codec.name)) + L"|" + widen(std::string(audio_codec.name)) + L"]")
+		, in_video_format_(format_desc)
+		, in_channel_layout_(channel_layout)
+		, video_pts_(0)
+		, audio_pts_(0)
+		, next_sink_id_(0)
+		, members_(0)
+		, flushed_(false)
+		, delivered_(false)
+		, video_encoder_executor_(print() + L" video_encoder")
+		, audio_encoder_executor_(print() + L" audio_encoder")
+	{
+		// Filters
+
+		configure_video_filters(
+			video_codec,
+			video_filter);
+
+		configure_audio_filters(
+			audio_codec,
+			audio_filter);
+
+		// Encoders
+
+		auto video_options = options;
+		auto audio_options = options;
+
+		video_enc_ = open_encoder(
+			video_codec,
+			video_options);
+
+		audio_enc_ = open_encoder(
+			audio_codec,
+			audio_options);
+
+		auto it = options.begin();
+		while(it != options.end())
+		{
+			if(video_options.find(it->first) == video_options.end() || audio_options.find(it->first) == audio_options.end())
+				it = options.erase(it);
+			else
+				++it;
+		}
+	}
+
+	~encoder_session()
+	{
+		video_encoder_executor_.stop();
+		audio_encoder_executor_.stop();
+		video_encoder_executor_.join();
+		audio_encoder_executor_.join();
+
+		video_graph_.reset();
+		audio_graph_.reset();
+		video_enc_.reset();
+		audio_enc_.reset();
+	}
+
+	// The session of all consumers opened with the same key, created from
+	// options if there is none.
+	static std::shared_ptr<encoder_session> open(
+		const std::string& key,
+		const core::video_format_desc& format_desc,
+		const core::channel_layout& channel_layout,
+		const AVCodec& video_codec,
+		const AVCodec& audio_codec,
+		const std::string& video_filter,
+		const std::string& audio_filter,
+		std::map<std::string, std::string>& options);
+
+	// False once the last member has left and the encoders are flushed.
+	bool join()
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		if(flushed_)
+			return false;
+
+		++members_;
+		return true;
+	}
+
+	// from_start is set, before the first packet reaches sink, to whether
+	// sink gets every packet of the session.
+	int attach(const packet_sink& sink, bool& from_start)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		from_start = !delivered_;
+
+		sinks_[next_sink_id_] = sink;
+		return next_sink_id_++;
+	}
+
+	// The last member to leave receives what the encoders still hold.
+	void leave(int sink_id)
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(mutex_);
+
+			if(--members_ > 0 || flushed_)
+			{
+				sinks_.erase(sink_id);
+				return;
+			}
+
+			flushed_ = true;
+		}
+
+		try
+		{
+			video_encoder_executor_.invoke([this] { encode_video(nullptr, nullptr); });
+			audio_encoder_executor_.invoke([this] { encode_audio(nullptr, nullptr); });
+			video_encoder_executor_.wait();
+			audio_encoder_executor_.wait();
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		sinks_.erase(sink_id);
+	}
+
+	bool is_flushed()
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		return flushed_;
+	}
+
+	bool is_primary(int sink_id)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		return !sinks_.empty() && sinks_.begin()->first == sink_id;
+	}
+
+	void send(const safe_ptr<core::read_frame>& frame, const std::shared_ptr<void>& token)
+	{
+		if(is_flushed())
+			return;
+
+		video_encoder_executor_.begin_invoke([=]() mutable
+		{
+			encode_video(
+				frame,
+				token);
+		});
+
+		audio_encoder_executor_.begin_invoke([=]() mutable
+		{
+			encode_audio(
+				frame,
+				token);
+		});
+	}
+
+	// Encodes the audio of frame and leaves a gap in the video where it
+	// would have been.
+	void drop_video(const safe_ptr<core::read_frame>& frame, const std::shared_ptr<void>& token)
+	{
+		if(is_flushed())
+			return;
+
+		video_encoder_executor_.begin_invoke([=]
+		{
+			video_pts_ += 1;
+		});
+
+		audio_encoder_executor_.begin_invoke([=]() mutable
+		{
+			encode_audio(
+				frame,
+				token);
+		});
+	}
+
+	const AVCodecContext& video_encoder() const
+	{
+		return *video_enc_;
+	}
+
+	const AVCodecContext& audio_encoder() const
+	{
+		return *audio_enc_;
+	}
+
+	std::wstring print() const
+	{
+		return name_;
+	}
+
+private:
+
+	std::shared_ptr<AVCodecContext> open_encoder(
+		const AVCodec& codec,
+		std::map<std::string,
+		std::string>& options)
+	{
+		auto enc = avcodec_alloc_context3(&codec);
+
+		if (!enc)
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Could not allocate encoder.") << boost::errinfo_api_function("avcodec_alloc_context3"));
+
+		std::shared_ptr<AVCodecContext> result(enc, [](AVCodecContext* p)
+		{
+			avcodec_free_context(&p);
+		});
+
+		switch(enc->codec_type)
+		{
+			case AVMEDIA_TYPE_VIDEO:
+			{
+				enc->time_base			  = video_graph_out_->inputs[0]->time_base;
+				enc->pix_fmt			  = static_cast<AVPixelFormat>(video_graph_out_->inputs[0]->format);
+				enc->sample_aspect_ratio  = video_graph_out_->inputs[0]->sample_aspect_ratio;
+				enc->width				  = video_graph_out_->inputs[0]->w;
+				enc->height				  = video_graph_out_->inputs[0]->h;
+
+				break;
+			}
+			case AVMEDIA_TYPE_AUDIO:
+			{
+				enc->time_base			  = audio_graph_out_->inputs[0]->time_base;
+				enc->sample_fmt			  = static_cast<AVSampleFormat>(audio_graph_out_->inputs[0]->format);
+				enc->sample_rate		  = audio_graph_out_->inputs[0]->sample_rate;
+				enc->channel_layout		  = audio_graph_out_->inputs[0]->channel_layout;
+				enc->channels			  = audio_graph_out_->inputs[0]->channels;
+
+				break;
+			}
+		}
+
+		// Consumers whose muxer wants in-band headers add them with dump_extra.
+		enc->flags |= CODEC_FLAG_GLOBAL_HEADER;
+
+		static const std::array<std::string, 4> char_id_map = {{"v", "a", "d", "s"}};
+
+		const auto char_id = char_id_map.at(enc->codec_type);
+
+		const auto codec_opts =
+			remove_options(
+				options,
+				boost::regex("^(" + char_id + "?[^:]+):" + char_id + "$"));
+
+		AVDictionary* av_codec_opts = nullptr;
+
+		to_dict(
+			&av_codec_opts,
+			options);
+
+		to_dict(
+			&av_codec_opts,
+			codec_opts);
+
+		options.clear();
+
+		FF(avcodec_open2(
+			enc,
+			&codec,
+			av_codec_opts ? &av_codec_opts : nullptr));
+
+		if(av_codec_opts)
+		{
+			auto t =
+				av_dict_get(
+					av_codec_opts,
+					"",
+					 nullptr,
+					AV_DICT_IGNORE_SUFFIX);
+
+			while(t)
+			{
+				options[t->key + (codec_opts.find(t->key) != codec_opts.end() ? ":" + char_id : "")] = t->value;
+
+				t = av_dict_get(
+						av_codec_opts,
+						"",
+						t,
+						AV_DICT_IGNORE_SUFFIX);
+			}
+
+			av_dict_free(&av_codec_opts);
+		}
+
+		if(enc->codec_type == AVMEDIA_TYPE_AUDIO && !(codec.capabilities & CODEC_CAP_VARIABLE_FRAME_SIZE))
+		{
+			CASPAR_ASSERT(enc->frame_size > 0);
+			av_buffersink_set_frame_size(audio_graph_out_,
+										 enc->frame_size);
+		}
+
+		return result;
+	}
+
+	void configure_video_filters(
+		const AVCodec& codec,
+		const std::string& filtergraph)
+	{
+		video_graph_.reset(
+			avfilter_graph_alloc(),
+			[](AVFilterGraph* p)
+			{
+				avfilter_graph_free(&p);
+			});
+
+		video_graph_->nb_threads  = boost::thread::hardware_concurrency()/2;
+		video_graph_->thread_type = AVFILTER_THREAD_SLICE;
+
+		const auto sample_aspect_ratio =
+			boost::rational<int>(
+				in_video_format_.square_width,
+				in_video_format_.square_height) /
+			boost::rational<int>(
+				in_video_format_.width,
+				in_video_format_.height);
+
+		const auto vsrc_options = (boost::format("video_size=%1%x%2%:pix_fmt=%3%:time_base=%4%/%5%:pixel_aspect=%6%/%7%:frame_rate=%8%/%9%")
+			% in_video_format_.width % in_video_format_.height
+			% AV_PIX_FMT_BGRA
+			% in_video_format_.duration	% in_video_format_.time_scale
+			% sample_aspect_ratio.numerator() % sample_aspect_ratio.denominator()
+			% in_video_format_.time_scale % in_video_format_.duration).str();
+
+		AVFilterContext* filt_vsrc = nullptr;
+		FF(avfilter_graph_create_filter(
+			&filt_vsrc,
+			avfilter_get_by_name("buffer"),
+			"ffmpeg_consumer_buffer",
+			vsrc_options.c_str(),
+			nullptr,
+			video_graph_.get()));
+
+		AVFilterContext* filt_vsink = nullptr;
+		FF(avfilter_graph_create_filter(
+			&filt_vsink,
+			avfilter_get_by_name("buffersink"),
+			"ffmpeg_consumer_buffersink",
+			nullptr,
+			nullptr,
+			video_graph_.get()));
+
+#pragma warning (push)
+#pragma warning (disable : 4245)
+
+		FF(av_opt_set_int_list(
+			filt_vsink,
+			"pix_fmts",
+			codec.pix_fmts,
+			-1,
+			AV_OPT_SEARCH_CHILDREN));
+
+#pragma warning (pop)
+
+		configure_filtergraph(
+			*video_graph_,
+			filtergraph,
+			*filt_vsrc,
+			*filt_vsink);
+
+		video_graph_in_  = filt_vsrc;
+		video_graph_out_ = filt_vsink;
+
+		CASPAR_LOG(info)
+			<< 	widen(std::string("\n")
+				+ avfilter_graph_dump(
+						video_graph_.get(),
+						nullptr));
+	}
+
+	void configure_audio_filters(
+		const AVCodec& codec,
+		const std::string& filtergraph)
+	{
+		audio_graph_.reset(
+			avfilter_graph_alloc(),
+			[](AVFilterGraph* p)
+			{
+				avfilter_graph_free(&p);
+			});
+
+		audio_graph_->nb_threads  = boost::thread::hardware_concurrency()/2;
+		audio_graph_->thread_type = AVFILTER_THREAD_SLICE;
+
+		const auto asrc_options = (boost::format("sample_rate=%1%:sample_fmt=%2%:channels=%3%:time_base=%4%/%5%:channel_layout=%6%")
+			% in_video_format_.audio_sample_rate
+			% av_get_sample_fmt_name(AV_SAMPLE_FMT_S32)
+			% in_channel_layout_.num_channels
+			% 1	% in_video_format_.audio_sample_rate
+			% boost::io::group(
+				std::hex,
+				std::showbase,
+				av_get_default_channel_layout(in_channel_layout_.num_channels))).str();
+
+		AVFilterContext* filt_asrc = nullptr;
+		FF(avfilter_graph_create_filter(
+			&filt_asrc,
+			avfilter_get_by_name("abuffer"),
+			"ffmpeg_consumer_abuffer",
+			asrc_options.c_str(),
+			nullptr,
+			audio_graph_.get()));
+
+		AVFilterContext* filt_asink = nullptr;
+		FF(avfilter_graph_create_filter(
+			&filt_asink,
+			avfilter_get_by_name("abuffersink"),
+			"ffmpeg_consumer_abuffersink",
+			nullptr,
+			nullptr,
+			audio_graph_.get()));
+
+#pragma warning (push)
+#pragma warning (disable : 4245)
+
+		FF(av_opt_set_int(
+			filt_asink,
+			"all_channel_counts",
+			1,
+			AV_OPT_SEARCH_CHILDREN));
+
+		FF(av_opt_set_int_list(
+			filt_asink,
+			"sample_fmts",
+			codec.sample_fmts,
+			-1,
+			AV_OPT_SEARCH_CHILDREN));
+
+		FF(av_opt_set_int_list(
+			filt_asink,
+			"channel_layouts",
+			codec.channel_layouts,
+			-1,
+			AV_OPT_SEARCH_CHILDREN));
+
+		FF(av_opt_set_int_list(
+			filt_asink,
+			"sample_rates" ,
+			codec.supported_samplerates,
+			-1,
+			AV_OPT_SEARCH_CHILDREN));
+
+#pragma warning (pop)
+
+		configure_filtergraph(
+			*audio_graph_,
+			filtergraph,
+			*filt_asrc,
+			*filt_asink);
+
+		audio_graph_in_  = filt_asrc;
+		audio_graph_out_ = filt_asink;
+
+		CASPAR_LOG(info)
+			<< 	widen(std::string("\n")
+				+ avfilter_graph_dump(
+					audio_graph_.get(),
+					nullptr));
+	}
+
+	void encode_video(
+		const std::shared_ptr<core::read_frame>& frame_ptr,
+		std::shared_ptr<void> token)
+	{
+		if(!video_enc_)
+			return;
+
+		auto enc = video_enc_.get();
+
+		std::shared_ptr<AVFrame> src_av_frame;
+
+		if(frame_ptr)
+		{
+			src_av_frame.reset(
+				av_frame_alloc(),
+				[frame_ptr](AVFrame* frame)
+				{
+					av_frame_free(&frame);
+				});
+
+			const auto sample_aspect_ratio =
+				boost::rational<int>(
+					in_video_format_.square_width,
+					in_video_format_.square_height) /
+				boost::rational<int>(
+					in_video_format_.width,
+					in_video_format_.height);
+
+			src_av_frame->format				  = AV_PIX_FMT_BGRA;
+			src_av_frame->width					  = in_video_format_.width;
+			src_av_frame->height				  = in_video_format_.height;
+			src_av_frame->sample_aspect_ratio.num = sample_aspect_ratio.numerator();
+			src_av_frame->sample_aspect_ratio.den = sample_aspect_ratio.denominator();
+			src_av_frame->pts					  = video_pts_;
+
+			video_pts_ += 1;
+
+			FF(av_image_fill_arrays(
+				src_av_frame->data,
+				src_av_frame->linesize,
+				frame_ptr->image_data().begin(),
+				static_cast<AVPixelFormat>(src_av_frame->format),
+				in_video_format_.width,
+				in_video_format_.height,
+				1));
+
+			FF(av_buffersrc_add_frame(
+				video_graph_in_,
+				src_av_frame.get()));
+		}
+		else
+		{
+			FF(av_buffersrc_add_frame(
+				video_graph_in_,
+				nullptr));
+		}
+
+		int ret = 0;
+
+		while(ret >= 0)
+		{
+			std::shared_ptr<AVFrame> filt_frame(
+				av_frame_alloc(),
+				[](AVFrame* p)
+				{
+					av_frame_free(&p);
+				});
+
+			ret = av_buffersink_get_frame(
+				video_graph_out_,
+				filt_frame.get());
+
+			video_encoder_executor_.begin_invoke([=]
+			{
+				if(ret == AVERROR_EOF)
+				{
+					if(enc->codec->capabilities & CODEC_CAP_DELAY)
+					{
+						while(encode_av_frame(
+								*enc,
+								0,
+								avcodec_encode_video2,
+								nullptr, token))
+						{
+						}
+					}
+				}
+				else if(ret != AVERROR(EAGAIN))
+				{
+					FF_RET(ret, "av_buffersink_get_frame");
+
+					if (filt_frame->interlaced_frame)
+					{
+						if (enc->codec->id == AV_CODEC_ID_MJPEG)
+							enc->field_order = filt_frame->top_field_first ? AV_FIELD_TT : AV_FIELD_BB;
+						else
+							enc->field_order = filt_frame->top_field_first ? AV_FIELD_TB : AV_FIELD_BT;
+					}
+					else
+						enc->field_order = AV_FIELD_PROGRESSIVE;
+
+					filt_frame->quality = enc->global_quality;
+
+					if (!enc->me_threshold)
+						filt_frame->pict_type = AV_PICTURE_TYPE_NONE;
+
+					encode_av_frame(
+						*enc,
+						0,
+						avcodec_encode_video2,
+						filt_frame,
+						token);
+				}
+			});
+		}
+	}
+
+	void encode_audio(
+		const std::shared_ptr<core::read_frame>& frame_ptr,
+		std::shared_ptr<void> token)
+	{
+		if(!audio_enc_)
+			return;
+
+		auto enc = audio_enc_.get();
+
+		std::shared_ptr<AVFrame> src_av_frame;
+
+		if(frame_ptr)
+		{
+			src_av_frame.reset(
+				av_frame_alloc(),
+				[](AVFrame* p)
+				{
+					av_frame_free(&p);
+				});
+
+			src_av_frame->channels		 = frame_ptr->num_channels();
+			src_av_frame->channel_layout = av_get_default_channel_layout(frame_ptr->num_channels());
+			src_av_frame->sample_rate	 = in_video_format_.audio_sample_rate;
+			src_av_frame->nb_samples	 = frame_ptr->audio_data().size() / src_av_frame->channels;
+			src_av_frame->format		 = AV_SAMPLE_FMT_S32;
+			src_av_frame->pts			 = audio_pts_;
+
+			audio_pts_ += src_av_frame->nb_samples;
+
+			FF(av_samples_fill_arrays(
+				src_av_frame->extended_data,
+				src_av_frame->linesize,
+				reinterpret_cast<const std::uint8_t*>(&*frame_ptr->audio_data().begin()),
+				src_av_frame->channels,
+				src_av_frame->nb_samples,
+				static_cast<AVSampleFormat>(src_av_frame->format),
+				16));
+
+			FF(av_buffersrc_add_frame(
+				audio_graph_in_,
+				src_av_frame.get()));
+		}
+		else
+		{
+			FF(av_buffersrc_add_frame(
+				audio_graph_in_,
+				nullptr));
+		}
+
+		int ret = 0;
+
+		while(ret >= 0)
+		{
+			std::shared_ptr<AVFrame> filt_frame(
+				av_frame_alloc(),
+				[](AVFrame* p)
+				{
+					av_frame_free(&p);
+				});
+
+			ret = av_buffersink_get_frame(
+				audio_graph_out_,
+				filt_frame.get());
+
+			audio_encoder_executor_.begin_invoke([=]
+			{
+				if(ret == AVERROR_EOF)
+				{
+					if(enc->codec->capabilities & CODEC_CAP_DELAY)
+					{
+						while(encode_av_frame(
+								*enc,
+								1,
+								avcodec_encode_audio2,
+								nullptr,
+								token))
+						{
+						}
+					}
+				}
+				else if(ret != AVERROR(EAGAIN))
+				{
+					FF_RET(
+						ret,
+						"av_buffersink_get_frame");
+
+					encode_av_frame(
+						*enc,
+						1,
+						avcodec_encode_audio2,
+						filt_frame,
+						token);
+				}
+			});
+		}
+	}
+
+	template<typename F>
+	bool encode_av_frame(
+		AVCodecContext& enc,
+		int stream_index,
+		const F& func,
+		const std::shared_ptr<AVFrame>& src_av_frame,
+		std::shared_ptr<void> token)
+	{
+		AVPacket pkt = {};
+		av_init_packet(&pkt);
+
+		CASPAR_SCOPE_EXIT
+		{
+			av_packet_unref(&pkt);
+		};
+
+		int got_packet = 0;
+
+		FF(func(
+			&enc,
+			&pkt,
+			src_av_frame.get(),
+			&got_packet));
+
+		if(!got_packet || pkt.size <= 0)
+			return false;
+
+		pkt.stream_index = stream_index;
+
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		delivered_ = true;
+
+		for(auto it = sinks_.begin(); it != sinks_.end(); ++it)
+			it->second(pkt, token);
+
+		return true;
+	}
+};
+
+struct encoder_session_registry : boost::noncopyable
+{
+	boost::mutex													mutex_;
+	std::map<std::string, std::weak_ptr<encoder_session>>			sessions_;
+
+	std::shared_ptr<encoder_session> open(
+		const std::string& key,
+		const std::function<std::shared_ptr<encoder_session>()>& factory)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		for(auto it = sessions_.begin(); it != sessions_.end();)
+		{
+			if(it->second.expired())
+				it = sessions_.erase(it);
+			else
+				++it;
+		}
+
+		auto it = sessions_.find(key);
+		auto session = it != sessions_.end() ? it->second.lock() : nullptr;
+
+		if(session && session->join())
+			return session;
+
+		session = factory();
+		session->join();
+		sessions_[key] = session;
+
+		return session;
+	}
+} g_encoder_sessions;
+
+std::shared_ptr<encoder_session> encoder_session::open(
+	const std::string& key,
+	const core::video_format_desc& format_desc,
+	const core::channel_layout& channel_layout,
+	const AVCodec& video_codec,
+	const AVCodec& audio_codec,
+	const std::string& video_filter,
+	const std::string& audio_filter,
+	std::map<std::string, std::string>& options)
+{
+	// Options are part of the key, so a session that is joined has already
+	// consumed them and reported the ones it did not use.
+	std::map<std::string, std::string> unused_options;
+
+	auto session = g_encoder_sessions.open(key, [&]() -> std::shared_ptr<encoder_session>
+	{
+		unused_options = options;
+
+		return std::make_shared<encoder_session>(
+			format_desc,
+			channel_layout,
+			video_codec,
+			audio_codec,
+			video_filter,
+			audio_filter,
+			unused_options);
+	});
+
+	options = std::move(unused_options);
+
+	return session;
+}
+
+// What a consumer does with new frames while queue-depth frames are being
+// encoded. Dropped frames leave a gap in the video, their audio is still
+// encoded. As they never reach the encoder, no other frame references them.
+struct queue_policy
+{
+	enum type
+	{
+		block,			// Wait for the encoders, which holds up the channel.
+		drop_oldest,	// Drop the oldest waiting frame.
+		drop_frames		// Drop the new frame.
+	};
+
+	static type parse(const std::string& name)
+	{
+		if(name == "block")
+			return block;
+		if(name == "drop-oldest")
+			return drop_oldest;
+		if(name == "drop-frames")
+			return drop_frames;
+
+		BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Invalid queue policy: " + name));
+	}
+
+	static std::wstring print(type policy)
+	{
+		switch(policy)
+		{
+			case block:			return L"block";
+			case drop_oldest:	return L"drop-oldest";
+			case drop_frames:	return L"drop-frames";
+			default:			return L"invalid";
+		}
+	}
+};
+
 class streaming_consumer sealed : public core::frame_consumer
 {
 public:
 	// Static Members
-		
+
 private:
-	
+
 	boost::filesystem::path						path_;
 	int											consumer_index_offset_;
 
 	std::map<std::string, std::string>			options_;
-												
+
 	core::video_format_desc						in_video_format_;
-	core::channel_layout						in_channel_layout_;
 
 	std::shared_ptr<AVFormatContext>			oc_;
 	tbb::atomic<bool>							abort_request_;
-												
-	std::shared_ptr<AVStream>					video_st_;
-	std::shared_ptr<AVStream>					audio_st_;
 
-	std::int64_t								video_pts_;
-	std::int64_t								audio_pts_;
-																					
-    AVFilterContext*							audio_graph_in_;  
-    AVFilterContext*							audio_graph_out_; 
-    std::shared_ptr<AVFilterGraph>				audio_graph_;    
-	std::shared_ptr<AVBitStreamFilterContext>	audio_bitstream_filter_;       
-
-    AVFilterContext*							video_graph_in_;  
-    AVFilterContext*							video_graph_out_; 
-    std::shared_ptr<AVFilterGraph>				video_graph_;  
+	AVStream*									video_st_;
+	AVStream*									audio_st_;
+
+	std::shared_ptr<encoder_session>			session_;
+	int											sink_id_;
+	bool										from_start_;
+	std::int64_t								start_time_;
+
+	std::shared_ptr<AVBitStreamFilterContext>	audio_bitstream_filter_;
 	std::shared_ptr<AVBitStreamFilterContext>	video_bitstream_filter_;
-	
+
 	executor									executor_;
 
-	executor									video_encoder_executor_;
-	executor									audio_encoder_executor_;
+	int											queue_depth_;
+	queue_policy::type							queue_policy_;
+
+	mutable boost::mutex						queue_mutex_;
+	boost::condition_variable					queue_cond_;
+	std::deque<safe_ptr<core::read_frame>>		queue_;
+	int											in_flight_;
+	bool										closed_;
+	double										encode_latency_;
+	std::int64_t								dropped_frames_;
 
-	tbb::atomic<int>							tokens_;
-	boost::mutex								tokens_mutex_;
-	boost::condition_variable					tokens_cond_;
+	tbb::atomic<int>							mux_depth_;
 
 	executor									write_executor_;
-	
+
 public:
 
 	streaming_consumer(
-		std::string path, 
+		std::string path,
 		std::string options)
 		: path_(path)
 		, consumer_index_offset_(crc16(path))
-		, video_pts_(0)
-		, audio_pts_(0)
+		, video_st_(nullptr)
+		, audio_st_(nullptr)
+		, sink_id_(-1)
+		, from_start_(false)
+		, start_time_(AV_NOPTS_VALUE)
 		, executor_(print())
-		, audio_encoder_executor_(print() + L" audio_encoder")
-		, video_encoder_executor_(print() + L" video_encoder")
+		, queue_policy_(queue_policy::block)
+		, in_flight_(0)
+		, closed_(false)
+		, encode_latency_(0.0)
+		, dropped_frames_(0)
 		, write_executor_(print() + L" io")
-	{		
-		abort_request_ = false;	
+	{
+		abort_request_ = false;
+		mux_depth_ = 0;
 
-		for(auto it = 
+		for(auto it =
 				boost::sregex_iterator(
-					options.begin(), 
-					options.end(), 
-					boost::regex("-(?<NAME>[^-\\s]+)(\\s+(?<VALUE>[^\\s]+))?")); 
-			it != boost::sregex_iterator(); 
+					options.begin(),
+					options.end(),
+					boost::regex("-(?<NAME>[^-\\s]+)(\\s+(?<VALUE>[^\\s]+))?"));
+			it != boost::sregex_iterator();
 			++it)
-		{				
+		{
 			options_[(*it)["NAME"].str()] = (*it)["VALUE"].matched ? (*it)["VALUE"].str() : "";
 		}
-										
+
         if (options_.find("threads") == options_.end())
             options_["threads"] = "auto";
 
-		tokens_ = 
+		queue_depth_ =
 			std::max(
-				1, 
+				1,
 				try_remove_arg<int>(
-					options_, 
-					boost::regex("tokens")).get_value_or(2));		
+					options_,
+					boost::regex("^queue|tokens$")).get_value_or(2));
 	}
-		
+
 	~streaming_consumer()
 	{
-		if(oc_)
 		{
-			video_encoder_executor_.begin_invoke([&] { encode_video(nullptr, nullptr); });
-			audio_encoder_executor_.begin_invoke([&] { encode_audio(nullptr, nullptr); });
+			boost::lock_guard<boost::mutex> lock(queue_mutex_);
+			closed_ = true;
+			queue_.clear();
+		}
+
+		queue_cond_.notify_all();
+
+		executor_.stop();
+		executor_.join();
+
+		// The tokens of frames that are still being encoded refer to this.
+		{
+			boost::unique_lock<boost::mutex> lock(queue_mutex_);
+
+			while(in_flight_ > 0)
+				queue_cond_.wait(lock);
+		}
 
-			video_encoder_executor_.stop();
-			audio_encoder_executor_.stop();
-			video_encoder_executor_.join();
-			audio_encoder_executor_.join();
+		if(session_)
+		{
+			session_->leave(sink_id_);
 
-			video_graph_.reset();
-			audio_graph_.reset();
-			video_st_.reset();
-			audio_st_.reset();
+			boost::lock_guard<boost::mutex> lock(queue_mutex_);
+			session_.reset();
+		}
 
+		if(oc_)
+		{
 			write_packet(nullptr, nullptr);
 
 			write_executor_.stop();
@@ -190,85 +1237,104 @@ public:
 		const core::channel_layout& audio_channel_layout,
 		int channel_index) override
 	{
+		// The output initializes again on a send failure or a format change,
+		// the old sink refers to this.
+		if(session_)
+		{
+			session_->leave(sink_id_);
+
+			boost::lock_guard<boost::mutex> lock(queue_mutex_);
+			session_.reset();
+			sink_id_ = -1;
+		}
+
 		try
-		{				
+		{
 			static boost::regex prot_exp("^.+:.*" );
-			
-			const auto overwrite = 
+
+			const auto overwrite =
 				try_remove_arg<std::string>(
 					options_,
 					boost::regex("y")) != nullptr;
 
 			if(!boost::regex_match(
-					path_.string(), 
+					path_.string(),
 					prot_exp))
 			{
 				if(!path_.is_complete())
 				{
-					path_ = 
+					path_ =
 						narrow(
-							env::media_folder()) + 
+							env::media_folder()) +
 							path_.string();
 				}
-			
+
 				if(boost::filesystem::exists(path_))
 				{
 					if(!overwrite)
 						BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("File exists"));
-						
+
 					boost::filesystem::remove(path_);
 				}
 			}
-							
-			const auto oformat_name = 
+
+			// Recordings rather wait than lose frames, streams rather lose
+			// frames than fall behind.
+			queue_policy_ =
+				queue_policy::parse(
+					try_remove_arg<std::string>(
+						options_,
+						boost::regex("^policy$")).get_value_or(
+							boost::regex_match(path_.string(), prot_exp) ? "drop-frames" : "block"));
+
+			const auto oformat_name =
 				try_remove_arg<std::string>(
-					options_, 
+					options_,
 					boost::regex("^f|format$"));
-			
+
 			AVFormatContext* oc;
 
 			FF(avformat_alloc_output_context2(
-				&oc, 
-				nullptr, 
-				oformat_name && !oformat_name->empty() ? oformat_name->c_str() : nullptr, 
+				&oc,
+				nullptr,
+				oformat_name && !oformat_name->empty() ? oformat_name->c_str() : nullptr,
 				path_.string().c_str()));
 
 			oc_.reset(
-				oc, 
+				oc,
 				avformat_free_context);
-					
+
 			CASPAR_VERIFY(oc_->oformat);
 
 			oc_->interrupt_callback.callback = streaming_consumer::interrupt_cb;
-			oc_->interrupt_callback.opaque   = this;	
+			oc_->interrupt_callback.opaque   = this;
 
 			CASPAR_VERIFY(format_desc.format != core::video_format::invalid);
 
 			in_video_format_ = format_desc;
-			in_channel_layout_ = audio_channel_layout;
-							
+
 			CASPAR_VERIFY(oc_->oformat);
-			
-			const auto video_codec_name = 
+
+			const auto video_codec_name =
 				try_remove_arg<std::string>(
-					options_, 
+					options_,
 					boost::regex("^c:v|codec:v|vcodec$"));
 
-			const auto video_codec = 
-				video_codec_name 
+			const auto video_codec =
+				video_codec_name
 					? avcodec_find_encoder_by_name(video_codec_name->c_str())
 					: avcodec_find_encoder(oc_->oformat->video_codec);
-						
-			const auto audio_codec_name = 
+
+			const auto audio_codec_name =
 				try_remove_arg<std::string>(
-					options_, 
+					options_,
 					 boost::regex("^c:a|codec:a|acodec$"));
-			
-			const auto audio_codec = 
-				audio_codec_name 
+
+			const auto audio_codec =
+				audio_codec_name
 					? avcodec_find_encoder_by_name(audio_codec_name->c_str())
 					: avcodec_find_encoder(oc_->oformat->audio_codec);
-			
+
 			if (!video_codec)
 				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info(
 						"Failed to find video codec " + (video_codec_name
@@ -281,20 +1347,14 @@ public:
 								? *audio_codec_name
 								: "with id " + boost::lexical_cast<std::string>(
 										oc_->oformat->audio_codec))));
-			
-			// Filters
 
-			{
-				configure_video_filters(
-					*video_codec, 
-					try_remove_arg<std::string>(options_, 
-					boost::regex("vf|f:v|filter:v")).get_value_or(""));
-
-				configure_audio_filters(
-					*audio_codec, 
-					try_remove_arg<std::string>(options_,
-					boost::regex("af|f:a|filter:a")).get_value_or(""));
-			}
+			const auto video_filter =
+				try_remove_arg<std::string>(options_,
+				boost::regex("vf|f:v|filter:v")).get_value_or("");
+
+			const auto audio_filter =
+				try_remove_arg<std::string>(options_,
+				boost::regex("af|f:a|filter:a")).get_value_or("");
 
 			// Bistream Filters
 			{
@@ -305,25 +1365,53 @@ public:
 			// Encoders
 
 			{
-				auto video_options = options_;
-				auto audio_options = options_;
-
-				video_st_ = open_encoder(
-					*video_codec, 
-					video_options);
-
-				audio_st_ = open_encoder(
-					*audio_codec, 
-					audio_options);
+				std::map<std::string, std::string> codec_options;
 
 				auto it = options_.begin();
 				while(it != options_.end())
 				{
-					if(video_options.find(it->first) == video_options.end() || audio_options.find(it->first) == audio_options.end())
+					if(is_codec_option(it->first, *video_codec, *audio_codec))
+					{
+						codec_options.insert(*it);
 						it = options_.erase(it);
+					}
 					else
 						++it;
 				}
+
+				// Only the primary feeds the session, the others share its
+				// queue, so consumers with a different policy or depth get a
+				// session of their own.
+				std::stringstream key;
+				key << channel_index << "|" << narrow(format_desc.name) << "|" << audio_channel_layout.num_channels << "|" << narrow(audio_channel_layout.name)
+					<< "|" << video_codec->name << "|" << audio_codec->name << "|" << video_filter << "|" << audio_filter
+					<< "|" << narrow(queue_policy::print(queue_policy_)) << "|" << queue_depth_;
+
+				BOOST_FOREACH(const auto& option, codec_options)
+					key << "|" << option.first << "=" << option.second;
+
+				session_ = encoder_session::open(
+					key.str(),
+					format_desc,
+					audio_channel_layout,
+					*video_codec,
+					*audio_codec,
+					video_filter,
+					audio_filter,
+					codec_options);
+
+				options_.insert(codec_options.begin(), codec_options.end());
+
+				video_st_ = add_stream(session_->video_encoder());
+				audio_st_ = add_stream(session_->audio_encoder());
+
+				// Without global headers in the container, repeat them in front of keyframes.
+				if (!(oc_->oformat->flags & AVFMT_GLOBALHEADER) && !video_bitstream_filter_ && session_->video_encoder().extradata_size > 0)
+				{
+					video_bitstream_filter_.reset(
+						av_bitstream_filter_init("dump_extra"),
+						av_bitstream_filter_close);
+				}
 			}
 
 			// Output
@@ -331,7 +1419,7 @@ public:
 				AVDictionary* av_opts = nullptr;
 
 				to_dict(
-					&av_opts, 
+					&av_opts,
 					std::move(options_));
 
 				CASPAR_SCOPE_EXIT
@@ -339,864 +1427,463 @@ public:
 					av_dict_free(&av_opts);
 				};
 
-				if (!(oc_->oformat->flags & AVFMT_NOFILE)) 
+				if (!(oc_->oformat->flags & AVFMT_NOFILE))
 				{
 					FF(avio_open2(
-						&oc_->pb, 
-						path_.string().c_str(), 
-						AVIO_FLAG_WRITE, 
-						&oc_->interrupt_callback, 
+						&oc_->pb,
+						path_.string().c_str(),
+						AVIO_FLAG_WRITE,
+						&oc_->interrupt_callback,
 						&av_opts));
 				}
-				
+
 				FF(avformat_write_header(
-					oc_.get(), 
+					oc_.get(),
 					&av_opts));
-				
+
 				options_ = to_map(av_opts);
 			}
 
 			// Dump Info
-			
+
 			av_dump_format(
-				oc_.get(), 
-				0, 
-				oc_->filename, 
-				1);		
+				oc_.get(),
+				0,
+				oc_->filename,
+				1);
 
 			BOOST_FOREACH(const auto& option, options_)
 			{
-				CASPAR_LOG(warning) 
-					<< L"Invalid option: -" 
-					<< widen(option.first) 
-					<< L" " 
+				CASPAR_LOG(warning)
+					<< L"Invalid option: -"
+					<< widen(option.first)
+					<< L" "
 					<< widen(option.second);
 			}
+
+			sink_id_ = session_->attach([this](const AVPacket& packet, const std::shared_ptr<void>& token)
+			{
+				on_packet(
+					packet,
+					token);
+			}, from_start_);
+
+			CASPAR_LOG(info) << print() << L" Attached to " << session_->print() << L".";
 		}
 		catch(...)
 		{
-			video_st_.reset();
-			audio_st_.reset();
+			if(session_)
+			{
+				session_->leave(sink_id_);
+				session_.reset();
+			}
+
+			video_st_ = nullptr;
+			audio_st_ = nullptr;
 			oc_.reset();
 			throw;
 		}
 	}
 
 	boost::unique_future<bool> send(const safe_ptr<core::read_frame>& frame) override
-	{		
+	{
 		CASPAR_VERIFY(in_video_format_.format != core::video_format::invalid);
-		
-		--tokens_;
-		std::shared_ptr<void> token(
-			nullptr, 
-			[this](void*)
-			{
-				++tokens_;
-				tokens_cond_.notify_one();
-			});
-
-		return executor_.begin_invoke([=]() -> bool
-		{
-			boost::unique_lock<boost::mutex> tokens_lock(tokens_mutex_);
 
-			while(tokens_ < 0)
-				tokens_cond_.wait(tokens_lock);
+		// The other consumers of the session get the same frames, with the
+		// same policy and queue depth.
+		if(!session_->is_primary(sink_id_))
+			return wrap_as_future(true);
 
-			video_encoder_executor_.begin_invoke([=]() mutable
-			{
-				encode_video(
-					frame, 
-					token);
-			});
-		
-			audio_encoder_executor_.begin_invoke([=]() mutable
+		if(queue_policy_ == queue_policy::block)
+		{
+			return executor_.begin_invoke([=]() -> bool
 			{
-				encode_audio(
-					frame, 
-					token);
-			});
-				
-			return true;
-		});
-	}
-
-	std::wstring print() const override
-	{
-		return L"streaming_consumer[" + widen(path_.string()) + L"]";
-	}
-	
-	virtual boost::property_tree::wptree info() const override
-	{
-		return boost::property_tree::wptree();
-	}
-
-	bool has_synchronization_clock() const override
-	{
-		return false;
-	}
-
-	int buffer_depth() const override
-	{
-		return -1;
-	}
-
-	int index() const override
-	{
-		return 100000 + consumer_index_offset_;
-	}
+				std::shared_ptr<encoder_session> session;
+				std::vector<safe_ptr<core::read_frame>> frames;
+				{
+					boost::unique_lock<boost::mutex> lock(queue_mutex_);
 
-	int64_t presentation_frame_age_millis() const override
-	{
-		return 0;
-	}
+					while(in_flight_ >= queue_depth_ && !closed_)
+						queue_cond_.wait(lock);
 
-private:
+					queue_.push_back(frame);
 
-	static int interrupt_cb(void* ctx)
-	{
-		CASPAR_ASSERT(ctx);
-		return reinterpret_cast<streaming_consumer*>(ctx)->abort_request_;		
-	}
-		
-	std::shared_ptr<AVStream> open_encoder(
-		const AVCodec& codec, 
-		std::map<std::string, 
-		std::string>& options)
-	{			
-		auto st = 
-			avformat_new_stream(
-				oc_.get(), 
-				&codec);
+					session = session_;
+					frames = take_ready_frames();
+				}
 
-		if (!st) 		
-			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Could not allocate video-stream.") << boost::errinfo_api_function("av_new_stream"));	
+				encode(
+					session,
+					frames);
 
-		auto enc = st->codec;
-				
-		CASPAR_VERIFY(enc);
-						
-		switch(enc->codec_type)
-		{
-			case AVMEDIA_TYPE_VIDEO:
-			{				
-				enc->time_base			  = video_graph_out_->inputs[0]->time_base;
-				enc->pix_fmt			  = static_cast<AVPixelFormat>(video_graph_out_->inputs[0]->format);
-				enc->sample_aspect_ratio  = st->sample_aspect_ratio = video_graph_out_->inputs[0]->sample_aspect_ratio;
-				enc->width				  = video_graph_out_->inputs[0]->w;
-				enc->height				  = video_graph_out_->inputs[0]->h;
-			
-				break;
-			}
-			case AVMEDIA_TYPE_AUDIO:
-			{
-				enc->time_base			  = audio_graph_out_->inputs[0]->time_base;
-				enc->sample_fmt			  = static_cast<AVSampleFormat>(audio_graph_out_->inputs[0]->format);
-				enc->sample_rate		  = audio_graph_out_->inputs[0]->sample_rate;
-				enc->channel_layout		  = audio_graph_out_->inputs[0]->channel_layout;
-				enc->channels			  = audio_graph_out_->inputs[0]->channels;
-			
-				break;
-			}
+				return true;
+			});
 		}
-										
-		if(oc_->oformat->flags & AVFMT_GLOBALHEADER)
-			enc->flags |= CODEC_FLAG_GLOBAL_HEADER;
-		
-		static const std::array<std::string, 4> char_id_map = {{"v", "a", "d", "s"}};
-
-		const auto char_id = char_id_map.at(enc->codec_type);
-								
-		const auto codec_opts = 
-			remove_options(
-				options, 
-				boost::regex("^(" + char_id + "?[^:]+):" + char_id + "$"));
-		
-		AVDictionary* av_codec_opts = nullptr;
-
-		to_dict(
-			&av_codec_opts, 
-			options);
-
-		to_dict(
-			&av_codec_opts,
-			codec_opts);
-
-		options.clear();
-		
-		FF(avcodec_open2(
-			enc,		
-			&codec, 
-			av_codec_opts ? &av_codec_opts : nullptr));		
 
-		if(av_codec_opts)
+		std::shared_ptr<encoder_session> session;
+		std::vector<safe_ptr<core::read_frame>> frames;
 		{
-			auto t = 
-				av_dict_get(
-					av_codec_opts, 
-					"", 
-					 nullptr, 
-					AV_DICT_IGNORE_SUFFIX);
+			boost::lock_guard<boost::mutex> lock(queue_mutex_);
 
-			while(t)
+			if(closed_)
+				return wrap_as_future(true);
+
+			if(queue_.size() >= static_cast<size_t>(queue_depth_))
 			{
-				options[t->key + (codec_opts.find(t->key) != codec_opts.end() ? ":" + char_id : "")] = t->value;
+				++dropped_frames_;
 
-				t = av_dict_get(
-						av_codec_opts, 
-						"", 
-						t, 
-						AV_DICT_IGNORE_SUFFIX);
+				if(queue_policy_ == queue_policy::drop_oldest)
+				{
+					session_->drop_video(queue_.front(), nullptr);
+					queue_.pop_front();
+					queue_.push_back(frame);
+				}
+				else
+					session_->drop_video(frame, nullptr);
 			}
+			else
+				queue_.push_back(frame);
 
-			av_dict_free(&av_codec_opts);
-		}
-				
-		if(enc->codec_type == AVMEDIA_TYPE_AUDIO && !(codec.capabilities & CODEC_CAP_VARIABLE_FRAME_SIZE))
-		{
-			CASPAR_ASSERT(enc->frame_size > 0);
-			av_buffersink_set_frame_size(audio_graph_out_, 
-										 enc->frame_size);
+			session = session_;
+			frames = take_ready_frames();
 		}
-		
-		return std::shared_ptr<AVStream>(st, [this](AVStream* st)
-		{
-			avcodec_close(st->codec);
-		});
-	}
-
-	void configue_audio_bistream_filters(std::map<std::string, std::string>& options)
-	{
-		const auto audio_bitstream_filter_str = 
-			try_remove_arg<std::string>(
-				options, 
-				boost::regex("^bsf:a|absf$"));
-
-		const auto audio_bitstream_filter = 
-			audio_bitstream_filter_str 
-				? av_bitstream_filter_init(audio_bitstream_filter_str->c_str()) 
-				: nullptr;
 
-		CASPAR_VERIFY(!audio_bitstream_filter_str || audio_bitstream_filter);
+		encode(
+			session,
+			frames);
 
-		if(audio_bitstream_filter)
-		{
-			audio_bitstream_filter_.reset(
-				audio_bitstream_filter, 
-				av_bitstream_filter_close);
-		}
-		
-		if(audio_bitstream_filter_str && !audio_bitstream_filter_)
-			options["bsf:a"] = *audio_bitstream_filter_str;
+		return wrap_as_future(true);
 	}
-	
-	void configue_video_bistream_filters(
-		std::map<std::string, std::string>& options)
-	{
-		const auto video_bitstream_filter_str = 
-				try_remove_arg<std::string>(
-					options, 
-					boost::regex("^bsf:v|vbsf$"));
-
-		const auto video_bitstream_filter = 
-			video_bitstream_filter_str 
-				? av_bitstream_filter_init(video_bitstream_filter_str->c_str()) 
-				: nullptr;
-
-		CASPAR_VERIFY(!video_bitstream_filter_str || video_bitstream_filter);
 
-		if(video_bitstream_filter)
-		{
-			video_bitstream_filter_.reset(
-				video_bitstream_filter, 
-				av_bitstream_filter_close);
-		}
-		
-		if(video_bitstream_filter_str && !video_bitstream_filter_)
-			options["bsf:v"] = *video_bitstream_filter_str;
-	}
-	
-	void configure_video_filters(
-		const AVCodec& codec, 
-		const std::string& filtergraph)
+	std::wstring print() const override
 	{
-		video_graph_.reset(
-			avfilter_graph_alloc(), 
-			[](AVFilterGraph* p)
-			{
-				avfilter_graph_free(&p);
-			});
-		
-		video_graph_->nb_threads  = boost::thread::hardware_concurrency()/2;
-		video_graph_->thread_type = AVFILTER_THREAD_SLICE;
-
-		const auto sample_aspect_ratio = 
-			boost::rational<int>(
-				in_video_format_.square_width, 
-				in_video_format_.square_height) /
-			boost::rational<int>(
-				in_video_format_.width, 
-				in_video_format_.height);
-		
-		const auto vsrc_options = (boost::format("video_size=%1%x%2%:pix_fmt=%3%:time_base=%4%/%5%:pixel_aspect=%6%/%7%:frame_rate=%8%/%9%")
-			% in_video_format_.width % in_video_format_.height
-			% AV_PIX_FMT_BGRA
-			% in_video_format_.duration	% in_video_format_.time_scale
-			% sample_aspect_ratio.numerator() % sample_aspect_ratio.denominator()
-			% in_video_format_.time_scale % in_video_format_.duration).str();
-					
-		AVFilterContext* filt_vsrc = nullptr;			
-		FF(avfilter_graph_create_filter(
-			&filt_vsrc,
-			avfilter_get_by_name("buffer"), 
-			"ffmpeg_consumer_buffer",
-			vsrc_options.c_str(), 
-			nullptr, 
-			video_graph_.get()));
-				
-		AVFilterContext* filt_vsink = nullptr;
-		FF(avfilter_graph_create_filter(
-			&filt_vsink,
-			avfilter_get_by_name("buffersink"), 
-			"ffmpeg_consumer_buffersink",
-			nullptr, 
-			nullptr, 
-			video_graph_.get()));
-		
-#pragma warning (push)
-#pragma warning (disable : 4245)
-
-		FF(av_opt_set_int_list(
-			filt_vsink, 
-			"pix_fmts", 
-			codec.pix_fmts, 
-			-1,
-			AV_OPT_SEARCH_CHILDREN));
-
-#pragma warning (pop)
-			
-		configure_filtergraph(
-			*video_graph_, 
-			filtergraph,
-			*filt_vsrc,
-			*filt_vsink);
-
-		video_graph_in_  = filt_vsrc;
-		video_graph_out_ = filt_vsink;
-		
-		CASPAR_LOG(info)
-			<< 	widen(std::string("\n") 
-				+ avfilter_graph_dump(
-						video_graph_.get(), 
-						nullptr));
+		return L"streaming_consumer[" + widen(path_.string()) + L"]";
 	}
 
-	void configure_audio_filters(
-		const AVCodec& codec,
-		const std::string& filtergraph)
+	virtual boost::property_tree::wptree info() const override
 	{
-		audio_graph_.reset(
-			avfilter_graph_alloc(), 
-			[](AVFilterGraph* p)
-			{
-				avfilter_graph_free(&p);
-			});
-		
-		audio_graph_->nb_threads  = boost::thread::hardware_concurrency()/2;
-		audio_graph_->thread_type = AVFILTER_THREAD_SLICE;
-		
-		const auto asrc_options = (boost::format("sample_rate=%1%:sample_fmt=%2%:channels=%3%:time_base=%4%/%5%:channel_layout=%6%")
-			% in_video_format_.audio_sample_rate
-			% av_get_sample_fmt_name(AV_SAMPLE_FMT_S32)
-			% in_channel_layout_.num_channels
-			% 1	% in_video_format_.audio_sample_rate
-			% boost::io::group(
-				std::hex, 
-				std::showbase, 
-				av_get_default_channel_layout(in_channel_layout_.num_channels))).str();				
-
-		AVFilterContext* filt_asrc = nullptr;
-		FF(avfilter_graph_create_filter(
-			&filt_asrc,
-			avfilter_get_by_name("abuffer"), 
-			"ffmpeg_consumer_abuffer",
-			asrc_options.c_str(), 
-			nullptr, 
-			audio_graph_.get()));
-				
-		AVFilterContext* filt_asink = nullptr;
-		FF(avfilter_graph_create_filter(
-			&filt_asink,
-			avfilter_get_by_name("abuffersink"), 
-			"ffmpeg_consumer_abuffersink",
-			nullptr, 
-			nullptr, 
-			audio_graph_.get()));
-		
-#pragma warning (push)
-#pragma warning (disable : 4245)
-
-		FF(av_opt_set_int(
-			filt_asink,	   
-			"all_channel_counts",
-			1,	
-			AV_OPT_SEARCH_CHILDREN));
-
-		FF(av_opt_set_int_list(
-			filt_asink, 
-			"sample_fmts",		 
-			codec.sample_fmts,				
-			-1, 
-			AV_OPT_SEARCH_CHILDREN));
+		boost::lock_guard<boost::mutex> lock(queue_mutex_);
+
+		boost::property_tree::wptree info;
+		info.add(L"type",				L"streaming-consumer");
+		info.add(L"path",				widen(path_.string()));
+		info.add(L"primary",			session_ && session_->is_primary(sink_id_));
+		info.add(L"queue-policy",		queue_policy::print(queue_policy_));
+		info.add(L"queue-depth",		queue_depth_);
+		info.add(L"queued-frames",		queue_.size());
+		info.add(L"encoding-frames",	in_flight_);
+		info.add(L"muxing-packets",		mux_depth_);
+		info.add(L"encode-latency",		static_cast<int>(encode_latency_ * 1000.0));
+		info.add(L"dropped-frames",		dropped_frames_);
+		return info;
+	}
 
-		FF(av_opt_set_int_list(
-			filt_asink,
-			"channel_layouts",	 
-			codec.channel_layouts,			
-			-1, 
-			AV_OPT_SEARCH_CHILDREN));
+	bool has_synchronization_clock() const override
+	{
+		return false;
+	}
 
-		FF(av_opt_set_int_list(
-			filt_asink, 
-			"sample_rates" ,	 
-			codec.supported_samplerates,	
-			-1, 
-			AV_OPT_SEARCH_CHILDREN));
+	// Only a block queue policy may hold back the channel, see send().
+	core::consumer_send_policy::type send_policy() const override
+	{
+		return queue_policy_ == queue_policy::block ? core::consumer_send_policy::block : core::consumer_send_policy::drop;
+	}
 
-#pragma warning (pop)
-			
-		configure_filtergraph(
-			*audio_graph_, 
-			filtergraph, 
-			*filt_asrc, 
-			*filt_asink);
+	int buffer_depth() const override
+	{
+		return -1;
+	}
 
-		audio_graph_in_  = filt_asrc;
-		audio_graph_out_ = filt_asink;
+	int index() const override
+	{
+		return 100000 + consumer_index_offset_;
+	}
 
-		CASPAR_LOG(info) 
-			<< 	widen(std::string("\n") 
-				+ avfilter_graph_dump(
-					audio_graph_.get(), 
-					nullptr));
+	int64_t presentation_frame_age_millis() const override
+	{
+		return 0;
 	}
 
-	void configure_filtergraph(
-		AVFilterGraph& graph, 
-		const std::string& filtergraph, 
-		AVFilterContext& source_ctx, 
-		AVFilterContext& sink_ctx)
+private:
+
+	static int interrupt_cb(void* ctx)
 	{
-		AVFilterInOut* outputs = nullptr;
-		AVFilterInOut* inputs = nullptr;
+		CASPAR_ASSERT(ctx);
+		return reinterpret_cast<streaming_consumer*>(ctx)->abort_request_;
+	}
 
-		try
-		{
-			if(!filtergraph.empty())
-			{
-				outputs = avfilter_inout_alloc();
-				inputs  = avfilter_inout_alloc();
-
-				CASPAR_VERIFY(outputs && inputs);
-
-				outputs->name       = av_strdup("in");
-				outputs->filter_ctx = &source_ctx;
-				outputs->pad_idx    = 0;
-				outputs->next       = nullptr;
-
-				inputs->name        = av_strdup("out");
-				inputs->filter_ctx  = &sink_ctx;
-				inputs->pad_idx     = 0;
-				inputs->next        = nullptr;
-
-				FF(avfilter_graph_parse(
-					&graph, 
-					filtergraph.c_str(), 
-					inputs, 
-					outputs, 
-					nullptr));
-			} 
-			else 
-			{
-				FF(avfilter_link(
-					&source_ctx, 
-					0, 
-					&sink_ctx, 
-					0));
-			}
+	// The waiting frames that can be encoded while fewer than queue-depth
+	// frames are being encoded. Called with queue_mutex_ held.
+	std::vector<safe_ptr<core::read_frame>> take_ready_frames()
+	{
+		std::vector<safe_ptr<core::read_frame>> frames;
 
-			FF(avfilter_graph_config(
-				&graph, 
-				nullptr));
-		}
-		catch(...)
+		while(!closed_ && in_flight_ < queue_depth_ && !queue_.empty())
 		{
-			avfilter_inout_free(&outputs);
-			avfilter_inout_free(&inputs);
-			throw;
+			++in_flight_;
+			frames.push_back(queue_.front());
+			queue_.pop_front();
 		}
+
+		return frames;
 	}
-	
-	void encode_video(
-		const std::shared_ptr<core::read_frame>& frame_ptr, 
-		std::shared_ptr<void> token)
-	{		
-		if(!video_st_)
-			return;
-		
-		auto enc = video_st_->codec;
-			
-		std::shared_ptr<AVFrame> src_av_frame;
 
-		if(frame_ptr)
+	// A frame is being encoded until the last packet made from it has been
+	// written, which is also when its latency is measured. Must not be
+	// called with queue_mutex_ held, as the token may be released here.
+	void encode(const std::shared_ptr<encoder_session>& session, const std::vector<safe_ptr<core::read_frame>>& frames)
+	{
+		BOOST_FOREACH(auto& frame, frames)
 		{
-			src_av_frame.reset(
-				av_frame_alloc(),
-				[frame_ptr](AVFrame* frame)
+			boost::timer latency_timer;
+
+			std::shared_ptr<void> token(
+				nullptr,
+				[this, latency_timer](void*)
 				{
-					av_frame_free(&frame);
-				});
-			
-			const auto sample_aspect_ratio = 
-				boost::rational<int>(
-					in_video_format_.square_width, 
-					in_video_format_.square_height) /
-				boost::rational<int>(
-					in_video_format_.width, 
-					in_video_format_.height);
+					std::shared_ptr<encoder_session> session;
+					std::vector<safe_ptr<core::read_frame>> frames;
+					{
+						boost::lock_guard<boost::mutex> lock(queue_mutex_);
 
-			src_av_frame->format				  = AV_PIX_FMT_BGRA;
-			src_av_frame->width					  = in_video_format_.width;
-			src_av_frame->height				  = in_video_format_.height;
-			src_av_frame->sample_aspect_ratio.num = sample_aspect_ratio.numerator();
-			src_av_frame->sample_aspect_ratio.den = sample_aspect_ratio.denominator();
-			src_av_frame->pts					  = video_pts_;
+						--in_flight_;
+						encode_latency_ = encode_latency_ * 0.9 + latency_timer.elapsed() * 0.1;
 
-			video_pts_ += 1;
+						session = session_;
+						frames = take_ready_frames();
 
-			FF(av_image_fill_arrays(
-				src_av_frame->data,
-				src_av_frame->linesize,
-				frame_ptr->image_data().begin(),
-				static_cast<AVPixelFormat>(src_av_frame->format), 
-				in_video_format_.width, 
-				in_video_format_.height, 
-				1));
+						queue_cond_.notify_all();
+					}
 
-			FF(av_buffersrc_add_frame(
-				video_graph_in_, 
-				src_av_frame.get()));
-		}		
+					if(!frames.empty())
+					{
+						encode(
+							session,
+							frames);
+					}
+				});
 
-		int ret = 0;
+			session->send(
+				frame,
+				token);
+		}
+	}
 
-		while(ret >= 0)
-		{
-			std::shared_ptr<AVFrame> filt_frame(
-				av_frame_alloc(), 
-				[](AVFrame* p)
-				{
-					av_frame_free(&p);
-				});
+	AVStream* add_stream(const AVCodecContext& enc)
+	{
+		auto st =
+			avformat_new_stream(
+				oc_.get(),
+				nullptr);
 
-			ret = av_buffersink_get_frame(
-				video_graph_out_, 
-				filt_frame.get());
-						
-			video_encoder_executor_.begin_invoke([=]
-			{
-				if(ret == AVERROR_EOF)
-				{
-					if(enc->codec->capabilities & CODEC_CAP_DELAY)
-					{
-						while(encode_av_frame(
-								*video_st_, 
-								video_bitstream_filter_.get(),
-								avcodec_encode_video2, 
-								nullptr, token))
-						{
-							boost::this_thread::yield(); // TODO:
-						}
-					}		
-				}
-				else if(ret != AVERROR(EAGAIN))
-				{
-					FF_RET(ret, "av_buffersink_get_frame");
-					
-					if (filt_frame->interlaced_frame) 
-					{
-						if (enc->codec->id == AV_CODEC_ID_MJPEG)
-							enc->field_order = filt_frame->top_field_first ? AV_FIELD_TT : AV_FIELD_BB;
-						else
-							enc->field_order = filt_frame->top_field_first ? AV_FIELD_TB : AV_FIELD_BT;
-					} 
-					else
-						enc->field_order = AV_FIELD_PROGRESSIVE;
+		if (!st)
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Could not allocate stream.") << boost::errinfo_api_function("avformat_new_stream"));
 
-					filt_frame->quality = enc->global_quality;
+		FF(avcodec_parameters_from_context(
+			st->codecpar,
+			&enc));
 
-					if (!enc->me_threshold)
-						filt_frame->pict_type = AV_PICTURE_TYPE_NONE;
-			
-					encode_av_frame(
-						*video_st_,
-						video_bitstream_filter_.get(),
-						avcodec_encode_video2,
-						filt_frame, 
-						token);
+		st->time_base			= enc.time_base;
+		st->sample_aspect_ratio = enc.sample_aspect_ratio;
 
-					boost::this_thread::yield(); // TODO:
-				}
-			});
-		}
+		return st;
 	}
-					
-	void encode_audio(
-		const std::shared_ptr<core::read_frame>& frame_ptr, 
-		std::shared_ptr<void> token)
-	{		
-		if(!audio_st_)
-			return;
-		
-		auto enc = audio_st_->codec;
-			
-		std::shared_ptr<AVFrame> src_av_frame;
-
-		if(frame_ptr)
-		{
-			src_av_frame.reset(
-				av_frame_alloc(), 
-				[](AVFrame* p)
-				{
-					av_frame_free(&p);
-				});
-		
-			src_av_frame->channels		 = frame_ptr->num_channels();
-			src_av_frame->channel_layout = av_get_default_channel_layout(frame_ptr->num_channels());
-			src_av_frame->sample_rate	 = in_video_format_.audio_sample_rate;
-			src_av_frame->nb_samples	 = frame_ptr->audio_data().size() / src_av_frame->channels;
-			src_av_frame->format		 = AV_SAMPLE_FMT_S32;
-			src_av_frame->pts			 = audio_pts_;
 
-			audio_pts_ += src_av_frame->nb_samples;
+	// Called by the session as packets are encoded. A consumer that attaches
+	// to a running session starts at the next video keyframe, the first one
+	// starts at 0 so that audio encoded ahead of the delayed first video
+	// packet is kept.
+	void on_packet(
+		const AVPacket& packet,
+		const std::shared_ptr<void>& token)
+	{
+		const bool is_video = packet.stream_index == 0;
 
-			FF(av_samples_fill_arrays(
-				src_av_frame->extended_data, 
-				src_av_frame->linesize,
-				reinterpret_cast<const std::uint8_t*>(&*frame_ptr->audio_data().begin()), 
-				src_av_frame->channels,
-				src_av_frame->nb_samples, 
-				static_cast<AVSampleFormat>(src_av_frame->format), 
-				16)); 					
-		
-			FF(av_buffersrc_add_frame(
-				audio_graph_in_, 
-				src_av_frame.get()));
-		}
+		const auto& enc = is_video ? session_->video_encoder() : session_->audio_encoder();
+		const auto	st	= is_video ? video_st_ : audio_st_;
+		const auto	ts	= packet.dts != AV_NOPTS_VALUE ? packet.dts : packet.pts;
 
-		int ret = 0;
+		if(start_time_ == AV_NOPTS_VALUE && from_start_)
+			start_time_ = 0;
 
-		while(ret >= 0)
+		if(start_time_ == AV_NOPTS_VALUE)
 		{
-			std::shared_ptr<AVFrame> filt_frame(
-				av_frame_alloc(), 
-				[](AVFrame* p)
-				{
-					av_frame_free(&p);
-				});
+			if(!is_video || !(packet.flags & AV_PKT_FLAG_KEY) || ts == AV_NOPTS_VALUE)
+				return;
 
-			ret = av_buffersink_get_frame(
-				audio_graph_out_, 
-				filt_frame.get());
-					
-			audio_encoder_executor_.begin_invoke([=]
-			{	
-				if(ret == AVERROR_EOF)
-				{
-					if(enc->codec->capabilities & CODEC_CAP_DELAY)
-					{
-						while(encode_av_frame(
-								*audio_st_, 
-								audio_bitstream_filter_.get(), 
-								avcodec_encode_audio2, 
-								nullptr, 
-								token))
-						{
-							boost::this_thread::yield(); // TODO:
-						}
-					}
-				}
-				else if(ret != AVERROR(EAGAIN))
-				{
-					FF_RET(
-						ret, 
-						"av_buffersink_get_frame");
+			start_time_ = av_rescale_q(ts, enc.time_base, AV_TIME_BASE_Q);
+		}
 
-					encode_av_frame(
-						*audio_st_, 
-						audio_bitstream_filter_.get(), 
-						avcodec_encode_audio2, 
-						filt_frame, 
-						token);
+		const auto offset = av_rescale_q(start_time_, AV_TIME_BASE_Q, enc.time_base);
 
-					boost::this_thread::yield(); // TODO:
-				}
+		if(ts != AV_NOPTS_VALUE && ts < offset && !is_video)
+			return;
+
+		std::shared_ptr<AVPacket> pkt(
+			av_packet_clone(&packet),
+			[](AVPacket* p)
+			{
+				av_packet_free(&p);
 			});
-		}
-	}
-	
-	template<typename F>
-	bool encode_av_frame(
-		AVStream& st,
-		AVBitStreamFilterContext* bsfc, 
-		const F& func, 
-		const std::shared_ptr<AVFrame>& src_av_frame, 
-		std::shared_ptr<void> token)
-	{
-		AVPacket pkt = {};
-		av_init_packet(&pkt);
 
-		int got_packet = 0;
+		CASPAR_VERIFY(pkt);
 
-		FF(func(
-			st.codec, 
-			&pkt, 
-			src_av_frame.get(), 
-			&got_packet));
-					
-		if(!got_packet || pkt.size <= 0)
-			return false;
-				
-		pkt.stream_index = st.index;
-				
-		if (pkt.pts != AV_NOPTS_VALUE)
+		if (pkt->pts != AV_NOPTS_VALUE)
 		{
-			pkt.pts = 
+			pkt->pts =
 				av_rescale_q(
-					pkt.pts,
-					st.codec->time_base, 
-					st.time_base);
+					pkt->pts - offset,
+					enc.time_base,
+					st->time_base);
 		}
 
-		if (pkt.dts != AV_NOPTS_VALUE)
+		if (pkt->dts != AV_NOPTS_VALUE)
 		{
-			pkt.dts = 
+			pkt->dts =
 				av_rescale_q(
-					pkt.dts, 
-					st.codec->time_base, 
-					st.time_base);
+					pkt->dts - offset,
+					enc.time_base,
+					st->time_base);
 		}
-				
-		pkt.duration = 
+
+		pkt->duration =
 			static_cast<int>(
 				av_rescale_q(
-					pkt.duration, 
-					st.codec->time_base, st.time_base));
+					pkt->duration,
+					enc.time_base, st->time_base));
 
-		write_packet(
-			std::shared_ptr<AVPacket>(
-				new AVPacket(pkt), 
-				[](AVPacket* p)
-				{
-					av_free_packet(p); 
-					delete p;
-				}), token);
+		pkt->stream_index = st->index;
 
-		return true;
+		write_packet(
+			pkt,
+			token);
 	}
 
 	void write_packet(
 		const std::shared_ptr<AVPacket>& pkt_ptr,
 		std::shared_ptr<void> token)
-	{		
+	{
+		++mux_depth_;
+
 		write_executor_.begin_invoke([this, pkt_ptr, token]() mutable
 		{
-			FF(av_interleaved_write_frame(
-				oc_.get(), 
-				pkt_ptr.get()));
-		});	
-	}	
-	
-	template<typename T>
-	static boost::optional<T> try_remove_arg(
-		std::map<std::string, std::string>& options, 
-		const boost::regex& expr)
-	{
-		for(auto it = options.begin(); it != options.end(); ++it)
-		{			
-			if(boost::regex_search(it->first, expr))
+			CASPAR_SCOPE_EXIT
+			{
+				--mux_depth_;
+			};
+
+			if(pkt_ptr)
 			{
-				auto arg = it->second;
-				options.erase(it);
-				return boost::lexical_cast<T>(arg);
+				const bool is_video = pkt_ptr->stream_index == video_st_->index;
+
+				filter_packet(
+					is_video ? video_bitstream_filter_.get() : audio_bitstream_filter_.get(),
+					is_video ? session_->video_encoder() : session_->audio_encoder(),
+					*pkt_ptr);
 			}
-		}
 
-		return boost::optional<T>();
+			FF(av_interleaved_write_frame(
+				oc_.get(),
+				pkt_ptr.get()));
+		});
 	}
-		
-	static std::map<std::string, std::string> remove_options(
-		std::map<std::string, std::string>& options, 
-		const boost::regex& expr)
+
+	static void filter_packet(
+		AVBitStreamFilterContext* bsfc,
+		const AVCodecContext& enc,
+		AVPacket& pkt)
 	{
-		std::map<std::string, std::string> result;
-			
-		auto it = options.begin();
-		while(it != options.end())
-		{			
-			boost::smatch what;
-			if(boost::regex_search(it->first, what, expr))
+		if(!bsfc)
+			return;
+
+		std::uint8_t* data = nullptr;
+		int size = 0;
+
+		const auto ret =
+			av_bitstream_filter_filter(
+				bsfc,
+				const_cast<AVCodecContext*>(&enc),
+				nullptr,
+				&data,
+				&size,
+				pkt.data,
+				pkt.size,
+				pkt.flags & AV_PKT_FLAG_KEY);
+
+		FF_RET(ret, "av_bitstream_filter_filter");
+
+		if(ret > 0)
+		{
+			auto buf = av_buffer_create(data, size, av_buffer_default_free, nullptr, 0);
+
+			if(!buf)
 			{
-				result[
-					what.size() > 0 && what[1].matched 
-						? what[1].str() 
-						: it->first] = it->second;
-				it = options.erase(it);
+				av_free(data);
+				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Could not allocate packet buffer.") << boost::errinfo_api_function("av_buffer_create"));
 			}
-			else
-				++it;
+
+			av_buffer_unref(&pkt.buf);
+			pkt.buf = buf;
 		}
 
-		return result;
+		pkt.data = data;
+		pkt.size = size;
 	}
-		
-	static void to_dict(AVDictionary** dest, const std::map<std::string, std::string>& c)
-	{		
-		BOOST_FOREACH(const auto& entry, c)
+
+	void configue_audio_bistream_filters(std::map<std::string, std::string>& options)
+	{
+		const auto audio_bitstream_filter_str =
+			try_remove_arg<std::string>(
+				options,
+				boost::regex("^bsf:a|absf$"));
+
+		const auto audio_bitstream_filter =
+			audio_bitstream_filter_str
+				? av_bitstream_filter_init(audio_bitstream_filter_str->c_str())
+				: nullptr;
+
+		CASPAR_VERIFY(!audio_bitstream_filter_str || audio_bitstream_filter);
+
+		if(audio_bitstream_filter)
 		{
-			av_dict_set(
-				dest, 
-				entry.first.c_str(), 
-				entry.second.c_str(), 0);
+			audio_bitstream_filter_.reset(
+				audio_bitstream_filter,
+				av_bitstream_filter_close);
 		}
+
+		if(audio_bitstream_filter_str && !audio_bitstream_filter_)
+			options["bsf:a"] = *audio_bitstream_filter_str;
 	}
 
-	static std::map<std::string, std::string> to_map(AVDictionary* dict)
+	void configue_video_bistream_filters(
+		std::map<std::string, std::string>& options)
 	{
-		std::map<std::string, std::string> result;
-		
-		for(auto t = dict 
-				? av_dict_get(
-					dict, 
-					"", 
-					nullptr, 
-					AV_DICT_IGNORE_SUFFIX) 
+		const auto video_bitstream_filter_str =
+				try_remove_arg<std::string>(
+					options,
+					boost::regex("^bsf:v|vbsf$"));
+
+		const auto video_bitstream_filter =
+			video_bitstream_filter_str
+				? av_bitstream_filter_init(video_bitstream_filter_str->c_str())
 				: nullptr;
-			t; 
-			t = av_dict_get(
-				dict, 
-				"", 
-				t,
-				AV_DICT_IGNORE_SUFFIX))
+
+		CASPAR_VERIFY(!video_bitstream_filter_str || video_bitstream_filter);
+
+		if(video_bitstream_filter)
 		{
-			result[t->key] = t->value;
+			video_bitstream_filter_.reset(
+				video_bitstream_filter,
+				av_bitstream_filter_close);
 		}
 
-		return result;
+		if(video_bitstream_filter_str && !video_bitstream_filter_)
+			options["bsf:v"] = *video_bitstream_filter_str;
 	}
 };
-	
+
 safe_ptr<core::frame_consumer> create_streaming_consumer(const core::parameters& params)
-{       
+{
 	if (params.size() < 1 || params[0] != L"STREAM")
 		return core::frame_consumer::empty();
 
@@ -1207,10 +1894,10 @@ safe_ptr<core::frame_consumer> create_streaming_consumer(const core::parameters&
 }
 
 safe_ptr<core::frame_consumer> create_streaming_consumer(const boost::property_tree::wptree& ptree)
-{              	
+{
     return make_safe<streaming_consumer>(
-		narrow(ptree.get<std::wstring>(L"path")), 
+		narrow(ptree.get<std::wstring>(L"path")),
 		narrow(ptree.get<std::wstring>(L"args", L"")));
 }
 
-}}
\ No newline at end of file
+}}
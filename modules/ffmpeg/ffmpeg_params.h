@@ -61,6 +61,9 @@ struct ffmpeg_producer_params
 
 	std::vector<option> options;
 
+	bool                in_memory;
+	bool                reverse;
+
 	ffmpeg_producer_params() 
 		: loop(false)
 		, start(0)
@@ -68,6 +71,8 @@ struct ffmpeg_producer_params
 		, filter_str(L"")
 		, resource_type(FFMPEG_FILE)
 		, resource_name(L"")
+		, in_memory(false)
+		, reverse(false)
 	{
 	}
 
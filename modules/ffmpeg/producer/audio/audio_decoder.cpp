@@ -61,6 +61,9 @@ struct audio_decoder::implementation : boost::noncopyable
 
 	std::queue<safe_ptr<AVPacket>>									packets_;
 
+	const double													fps_;
+	int64_t															skip_samples_;
+
 	const int64_t													nb_frames_;
 	tbb::atomic<size_t>												file_frame_number_;
 	core::channel_layout											channel_layout_;
@@ -73,6 +76,8 @@ public:
 		, format_desc_(format_desc)	
 		, codec_context_(open_codec(*context, AVMEDIA_TYPE_AUDIO, index_))
 		, buffer_(480000*2)
+		, fps_(read_fps(*context, 0.0))
+		, skip_samples_(0)
 		, nb_frames_(0)//context->streams[index_]->nb_frames)
 		, channel_layout_(get_audio_channel_layout(*codec_context_, custom_channel_order))
 		, swr_(swr_alloc_set_opts(nullptr,
@@ -113,6 +118,7 @@ public:
 		{
 			packets_.pop();
 			file_frame_number_ = static_cast<size_t>(packet->pos);
+			skip_samples_ = fps_ > 0.0 ? static_cast<int64_t>(std::max<int64_t>(0, packet->duration) / fps_ * format_desc_.audio_sample_rate + 0.5) : 0;
 			avcodec_flush_buffers(codec_context_.get());
 			return flush_audio();
 		}
@@ -156,7 +162,14 @@ public:
 		
 		++file_frame_number_;
 
-		return std::make_shared<core::audio_buffer>(buffer_.begin(), buffer_.begin() + channel_samples * decoded_frame->channels);
+		// Drop the audio of the frames leading up to a keyframe index seek target.
+		const auto skipped = static_cast<int>(std::min<int64_t>(skip_samples_, channel_samples));
+		skip_samples_ -= skipped;
+
+		if(skipped == channel_samples)
+			return nullptr;
+
+		return std::make_shared<core::audio_buffer>(buffer_.begin() + skipped * decoded_frame->channels, buffer_.begin() + channel_samples * decoded_frame->channels);
 	}
 
 	bool ready() const
@@ -30,10 +30,13 @@
 #include "muxer/frame_muxer.h"
 #include "input/input.h"
 #include "util/util.h"
+#include "util/frame_cache.h"
+#include "util/frame_store.h"
 #include "audio/audio_decoder.h"
 #include "video/video_decoder.h"
 
 #include <common/env.h>
+#include <common/concurrency/executor.h>
 #include <common/utility/assert.h>
 #include <common/diagnostics/graph.h>
 
@@ -54,13 +57,18 @@
 #include <boost/range/algorithm/find_if.hpp>
 #include <boost/range/algorithm/find.hpp>
 #include <boost/regex.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 
+#include <tbb/atomic.h>
+#include <tbb/concurrent_queue.h>
 #include <tbb/parallel_invoke.h>
 
+#include <exception>
 #include <limits>
 #include <memory>
 #include <deque>
+#include <sstream>
 
 namespace caspar { namespace ffmpeg {
 
@@ -88,6 +96,27 @@ std::wstring get_relative_or_original(
 
 	return result;
 }
+
+// Producers with the same key produce the same frames.
+std::wstring get_frame_cache_key(
+		const std::wstring& filename,
+		const std::wstring& filter,
+		bool loop,
+		uint32_t start,
+		uint32_t length,
+		bool alpha,
+		const core::frame_factory& frame_factory)
+{
+	auto format_desc = frame_factory.get_video_format_desc();
+
+	std::wstringstream key;
+	key << boost::to_lower_copy(boost::filesystem::complete(filename).wstring())
+		<< L"|" << filter << L"|" << loop << L"|" << start << L"|" << length << L"|" << alpha
+		<< L"|" << format_desc.width << L"x" << format_desc.height << L"|" << format_desc.time_scale << L"/" << format_desc.duration
+		<< L"|" << format_desc.field_mode << L"|" << format_desc.audio_sample_rate
+		<< L"|" << frame_factory.requires_cpu_frames();
+	return key.str();
+}
 				
 struct ffmpeg_producer : public core::frame_producer
 {
@@ -117,12 +146,39 @@ struct ffmpeg_producer : public core::frame_producer
 
 	safe_ptr<core::basic_frame>									last_frame_;
 	
-	std::deque<std::pair<safe_ptr<core::basic_frame>, size_t>>	frame_buffer_;
+	tbb::concurrent_bounded_queue<std::pair<safe_ptr<core::basic_frame>, size_t>>	frame_buffer_;
 
 	int64_t														frame_number_;
 	uint32_t													file_frame_number_;
 
 	std::deque<double>											stops_;
+
+	const size_t												decode_ahead_;
+	tbb::atomic<int>											hints_;
+	tbb::atomic<bool>											decoding_;
+	tbb::atomic<bool>											decoder_eof_;
+	tbb::atomic<int>											seeking_;
+	boost::mutex												exception_mutex_;
+	std::exception_ptr											decode_exception_;
+
+	// Written where the decoders and the muxer run, read by the stage.
+	tbb::atomic<uint32_t>										nb_frames_;
+	tbb::atomic<uint32_t>										decoded_file_frame_number_;
+
+	std::shared_ptr<frame_cache>								frame_cache_;
+	tbb::atomic<bool>											sharing_;
+	tbb::atomic<bool>											following_;
+	int64_t														position_;
+	int64_t														decoded_position_;
+	int															follow_misses_;
+
+	std::shared_ptr<frame_store>								store_;
+	tbb::atomic<bool>											in_memory_;
+	tbb::atomic<bool>											reverse_;
+	tbb::atomic<int64_t>										store_seek_;
+	int64_t														store_index_;
+
+	executor													decode_executor_;
 		
 public:
 	explicit ffmpeg_producer(const safe_ptr<core::frame_factory>& frame_factory, const std::wstring& filename, FFMPEG_Resource resource_type, const std::wstring& filter, bool loop, uint32_t start, uint32_t length, bool thumbnail_mode, const ffmpeg_producer_params& vid_params, bool alpha = false)
@@ -139,9 +195,27 @@ public:
 		, thumbnail_mode_(thumbnail_mode)
 		, last_frame_(core::basic_frame::empty())
 		, frame_number_(0)
+		, file_frame_number_(start)
+		, decode_ahead_(thumbnail_mode ? 0 : env::properties().get(L"configuration.ffmpeg.decode-ahead", 3))
+		, position_(0)
+		, decoded_position_(0)
+		, follow_misses_(0)
+		, store_index_(-1)
+		, decode_executor_(L"ffmpeg_producer")
 	{
+		hints_			= 0;
+		decoding_		= false;
+		decoder_eof_	= false;
+		seeking_		= 0;
+		sharing_		= false;
+		following_		= false;
+		in_memory_		= false;
+		reverse_		= vid_params.reverse;
+		store_seek_		= -1;
+
 		graph_->set_color("frame-time", diagnostics::color(0.1f, 1.0f, 0.1f));
 		graph_->set_color("underflow", diagnostics::color(0.6f, 0.3f, 0.9f));	
+		graph_->set_color("decode-ahead", diagnostics::color(0.2f, 0.6f, 0.9f));
 		diagnostics::register_graph(graph_);
 
 		const auto xmlPath = boost::filesystem::change_extension(filename, L".xml");
@@ -203,6 +277,42 @@ public:
 			BOOST_THROW_EXCEPTION(averror_stream_not_found() << msg_info("No streams found"));
 
 		muxer_.reset(new frame_muxer(fps_, frame_factory, thumbnail_mode_, audio_channel_layout, filter));
+
+		decoded_file_frame_number_ = 0;
+		update_nb_frames();
+
+		if(!thumbnail_mode_ && resource_type_ == FFMPEG_FILE && vid_params.in_memory)
+			store_ = create_frame_store();
+
+		if(!thumbnail_mode_ && resource_type_ == FFMPEG_FILE && vid_params.options.empty() && !store_)
+			frame_cache_ = frame_cache::open(get_frame_cache_key(filename_, filter, loop, start, length, alpha, *frame_factory));
+
+		if(frame_cache_)
+		{
+			sharing_	= true;
+			following_	= frame_cache_->has_leader();
+		}
+
+		// Playing backwards needs the frames in memory.
+		if(reverse_ && !store_)
+			BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("REVERSE requires RAM."));
+
+		if(store_)
+		{
+			in_memory_ = true;
+			fill_store();
+		}
+		else if(decode_ahead_ > 0 && !following_)
+			decode_ahead();
+	}
+
+	~ffmpeg_producer()
+	{
+		decode_executor_.stop();
+		decode_executor_.join();
+
+		if(frame_cache_)
+			frame_cache_->leave(this);
 	}
 
 	// frame_producer
@@ -228,15 +338,68 @@ public:
 	{		
 		frame_timer_.restart();
 		auto disable_logging = temporary_disable_logging_for_thread(thumbnail_mode_);
-				
-		for(int n = 0; n < 16 && frame_buffer_.size() < 2; ++n)
-			try_decode_frame(hints);
+
+		if(in_memory_)
+		{
+			hints_ = hints;
+
+			if(!store_->is_abandoned())
+				return render_stored_frame();
+
+			CASPAR_LOG(warning) << print() << L" Does not fit in memory, streaming from " << file_frame_number_ << L".";
+			in_memory_ = false;
+			reverse_ = false;
+			queue_seek(file_frame_number_);
+		}
+
+		std::pair<safe_ptr<core::basic_frame>, size_t> frame(core::basic_frame::empty(), 0);
+
+		if(try_receive_shared(hints, frame))
+			return deliver(frame);
+
+		// Until a seek has been carried out the buffered frames are from
+		// before it.
+		if(following_ || seeking_ > 0)
+		{
+			graph_->set_tag("underflow");
+			send_osc();
+			return std::make_pair(core::basic_frame::late(), -1);
+		}
+
+		if(decode_ahead_ > 0)
+		{
+			hints_ = hints;
+
+			// Give the first frame the same chance as synchronous decoding.
+			if(frame_number_ == 0 && frame_buffer_.empty())
+				decode_executor_.wait();
+
+			if(!decoding_)
+			{
+				auto exception = take_decode_exception();
+				if(exception)
+					std::rethrow_exception(exception);
+			}
+		}
+		else
+		{
+			for(int n = 0; n < 16 && frame_buffer_.size() < 2; ++n)
+				try_decode_frame(hints);
+		}
 		
 		graph_->set_value("frame-time", frame_timer_.elapsed()*format_desc_.fps*0.5);
 
-		if (frame_buffer_.empty())
+		auto popped = frame_buffer_.try_pop(frame);
+
+		if(decode_ahead_ > 0)
 		{
-			if (input_.eof())
+			graph_->set_value("decode-ahead", static_cast<double>(frame_buffer_.size())/decode_ahead_);
+			decode_ahead();
+		}
+
+		if (!popped)
+		{
+			if (input_.eof() && (decode_ahead_ == 0 || decoder_eof_))
 			{
 				send_osc();
 				return std::make_pair(last_frame(), -1);
@@ -253,11 +416,14 @@ public:
 				return std::make_pair(last_frame(), -1);
 			}
 		}
-		
-		auto frame = frame_buffer_.front(); 
-		frame_buffer_.pop_front();
-		
+
+		return deliver(frame);
+	}
+
+	std::pair<safe_ptr<core::basic_frame>, uint32_t> deliver(const std::pair<safe_ptr<core::basic_frame>, size_t>& frame)
+	{
 		++frame_number_;
+		++position_;
 
 		file_frame_number_ = frame.second;
 
@@ -270,6 +436,240 @@ public:
 		return frame;
 	}
 
+	std::pair<safe_ptr<core::basic_frame>, uint32_t> render_stored_frame()
+	{
+		const bool		reverse		= reverse_;
+		const bool		complete	= store_->is_complete();
+		const int64_t	size		= store_->size();
+
+		int64_t next = store_index_ + (reverse ? -1 : 1);
+
+		auto seek = store_seek_;
+		if(seek >= 0)
+		{
+			size_t index = 0;
+			if(!store_->find(static_cast<uint32_t>(seek), index))
+				return std::make_pair(core::basic_frame::late(), -1);
+
+			store_seek_.compare_and_swap(-1, seek);
+			next = index;
+		}
+		else if(reverse && !complete) // Reverse play starts at the end.
+		{
+			graph_->set_tag("underflow");
+			send_osc();
+			return std::make_pair(core::basic_frame::late(), -1);
+		}
+		else if(reverse && frame_number_ == 0)
+			next = size - 1;
+
+		if(next >= size && !complete)
+		{
+			graph_->set_tag("underflow");
+			send_osc();
+			return std::make_pair(core::basic_frame::late(), -1);
+		}
+
+		if(next < 0 || next >= size)
+		{
+			if(!input_.loop() || size == 0)
+			{
+				send_osc();
+				return std::make_pair(last_frame(), -1);
+			}
+
+			next = next < 0 ? size - 1 : 0;
+		}
+
+		store_index_ = next;
+
+		// Stored frames are handed out again, so every layer gets its own
+		// transform. Audio is not played backwards.
+		auto stored	= store_->at(static_cast<size_t>(next));
+		auto frame	= reverse ? disable_audio(stored) : make_safe<core::basic_frame>(stored);
+
+		graph_->set_value("frame-time", frame_timer_.elapsed()*format_desc_.fps*0.5);
+
+		return deliver(std::make_pair(frame, store_->file_frame_number(static_cast<size_t>(next))));
+	}
+
+	std::shared_ptr<frame_store> create_frame_store()
+	{
+		const uint32_t file_frames = file_nb_frames();
+
+		if(file_frames <= start_)
+		{
+			CASPAR_LOG(warning) << print() << L" Unknown length, can not be played from memory.";
+			return nullptr;
+		}
+
+		const auto nb_frames	= muxer_->calc_nb_frames(std::min(length_, file_frames - start_));
+		const auto frame_size	= video_decoder_ ? get_image_size(video_decoder_->pix_fmt(), video_decoder_->width(), video_decoder_->height()) : 0;
+
+		auto store = frame_store::create(nb_frames, frame_size, !frame_factory_->requires_cpu_frames());
+
+		if(!store)
+			CASPAR_LOG(warning) << print() << L" Does not fit in memory, streaming instead.";
+
+		return store;
+	}
+
+	// Decodes the whole clip into store_, a batch at a time so that the
+	// executor can be stopped in between.
+	void fill_store()
+	{
+		// Batches that were queued when the producer stopped still run.
+		if(!decode_executor_.is_running())
+			return;
+
+		decode_executor_.begin_invoke([this]
+		{
+			if(!in_memory_ || store_->is_complete() || store_->is_abandoned())
+				return;
+
+			bool attempted	= false;
+			bool progress	= false;
+
+			try
+			{
+				for(int n = 0; n < 16 && !store_->is_complete() && !store_->is_abandoned(); ++n)
+				{
+					auto size = store_->size();
+					try_decode_frame(hints_);
+					attempted = true;
+					progress |= store_->size() > size;
+				}
+			}
+			catch(...)
+			{
+				set_decode_exception(std::current_exception());
+				store_->abandon();
+				return;
+			}
+
+			if(attempted && !progress && input_.eof())
+				store_->complete();
+
+			if(store_->is_complete())
+			{
+				CASPAR_LOG(info) << print() << L" Decoded " << store_->size() << L" frames (" << store_->bytes()/(1024*1024) << L" MB) into memory.";
+				return;
+			}
+
+			if(!progress)
+				boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+
+			fill_store();
+		});
+	}
+
+	// Takes the frame at position_ from the leader of frame_cache_. A
+	// follower that has lost its leader, or waited for it too long, seeks
+	// to where it is and continues on its own.
+	bool try_receive_shared(int hints, std::pair<safe_ptr<core::basic_frame>, size_t>& frame)
+	{
+		static const int MAX_FOLLOW_MISSES = 2;
+
+		if(!sharing_)
+			return false;
+
+		auto shared_frame = core::basic_frame::empty();
+		uint32_t file_frame_number = 0;
+
+		if(frame_cache_->try_get(this, position_, hints, shared_frame, file_frame_number))
+		{
+			if(!following_)
+			{
+				CASPAR_LOG(debug) << print() << L" Sharing decoded frames.";
+				following_ = true;
+				flush_frame_buffer();
+			}
+
+			follow_misses_ = 0;
+
+			frame = std::make_pair(shared_frame, file_frame_number);
+			graph_->set_value("frame-time", frame_timer_.elapsed()*format_desc_.fps*0.5);
+			return true;
+		}
+
+		if(following_ && frame_cache_->pending(this, position_) && ++follow_misses_ <= MAX_FOLLOW_MISSES)
+			return false;
+
+		if(following_)
+		{
+			CASPAR_LOG(debug) << print() << L" Lost leader, decoding from " << file_frame_number_ << L".";
+			stop_sharing();
+			queue_seek(file_frame_number_);
+		}
+
+		return false;
+	}
+
+	void stop_sharing()
+	{
+		following_	= false;
+		sharing_	= false;
+
+		// After any publish in flight on the decode executor.
+		if(decode_ahead_ > 0)
+			decode_executor_.begin_invoke([this]{frame_cache_->leave(this);});
+		else
+			frame_cache_->leave(this);
+	}
+
+	// Seeks the input and drops what was decoded before it, on the decode
+	// executor when there is one so that no decoding happens in between.
+	void seek_and_flush(uint32_t target)
+	{
+		input_.seek(target);
+
+		std::pair<safe_ptr<core::basic_frame>, size_t> frame(core::basic_frame::empty(), 0);
+		while(frame_buffer_.try_pop(frame));
+	}
+
+	void queue_seek(uint32_t target)
+	{
+		if(decode_ahead_ == 0)
+		{
+			seek_and_flush(target);
+			return;
+		}
+
+		++seeking_;
+		decode_executor_.begin_invoke([=]
+		{
+			seek_and_flush(target);
+			--seeking_;
+		}, high_priority);
+	}
+
+	void set_decode_exception(const std::exception_ptr& exception)
+	{
+		boost::lock_guard<boost::mutex> lock(exception_mutex_);
+		decode_exception_ = exception;
+	}
+
+	// Each exception is rethrown once.
+	std::exception_ptr take_decode_exception()
+	{
+		boost::lock_guard<boost::mutex> lock(exception_mutex_);
+		auto exception = decode_exception_;
+		decode_exception_ = std::exception_ptr();
+		return exception;
+	}
+
+	void flush_frame_buffer()
+	{
+		if(decode_ahead_ > 0)
+		{
+			decode_executor_.begin_invoke([this]
+			{
+				std::pair<safe_ptr<core::basic_frame>, size_t> frame(core::basic_frame::empty(), 0);
+				while(frame_buffer_.try_pop(frame));
+			});
+		}
+	}
+
 	void send_osc()
 	{
 		monitor_subject_	<< core::monitor::message("/profiler/time")		% frame_timer_.elapsed() % (1.0/format_desc_.fps);			
@@ -285,25 +685,29 @@ public:
 	
 	safe_ptr<core::basic_frame> render_specific_frame(uint32_t file_position, int hints)
 	{
-		// Some trial and error and undeterministic stuff here
-		static const int NUM_RETRIES = 32;
+		// Some trial and error and undeterministic stuff here. Seeks go through
+		// the keyframe index when there is one, and instead of sleeping between
+		// attempts the input is waited for.
+		static const int NUM_RETRIES			= 256;
+		static const int PACKET_TIMEOUT_MILLIS	= 2000;
 		
 		if (file_position > 0) // Assume frames are requested in sequential order,
 			                   // therefore no seeking should be necessary for the first frame.
-		{
 			input_.seek(file_position > 1 ? file_position - 2: file_position).get();
-			boost::this_thread::sleep(boost::posix_time::milliseconds(40));
-		}
+
+		int drain_attempts = 0;
 
 		for (int i = 0; i < NUM_RETRIES; ++i)
 		{
-			boost::this_thread::sleep(boost::posix_time::milliseconds(40));
-		
 			auto frame = render_frame(hints);
 
 			if (frame.second == std::numeric_limits<uint32_t>::max())
 			{
-				// Retry
+				// Nothing decoded yet. At the end of the input only what is
+				// already buffered remains to be decoded.
+				if (input_.eof() ? ++drain_attempts > 16 : !input_.wait_for_packet(PACKET_TIMEOUT_MILLIS))
+					break;
+
 				continue;
 			}
 			else if (frame.second == file_position + 1 || frame.second == file_position)
@@ -317,7 +721,6 @@ public:
 				{
 					CASPAR_LOG(trace) << print() << L" adjusting to " << adjusted_seek;
 					input_.seek(static_cast<uint32_t>(adjusted_seek) - 1).get();
-					boost::this_thread::sleep(boost::posix_time::milliseconds(40));
 				}
 				else
 					return frame.first;
@@ -378,7 +781,10 @@ public:
 	
 	uint32_t file_frame_number() const
 	{
-		return video_decoder_ ? video_decoder_->file_frame_number() : 0;
+		if(following_ || in_memory_)
+			return file_frame_number_;
+
+		return decoded_file_frame_number_;
 	}
 
 	virtual uint32_t nb_frames() const override
@@ -387,12 +793,17 @@ public:
 		if(resource_type_ == FFMPEG_DEVICE || resource_type_ == FFMPEG_STREAM || input_.loop()) 
 			return std::numeric_limits<uint32_t>::max();
 
+		return nb_frames_;
+	}
+
+	// The muxer changes mode while decoding, so it is asked for the number of
+	// frames where it runs.
+	void update_nb_frames()
+	{
 		uint32_t nb_frames = file_nb_frames();
 
 		nb_frames = std::min(length_, nb_frames - start_);
-		nb_frames = muxer_->calc_nb_frames(nb_frames);
-		
-		return nb_frames;
+		nb_frames_ = muxer_->calc_nb_frames(nb_frames);
 	}
 
 	uint32_t file_nb_frames() const
@@ -406,7 +817,10 @@ public:
 	virtual boost::unique_future<std::wstring> call(const std::wstring& param) override
 	{
 		boost::promise<std::wstring> promise;
-		promise.set_value(do_call(param));
+		if(decode_ahead_ > 0)
+			promise.set_value(decode_executor_.invoke([&]{return do_call(param);}, high_priority));
+		else
+			promise.set_value(do_call(param));
 		return promise.get_future();
 	}
 				
@@ -432,6 +846,9 @@ public:
 		info.add(L"nb-frames",			nb_frames2 == std::numeric_limits<int64_t>::max() ? -1 : nb_frames2);
 		info.add(L"file-frame-number",	file_frame_number_);
 		info.add(L"file-nb-frames",		file_nb_frames());
+		info.add(L"shared",				static_cast<bool>(following_));
+		info.add(L"in-memory",			static_cast<bool>(in_memory_));
+		info.add(L"reverse",			static_cast<bool>(reverse_));
 		return info;
 	}
 
@@ -451,17 +868,49 @@ public:
 	{
 		static const boost::wregex loop_exp(L"LOOP\\s*(?<VALUE>\\d?)?", boost::regex::icase);
 		static const boost::wregex seek_exp(L"SEEK\\s+(?<VALUE>\\d+)", boost::regex::icase);
+		static const boost::wregex reverse_exp(L"REVERSE\\s*(?<VALUE>\\d?)?", boost::regex::icase);
 		
 		boost::wsmatch what;
 		if(boost::regex_match(param, what, loop_exp))
 		{
 			if(!what["VALUE"].str().empty())
-				input_.loop(boost::lexical_cast<bool>(what["VALUE"].str()));
+			{
+				auto loop = boost::lexical_cast<bool>(what["VALUE"].str());
+
+				if(sharing_ && loop != input_.loop())
+					stop_sharing();
+
+				input_.loop(loop);
+			}
 			return boost::lexical_cast<std::wstring>(input_.loop());
 		}
+		if(boost::regex_match(param, what, reverse_exp))
+		{
+			if(!what["VALUE"].str().empty())
+			{
+				auto reverse = boost::lexical_cast<bool>(what["VALUE"].str());
+
+				if(reverse && !in_memory_)
+					BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("REVERSE requires RAM."));
+
+				reverse_ = reverse;
+			}
+			return boost::lexical_cast<std::wstring>(static_cast<bool>(reverse_));
+		}
 		if(boost::regex_match(param, what, seek_exp))
 		{
-			input_.seek(boost::lexical_cast<uint32_t>(what["VALUE"].str()));
+			// Seeking within memory leaves the input alone.
+			if(in_memory_)
+			{
+				store_seek_ = boost::lexical_cast<uint32_t>(what["VALUE"].str());
+				return L"";
+			}
+
+			if(sharing_)
+				stop_sharing();
+
+			seek_and_flush(boost::lexical_cast<uint32_t>(what["VALUE"].str()));
+
 			return L"";
 		}
 
@@ -518,8 +967,72 @@ public:
 		file_frame_number = std::max(file_frame_number, video_decoder_ ? video_decoder_->file_frame_number() : 0);
 		//file_frame_number = std::max(file_frame_number, audio_decoder_ ? audio_decoder_->file_frame_number() : 0);
 
+		decoded_file_frame_number_ = static_cast<uint32_t>(file_frame_number);
+		update_nb_frames();
+
 		for(auto frame = muxer_->poll(); frame; frame = muxer_->poll())
-			frame_buffer_.push_back(std::make_pair(make_safe_ptr(frame), file_frame_number));
+		{
+			auto decoded = make_safe_ptr(frame);
+
+			if(in_memory_)
+			{
+				store_->push(decoded, static_cast<uint32_t>(file_frame_number));
+				continue;
+			}
+
+			if(sharing_)
+			{
+				frame_cache_->publish(this, decoded_position_++, hints, decoded, static_cast<uint32_t>(file_frame_number));
+				decoded = make_safe<core::basic_frame>(decoded);
+			}
+
+			frame_buffer_.push(std::make_pair(decoded, file_frame_number));
+		}
+
+		// The input looped, everything up to here is the whole clip.
+		if(in_memory_ && store_->size() > 0 && (video == flush_video() || (!video_decoder_ && audio == flush_audio())))
+			store_->complete();
+	}
+
+	// Decodes, filters and muxes up to decode_ahead_ frames on the decode
+	// executor so that receive() only has to pop a ready frame.
+	void decode_ahead()
+	{
+		if(following_ || in_memory_ || !decode_executor_.is_running() || decoding_.fetch_and_store(true))
+			return;
+
+		decode_executor_.begin_invoke([this]
+		{
+			bool attempted	= false;
+			bool progress	= false;
+			bool failed		= false;
+
+			try
+			{
+				for(int n = 0; n < 16 && frame_buffer_.size() < static_cast<std::ptrdiff_t>(decode_ahead_); ++n)
+				{
+					auto size = frame_buffer_.size();
+					try_decode_frame(hints_);
+					attempted = true;
+					progress |= frame_buffer_.size() > size;
+				}
+			}
+			catch(...)
+			{
+				set_decode_exception(std::current_exception());
+				progress = false;
+				failed = true;
+			}
+
+			if(attempted && !progress && input_.eof())
+				decoder_eof_ = true;
+
+			decoding_ = false;
+
+			// Without progress the next receive() tries again.
+			if(progress && !failed && frame_buffer_.size() < static_cast<std::ptrdiff_t>(decode_ahead_))
+				decode_ahead();
+		});
 	}
 
 	core::monitor::subject& monitor_output()
@@ -572,11 +1085,16 @@ safe_ptr<core::frame_producer> create_producer(
 	auto length		= params.get(L"LENGTH", std::numeric_limits<uint32_t>::max());
 	auto filter_str = params.get(L"FILTER", L""); 	
 	auto custom_channel_order	= params.get(L"CHANNEL_LAYOUT", L"");
+	auto in_memory	= params.has(L"RAM");
+	auto reverse	= params.has(L"REVERSE");
 
 	boost::replace_all(filter_str, L"DEINTERLACE_BOB", L"YADIF=1:-1");
 	boost::replace_all(filter_str, L"DEINTERLACE", L"YADIF=0:-1");
 	
 	ffmpeg_producer_params vid_params;
+	vid_params.in_memory	= in_memory;
+	vid_params.reverse		= reverse;
+
 	bool haveFFMPEGStartIndicator = false;
 	for (size_t i = 0; i < params.size() - 1; ++i)
 	{
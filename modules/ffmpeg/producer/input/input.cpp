@@ -22,6 +22,8 @@
 #include "../../stdafx.h"
 
 #include "input.h"
+#include "keyframe_index.h"
+#include "read_ahead.h"
 
 #include "../util/util.h"
 #include "../util/flv.h"
@@ -41,12 +43,16 @@
 #include <tbb/atomic.h>
 #include <tbb/recursive_mutex.h>
 
+#include <boost/foreach.hpp>
 #include <boost/rational.hpp>
 #include <boost/range/algorithm.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
 
+#include <limits>
+#include <vector>
+
 #if defined(_MSC_VER)
 #pragma warning (push)
 #pragma warning (disable : 4244)
@@ -61,12 +67,9 @@ extern "C"
 #pragma warning (pop)
 #endif
 
-static const size_t MAX_BUFFER_COUNT    = 100;
-static const size_t MAX_BUFFER_COUNT_RT = 3;
-static const size_t MIN_BUFFER_COUNT    = 50;
-static const size_t MAX_BUFFER_SIZE     = 64 * 1000000;
-
 namespace caspar { namespace ffmpeg {
+
+static const int MAX_SEEK_PROBE_PACKETS = 256; // Read to find the frame a seek without an index landed on.
 		
 struct input::implementation : boost::noncopyable
 {		
@@ -74,6 +77,8 @@ struct input::implementation : boost::noncopyable
 
 	const safe_ptr<AVFormatContext>								format_context_; // Destroy this last
 	const int													default_stream_index_;
+	const FFMPEG_Resource										resource_type_;
+	std::shared_ptr<const keyframe_index>						keyframe_index_;
 			
 	const std::wstring											filename_;
 	const uint32_t												start_;		
@@ -83,20 +88,24 @@ struct input::implementation : boost::noncopyable
 	uint32_t													frame_number_;
 	
 	tbb::concurrent_bounded_queue<std::shared_ptr<AVPacket>>	buffer_;
-	tbb::atomic<size_t>											buffer_size_;
+	boost::mutex												waiters_mutex_;
+	boost::condition_variable									waiters_cond_;
 		
 	executor													executor_;
+	read_ahead													read_ahead_; // Destroy this before executor_.
 	
 	explicit implementation(const safe_ptr<diagnostics::graph> graph, const std::wstring& filename, FFMPEG_Resource resource_type, bool loop, uint32_t start, uint32_t length, bool thumbnail_mode, const ffmpeg_producer_params& vid_params) 
 		: graph_(graph)
 		, format_context_(open_input(filename, resource_type, vid_params))		
 		, default_stream_index_(av_find_default_stream_index(format_context_.get()))
+		, resource_type_(resource_type)
 		, filename_(filename)
 		, start_(start)
 		, length_(length)
 		, thumbnail_mode_(thumbnail_mode)
 		, frame_number_(0)
 		, executor_(print())
+		, read_ahead_(format_context_->bit_rate, thumbnail_mode, [this]{tick();})
 	{
 		if (thumbnail_mode_)
 			executor_.invoke([]
@@ -105,17 +114,25 @@ struct input::implementation : boost::noncopyable
 			});
 
 		loop_			= loop;
-		buffer_size_	= 0;
+
+		// Thumbnails only decode a few frames, not worth indexing the file for.
+		if(resource_type_ == FFMPEG_FILE && !thumbnail_mode_)
+			keyframe_index_ = keyframe_index::find(filename_);
 
 		if(start_ > 0)			
 			queued_seek(start_);
 								
 		graph_->set_color("seek", diagnostics::color(1.0f, 0.5f, 0.0f));	
-		graph_->set_color("buffer-count", diagnostics::color(0.7f, 0.4f, 0.4f));
 		graph_->set_color("buffer-size", diagnostics::color(1.0f, 1.0f, 0.0f));	
 
 		tick();
 	}
+
+	~implementation()
+	{
+		executor_.stop();
+		executor_.join();
+	}
 	
 	bool try_pop(std::shared_ptr<AVPacket>& packet)
 	{
@@ -123,25 +140,41 @@ struct input::implementation : boost::noncopyable
 		
 		if(result)
 		{
-			if(packet)
-				buffer_size_ -= packet->size;
+			read_ahead_.on_consumed(packet ? packet->size : 0);
 			tick();
 		}
 
-		graph_->set_value("buffer-size", (static_cast<double>(buffer_size_)+0.001)/MAX_BUFFER_SIZE);
-		graph_->set_value("buffer-count", (static_cast<double>(buffer_.size()+0.001)/MAX_BUFFER_COUNT));
+		update_graph();
 		
 		return result;
 	}
 
-	std::ptrdiff_t get_max_buffer_count() const
+	bool wait_for_packet(int timeout_millis)
 	{
-		return thumbnail_mode_ ? 1 : MAX_BUFFER_COUNT;
+		boost::mutex::scoped_lock lock(waiters_mutex_);
+
+		return waiters_cond_.timed_wait(lock, boost::posix_time::milliseconds(timeout_millis), [this]
+		{
+			return !buffer_.empty() || !executor_.is_running();
+		});
 	}
 
-	std::ptrdiff_t get_min_buffer_count() const
+	void notify_waiters()
 	{
-		return thumbnail_mode_ ? 0 : MIN_BUFFER_COUNT;
+		// Only thumbnail rendering waits for packets, playback polls.
+		if (!thumbnail_mode_)
+			return;
+
+		{
+			boost::mutex::scoped_lock lock(waiters_mutex_);
+		}
+
+		waiters_cond_.notify_all();
+	}
+
+	void update_graph()
+	{
+		graph_->set_value("buffer-size", (static_cast<double>(read_ahead_.buffered_bytes())+0.001)/read_ahead_.target_bytes());
 	}
 
 	boost::unique_future<bool> seek(uint32_t target)
@@ -152,8 +185,8 @@ struct input::implementation : boost::noncopyable
 		return executor_.begin_invoke([=]() -> bool
 		{
 			std::shared_ptr<AVPacket> packet;
-			while(buffer_.try_pop(packet) && packet)
-				buffer_size_ -= packet->size;
+			while(buffer_.try_pop(packet))
+				read_ahead_.on_discarded(packet ? packet->size : 0);
 
 			queued_seek(target);
 
@@ -167,11 +200,6 @@ struct input::implementation : boost::noncopyable
 	{
 		return L"ffmpeg_input[" + filename_ + L")]";
 	}
-	
-	bool full() const
-	{
-		return (buffer_size_ > MAX_BUFFER_SIZE || buffer_.size() > get_max_buffer_count()) && buffer_.size() > get_min_buffer_count();
-	}
 
 	void tick()
 	{	
@@ -180,7 +208,7 @@ struct input::implementation : boost::noncopyable
 		
 		executor_.begin_invoke([this]
 		{			
-			if(full())
+			if(!read_ahead_.may_read())
 				return;
 
 			try
@@ -200,7 +228,10 @@ struct input::implementation : boost::noncopyable
 						CASPAR_LOG(trace) << print() << " Looping.";			
 					}		
 					else
+					{
 						executor_.stop();
+						notify_waiters();
+					}
 				}
 				else
 				{		
@@ -209,23 +240,13 @@ struct input::implementation : boost::noncopyable
 					if(packet->stream_index == default_stream_index_)
 						++frame_number_;
 
-					THROW_ON_ERROR2(av_dup_packet(packet.get()), print());
-				
-					// Make sure that the packet is correctly deallocated even if size and data is modified during decoding.
-					auto size = packet->size;
-					auto data = packet->data;
-			
-					packet = safe_ptr<AVPacket>(packet.get(), [packet, size, data](AVPacket*)
-					{
-						packet->size = size;
-						packet->data = data;				
-					});
+					packet = make_queueable(packet);
 
-					buffer_.try_push(packet);
-					buffer_size_ += packet->size;
+					read_ahead_.on_buffered(packet->size);
+					buffer_.push(packet);
+					notify_waiters();
 				
-					graph_->set_value("buffer-size", (static_cast<double>(buffer_size_)+0.001)/MAX_BUFFER_SIZE);
-					graph_->set_value("buffer-count", (static_cast<double>(buffer_.size()+0.001)/MAX_BUFFER_COUNT));
+					update_graph();
 				}	
 		
 				tick();		
@@ -235,6 +256,7 @@ struct input::implementation : boost::noncopyable
 				if (!thumbnail_mode_)
 					CASPAR_LOG_CURRENT_EXCEPTION();
 				executor_.stop();
+				notify_waiters();
 			}
 		});
 	}	
@@ -336,6 +358,41 @@ struct input::implementation : boost::noncopyable
 		if (!thumbnail_mode_)
 			CASPAR_LOG(debug) << print() << " Seeking: " << target;
 
+		if(!keyframe_index_ && resource_type_ == FFMPEG_FILE && !thumbnail_mode_)
+			keyframe_index_ = keyframe_index::find(filename_);
+
+		auto flush_packet	= create_packet();
+		flush_packet->data	= nullptr;
+		flush_packet->size	= 0;
+		flush_packet->pos	= target;
+
+		auto keyframe = keyframe_index_ && keyframe_index_->stream_index() == default_stream_index_ && target > 0 ? keyframe_index_->seek_point(target) : nullptr;
+
+		std::vector<safe_ptr<AVPacket>> packets;
+
+		// Decoders resume at the keyframe and drop the frames leading up to the target.
+		if(keyframe && avformat_seek_file(format_context_.get(), default_stream_index_, std::numeric_limits<int64_t>::min(), keyframe->pts, keyframe->pts, 0) >= 0)
+			flush_packet->duration = target - keyframe->frame;
+		else
+			flush_packet->duration = target - std::min(target, seek_nearest(target, packets));
+
+		read_ahead_.on_buffered(0);
+		buffer_.push(flush_packet);
+
+		BOOST_FOREACH(auto& packet, packets)
+		{
+			read_ahead_.on_buffered(packet->size);
+			buffer_.push(packet);
+		}
+
+		notify_waiters();
+	}
+
+	// Seeks to the last keyframe at or before target, the same way as with an
+	// index, and returns the frame it landed on (target if unknown). The
+	// packets read to find out are returned to be queued after the flush.
+	uint32_t seek_nearest(const uint32_t target, std::vector<safe_ptr<AVPacket>>& packets)
+	{
 		int flags = AVSEEK_FLAG_FRAME;
 		if(target == 0)
 		{
@@ -352,23 +409,56 @@ struct input::implementation : boost::noncopyable
 		auto stream = format_context_->streams[default_stream_index_];
 		
 		auto fps = read_fps(*format_context_, 0.0);
+		auto start_time = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+		auto ts = start_time + static_cast<int64_t>((target / fps * stream->time_base.den) / stream->time_base.num);
 				
 		THROW_ON_ERROR2(avformat_seek_file(
 			format_context_.get(), 
 			default_stream_index_, 
 			std::numeric_limits<int64_t>::min(),
-			static_cast<int64_t>((target / fps * stream->time_base.den) / stream->time_base.num),
-			std::numeric_limits<int64_t>::max(), 
+			ts,
+			ts, 
 			0), print());
 
-		auto flush_packet	= create_packet();
-		flush_packet->data	= nullptr;
-		flush_packet->size	= 0;
-		flush_packet->pos	= target;
+		for(int n = 0; n < MAX_SEEK_PROBE_PACKETS; ++n)
+		{
+			auto packet = create_packet();
+			if(av_read_frame(format_context_.get(), packet.get()) < 0)
+				break;
 
-		buffer_.push(flush_packet);
+			packets.push_back(make_queueable(packet));
+
+			if(packet->stream_index != default_stream_index_)
+				continue;
+
+			++frame_number_;
+
+			auto pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+			if(pts == AV_NOPTS_VALUE || fps <= 0.0)
+				break;
+
+			return static_cast<uint32_t>(std::max(0.0, static_cast<double>(pts - start_time) * stream->time_base.num / stream->time_base.den * fps + 0.5));
+		}
+
+		return target;
 	}	
 
+	// Makes sure that the packet is correctly deallocated even if size and
+	// data is modified during decoding.
+	safe_ptr<AVPacket> make_queueable(const safe_ptr<AVPacket>& packet)
+	{
+		make_refcounted(*packet);
+
+		auto size = packet->size;
+		auto data = packet->data;
+
+		return safe_ptr<AVPacket>(packet.get(), [packet, size, data](AVPacket*)
+		{
+			packet->size = size;
+			packet->data = data;				
+		});
+	}
+
 	bool is_eof(int ret)
 	{
 		if(ret == AVERROR(EIO))
@@ -384,6 +474,7 @@ input::input(const safe_ptr<diagnostics::graph>& graph, const std::wstring& file
 	: impl_(new implementation(graph, filename, resource_type, loop, start, length, thumbnail_mode, vid_params)){}
 bool input::eof() const {return !impl_->executor_.is_running();}
 bool input::try_pop(std::shared_ptr<AVPacket>& packet){return impl_->try_pop(packet);}
+bool input::wait_for_packet(int timeout_millis){return impl_->wait_for_packet(timeout_millis);}
 safe_ptr<AVFormatContext> input::context(){return impl_->format_context_;}
 void input::loop(bool value){impl_->loop_ = value;}
 bool input::loop() const{return impl_->loop_;}
@@ -52,6 +52,10 @@ public:
 	bool try_pop(std::shared_ptr<AVPacket>& packet);
 	bool eof() const;
 
+	// Blocks until a packet is buffered or the input has ended. Only
+	// supported in thumbnail mode, returns false on timeout.
+	bool wait_for_packet(int timeout_millis);
+
 	void loop(bool value);
 	bool loop() const;
 
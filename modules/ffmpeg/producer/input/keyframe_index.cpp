@@ -0,0 +1,332 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../../stdafx.h"
+
+#include "keyframe_index.h"
+
+#include "../util/util.h"
+#include "../../ffmpeg_error.h"
+
+#include <common/env.h>
+#include <common/exception/exceptions.h>
+#include <common/concurrency/executor.h>
+#include <common/log/log.h>
+#include <common/utility/binary_io.h>
+#include <common/utility/string.h>
+
+#include <tbb/atomic.h>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <sstream>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C"
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavformat/avformat.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+namespace caspar { namespace ffmpeg {
+
+static const uint32_t INDEX_MAGIC		= 0x4946424b; // "KBFI"
+static const uint32_t INDEX_VERSION		= 3;
+static const size_t MAX_CACHED_INDEXES	= 256;
+
+std::wstring get_index_filename(const std::wstring& filename)
+{
+	// FNV-1a of the normalized path.
+	auto path = boost::to_lower_copy(boost::filesystem::complete(filename).wstring());
+
+	uint64_t hash = 14695981039346656037ULL;
+	BOOST_FOREACH(auto c, path)
+	{
+		hash ^= static_cast<uint64_t>(c);
+		hash *= 1099511628211ULL;
+	}
+
+	std::wstringstream str;
+	str << env::data_folder() << L"keyframe-index\\" << std::hex << hash << L".kfi";
+	return str.str();
+}
+
+void save(const std::wstring& index_filename, const file_stamp& stamp, const keyframe_index& index)
+{
+	save_index_file(index_filename, INDEX_MAGIC, INDEX_VERSION, [&](std::ostream& stream)
+	{
+		write_file_stamp(stream, stamp);
+		write_value(stream, static_cast<int32_t>(index.stream_index()));
+		write_value(stream, static_cast<uint32_t>(index.keyframes().size()));
+
+		BOOST_FOREACH(auto& entry, index.keyframes())
+		{
+			write_value(stream, entry.frame);
+			write_value(stream, entry.pts);
+		}
+	});
+}
+
+std::shared_ptr<const keyframe_index> load(const std::wstring& index_filename, const file_stamp& stamp)
+{
+	boost::filesystem::ifstream stream;
+	if(!open_index_file(stream, index_filename, INDEX_MAGIC, INDEX_VERSION))
+		return nullptr;
+
+	if(!(read_file_stamp(stream) == stamp))
+		return nullptr;
+
+	auto stream_index	= read_value<int32_t>(stream);
+	auto count			= read_value<uint32_t>(stream);
+
+	std::vector<keyframe> keyframes;
+	keyframes.reserve(count);
+
+	for(uint32_t n = 0; n < count && stream; ++n)
+	{
+		keyframe entry;
+		entry.frame	= read_value<uint32_t>(stream);
+		entry.pts	= read_value<int64_t>(stream);
+		keyframes.push_back(entry);
+	}
+
+	if(!stream)
+		return nullptr;
+
+	return std::make_shared<keyframe_index>(stream_index, std::move(keyframes));
+}
+
+std::shared_ptr<keyframe_index> build(const std::wstring& filename, const tbb::atomic<bool>& aborted)
+{
+	AVFormatContext* weak_context = nullptr;
+	THROW_ON_ERROR2(avformat_open_input(&weak_context, narrow(filename).c_str(), nullptr, nullptr), filename);
+	safe_ptr<AVFormatContext> context(weak_context, [](AVFormatContext* ptr) { avformat_close_input(&ptr); });
+	THROW_ON_ERROR2(avformat_find_stream_info(weak_context, nullptr), filename);
+
+	const int stream_index = av_find_default_stream_index(context.get());
+	const auto stream = context->streams[stream_index];
+	const auto fps = read_fps(*context, 0.0);
+	const auto start_time = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+
+	if(fps <= 0.0)
+		return nullptr;
+
+	for(unsigned int n = 0; n < context->nb_streams; ++n)
+	{
+		if(static_cast<int>(n) != stream_index)
+			context->streams[n]->discard = AVDISCARD_ALL;
+	}
+
+	std::vector<keyframe> keyframes;
+	size_t nb_packets = 0;
+
+	auto packet = create_packet();
+
+	while(!aborted)
+	{
+		auto ret = av_read_frame(context.get(), packet.get());
+
+		if(ret == AVERROR_EOF || ret == AVERROR(EIO))
+			break;
+
+		THROW_ON_ERROR(ret, "av_read_frame", filename);
+
+		if(packet->stream_index == stream_index)
+		{
+			++nb_packets;
+
+			auto ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+			if((packet->flags & AV_PKT_FLAG_KEY) && ts != AV_NOPTS_VALUE && ts >= start_time)
+			{
+				// Frames are counted from the start of the stream, not from timestamp zero.
+				keyframe entry;
+				entry.frame	= static_cast<uint32_t>(static_cast<double>(ts - start_time) * stream->time_base.num / stream->time_base.den * fps + 0.5);
+				entry.pts	= ts;
+
+				if(keyframes.empty() || entry.frame > keyframes.back().frame)
+					keyframes.push_back(entry);
+			}
+		}
+
+		av_free_packet(packet.get());
+	}
+
+	if(aborted)
+		return nullptr;
+
+	// Intra-only streams seek exactly without an index.
+	if(keyframes.size() == nb_packets)
+		keyframes.clear();
+
+	return std::make_shared<keyframe_index>(stream_index, std::move(keyframes));
+}
+
+struct keyframe_indexer : boost::noncopyable
+{
+	boost::mutex													mutex_;
+	std::map<std::wstring, std::pair<file_stamp, std::shared_ptr<const keyframe_index>>>	indexes_;
+	std::set<std::wstring>											pending_;
+	tbb::atomic<bool>												aborted_;
+	std::unique_ptr<executor>										executor_;
+
+	keyframe_indexer()
+	{
+		aborted_ = false;
+	}
+
+	~keyframe_indexer()
+	{
+		aborted_ = true;
+	}
+
+	std::shared_ptr<const keyframe_index> find(const std::wstring& filename)
+	{
+		file_stamp stamp;
+		if(!try_get_file_stamp(filename, stamp))
+			return nullptr;
+
+		{
+			boost::lock_guard<boost::mutex> lock(mutex_);
+
+			if(pending_.find(filename) != pending_.end())
+				return nullptr;
+
+			auto it = indexes_.find(filename);
+			if(it != indexes_.end() && it->second.first == stamp)
+				return it->second.second;
+		}
+
+		auto index_filename = get_index_filename(filename);
+
+		// Reads the file without holding up lookups of other clips.
+		auto index = load(index_filename, stamp);
+
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		if(index)
+		{
+			cache(filename, stamp, index);
+			return index;
+		}
+
+		if(!pending_.insert(filename).second)
+			return nullptr;
+
+		if(!executor_)
+		{
+			executor_.reset(new executor(L"keyframe_indexer", thread_backend));
+			executor_->set_priority_class(below_normal_priority_class);
+		}
+
+		executor_->begin_invoke([=]
+		{
+			std::shared_ptr<keyframe_index> index;
+
+			try
+			{
+				index = build(filename, aborted_);
+
+				if(index)
+				{
+					save(index_filename, stamp, *index);
+					CASPAR_LOG(debug) << L"[keyframe_indexer] Indexed " << filename << L" (" << index->size() << L" keyframes).";
+				}
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+				CASPAR_LOG(warning) << L"[keyframe_indexer] Failed to index " << filename;
+			}
+
+			boost::lock_guard<boost::mutex> lock(mutex_);
+
+			pending_.erase(filename);
+
+			if(index)
+				cache(filename, stamp, index);
+		});
+
+		return nullptr;
+	}
+
+	void cache(const std::wstring& filename, const file_stamp& stamp, const std::shared_ptr<const keyframe_index>& index)
+	{
+		if(indexes_.size() >= MAX_CACHED_INDEXES)
+			indexes_.clear();
+
+		indexes_[filename] = std::make_pair(stamp, index);
+	}
+} g_keyframe_indexer;
+
+keyframe_index::keyframe_index(int stream_index, std::vector<keyframe>&& keyframes)
+	: stream_index_(stream_index)
+	, keyframes_(std::move(keyframes))
+{
+}
+
+std::shared_ptr<const keyframe_index> keyframe_index::find(const std::wstring& filename)
+{
+	return g_keyframe_indexer.find(filename);
+}
+
+const keyframe* keyframe_index::seek_point(uint32_t frame) const
+{
+	auto it = std::upper_bound(keyframes_.begin(), keyframes_.end(), frame, [](uint32_t frame, const keyframe& entry)
+	{
+		return frame < entry.frame;
+	});
+
+	if(it == keyframes_.begin())
+		return nullptr;
+
+	return &*(it - 1);
+}
+
+int keyframe_index::stream_index() const
+{
+	return stream_index_;
+}
+
+size_t keyframe_index::size() const
+{
+	return keyframes_.size();
+}
+
+const std::vector<keyframe>& keyframe_index::keyframes() const
+{
+	return keyframes_;
+}
+
+}}
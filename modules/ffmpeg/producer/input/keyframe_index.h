@@ -0,0 +1,62 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace caspar { namespace ffmpeg {
+
+struct keyframe
+{
+	uint32_t	frame;
+	int64_t		pts;	// In the time base of the indexed stream.
+};
+
+// Keyframe positions of the default stream of a media file. The index is
+// built in the background the first time a file is opened and stored in
+// <data-path>/keyframe-index, so that seeks and loops can go straight to
+// the keyframe preceding the target frame.
+class keyframe_index : boost::noncopyable
+{
+public:
+	keyframe_index(int stream_index, std::vector<keyframe>&& keyframes);
+
+	// Returns the index of the file if it has been built, otherwise
+	// schedules it to be built and returns nullptr.
+	static std::shared_ptr<const keyframe_index> find(const std::wstring& filename);
+
+	// The last keyframe at or before frame, nullptr if there is none.
+	const keyframe* seek_point(uint32_t frame) const;
+
+	int stream_index() const;
+	size_t size() const;
+	const std::vector<keyframe>& keyframes() const;
+private:
+	const int				stream_index_;
+	std::vector<keyframe>	keyframes_;
+};
+
+}}
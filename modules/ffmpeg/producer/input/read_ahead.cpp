@@ -0,0 +1,386 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../../stdafx.h"
+
+#include "read_ahead.h"
+
+#include <common/env.h>
+
+#include <boost/foreach.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/timer.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C"
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavcodec/avcodec.h>
+	#include <libavutil/buffer.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+static const size_t MIN_BUFFER_COUNT		= 50;
+static const size_t MIN_BUFFER_COUNT_IDLE	= 16;
+static const size_t MAX_BUFFER_COUNT		= 1000;
+static const size_t MAX_BUFFER_COUNT_THUMBNAIL	= 1;
+static const size_t MIN_BUFFER_SIZE			= 2 * 1000000;
+static const size_t MAX_BUFFER_SIZE			= 64 * 1000000;
+static const double IDLE_TIMEOUT			= 1.0;
+static const double RATE_WINDOW				= 0.25;
+
+namespace caspar { namespace ffmpeg {
+
+struct read_ahead::implementation : boost::noncopyable
+{
+	struct scheduler
+	{
+		boost::mutex					mutex;
+		boost::condition_variable		wakes_done;
+		std::set<implementation*>		inputs;
+		size_t							buffered_bytes;
+		bool							configured;
+		size_t							budget;
+		double							read_ahead_seconds;
+
+		scheduler()
+			: buffered_bytes(0)
+			, configured(false)
+			, budget(0)
+			, read_ahead_seconds(0.0)
+		{
+		}
+
+		void configure()
+		{
+			if(configured)
+				return;
+
+			budget				= env::properties().get(L"configuration.ffmpeg.read-ahead-budget", 256) * 1000000;
+			read_ahead_seconds	= env::properties().get(L"configuration.ffmpeg.read-ahead-millis", 2000) / 1000.0;
+			configured			= true;
+		}
+	};
+
+	static scheduler global_scheduler;
+
+	static scheduler& get_scheduler()
+	{
+		return global_scheduler;
+	}
+
+	scheduler&				scheduler_;
+	const double			bit_rate_; // bytes per second, 0 if unknown.
+	const bool				thumbnail_mode_;
+	const std::function<void()>	wake_;
+
+	size_t					bytes_;
+	size_t					packets_;
+	bool					throttled_;
+	int						pending_wakes_;
+
+	boost::timer			since_consumed_;
+	bool					consumed_;
+	boost::timer			rate_window_;
+	size_t					window_bytes_;
+	double					consume_rate_;
+
+	implementation(int64_t bit_rate, bool thumbnail_mode, const std::function<void()>& wake)
+		: scheduler_(get_scheduler())
+		, bit_rate_(std::max<int64_t>(0, bit_rate) / 8.0)
+		, thumbnail_mode_(thumbnail_mode)
+		, wake_(wake)
+		, bytes_(0)
+		, packets_(0)
+		, throttled_(false)
+		, pending_wakes_(0)
+		, consumed_(false)
+		, window_bytes_(0)
+		, consume_rate_(0.0)
+	{
+		boost::lock_guard<boost::mutex> lock(scheduler_.mutex);
+		scheduler_.configure();
+		scheduler_.inputs.insert(this);
+	}
+
+	~implementation()
+	{
+		std::vector<implementation*> wakes;
+		{
+			boost::unique_lock<boost::mutex> lock(scheduler_.mutex);
+			scheduler_.inputs.erase(this);
+
+			// wake_ may be running outside of the lock.
+			while(pending_wakes_ > 0)
+				scheduler_.wakes_done.wait(lock);
+
+			release(bytes_, wakes);
+		}
+		wake(wakes);
+	}
+
+	bool active() const
+	{
+		return consumed_ && since_consumed_.elapsed() < IDLE_TIMEOUT;
+	}
+
+	size_t min_packets() const
+	{
+		return active() ? MIN_BUFFER_COUNT : MIN_BUFFER_COUNT_IDLE;
+	}
+
+	size_t target() const
+	{
+		if(!active())
+			return MIN_BUFFER_SIZE;
+
+		auto rate = std::max(bit_rate_, consume_rate_);
+		auto bytes = static_cast<size_t>(rate * scheduler_.read_ahead_seconds);
+
+		return std::min(MAX_BUFFER_SIZE, std::max(MIN_BUFFER_SIZE, bytes));
+	}
+
+	bool may_read()
+	{
+		boost::lock_guard<boost::mutex> lock(scheduler_.mutex);
+
+		// Thumbnails only decode a frame or two, do not read ahead for them.
+		if(thumbnail_mode_)
+			return packets_ < MAX_BUFFER_COUNT_THUMBNAIL;
+
+		if(packets_ >= MAX_BUFFER_COUNT || bytes_ >= MAX_BUFFER_SIZE)
+			return false;
+
+		if(packets_ < min_packets())
+			return true;
+
+		const auto target_bytes = target();
+
+		if(bytes_ >= target_bytes)
+			return false;
+
+		if(scheduler_.buffered_bytes < scheduler_.budget)
+			return true;
+
+		// Over budget, only inputs that are playing and about to run dry may continue.
+		if(active() && bytes_ < target_bytes / 2)
+			return true;
+
+		throttled_ = true;
+		return false;
+	}
+
+	void on_buffered(size_t bytes)
+	{
+		boost::lock_guard<boost::mutex> lock(scheduler_.mutex);
+
+		bytes_ += bytes;
+		++packets_;
+		scheduler_.buffered_bytes += bytes;
+	}
+
+	void on_consumed(size_t bytes)
+	{
+		std::vector<implementation*> wakes;
+		{
+			boost::lock_guard<boost::mutex> lock(scheduler_.mutex);
+			consumed(bytes, wakes);
+		}
+		wake(wakes);
+	}
+
+	void consumed(size_t bytes, std::vector<implementation*>& wakes)
+	{
+		if(!active())
+		{
+			rate_window_.restart();
+			window_bytes_ = 0;
+			consume_rate_ = 0.0;
+		}
+
+		consumed_ = true;
+		since_consumed_.restart();
+
+		window_bytes_ += bytes;
+
+		auto elapsed = rate_window_.elapsed();
+		if(elapsed >= RATE_WINDOW)
+		{
+			auto rate = window_bytes_ / elapsed;
+			consume_rate_ = consume_rate_ > 0.0 ? 0.5 * consume_rate_ + 0.5 * rate : rate;
+
+			rate_window_.restart();
+			window_bytes_ = 0;
+		}
+
+		--packets_;
+		release(bytes, wakes);
+	}
+
+	void on_discarded(size_t bytes)
+	{
+		std::vector<implementation*> wakes;
+		{
+			boost::lock_guard<boost::mutex> lock(scheduler_.mutex);
+
+			--packets_;
+			release(bytes, wakes);
+		}
+		wake(wakes);
+	}
+
+	// Collects the throttled inputs to wake, wake() runs them once the
+	// scheduler mutex has been released.
+	void release(size_t bytes, std::vector<implementation*>& wakes)
+	{
+		bytes_ -= bytes;
+		scheduler_.buffered_bytes -= bytes;
+
+		if(scheduler_.buffered_bytes >= scheduler_.budget)
+			return;
+
+		BOOST_FOREACH(auto input, scheduler_.inputs)
+		{
+			if(input->throttled_)
+			{
+				input->throttled_ = false;
+				++input->pending_wakes_;
+				wakes.push_back(input);
+			}
+		}
+	}
+
+	void wake(const std::vector<implementation*>& wakes)
+	{
+		if(wakes.empty())
+			return;
+
+		BOOST_FOREACH(auto input, wakes)
+		{
+			try
+			{
+				input->wake_();
+			}
+			catch(...)
+			{
+				// The input is stopping, it does not need to read any more.
+			}
+		}
+
+		{
+			boost::lock_guard<boost::mutex> lock(scheduler_.mutex);
+			BOOST_FOREACH(auto input, wakes)
+				--input->pending_wakes_;
+		}
+		scheduler_.wakes_done.notify_all();
+	}
+};
+
+read_ahead::implementation::scheduler read_ahead::implementation::global_scheduler;
+
+read_ahead::read_ahead(int64_t bit_rate, bool thumbnail_mode, const std::function<void()>& wake)
+	: impl_(new implementation(bit_rate, thumbnail_mode, wake)){}
+read_ahead::~read_ahead(){}
+bool read_ahead::may_read(){return impl_->may_read();}
+void read_ahead::on_buffered(size_t bytes){impl_->on_buffered(bytes);}
+void read_ahead::on_consumed(size_t bytes){impl_->on_consumed(bytes);}
+void read_ahead::on_discarded(size_t bytes){impl_->on_discarded(bytes);}
+
+size_t read_ahead::buffered_bytes() const
+{
+	boost::lock_guard<boost::mutex> lock(impl_->scheduler_.mutex);
+	return impl_->bytes_;
+}
+
+size_t read_ahead::target_bytes() const
+{
+	boost::lock_guard<boost::mutex> lock(impl_->scheduler_.mutex);
+	return impl_->target();
+}
+
+struct packet_pools : boost::noncopyable
+{
+	static const int MIN_SIZE_CLASS = 12;
+	static const int MAX_SIZE_CLASS = 24;
+
+	boost::mutex	mutex;
+	AVBufferPool*	pools[MAX_SIZE_CLASS + 1];
+
+	packet_pools()
+	{
+		std::fill_n(pools, MAX_SIZE_CLASS + 1, static_cast<AVBufferPool*>(nullptr));
+	}
+
+	~packet_pools()
+	{
+		for(int n = 0; n <= MAX_SIZE_CLASS; ++n)
+			av_buffer_pool_uninit(&pools[n]);
+	}
+
+	AVBufferRef* get(int size)
+	{
+		int size_class = MIN_SIZE_CLASS;
+		while(size_class <= MAX_SIZE_CLASS && (1 << size_class) < size)
+			++size_class;
+
+		if(size_class > MAX_SIZE_CLASS)
+			return av_buffer_alloc(size);
+
+		AVBufferPool* pool;
+		{
+			boost::lock_guard<boost::mutex> lock(mutex);
+			if(!pools[size_class])
+				pools[size_class] = av_buffer_pool_init(1 << size_class, av_buffer_alloc);
+			pool = pools[size_class];
+		}
+
+		return pool ? av_buffer_pool_get(pool) : nullptr;
+	}
+} g_packet_pools;
+
+void make_refcounted(AVPacket& packet)
+{
+	if(packet.buf || !packet.data)
+		return;
+
+	auto buf = g_packet_pools.get(packet.size + AV_INPUT_BUFFER_PADDING_SIZE);
+	if(!buf)
+		throw std::bad_alloc();
+
+	std::memcpy(buf->data, packet.data, packet.size);
+	std::memset(buf->data + packet.size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+	packet.buf	= buf;
+	packet.data	= buf->data;
+}
+
+}}
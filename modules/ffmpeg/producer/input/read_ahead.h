@@ -0,0 +1,65 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <functional>
+
+struct AVPacket;
+
+namespace caspar { namespace ffmpeg {
+
+// Read-ahead accounting of a single input. All inputs share one memory
+// budget. Inputs that are being consumed read ahead according to their
+// bitrate and consumption rate, idle inputs are held at a small floor and
+// when the budget is exhausted only the inputs that are about to run dry
+// may continue. Throttled inputs are woken through the callback once
+// memory has been released.
+class read_ahead : boost::noncopyable
+{
+public:
+	read_ahead(int64_t bit_rate, bool thumbnail_mode, const std::function<void()>& wake);
+	~read_ahead();
+
+	bool may_read();
+
+	void on_buffered(size_t bytes);
+	void on_consumed(size_t bytes);
+	void on_discarded(size_t bytes);
+
+	size_t buffered_bytes() const;
+	size_t target_bytes() const;
+
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+// Gives the packet its own reference counted buffer, like av_dup_packet,
+// but takes the buffer from a size-class pool. Packets that already
+// reference a buffer are left untouched.
+void make_refcounted(AVPacket& packet);
+
+}}
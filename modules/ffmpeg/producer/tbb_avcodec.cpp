@@ -32,6 +32,11 @@
 #include <tbb/parallel_for.h>
 #include <tbb/tbb_thread.h>
 
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <map>
+
 #if defined(_MSC_VER)
 #pragma warning (push)
 #pragma warning (disable : 4244)
@@ -48,14 +53,164 @@ extern "C"
 
 namespace caspar {
 
+static const int MAX_THREADS		= 16;
+static const int PIXELS_PER_THREAD	= 960 * 540;
+
+int thread_execute(AVCodecContext* s, int (*func)(AVCodecContext* c2, void* arg2), void* arg, int* ret, int count, int size)
+{
+	tbb::parallel_for(0, count, 1, [&](int i)
+	{
+		int r = func(s, static_cast<char*>(arg) + i*size);
+		if(ret) 
+			ret[i] = r;
+	});
+
+	return 0;
+}
+
+int thread_execute2(AVCodecContext* s, int (*func)(AVCodecContext* c2, void* arg2, int, int), void* arg, int* ret, int count)
+{
+	const int nb_jobs = std::min(count, s->thread_count);
+
+	tbb::parallel_for(0, nb_jobs, 1, [&](int job)
+	{
+		for(int n = (job*count)/nb_jobs; n < ((job+1)*count)/nb_jobs; ++n)
+		{
+			int r = func(s, arg, n, job);
+			if(ret) 
+				ret[n] = r;
+		}
+	});
+
+	return 0;
+}
+
+// Hands out decoder threads from a server wide budget so that many
+// simultaneous clips do not oversubscribe the cores while a single large
+// clip can still use most of them.
+class decoder_thread_budget
+{
+	boost::mutex					mutex_;
+	std::map<AVCodecContext*, int>	granted_;
+	int								in_use_;
+	int								budget_;
+	bool							configured_;
+	bool							tbb_slice_threads_;
+public:
+	decoder_thread_budget()
+		: in_use_(0)
+		, budget_(0)
+		, configured_(false)
+		, tbb_slice_threads_(false)
+	{
+	}
+
+	int acquire(AVCodecContext* avctx)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		configure();
+
+		const int pixels	= avctx->width * avctx->height;
+		const int wanted	= std::max(1, std::min(MAX_THREADS, (pixels + PIXELS_PER_THREAD - 1) / PIXELS_PER_THREAD));
+		const int granted	= std::max(1, std::min(wanted, budget_ - in_use_));
+
+		in_use_ += granted;
+		granted_[avctx] = granted;
+
+		return granted;
+	}
+
+	// Gives back what avctx was granted but does not use.
+	void shrink(AVCodecContext* avctx, int used)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		auto it = granted_.find(avctx);
+		if(it == granted_.end() || it->second <= used)
+			return;
+
+		in_use_ -= it->second - used;
+		it->second = used;
+	}
+
+	void release(AVCodecContext* avctx)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		auto it = granted_.find(avctx);
+		if(it == granted_.end())
+			return;
+
+		in_use_ -= it->second;
+		granted_.erase(it);
+	}
+
+	bool tbb_slice_threads() const
+	{
+		return tbb_slice_threads_;
+	}
+private:
+	void configure()
+	{
+		if(configured_)
+			return;
+
+		budget_				= env::properties().get(L"configuration.ffmpeg.decoder-threads", static_cast<int>(tbb::tbb_thread::hardware_concurrency()));
+		tbb_slice_threads_	= env::properties().get(L"configuration.ffmpeg.tbb-slice-threads", false);
+		configured_			= true;
+	}
+} g_decoder_thread_budget;
+
 int tbb_avcodec_open(AVCodecContext* avctx, AVCodec* codec)
 {
-	return avcodec_open2(avctx, codec, nullptr); 
+	if(avctx->codec_type != AVMEDIA_TYPE_VIDEO)
+		return avcodec_open2(avctx, codec, nullptr);
+
+	avctx->thread_count	= 1;
+	avctx->thread_type	= 0;
+
+	// Frame threading scales better but adds a frame of latency per thread, decode-ahead absorbs it.
+	if(codec->capabilities & CODEC_CAP_FRAME_THREADS)
+		avctx->thread_type = FF_THREAD_FRAME;
+	else if(codec->capabilities & CODEC_CAP_SLICE_THREADS)
+		avctx->thread_type = FF_THREAD_SLICE;
+
+	// Only codecs that can thread draw from the budget.
+	if(avctx->thread_type != 0)
+		avctx->thread_count = g_decoder_thread_budget.acquire(avctx);
+
+	auto ret = avcodec_open2(avctx, codec, nullptr);
+
+	if(ret < 0)
+	{
+		g_decoder_thread_budget.release(avctx);
+		return ret;
+	}
+
+	// libavcodec may decide against threading, e.g. for low_delay or one thread.
+	if(avctx->active_thread_type == 0 || avctx->thread_count < 2)
+		g_decoder_thread_budget.release(avctx);
+	else
+		g_decoder_thread_budget.shrink(avctx, avctx->thread_count);
+
+	// Run slice jobs on the tbb scheduler instead of libavcodec's own workers.
+	if(avctx->active_thread_type == FF_THREAD_SLICE && g_decoder_thread_budget.tbb_slice_threads())
+	{
+		avctx->execute	= thread_execute;
+		avctx->execute2	= thread_execute2;
+	}
+
+	CASPAR_LOG(debug) << L"[tbb_avcodec] " << codec->name << L" " << avctx->width << L"x" << avctx->height 
+					  << L" using " << avctx->thread_count << (avctx->active_thread_type == FF_THREAD_FRAME ? L" frame" : L" slice") << L" thread(s).";
+
+	return ret;
 }
 
 int tbb_avcodec_close(AVCodecContext* avctx)
 {
+	g_decoder_thread_budget.release(avctx);
 	return avcodec_close(avctx); 
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,213 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../../stdafx.h"
+
+#include "frame_cache.h"
+
+#include <common/env.h>
+
+#include <core/producer/frame/basic_frame.h>
+#include <core/producer/frame/frame_transform.h>
+#include <core/producer/frame/frame_visitor.h>
+#include <core/mixer/write_frame.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+namespace caspar { namespace ffmpeg {
+
+// Copies the frame tree with every write_frame retagged, so that the audio
+// of each producer is mixed on its own and the mixers of the leader do not
+// see the frames of the followers.
+class retagger : public core::frame_visitor
+{
+	typedef std::pair<core::frame_transform, std::vector<safe_ptr<core::basic_frame>>> level;
+
+	const void*			tag_;
+	std::vector<level>	stack_;
+public:
+	explicit retagger(const void* tag)
+		: tag_(tag)
+		, stack_(1)
+	{
+	}
+
+	virtual void begin(core::basic_frame& frame) override
+	{
+		stack_.push_back(level(frame.get_frame_transform(), std::vector<safe_ptr<core::basic_frame>>()));
+	}
+
+	virtual void visit(core::write_frame& frame) override
+	{
+		stack_.back().second.push_back(frame.retag(tag_));
+	}
+
+	virtual void end() override
+	{
+		auto frame = make_safe<core::basic_frame>(std::move(stack_.back().second));
+		frame->get_frame_transform() = stack_.back().first;
+		stack_.pop_back();
+		stack_.back().second.push_back(frame);
+	}
+
+	safe_ptr<core::basic_frame> retag(const safe_ptr<core::basic_frame>& frame)
+	{
+		frame->accept(*this);
+		return stack_.front().second.at(0);
+	}
+};
+
+struct frame_cache_registry : boost::noncopyable
+{
+	boost::mutex										mutex_;
+	std::map<std::wstring, std::weak_ptr<frame_cache>>	caches_;
+	int													window_;
+
+	frame_cache_registry()
+		: window_(-1)
+	{
+	}
+
+	std::shared_ptr<frame_cache> open(const std::wstring& key)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		if(window_ < 0)
+			window_ = std::max(0, env::properties().get(L"configuration.ffmpeg.shared-frames", 8));
+
+		if(window_ == 0)
+			return nullptr;
+
+		for(auto it = caches_.begin(); it != caches_.end();)
+		{
+			if(it->second.expired())
+				it = caches_.erase(it);
+			else
+				++it;
+		}
+
+		auto cache = caches_[key].lock();
+		if(!cache)
+		{
+			cache = std::make_shared<frame_cache>(window_);
+			caches_[key] = cache;
+		}
+
+		return cache;
+	}
+} g_frame_cache_registry;
+
+struct frame_cache::implementation : boost::noncopyable
+{
+	struct entry
+	{
+		safe_ptr<core::basic_frame>	frame;
+		int							hints;
+		uint32_t					file_frame_number;
+	};
+
+	const size_t					window_;
+
+	mutable boost::mutex			mutex_;
+	const void*						leader_;
+	std::map<int64_t, entry>		frames_;
+
+	implementation(size_t window)
+		: window_(window)
+		, leader_(nullptr)
+	{
+	}
+
+	void publish(const void* producer, int64_t position, int hints, const safe_ptr<core::basic_frame>& frame, uint32_t file_frame_number)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		if(!leader_)
+			leader_ = producer;
+
+		if(leader_ != producer)
+			return;
+
+		entry e = {frame, hints, file_frame_number};
+		frames_.insert(std::make_pair(position, e));
+
+		while(frames_.size() > window_)
+			frames_.erase(frames_.begin());
+	}
+
+	bool try_get(const void* producer, int64_t position, int hints, safe_ptr<core::basic_frame>& frame, uint32_t& file_frame_number) const
+	{
+		auto shared_frame = core::basic_frame::empty();
+		{
+			boost::lock_guard<boost::mutex> lock(mutex_);
+
+			if(leader_ == producer)
+				return false;
+
+			auto it = frames_.find(position);
+			if(it == frames_.end() || it->second.hints != hints)
+				return false;
+
+			shared_frame		= it->second.frame;
+			file_frame_number	= it->second.file_frame_number;
+		}
+
+		frame = retagger(producer).retag(shared_frame);
+		return true;
+	}
+
+	bool pending(const void* producer, int64_t position) const
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		if(!leader_ || leader_ == producer)
+			return false;
+
+		return frames_.empty() || position > frames_.rbegin()->first;
+	}
+
+	bool has_leader() const
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		return leader_ != nullptr;
+	}
+
+	void leave(const void* producer)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		if(leader_ == producer)
+			leader_ = nullptr;
+	}
+};
+
+frame_cache::frame_cache(size_t window) : impl_(new implementation(window)){}
+std::shared_ptr<frame_cache> frame_cache::open(const std::wstring& key){return g_frame_cache_registry.open(key);}
+void frame_cache::publish(const void* producer, int64_t position, int hints, const safe_ptr<core::basic_frame>& frame, uint32_t file_frame_number){impl_->publish(producer, position, hints, frame, file_frame_number);}
+bool frame_cache::try_get(const void* producer, int64_t position, int hints, safe_ptr<core::basic_frame>& frame, uint32_t& file_frame_number) const{return impl_->try_get(producer, position, hints, frame, file_frame_number);}
+bool frame_cache::pending(const void* producer, int64_t position) const{return impl_->pending(producer, position);}
+bool frame_cache::has_leader() const{return impl_->has_leader();}
+void frame_cache::leave(const void* producer){impl_->leave(producer);}
+
+}}
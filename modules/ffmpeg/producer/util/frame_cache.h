@@ -0,0 +1,77 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace caspar {
+
+namespace core {
+
+class basic_frame;
+
+}
+
+namespace ffmpeg {
+
+// Decoded frames of a clip, shared by all producers that play it from the
+// same start into the same output format. Frames are identified by their
+// position, the number of frames produced since the start. The first
+// producer to publish leads: it decodes and publishes its frames and the
+// other producers take them instead of decoding their own. The newest
+// frames are kept for a short window, so that producers which are a few
+// frames behind the leader can still share.
+class frame_cache : boost::noncopyable
+{
+public:
+	explicit frame_cache(size_t window);
+
+	// The cache of all producers opened with the same key, nullptr if
+	// sharing is disabled. The cache lives as long as any of them.
+	static std::shared_ptr<frame_cache> open(const std::wstring& key);
+
+	// Ignored unless producer leads, which it does if nobody else does.
+	void publish(const void* producer, int64_t position, int hints, const safe_ptr<core::basic_frame>& frame, uint32_t file_frame_number);
+
+	// A frame published by another producer, as a copy whose frames are
+	// tagged with producer.
+	bool try_get(const void* producer, int64_t position, int hints, safe_ptr<core::basic_frame>& frame, uint32_t& file_frame_number) const;
+
+	// True if another producer leads and has not reached position yet.
+	bool pending(const void* producer, int64_t position) const;
+
+	bool has_leader() const;
+
+	// Gives up the lead if producer has it.
+	void leave(const void* producer);
+
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}}
@@ -0,0 +1,276 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../../stdafx.h"
+
+#include "frame_store.h"
+
+#include <common/env.h>
+
+#include <core/mixer/write_frame.h>
+#include <core/producer/frame/basic_frame.h>
+#include <core/producer/frame/frame_visitor.h>
+#include <core/producer/frame/pixel_format.h>
+
+#include <boost/foreach.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace caspar { namespace ffmpeg {
+
+struct frame_store_budget : boost::noncopyable
+{
+	const wchar_t*	key_;
+	const int		default_mb_;
+	boost::mutex	mutex_;
+	int64_t			budget_;
+	int64_t			used_;
+
+	frame_store_budget(const wchar_t* key, int default_mb)
+		: key_(key)
+		, default_mb_(default_mb)
+		, budget_(-1)
+		, used_(0)
+	{
+	}
+
+	bool try_reserve(size_t bytes)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		if(budget_ < 0)
+			budget_ = env::properties().get(key_, default_mb_) * 1024LL * 1024LL;
+
+		if(used_ + static_cast<int64_t>(bytes) > budget_)
+			return false;
+
+		used_ += bytes;
+		return true;
+	}
+
+	void release(size_t bytes)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		used_ -= bytes;
+	}
+};
+
+frame_store_budget g_host_budget(L"configuration.ffmpeg.in-memory-budget", 1024);
+frame_store_budget g_device_budget(L"configuration.ffmpeg.in-memory-device-budget", 512);
+
+// Bytes charged to one budget by a store.
+struct budget_account
+{
+	frame_store_budget*	budget;
+	size_t				reserved;
+	size_t				used;
+
+	budget_account(frame_store_budget& budget, size_t reserved)
+		: budget(&budget)
+		, reserved(reserved)
+		, used(0)
+	{
+	}
+
+	bool add(size_t bytes)
+	{
+		used += bytes;
+
+		if(used > reserved)
+		{
+			if(!budget->try_reserve(used - reserved))
+				return false;
+
+			reserved = used;
+		}
+
+		return true;
+	}
+
+	// Gives back what was reserved in excess.
+	void trim()
+	{
+		budget->release(reserved - used);
+		reserved = used;
+	}
+
+	void clear()
+	{
+		budget->release(reserved);
+		reserved = 0;
+		used = 0;
+	}
+};
+
+struct frame_size_visitor : public core::frame_visitor
+{
+	size_t image_bytes;
+	size_t audio_bytes;
+
+	frame_size_visitor()
+		: image_bytes(0)
+		, audio_bytes(0)
+	{
+	}
+
+	virtual void begin(core::basic_frame&) override {}
+	virtual void end() override {}
+
+	virtual void visit(core::write_frame& frame) override
+	{
+		BOOST_FOREACH(auto& plane, frame.get_pixel_format_desc().planes)
+			image_bytes += plane.size;
+
+		audio_bytes += frame.audio_data().size() * sizeof(int32_t);
+	}
+};
+
+struct frame_store::implementation : boost::noncopyable
+{
+	struct entry
+	{
+		safe_ptr<core::basic_frame>	frame;
+		uint32_t					file_frame_number;
+	};
+
+	mutable boost::mutex	mutex_;
+	std::vector<entry>		frames_;
+	budget_account			image_;
+	budget_account			audio_;
+	bool					complete_;
+	bool					abandoned_;
+
+	implementation(size_t nb_frames, size_t reserved_bytes, bool device_memory)
+		: image_(device_memory ? g_device_budget : g_host_budget, reserved_bytes)
+		, audio_(g_host_budget, 0)
+		, complete_(false)
+		, abandoned_(false)
+	{
+		frames_.reserve(nb_frames);
+	}
+
+	~implementation()
+	{
+		image_.clear();
+		audio_.clear();
+	}
+
+	bool push(const safe_ptr<core::basic_frame>& frame, uint32_t file_frame_number)
+	{
+		frame_size_visitor visitor;
+		frame->accept(visitor);
+
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		if(abandoned_ || complete_)
+			return !abandoned_;
+
+		if(!image_.add(visitor.image_bytes) || !audio_.add(visitor.audio_bytes))
+		{
+			do_abandon();
+			return false;
+		}
+
+		entry e = {frame, file_frame_number};
+		frames_.push_back(e);
+		return true;
+	}
+
+	void complete()
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		if(abandoned_ || complete_)
+			return;
+
+		complete_ = true;
+
+		image_.trim();
+		audio_.trim();
+	}
+
+	void abandon()
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		do_abandon();
+	}
+
+	void do_abandon()
+	{
+		if(abandoned_)
+			return;
+
+		abandoned_ = true;
+		complete_ = false;
+
+		std::vector<entry>().swap(frames_);
+
+		image_.clear();
+		audio_.clear();
+	}
+
+	bool find(uint32_t file_frame_number, size_t& index) const
+	{
+		boost::lock_guard<boost::mutex> lock(mutex_);
+
+		auto it = std::lower_bound(frames_.begin(), frames_.end(), file_frame_number, [](const entry& e, uint32_t file_frame_number)
+		{
+			return e.file_frame_number < file_frame_number;
+		});
+
+		if(it == frames_.end())
+		{
+			if(!complete_ || frames_.empty())
+				return false;
+
+			--it;
+		}
+
+		index = it - frames_.begin();
+		return true;
+	}
+};
+
+std::shared_ptr<frame_store> frame_store::create(size_t nb_frames, size_t frame_size, bool device_memory)
+{
+	auto bytes = nb_frames * frame_size;
+
+	if(!(device_memory ? g_device_budget : g_host_budget).try_reserve(bytes))
+		return nullptr;
+
+	return std::make_shared<frame_store>(nb_frames, bytes, device_memory);
+}
+
+frame_store::frame_store(size_t nb_frames, size_t reserved_bytes, bool device_memory) : impl_(new implementation(nb_frames, reserved_bytes, device_memory)){}
+frame_store::~frame_store(){}
+bool frame_store::push(const safe_ptr<core::basic_frame>& frame, uint32_t file_frame_number){return impl_->push(frame, file_frame_number);}
+void frame_store::complete(){impl_->complete();}
+bool frame_store::is_complete() const{boost::lock_guard<boost::mutex> lock(impl_->mutex_); return impl_->complete_;}
+void frame_store::abandon(){impl_->abandon();}
+bool frame_store::is_abandoned() const{boost::lock_guard<boost::mutex> lock(impl_->mutex_); return impl_->abandoned_;}
+size_t frame_store::size() const{boost::lock_guard<boost::mutex> lock(impl_->mutex_); return impl_->frames_.size();}
+size_t frame_store::bytes() const{boost::lock_guard<boost::mutex> lock(impl_->mutex_); return impl_->image_.used + impl_->audio_.used;}
+safe_ptr<core::basic_frame> frame_store::at(size_t index) const{boost::lock_guard<boost::mutex> lock(impl_->mutex_); return impl_->frames_.at(index).frame;}
+uint32_t frame_store::file_frame_number(size_t index) const{boost::lock_guard<boost::mutex> lock(impl_->mutex_); return impl_->frames_.at(index).file_frame_number;}
+bool frame_store::find(uint32_t file_frame_number, size_t& index) const{return impl_->find(file_frame_number, index);}
+
+}}
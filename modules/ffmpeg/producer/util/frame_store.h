@@ -0,0 +1,79 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <memory>
+
+namespace caspar {
+
+namespace core {
+
+class basic_frame;
+
+}
+
+namespace ffmpeg {
+
+// All decoded frames of a clip, so that it can be played, looped and
+// reversed without decoding. Images of frames from a gpu channel are
+// textures and count against ffmpeg.in-memory-device-budget, everything
+// else against ffmpeg.in-memory-budget. A store that outgrows a budget is
+// abandoned and releases its frames.
+class frame_store : boost::noncopyable
+{
+public:
+	// Reserves nb_frames * frame_size image bytes up front, nullptr if they
+	// do not fit the budget.
+	static std::shared_ptr<frame_store> create(size_t nb_frames, size_t frame_size, bool device_memory);
+
+	frame_store(size_t nb_frames, size_t reserved_bytes, bool device_memory);
+	~frame_store();
+
+	// False if the store is, or has now been, abandoned.
+	bool push(const safe_ptr<core::basic_frame>& frame, uint32_t file_frame_number);
+
+	void complete();
+	bool is_complete() const;
+
+	void abandon();
+	bool is_abandoned() const;
+
+	size_t size() const;
+	size_t bytes() const;
+
+	safe_ptr<core::basic_frame> at(size_t index) const;
+	uint32_t file_frame_number(size_t index) const;
+
+	// The first frame at or after file_frame_number, false if it has not
+	// been stored yet.
+	bool find(uint32_t file_frame_number, size_t& index) const;
+
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}}
@@ -0,0 +1,268 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "../../stdafx.h"
+
+#include "pixel_convert.h"
+
+#include <core/mixer/write_frame.h>
+
+#include <common/memory/memcpy.h>
+
+#include <tbb/parallel_for.h>
+
+#include <intrin.h>
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C"
+{
+	#include <libavutil/frame.h>
+	#include <libavutil/pixfmt.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+namespace caspar { namespace ffmpeg {
+
+namespace {
+
+// 10 bit samples in the low bits of 16 bit words to 8 bit, rounded.
+void pack_10_to_8(const uint16_t* src, uint8_t* dest, size_t count)
+{
+	const __m128i round = _mm_set1_epi16(2);
+
+	size_t n = 0;
+	for(; n + 16 <= count; n += 16)
+	{
+		auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n));
+		auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n + 8));
+		a = _mm_srli_epi16(_mm_adds_epu16(a, round), 2);
+		b = _mm_srli_epi16(_mm_adds_epu16(b, round), 2);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_packus_epi16(a, b));
+	}
+
+	for(; n < count; ++n)
+		dest[n] = static_cast<uint8_t>(std::min(255, (src[n] + 2) >> 2));
+}
+
+// Samples in the high bits of 16 bit words to 8 bit, rounded.
+void pack_msb_to_8(const uint16_t* src, uint8_t* dest, size_t count)
+{
+	const __m128i round = _mm_set1_epi16(0x80);
+
+	size_t n = 0;
+	for(; n + 16 <= count; n += 16)
+	{
+		auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n));
+		auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n + 8));
+		a = _mm_srli_epi16(_mm_adds_epu16(a, round), 8);
+		b = _mm_srli_epi16(_mm_adds_epu16(b, round), 8);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_packus_epi16(a, b));
+	}
+
+	for(; n < count; ++n)
+		dest[n] = static_cast<uint8_t>(std::min(255, (src[n] + 0x80) >> 8));
+}
+
+// UVUV... to U and V.
+void deinterleave_8(const uint8_t* src, uint8_t* dest_u, uint8_t* dest_v, size_t count)
+{
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+
+	size_t n = 0;
+	for(; n + 16 <= count; n += 16)
+	{
+		auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n*2));
+		auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n*2 + 16));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest_u + n), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest_v + n), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+	}
+
+	for(; n < count; ++n)
+	{
+		dest_u[n] = src[n*2+0];
+		dest_v[n] = src[n*2+1];
+	}
+}
+
+// UVUV... with samples in the high bits of 16 bit words to 8 bit U and V.
+void deinterleave_msb_to_8(const uint16_t* src, uint8_t* dest_u, uint8_t* dest_v, size_t count)
+{
+	const __m128i round = _mm_set1_epi16(0x80);
+	const __m128i mask	= _mm_set1_epi32(0x0000FFFF);
+
+	size_t n = 0;
+	for(; n + 16 <= count; n += 16)
+	{
+		__m128i u[4];
+		__m128i v[4];
+
+		for(int k = 0; k < 4; ++k)
+		{
+			auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n*2 + k*8));
+			x = _mm_srli_epi16(_mm_adds_epu16(x, round), 8);
+			u[k] = _mm_and_si128(x, mask);
+			v[k] = _mm_srli_epi32(x, 16);
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest_u + n), _mm_packus_epi16(_mm_packs_epi32(u[0], u[1]), _mm_packs_epi32(u[2], u[3])));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest_v + n), _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3])));
+	}
+
+	for(; n < count; ++n)
+	{
+		dest_u[n] = static_cast<uint8_t>(std::min(255, (src[n*2+0] + 0x80) >> 8));
+		dest_v[n] = static_cast<uint8_t>(std::min(255, (src[n*2+1] + 0x80) >> 8));
+	}
+}
+
+// UYVY or YUYV to planar 4:2:2, count is the number of pixel pairs.
+void unpack_422(const uint8_t* src, uint8_t* dest_y, uint8_t* dest_u, uint8_t* dest_v, size_t count, bool luma_first)
+{
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+
+	size_t n = 0;
+	for(; n + 16 <= count; n += 16)
+	{
+		__m128i x[4];
+		for(int k = 0; k < 4; ++k)
+			x[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n*4 + k*16));
+
+		__m128i y[4];
+		__m128i c[4];
+		for(int k = 0; k < 4; ++k)
+		{
+			y[k] = luma_first ? _mm_and_si128(x[k], mask) : _mm_srli_epi16(x[k], 8);
+			c[k] = luma_first ? _mm_srli_epi16(x[k], 8) : _mm_and_si128(x[k], mask);
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest_y + n*2),		_mm_packus_epi16(y[0], y[1]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest_y + n*2 + 16), _mm_packus_epi16(y[2], y[3]));
+
+		auto c01 = _mm_packus_epi16(c[0], c[1]);
+		auto c23 = _mm_packus_epi16(c[2], c[3]);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest_u + n), _mm_packus_epi16(_mm_and_si128(c01, mask), _mm_and_si128(c23, mask)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest_v + n), _mm_packus_epi16(_mm_srli_epi16(c01, 8), _mm_srli_epi16(c23, 8)));
+	}
+
+	const int y0 = luma_first ? 0 : 1;
+	const int c0 = luma_first ? 1 : 0;
+
+	for(; n < count; ++n)
+	{
+		dest_y[n*2+0]	= src[n*4 + y0];
+		dest_u[n]		= src[n*4 + c0];
+		dest_y[n*2+1]	= src[n*4 + y0 + 2];
+		dest_v[n]		= src[n*4 + c0 + 2];
+	}
+}
+
+template<typename T>
+const T* row(const AVFrame& frame, int plane, size_t y)
+{
+	return reinterpret_cast<const T*>(frame.data[plane] + y*frame.linesize[plane]);
+}
+
+uint8_t* row(core::write_frame& frame, const core::pixel_format_desc& desc, int plane, size_t y)
+{
+	return frame.image_data(plane).begin() + y*desc.planes[plane].linesize;
+}
+
+bool is_planar_8bit_yuv(const core::pixel_format_desc& desc)
+{
+	return desc.pix_fmt == core::pixel_format::ycbcr && desc.planes.size() == 3 && desc.planes[0].channels == 1;
+}
+
+}
+
+bool try_convert_frame(const AVFrame& decoded_frame, core::write_frame& frame, const core::pixel_format_desc& desc)
+{
+	if(!is_planar_8bit_yuv(desc))
+		return false;
+
+	const auto& luma	= desc.planes[0];
+	const auto& chroma	= desc.planes[1];
+
+	switch(decoded_frame.format)
+	{
+	case AV_PIX_FMT_YUV420P10LE:
+	case AV_PIX_FMT_YUV422P10LE:
+	case AV_PIX_FMT_YUV444P10LE:
+		for(int n = 0; n < 3; ++n)
+		{
+			const auto& plane = desc.planes[n];
+			tbb::parallel_for<size_t>(0, plane.height, [&](size_t y)
+			{
+				pack_10_to_8(row<uint16_t>(decoded_frame, n, y), row(frame, desc, n, y), plane.width);
+			});
+		}
+		break;
+	case AV_PIX_FMT_UYVY422:
+	case AV_PIX_FMT_YUYV422:
+		{
+			if(luma.width != chroma.width*2)
+				return false;
+
+			const bool luma_first = decoded_frame.format == AV_PIX_FMT_YUYV422;
+			tbb::parallel_for<size_t>(0, luma.height, [&](size_t y)
+			{
+				unpack_422(row<uint8_t>(decoded_frame, 0, y), row(frame, desc, 0, y), row(frame, desc, 1, y), row(frame, desc, 2, y), chroma.width, luma_first);
+			});
+		}
+		break;
+	case AV_PIX_FMT_NV12:
+		tbb::parallel_for<size_t>(0, luma.height, [&](size_t y)
+		{
+			fast_memcpy(row(frame, desc, 0, y), row<uint8_t>(decoded_frame, 0, y), luma.width);
+		});
+		tbb::parallel_for<size_t>(0, chroma.height, [&](size_t y)
+		{
+			deinterleave_8(row<uint8_t>(decoded_frame, 1, y), row(frame, desc, 1, y), row(frame, desc, 2, y), chroma.width);
+		});
+		break;
+	case AV_PIX_FMT_P010LE:
+		tbb::parallel_for<size_t>(0, luma.height, [&](size_t y)
+		{
+			pack_msb_to_8(row<uint16_t>(decoded_frame, 0, y), row(frame, desc, 0, y), luma.width);
+		});
+		tbb::parallel_for<size_t>(0, chroma.height, [&](size_t y)
+		{
+			deinterleave_msb_to_8(row<uint16_t>(decoded_frame, 1, y), row(frame, desc, 1, y), row(frame, desc, 2, y), chroma.width);
+		});
+		break;
+	default:
+		return false;
+	}
+
+	for(int n = 0; n < 3; ++n)
+		frame.commit(n);
+
+	return true;
+}
+
+}}
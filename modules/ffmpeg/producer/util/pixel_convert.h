@@ -0,0 +1,43 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+
+#include <core/producer/frame/pixel_format.h>
+
+struct AVFrame;
+
+namespace caspar {
+
+namespace core {
+
+class write_frame;
+
+}
+
+namespace ffmpeg {
+
+// Converts packed and high bit depth yuv frames (UYVY, YUYV, NV12, P010 and
+// 10 bit planar 4:2:0, 4:2:2 and 4:4:4) to the 8 bit planar layout of desc
+// in one pass, straight into the planes of frame. Returns false if there is
+// no converter for the source format.
+bool try_convert_frame(const AVFrame& decoded_frame, core::write_frame& frame, const core::pixel_format_desc& desc);
+
+}}
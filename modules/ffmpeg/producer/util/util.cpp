@@ -24,6 +24,7 @@
 #include "util.h"
 
 #include "flv.h"
+#include "pixel_convert.h"
 
 #include "../tbb_avcodec.h"
 #include "../../ffmpeg_error.h"
@@ -44,6 +45,7 @@
 #include <tbb/parallel_for.h>
 
 #include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
 
@@ -175,10 +177,96 @@ int make_alpha_format(int format)
 	//}
 }
 
-safe_ptr<core::write_frame> make_write_frame(const void* tag, const safe_ptr<AVFrame>& decoded_frame, const safe_ptr<core::frame_factory>& frame_factory, int hints, const core::channel_layout& audio_channel_layout)
-{			
+void sws_convert_frame(const AVFrame& decoded_frame, core::write_frame& write, AVPixelFormat target_pix_fmt, const core::pixel_format_desc& target_desc)
+{
 	static tbb::concurrent_unordered_map<int64_t, tbb::concurrent_queue<std::shared_ptr<SwsContext>>> sws_contexts_;
+
+	const auto width	= decoded_frame.width;
+	const auto height	= decoded_frame.height;
+	const auto pix_fmt	= static_cast<AVPixelFormat>(decoded_frame.format);
+
+	std::shared_ptr<SwsContext> sws_context;
+
+	//CASPAR_LOG(warning) << "Hardware accelerated color transform not supported.";
 	
+	int64_t key = ((static_cast<int64_t>(width)			 << 32) & 0xFFFF00000000) | 
+				  ((static_cast<int64_t>(height)		 << 16) & 0xFFFF0000) | 
+				  ((static_cast<int64_t>(pix_fmt)		 <<  8) & 0xFF00) | 
+				  ((static_cast<int64_t>(target_pix_fmt) <<  0) & 0xFF);
+		
+	auto& pool = sws_contexts_[key];
+					
+	if(!pool.try_pop(sws_context))
+	{
+		double param;
+		sws_context.reset(sws_getContext(width, height, static_cast<AVPixelFormat>(pix_fmt), width, height, target_pix_fmt, SWS_BILINEAR, nullptr, nullptr, &param), sws_freeContext);
+	}
+		
+	if(!sws_context)
+	{
+		BOOST_THROW_EXCEPTION(operation_failed() << msg_info("Could not create software scaling context.") << 
+								boost::errinfo_api_function("sws_getContext"));
+	}	
+	
+	safe_ptr<AVFrame> av_frame(av_frame_alloc(), [](AVFrame* ptr) { av_frame_free(&ptr); });
+	if(target_pix_fmt == AV_PIX_FMT_BGRA)
+	{
+		auto size = avpicture_fill(reinterpret_cast<AVPicture*>(av_frame.get()), write.image_data().begin(), AV_PIX_FMT_BGRA, width, height);
+		CASPAR_VERIFY(size == static_cast<int>(write.image_data().size()));
+	}
+	else
+	{
+		av_frame->width	 = width;
+		av_frame->height = height;
+		for(size_t n = 0; n < target_desc.planes.size(); ++n)
+		{
+			av_frame->data[n]		= write.image_data(n).begin();
+			av_frame->linesize[n]	= target_desc.planes[n].linesize;
+		}
+	}
+
+	sws_scale(sws_context.get(), decoded_frame.data, decoded_frame.linesize, 0, height, av_frame->data, av_frame->linesize);	
+	pool.push(sws_context);
+
+	write.commit();
+}
+
+// The format frames that can not be mixed as they are get converted to.
+AVPixelFormat get_target_pix_fmt(AVPixelFormat pix_fmt)
+{
+	switch(pix_fmt)
+	{
+	case AV_PIX_FMT_UYVY422:	return AV_PIX_FMT_YUV422P;
+	case AV_PIX_FMT_YUYV422:	return AV_PIX_FMT_YUV422P;
+	case AV_PIX_FMT_UYYVYY411:	return AV_PIX_FMT_YUV411P;
+	case AV_PIX_FMT_YUV420P10:	return AV_PIX_FMT_YUV420P;
+	case AV_PIX_FMT_YUV422P10:	return AV_PIX_FMT_YUV422P;
+	case AV_PIX_FMT_YUV444P10:	return AV_PIX_FMT_YUV444P;
+	case AV_PIX_FMT_NV12:		return AV_PIX_FMT_YUV420P;
+	case AV_PIX_FMT_P010LE:		return AV_PIX_FMT_YUV420P;
+	default:					return AV_PIX_FMT_BGRA;
+	}
+}
+
+size_t get_image_size(int pix_fmt, size_t width, size_t height)
+{
+	if(width < 1 || height < 1)
+		return 0;
+
+	auto desc = get_pixel_format_desc(static_cast<AVPixelFormat>(pix_fmt), width, height);
+
+	if(desc.pix_fmt == core::pixel_format::invalid)
+		desc = get_pixel_format_desc(get_target_pix_fmt(static_cast<AVPixelFormat>(pix_fmt)), width, height);
+
+	size_t size = 0;
+	BOOST_FOREACH(auto& plane, desc.planes)
+		size += plane.size;
+
+	return size;
+}
+
+safe_ptr<core::write_frame> make_write_frame(const void* tag, const safe_ptr<AVFrame>& decoded_frame, const safe_ptr<core::frame_factory>& frame_factory, int hints, const core::channel_layout& audio_channel_layout)
+{			
 	if(decoded_frame->width < 1 || decoded_frame->height < 1)
 		return make_safe<core::write_frame>(tag, audio_channel_layout);
 
@@ -193,71 +281,14 @@ safe_ptr<core::write_frame> make_write_frame(const void* tag, const safe_ptr<AVF
 
 	if(desc.pix_fmt == core::pixel_format::invalid)
 	{
-		auto pix_fmt = static_cast<AVPixelFormat>(decoded_frame->format);
-		auto target_pix_fmt = AV_PIX_FMT_BGRA;
-
-		if(pix_fmt == AV_PIX_FMT_UYVY422)
-			target_pix_fmt = AV_PIX_FMT_YUV422P;
-		else if(pix_fmt == AV_PIX_FMT_YUYV422)
-			target_pix_fmt = AV_PIX_FMT_YUV422P;
-		else if(pix_fmt == AV_PIX_FMT_UYYVYY411)
-			target_pix_fmt = AV_PIX_FMT_YUV411P;
-		else if(pix_fmt == AV_PIX_FMT_YUV420P10)
-			target_pix_fmt = AV_PIX_FMT_YUV420P;
-		else if(pix_fmt == AV_PIX_FMT_YUV422P10)
-			target_pix_fmt = AV_PIX_FMT_YUV422P;
-		else if(pix_fmt == AV_PIX_FMT_YUV444P10)
-			target_pix_fmt = AV_PIX_FMT_YUV444P;
-		
+		auto target_pix_fmt = get_target_pix_fmt(static_cast<AVPixelFormat>(decoded_frame->format));
 		auto target_desc = get_pixel_format_desc(static_cast<AVPixelFormat>(target_pix_fmt), width, height);
 
 		write = frame_factory->create_frame(tag, target_desc, audio_channel_layout);
 		write->set_type(get_mode(*decoded_frame));
 
-		std::shared_ptr<SwsContext> sws_context;
-
-		//CASPAR_LOG(warning) << "Hardware accelerated color transform not supported.";
-		
-		int64_t key = ((static_cast<int64_t>(width)			 << 32) & 0xFFFF00000000) | 
-					  ((static_cast<int64_t>(height)		 << 16) & 0xFFFF0000) | 
-					  ((static_cast<int64_t>(pix_fmt)		 <<  8) & 0xFF00) | 
-					  ((static_cast<int64_t>(target_pix_fmt) <<  0) & 0xFF);
-			
-		auto& pool = sws_contexts_[key];
-						
-		if(!pool.try_pop(sws_context))
-		{
-			double param;
-			sws_context.reset(sws_getContext(width, height, static_cast<AVPixelFormat>(pix_fmt), width, height, target_pix_fmt, SWS_BILINEAR, nullptr, nullptr, &param), sws_freeContext);
-		}
-			
-		if(!sws_context)
-		{
-			BOOST_THROW_EXCEPTION(operation_failed() << msg_info("Could not create software scaling context.") << 
-									boost::errinfo_api_function("sws_getContext"));
-		}	
-		
-		safe_ptr<AVFrame> av_frame(av_frame_alloc(), [](AVFrame* ptr) { av_frame_free(&ptr); });
-		if(target_pix_fmt == AV_PIX_FMT_BGRA)
-		{
-			auto size = avpicture_fill(reinterpret_cast<AVPicture*>(av_frame.get()), write->image_data().begin(), AV_PIX_FMT_BGRA, width, height);
-			CASPAR_VERIFY(size == static_cast<int>(write->image_data().size()));
-		}
-		else
-		{
-			av_frame->width	 = width;
-			av_frame->height = height;
-			for(size_t n = 0; n < target_desc.planes.size(); ++n)
-			{
-				av_frame->data[n]		= write->image_data(n).begin();
-				av_frame->linesize[n]	= target_desc.planes[n].linesize;
-			}
-		}
-
-		sws_scale(sws_context.get(), decoded_frame->data, decoded_frame->linesize, 0, height, av_frame->data, av_frame->linesize);	
-		pool.push(sws_context);
-
-		write->commit();		
+		if(!try_convert_frame(*decoded_frame, *write, target_desc))
+			sws_convert_frame(*decoded_frame, *write, target_pix_fmt, target_desc);
 	}
 	else
 	{
@@ -65,6 +65,8 @@ static const int CASPAR_PIX_FMT_LUMA = 10; // Just hijack some unual pixel forma
 
 core::field_mode::type		get_mode(const AVFrame& frame);
 int							make_alpha_format(int format); // NOTE: Be careful about CASPAR_PIX_FMT_LUMA, change it to PIX_FMT_GRAY8 if you want to use the frame inside some ffmpeg function.
+// Bytes of the image of a write_frame made from a decoded frame.
+size_t						get_image_size(int pix_fmt, size_t width, size_t height);
 safe_ptr<core::write_frame> make_write_frame(const void* tag, const safe_ptr<AVFrame>& decoded_frame, const safe_ptr<core::frame_factory>& frame_factory, int hints, const core::channel_layout& audio_channel_layout);
 
 safe_ptr<AVPacket> create_packet();
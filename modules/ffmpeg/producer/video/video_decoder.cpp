@@ -64,6 +64,7 @@ struct video_decoder::implementation : boost::noncopyable
 	bool									is_progressive_;
 
 	tbb::atomic<size_t>						file_frame_number_;
+	int64_t									skip_frames_;
 
 public:
 	explicit implementation(const safe_ptr<AVFormatContext>& context, int index) 
@@ -74,6 +75,7 @@ public:
 		, height_(codec_context_->height)
 	{
 		file_frame_number_ = 0;
+		skip_frames_ = 0;
 
 		codec_context_->refcounted_frames = 1;
 	}
@@ -88,10 +90,22 @@ public:
 	}
 
 	std::shared_ptr<AVFrame> poll()
-	{		
-		if(packets_.empty())
-			return nullptr;
-		
+	{
+		while(!packets_.empty())
+		{
+			auto video = poll_packet();
+
+			if(!video || skip_frames_ == 0 || video == flush_video())
+				return video;
+
+			--skip_frames_;
+		}
+
+		return nullptr;
+	}
+
+	std::shared_ptr<AVFrame> poll_packet()
+	{
 		auto packet = packets_.front();
 					
 		if(packet->data == nullptr)
@@ -104,7 +118,8 @@ public:
 			}
 					
 			packets_.pop();
-			file_frame_number_ = static_cast<size_t>(packet->pos);
+			skip_frames_ = std::max<int64_t>(0, packet->duration);
+			file_frame_number_ = static_cast<size_t>(packet->pos - skip_frames_);
 			avcodec_flush_buffers(codec_context_.get());
 			return flush_video();	
 		}
@@ -165,6 +180,7 @@ std::shared_ptr<AVFrame> video_decoder::poll(){return impl_->poll();}
 bool video_decoder::ready() const{return impl_->ready();}
 size_t video_decoder::width() const{return impl_->width_;}
 size_t video_decoder::height() const{return impl_->height_;}
+int video_decoder::pix_fmt() const{return impl_->codec_context_->pix_fmt;}
 uint32_t video_decoder::nb_frames() const{return impl_->nb_frames();}
 uint32_t video_decoder::file_frame_number() const{return impl_->file_frame_number_;}
 bool	video_decoder::is_progressive() const{return impl_->is_progressive_;}
@@ -49,6 +49,7 @@ public:
 	
 	size_t	 width()		const;
 	size_t	 height()	const;
+	int		 pix_fmt()	const;
 
 	uint32_t nb_frames() const;
 	uint32_t file_frame_number() const;
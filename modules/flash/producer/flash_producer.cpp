@@ -372,7 +372,7 @@ public:
 		, width_(width > 0 ? width : frame_factory->get_video_format_desc().width)
 		, height_(height > 0 ? height : frame_factory->get_video_format_desc().height)
 		, buffer_size_(env::properties().get(L"configuration.flash.buffer-depth", frame_factory_->get_video_format_desc().fps > 30.0 ? 4 : 2))
-		, executor_(L"flash_producer")
+		, executor_(L"flash_producer", thread_backend)
 	{	
 		fps_ = 0;
 	 
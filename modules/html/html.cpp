@@ -275,7 +275,7 @@ bool init()
 
 	core::register_producer_factory(html::create_producer);
 	
-	g_cef_executor.reset(new executor(L"cef"));
+	g_cef_executor.reset(new executor(L"cef", thread_backend));
 	g_cef_executor->invoke([&]
 	{
 		CefSettings settings;
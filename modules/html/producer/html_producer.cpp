@@ -99,7 +99,7 @@ namespace caspar {
 				, frame_factory_(frame_factory)
 				, last_frame_(core::basic_frame::empty())
 				, last_progressive_frame_(core::basic_frame::empty())
-				, executor_(L"html_producer")
+				, executor_(L"html_producer", thread_backend)
 			{
 				graph_->set_color("browser-tick-time", diagnostics::color(0.1f, 1.0f, 0.1f));
 				graph_->set_color("tick-time", diagnostics::color(0.0f, 0.6f, 0.9f));
@@ -57,7 +57,7 @@ struct newtek_ivga_consumer : public core::frame_consumer
 public:
 
 	newtek_ivga_consumer(core::channel_layout channel_layout, bool provide_sync)
-		: executor_(print())
+		: executor_(print(), thread_backend)
 		, channel_layout_(channel_layout)
 		, provide_sync_(provide_sync)
 	{
@@ -167,6 +167,11 @@ public:
 	{
 		return provide_sync_ && connected_;
 	}
+
+	virtual core::consumer_send_policy::type send_policy() const override
+	{
+		return provide_sync_ ? core::consumer_send_policy::block : core::consumer_send_policy::drop;
+	}
 };	
 
 safe_ptr<core::frame_consumer> create_ivga_consumer(const core::parameters& params)
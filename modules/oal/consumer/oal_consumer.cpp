@@ -147,6 +147,11 @@ public:
 		return false;
 	}
 
+	virtual core::consumer_send_policy::type send_policy() const override
+	{
+		return core::consumer_send_policy::drop;
+	}
+
 	virtual boost::property_tree::wptree info() const override
 	{
 		boost::property_tree::wptree info;
@@ -580,6 +580,11 @@ public:
 	{
 		return false;
 	}
+
+	virtual core::consumer_send_policy::type send_policy() const override
+	{
+		return core::consumer_send_policy::drop;
+	}
 	
 	virtual int buffer_depth() const override
 	{
@@ -23,9 +23,11 @@
 
 #include "AMCPCommandQueue.h"
 
-#include <boost/property_tree/ptree.hpp>
+#include <core/producer/stage.h>
 
-#include <common/concurrency/lock.h>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/ptree.hpp>
 
 namespace caspar { namespace protocol { namespace amcp {
 
@@ -47,10 +49,13 @@ std::map<std::wstring, AMCPCommandQueue*>& get_instances()
 
 }
 	
-AMCPCommandQueue::AMCPCommandQueue(const std::wstring& name)
-	: executor_(L"AMCPCommandQueue " + name)
-	, running_command_(false)
+AMCPCommandQueue::AMCPCommandQueue(const std::wstring& name, int layer_queues)
+	: name_(name)
+	, executor_(L"AMCPCommandQueue " + name)
 {
+	for(int n = 0; n < layer_queues; ++n)
+		lanes_.push_back(std::make_shared<executor>(L"AMCPCommandQueue " + name + L" lane " + boost::lexical_cast<std::wstring>(n + 1)));
+
 	tbb::spin_mutex::scoped_lock lock(get_global_mutex());
 
 	get_instances().insert(std::make_pair(name, this));
@@ -58,66 +63,190 @@ AMCPCommandQueue::AMCPCommandQueue(const std::wstring& name)
 
 AMCPCommandQueue::~AMCPCommandQueue() 
 {
-	tbb::spin_mutex::scoped_lock lock(get_global_mutex());
+	{
+		tbb::spin_mutex::scoped_lock lock(get_global_mutex());
+
+		get_instances().erase(name_);
+	}
 
-	get_instances().erase(widen(executor_.name()));
+	executor_.stop();
+	executor_.join();
+
+	BOOST_FOREACH(auto& lane, lanes_)
+	{
+		lane->stop();
+		lane->join();
+	}
 }
 
-void AMCPCommandQueue::AddCommand(AMCPCommandPtr pCurrentCommand)
+int AMCPCommandQueue::lane_of(const AMCPCommandPtr& command) const
 {
-	if(!pCurrentCommand)
-		return;
+	auto layer = command->GetLayerIndex(-1);
+
+	if(lanes_.empty() || !command->NeedChannel() || layer == -1)
+		return -1;
+
+	return std::abs(layer) % static_cast<int>(lanes_.size());
+}
+
+bool AMCPCommandQueue::is_full(int lane) const
+{
+	auto size = executor_.size();
+
+	if(lane >= 0)
+		size += lanes_[lane]->size();
+
+	return size > 64;
+}
+
+AMCPCommandQueue::command_info_ptr AMCPCommandQueue::enlist(const AMCPCommandPtr& command, int lane)
+{
+	auto info = std::make_shared<command_info>();
+	info->name = command->print();
+	info->params = command->GetParameters().get_original_string();
+	info->lane = lane;
+	info->running = false;
+	info->waited = 0.0;
+
+	tbb::spin_mutex::scoped_lock lock(commands_mutex_);
+	commands_.push_back(info);
 
-	if(executor_.size() > 64)
+	return info;
+}
+
+void AMCPCommandQueue::reject(const AMCPCommandPtr& command, const command_info_ptr& info)
+{
+	try
+	{
+		CASPAR_LOG(error) << "AMCP Command Queue Overflow.";
+		CASPAR_LOG(error) << "Failed to execute command:" << info->name << L" on " << name_;
+		command->SetReplyString(L"500 FAILED\r\n");
+		command->SendReply();
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+	}
+
+	tbb::spin_mutex::scoped_lock lock(commands_mutex_);
+	commands_.remove(info);
+}
+
+void AMCPCommandQueue::execute(const AMCPCommandPtr& command, const command_info_ptr& info)
+{
+	try
 	{
+		{
+			tbb::spin_mutex::scoped_lock lock(commands_mutex_);
+			info->running = true;
+			info->waited = info->since.elapsed();
+			info->since.restart();
+		}
+
 		try
 		{
-			CASPAR_LOG(error) << "AMCP Command Queue Overflow.";
-			CASPAR_LOG(error) << "Failed to execute command:" << pCurrentCommand->print();
-			pCurrentCommand->SetReplyString(L"500 FAILED\r\n");
-			pCurrentCommand->SendReply();
+			if(command->Execute()) 
+				CASPAR_LOG(debug) << "Executed command: " << info->name;
+			else 
+				CASPAR_LOG(warning) << "Failed to execute command: " << info->name << L" on " << name_;
 		}
 		catch(...)
 		{
 			CASPAR_LOG_CURRENT_EXCEPTION();
+			CASPAR_LOG(error) << "Failed to execute command:" << info->name << L" on " << name_;
+			command->SetReplyString(L"500 FAILED\r\n");
 		}
+				
+		command->SendReply();
+			
+		CASPAR_LOG(trace) << "Ready for a new command";
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+	}
+
+	tbb::spin_mutex::scoped_lock lock(commands_mutex_);
+	commands_.remove(info);
+}
+
+void AMCPCommandQueue::wait_for_lanes()
+{
+	BOOST_FOREACH(auto& lane, lanes_)
+		lane->wait();
+}
+
+void AMCPCommandQueue::AddCommand(AMCPCommandPtr pCurrentCommand)
+{
+	if(!pCurrentCommand)
+		return;
+
+	auto lane = lane_of(pCurrentCommand);
+	auto info = enlist(pCurrentCommand, lane);
+
+	if(is_full(lane))
+	{
+		reject(pCurrentCommand, info);
+		return;
 	}
 	
+	if(lane < 0)
+	{
+		executor_.begin_invoke([=]
+		{
+			wait_for_lanes();
+			execute(pCurrentCommand, info);
+		});
+	}
+	else
+	{
+		// Dispatched through the channel queue to stay behind earlier commands for the whole channel.
+		executor_.begin_invoke([=]
+		{
+			lanes_[lane]->begin_invoke([=]
+			{
+				execute(pCurrentCommand, info);
+			});
+		});
+	}
+}
+
+void AMCPCommandQueue::AddBatch(const std::vector<AMCPCommandPtr>& commands, int delay, const std::function<void ()>& on_done)
+{
+	std::vector<command_info_ptr> infos;
+	BOOST_FOREACH(auto& command, commands)
+		infos.push_back(enlist(command, -1));
+	
 	executor_.begin_invoke([=]
 	{
+		wait_for_lanes();
+
+		std::shared_ptr<void> hold;
+
 		try
 		{
-			try
-			{
-				auto print = pCurrentCommand->print();
-				auto params = pCurrentCommand->GetParameters().get_original_string();
-
-				{
-					tbb::spin_mutex::scoped_lock lock(running_command_mutex_);
-					running_command_ = true;
-					running_command_name_ = print;
-					running_command_params_ = std::move(params);
-					running_command_since_.restart();
-				}
-
-				if(pCurrentCommand->Execute()) 
-					CASPAR_LOG(debug) << "Executed command: " << print;
-				else 
-					CASPAR_LOG(warning) << "Failed to execute command: " << print << L" on " << widen(executor_.name());
-			}
-			catch(...)
+			// Commands wait for the loads of their layer, which must not
+			// happen while the channel is frozen.
+			if(!commands.empty() && commands.front()->GetChannel())
 			{
-				CASPAR_LOG_CURRENT_EXCEPTION();
-				CASPAR_LOG(error) << "Failed to execute command:" << pCurrentCommand->print() << L" on " << widen(executor_.name());
-				pCurrentCommand->SetReplyString(L"500 FAILED\r\n");
+				auto stage = commands.front()->GetChannel()->stage();
+				stage->wait_for_loads();
+				hold = stage->hold(delay).get();
 			}
-				
-			pCurrentCommand->SendReply();
-			
-			CASPAR_LOG(trace) << "Ready for a new command";
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+
+		for(size_t n = 0; n < commands.size(); ++n)
+			execute(commands[n], infos[n]);
+
+		hold.reset();
 
-			tbb::spin_mutex::scoped_lock lock(running_command_mutex_);
-			running_command_ = false;
+		try
+		{
+			on_done();
 		}
 		catch(...)
 		{
@@ -130,36 +259,43 @@ boost::property_tree::wptree AMCPCommandQueue::info() const
 {
 	boost::property_tree::wptree info;
 
-	auto name = widen(executor_.name());
-	info.add(L"name", name);
-	auto size = executor_.size();
-	info.add(L"queued", std::max(0, size));
+	info.add(L"name", name_);
+	info.add(L"layer-queues", lanes_.size());
 
-	bool running_command;
-	std::wstring running_command_name;
-	std::wstring running_command_params;
-	int64_t running_command_elapsed;
+	std::vector<command_info> commands;
 
-	lock(running_command_mutex_, [&]
 	{
-		running_command = running_command_;
-		
-		if (running_command)
-		{
-			running_command_name = running_command_name_;
-			running_command_params = running_command_params_;
-			running_command_elapsed = static_cast<int64_t>(
-					running_command_since_.elapsed() * 1000.0);
-		}
-	});
+		tbb::spin_mutex::scoped_lock lock(commands_mutex_);
+
+		BOOST_FOREACH(auto& command, commands_)
+			commands.push_back(*command);
+	}
+
+	int queued = 0;
 
-	if (running_command)
+	BOOST_FOREACH(auto& command, commands)
 	{
-		info.add(L"running.command", running_command_name);
-		info.add(L"running.params", running_command_params);
-		info.add(L"running.elapsed", running_command_elapsed);
+		boost::property_tree::wptree command_info;
+		command_info.add(L"command", command.name);
+		command_info.add(L"params", command.params);
+		command_info.add(L"layer-queue", command.lane + 1);
+
+		if(command.running)
+		{
+			command_info.add(L"waited", static_cast<int64_t>(command.waited * 1000.0));
+			command_info.add(L"elapsed", static_cast<int64_t>(command.since.elapsed() * 1000.0));
+			info.add_child(L"running", command_info);
+		}
+		else
+		{
+			command_info.add(L"waiting", static_cast<int64_t>(command.since.elapsed() * 1000.0));
+			info.add_child(L"waiting", command_info);
+			++queued;
+		}
 	}
 
+	info.add(L"queued", queued);
+
 	return info;
 }
 
@@ -32,6 +32,10 @@
 
 #include <tbb/spin_mutex.h>
 
+#include <functional>
+#include <list>
+#include <vector>
+
 namespace caspar { namespace protocol { namespace amcp {
 
 class AMCPCommandQueue
@@ -39,21 +43,48 @@ class AMCPCommandQueue
 	AMCPCommandQueue(const AMCPCommandQueue&);
 	AMCPCommandQueue& operator=(const AMCPCommandQueue&);
 public:
-	AMCPCommandQueue(const std::wstring& name);
+	// Commands addressed to a layer run on one of layer_queues queues, picked
+	// by layer number, so that a slow command only holds up the layers that
+	// share its queue. Commands for the whole channel wait for all of them.
+	// Replies are sent as commands finish, so a client that does not wait
+	// for each reply can get them out of order.
+	AMCPCommandQueue(const std::wstring& name, int layer_queues = 0);
 	~AMCPCommandQueue();
 
 	void AddCommand(AMCPCommandPtr pCommand);
 
+	// Runs the commands in order after everything queued before them, with the
+	// frames of their channel held back, starting delay frames from now, until
+	// the last one has run. on_done is called afterwards.
+	void AddBatch(const std::vector<AMCPCommandPtr>& commands, int delay, const std::function<void ()>& on_done);
+
 	boost::property_tree::wptree info() const;
 
 	static boost::property_tree::wptree info_all_queues();
 private:
-	executor				executor_;
-	mutable tbb::spin_mutex	running_command_mutex_;
-	bool					running_command_;
-	std::wstring			running_command_name_;
-	std::wstring			running_command_params_;
-	boost::timer			running_command_since_;
+	struct command_info
+	{
+		std::wstring	name;
+		std::wstring	params;
+		int				lane;
+		bool			running;
+		boost::timer	since;
+		double			waited;
+	};
+	typedef std::shared_ptr<command_info> command_info_ptr;
+
+	int lane_of(const AMCPCommandPtr& command) const;
+	bool is_full(int lane) const;
+	command_info_ptr enlist(const AMCPCommandPtr& command, int lane);
+	void reject(const AMCPCommandPtr& command, const command_info_ptr& info);
+	void execute(const AMCPCommandPtr& command, const command_info_ptr& info);
+	void wait_for_lanes();
+
+	const std::wstring						name_;
+	std::vector<std::shared_ptr<executor>>	lanes_;
+	executor								executor_;
+	mutable tbb::spin_mutex					commands_mutex_;
+	std::list<command_info_ptr>				commands_;
 };
 typedef std::tr1::shared_ptr<AMCPCommandQueue> AMCPCommandQueuePtr;
 
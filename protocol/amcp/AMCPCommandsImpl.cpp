@@ -44,11 +44,13 @@
 #include <core/producer/transition/transition_producer.h>
 #include <core/producer/channel/channel_producer.h>
 #include <core/producer/layer/layer_producer.h>
+#include <core/producer/preroll/preroll_producer.h>
 #include <core/producer/frame/frame_transform.h>
 #include <core/producer/stage.h>
 #include <core/producer/layer.h>
 #include <core/producer/media_info/media_info.h>
 #include <core/producer/media_info/media_info_repository.h>
+#include <core/media_library.h>
 #include <core/mixer/mixer.h>
 #include <core/mixer/gpu/ogl_device.h>
 #include <core/consumer/output.h>
@@ -88,6 +90,7 @@
 #include <boost/format.hpp>
 
 #include <tbb/concurrent_unordered_map.h>
+#include <tbb/spin_mutex.h>
 
 /* Return codes
 
@@ -202,31 +205,37 @@ std::wstring read_file(const boost::filesystem::path& file)
 	return read_latin1_file(file);
 }
 
+std::wstring ClipType(const boost::filesystem::path& path)
+{
+	std::wstring extension = boost::to_upper_copy(path.extension().wstring());
+	if(extension == TEXT(".TGA") || extension == TEXT(".COL") || extension == L".PNG" || extension == L".JPEG" || extension == L".JPG" ||
+		extension == L".GIF" || extension == L".BMP")
+	{
+		return TEXT("STILL");			
+	}
+	else if(extension == TEXT(".WAV") || extension == TEXT(".MP3"))
+	{
+		return TEXT("AUDIO");
+	}
+	else if(extension == TEXT(".SWF") || extension == TEXT(".CT") ||
+			extension == TEXT(".DV") || extension == TEXT(".MOV") || 
+			extension == TEXT(".MPG") || extension == TEXT(".AVI") || 
+			extension == TEXT(".MP4") || extension == TEXT(".FLV") || 
+			caspar::ffmpeg::is_valid_file(path.wstring()))
+	{
+		return TEXT("MOVIE");
+	}
+
+	return L"";
+}
+
 std::wstring MediaInfo(const boost::filesystem::path& path, const std::shared_ptr<core::media_info_repository>& media_info_repo)
 {
 	if(boost::filesystem::is_regular_file(path))
 	{
-		std::wstring clipttype = TEXT(" N/A ");
-		std::wstring extension = boost::to_upper_copy(path.extension().wstring());
-		if(extension == TEXT(".TGA") || extension == TEXT(".COL") || extension == L".PNG" || extension == L".JPEG" || extension == L".JPG" ||
-			extension == L".GIF" || extension == L".BMP")
-		{
-			clipttype = TEXT(" STILL ");			
-		}
-		else if(extension == TEXT(".WAV") || extension == TEXT(".MP3"))
-		{
-			clipttype = TEXT(" AUDIO ");
-		}
-		else if(extension == TEXT(".SWF") || extension == TEXT(".CT") ||
-				extension == TEXT(".DV") || extension == TEXT(".MOV") || 
-				extension == TEXT(".MPG") || extension == TEXT(".AVI") || 
-				extension == TEXT(".MP4") || extension == TEXT(".FLV") || 
-				caspar::ffmpeg::is_valid_file(path.wstring()))
-		{
-			clipttype = TEXT(" MOVIE ");
-		}
+		std::wstring clipttype = ClipType(path);
 
-		if(clipttype != TEXT(" N/A "))
+		if(!clipttype.empty())
 		{		
 			auto is_not_digit = [](char c){ return std::isdigit(c) == 0; };
 
@@ -247,8 +256,8 @@ std::wstring MediaInfo(const boost::filesystem::path& path, const std::shared_pt
 			
 			return std::wstring() 
 					+ L"\""		+ str +
-					+ L"\" "	+ clipttype +
-					+ L" "		+ sizeStr +
+					+ L"\"  "	+ clipttype +
+					+ L"  "		+ sizeStr +
 					+ L" "		+ writeTimeWStr +
 					+ L" "		+ boost::lexical_cast<std::wstring>(media_info.duration) +
 					+ L" "		+ boost::lexical_cast<std::wstring>(media_info.time_base.numerator()) + L"/" + boost::lexical_cast<std::wstring>(media_info.time_base.denominator())
@@ -440,6 +449,7 @@ bool CallCommand::DoExecute()
 
 // UGLY HACK
 tbb::concurrent_unordered_map<int, std::vector<stage::transform_tuple_t>> deferred_transforms;
+tbb::spin_mutex deferred_transforms_mutex; // The layers of a channel are served by more than one queue.
 
 core::frame_transform MixerCommand::get_current_transform()
 {
@@ -886,6 +896,7 @@ bool MixerCommand::DoExecute()
 		}
 		else if(_parameters[0] == L"COMMIT")
 		{
+			tbb::spin_mutex::scoped_lock lock(deferred_transforms_mutex);
 			transforms = std::move(deferred_transforms[GetChannelIndex()]);
 		}
 		else
@@ -896,6 +907,7 @@ bool MixerCommand::DoExecute()
 
 		if(defer)
 		{
+			tbb::spin_mutex::scoped_lock lock(deferred_transforms_mutex);
 			auto& defer_tranforms = deferred_transforms[GetChannelIndex()];
 			defer_tranforms.insert(defer_tranforms.end(), transforms.begin(), transforms.end());
 		}
@@ -1247,6 +1259,41 @@ bool LoadbgCommand::DoExecute()
 	try
 	{
 		auto uri_tokens = core::parameters::protocol_split(_parameters.at_original(0));
+		bool auto_play = std::find(_parameters.begin(), _parameters.end(), L"AUTO") != _parameters.end();
+
+		// Producers are created on a loader thread of the stage so that
+		// opening the file does not hold up the command queue. That is only
+		// done for resources known to exist, so that a missing one is still
+		// answered with 404. Routes are created right away since they only
+		// attach to another channel.
+		if(uri_tokens[0] != L"route" && env::properties().get(L"configuration.loadbg.async", true) && IsKnownResource())
+		{
+			auto channel		= GetChannel();
+			auto frame_factory	= channel->mixer()->get_frame_factory(GetLayerIndex());
+			auto parameters		= _parameters;
+			auto preroll_frames	= env::properties().get(L"configuration.loadbg.preroll-frames", 2);
+
+			channel->stage()->load_async(GetLayerIndex(), [=](int hints) -> safe_ptr<core::frame_producer>
+			{
+				auto pFP = create_producer(frame_factory, parameters);
+				if(pFP == frame_producer::empty())
+				{
+					CASPAR_LOG(error) << L"File not found. No match found for parameters. Check syntax:" << parameters.get_original_string();
+					BOOST_THROW_EXCEPTION(file_not_found() << msg_info(parameters.size() > 0 ? narrow(parameters[0]) : ""));
+				}
+
+				// Live producers have no end, buffering them only adds delay.
+				if(pFP->nb_frames() != std::numeric_limits<uint32_t>::max())
+					pFP = create_preroll_producer(pFP, preroll_frames, hints);
+
+				return create_transition_producer(channel->get_video_format_desc().field_mode, pFP, transitionInfo);
+			}, false, auto_play ? transitionInfo.duration : -1);
+
+			SetReplyString(TEXT("202 LOADBG OK\r\n"));
+
+			return true;
+		}
+
 		auto pFP = frame_producer::empty();
 		if (uri_tokens[0] == L"route")
 		{
@@ -1259,8 +1306,6 @@ bool LoadbgCommand::DoExecute()
 		if(pFP == frame_producer::empty())
 			BOOST_THROW_EXCEPTION(file_not_found() << msg_info(_parameters.size() > 0 ? narrow(_parameters[0]) : ""));
 
-		bool auto_play = std::find(_parameters.begin(), _parameters.end(), L"AUTO") != _parameters.end();
-
 		auto pFP2 = create_transition_producer(GetChannel()->get_video_format_desc().field_mode, pFP, transitionInfo);
 		GetChannel()->stage()->load(GetLayerIndex(), pFP2, false, auto_play ? transitionInfo.duration : -1); // TODO: LOOP
 	
@@ -1282,6 +1327,20 @@ bool LoadbgCommand::DoExecute()
 	}
 }
 
+bool LoadbgCommand::IsKnownResource()
+{
+	if(is_producer_resolved(_parameters))
+		return true;
+
+	// A clip in the media library, which is kept up to date without
+	// touching the filesystem.
+	auto tokens = core::parameters::protocol_split(_parameters.at_original(0));
+	auto media_library = GetMediaLibrary();
+
+	return tokens[0].empty() && media_library && media_library->is_ready()
+		&& media_library->contains(tokens[1]);
+}
+
 bool PauseCommand::DoExecute()
 {
 	try
@@ -1327,6 +1386,7 @@ bool PlayCommand::DoExecute()
 			lbg.SetLayerIntex(GetLayerIndex());
 			lbg.SetClientInfo(GetClientInfo());
 			lbg.SetParameters(_parameters);
+			lbg.SetMediaLibrary(GetMediaLibrary());
 			if(!lbg.Execute())
 				throw std::exception();
 		}
@@ -2109,12 +2169,18 @@ bool CinfCommand::DoExecute()
 	try
 	{
 		std::wstring info;
-		for (boost::filesystem::recursive_directory_iterator itr(env::media_folder()), end; itr != end; ++itr)
+		auto media_library = GetMediaLibrary();
+		if(media_library && media_library->is_ready())
+			info = media_library->find(_parameters.at(0));
+		else
 		{
-			auto path = itr->path();
-			auto file = path.replace_extension(L"").filename();
-			if(boost::iequals(file.wstring(), _parameters.at(0)))
-				info += MediaInfo(itr->path(), GetMediaInfoRepo());
+			for (boost::filesystem::recursive_directory_iterator itr(env::media_folder()), end; itr != end; ++itr)
+			{
+				auto path = itr->path();
+				auto file = path.replace_extension(L"").filename();
+				if(boost::iequals(file.wstring(), _parameters.at(0)))
+					info += MediaInfo(itr->path(), GetMediaInfoRepo());
+			}
 		}
 
 		if(info.empty())
@@ -2334,7 +2400,11 @@ bool ClsCommand::DoExecute()
 	*/
 	std::wstringstream replyString;
 	replyString << TEXT("200 CLS OK\r\n");
-	replyString << ListMedia(GetMediaInfoRepo());
+	auto media_library = GetMediaLibrary();
+	if(media_library && media_library->is_ready())
+		replyString << media_library->list();
+	else
+		replyString << ListMedia(GetMediaInfoRepo());
 	replyString << TEXT("\r\n");
 	SetReplyString(boost::to_upper_copy(replyString.str()));
 	return true;
@@ -25,6 +25,8 @@
 
 #include "AMCPCommand.h"
 
+#include <boost/filesystem/path.hpp>
+
 namespace caspar {
 
 namespace core {
@@ -37,6 +39,9 @@ namespace protocol {
 std::wstring ListMedia();
 std::wstring ListTemplates();
 
+// STILL, AUDIO or MOVIE, or an empty string if the file is not media.
+std::wstring ClipType(const boost::filesystem::path& file);
+
 namespace amcp {
 	
 class ChannelGridCommand : public AMCPCommandBase<false, AddToQueue, 0>
@@ -116,6 +121,7 @@ class LoadbgCommand : public AMCPCommandBase<true, AddToQueue, 1>
 {
 	std::wstring print() const { return L"LoadbgCommand";}
 	bool DoExecute();
+	bool IsKnownResource();
 };
 
 class PlayCommand: public AMCPCommandBase<true, AddToQueue, 0>
@@ -27,6 +27,8 @@
 #include "../util/AsyncEventServer.h"
 #include "AMCPCommandsImpl.h"
 
+#include <common/env.h>
+
 #include <stdio.h>
 #include <crtdbg.h>
 #include <string.h>
@@ -37,6 +39,7 @@
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/foreach.hpp>
 
 #if defined(_MSC_VER)
 #pragma warning (push, 1) // TODO: Legacy code, just disable warnings
@@ -58,11 +61,13 @@ AMCPProtocolStrategy::AMCPProtocolStrategy(
 		const std::vector<safe_ptr<core::video_channel>>& channels,
 		const std::shared_ptr<core::thumbnail_generator>& thumb_gen,
 		const safe_ptr<core::media_info_repository>& media_info_repo,
+		const std::shared_ptr<core::media_library>& media_library,
 		const safe_ptr<core::ogl_device>& ogl_device,
 		const std::function<void (bool)>& shutdown_server_now)
 	: channels_(channels)
 	, thumb_gen_(thumb_gen)
 	, media_info_repo_(media_info_repo)
+	, media_library_(media_library)
 	, ogl_(ogl_device)
 	, shutdown_server_now_(shutdown_server_now)
 {
@@ -70,11 +75,13 @@ AMCPProtocolStrategy::AMCPProtocolStrategy(
 	commandQueues_.push_back(pGeneralCommandQueue);
 
 
+	auto layerQueues = env::properties().get(L"configuration.amcp.layer-queues", 0);
+
 	std::shared_ptr<core::video_channel> pChannel;
 	unsigned int index = -1;
 	//Create a commandpump for each video_channel
 	while((pChannel = GetChannelSafe(++index, channels_)) != 0) {
-		AMCPCommandQueuePtr pChannelCommandQueue(new AMCPCommandQueue(L"Channel " + boost::lexical_cast<std::wstring>(index + 1) + L" for " + name));
+		AMCPCommandQueuePtr pChannelCommandQueue(new AMCPCommandQueue(L"Channel " + boost::lexical_cast<std::wstring>(index + 1) + L" for " + name, layerQueues));
 		std::wstring title = TEXT("video_channel ");
 
 		//HACK: Perform real conversion from int to string
@@ -139,6 +146,9 @@ void AMCPProtocolStrategy::ProcessMessage(const std::wstring& message, ClientInf
 	else
 		CASPAR_LOG(info) << L"Received long message from " << pClientInfo->print() << L": " << message.substr(0, 510) << L" [...]\\r\\n";
 	
+	if(ProcessBatchMessage(message, pClientInfo))
+		return;
+
 	bool bError = true;
 	MessageParserState state = New;
 
@@ -148,7 +158,7 @@ void AMCPProtocolStrategy::ProcessMessage(const std::wstring& message, ClientInf
 
 	if(pCommand != 0) {
 		pCommand->SetClientInfo(pClientInfo);	
-		if(QueueCommand(pCommand))
+		if(AddToBatch(pCommand, pClientInfo) || QueueCommand(pCommand))
 			bError = false;
 		else
 			state = GetChannel;
@@ -175,6 +185,140 @@ void AMCPProtocolStrategy::ProcessMessage(const std::wstring& message, ClientInf
 	}
 }
 
+bool AMCPProtocolStrategy::ProcessBatchMessage(const std::wstring& message, ClientInfoPtr& pClientInfo)
+{
+	std::vector<std::wstring> tokens;
+	if(TokenizeMessage(message, &tokens) == 0)
+		return false;
+
+	auto command = boost::to_upper_copy(tokens[0]);
+
+	if(command == L"BEGIN")
+	{
+		tbb::spin_mutex::scoped_lock lock(batchesMutex_);
+
+		for(auto it = batches_.begin(); it != batches_.end();)
+		{
+			if(it->second.client.expired())
+				it = batches_.erase(it);
+			else
+				++it;
+		}
+
+		if(FindBatch(pClientInfo) != batches_.end())
+		{
+			pClientInfo->Send(L"403 BEGIN ERROR\r\n");
+			return true;
+		}
+
+		batches_[pClientInfo.get()].client = pClientInfo;
+		pClientInfo->Send(L"202 BEGIN OK\r\n");
+		return true;
+	}
+	else if(command == L"DISCARD")
+	{
+		tbb::spin_mutex::scoped_lock lock(batchesMutex_);
+
+		auto it = FindBatch(pClientInfo);
+		if(it == batches_.end())
+			pClientInfo->Send(L"403 DISCARD ERROR\r\n");
+		else
+		{
+			batches_.erase(it);
+			pClientInfo->Send(L"202 DISCARD OK\r\n");
+		}
+		return true;
+	}
+	else if(command == L"COMMIT")
+	{
+		std::vector<AMCPCommandPtr> commands;
+
+		{
+			tbb::spin_mutex::scoped_lock lock(batchesMutex_);
+
+			auto it = FindBatch(pClientInfo);
+			if(it == batches_.end())
+			{
+				pClientInfo->Send(L"403 COMMIT ERROR\r\n");
+				return true;
+			}
+
+			commands = std::move(it->second.commands);
+			batches_.erase(it);
+		}
+
+		// The frames of one channel are held while the batch runs, so all of its commands must target that channel
+		// and none of them may create a producer.
+		int channelIndex = -1;
+		int delay = 0;
+
+		try
+		{
+			if(tokens.size() > 1)
+				delay = std::max(0, boost::lexical_cast<int>(tokens[1]));
+
+			BOOST_FOREACH(auto& pCommand, commands)
+			{
+				if(!pCommand->NeedChannel() || (channelIndex != -1 && channelIndex != static_cast<int>(pCommand->GetChannelIndex())))
+					BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Batch spans more than one channel."));
+
+				if(dynamic_cast<LoadCommand*>(pCommand.get()) || dynamic_cast<LoadbgCommand*>(pCommand.get()) ||
+				   (dynamic_cast<PlayCommand*>(pCommand.get()) && !pCommand->GetParameters().empty()))
+					BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Batch loads a producer."));
+
+				channelIndex = pCommand->GetChannelIndex();
+			}
+		}
+		catch(...)
+		{
+			CASPAR_LOG(warning) << L"Discarded batch from " << pClientInfo->print() << L": " << message;
+			pClientInfo->Send(L"403 COMMIT ERROR\r\n");
+			return true;
+		}
+
+		if(commands.empty())
+		{
+			pClientInfo->Send(L"202 COMMIT OK\r\n");
+			return true;
+		}
+
+		auto client = pClientInfo;
+		commandQueues_.at(channelIndex + 1)->AddBatch(commands, delay, [client]
+		{
+			client->Send(L"202 COMMIT OK\r\n");
+		});
+		return true;
+	}
+
+	return false;
+}
+
+bool AMCPProtocolStrategy::AddToBatch(AMCPCommandPtr pCommand, ClientInfoPtr& pClientInfo)
+{
+	tbb::spin_mutex::scoped_lock lock(batchesMutex_);
+
+	auto it = FindBatch(pClientInfo);
+	if(it == batches_.end())
+		return false;
+
+	it->second.commands.push_back(pCommand);
+	return true;
+}
+
+// The batch of a client that disconnected may be found by a new client at
+// the same address, it is dropped rather than swallowing its commands.
+std::map<IO::ClientInfo*, AMCPProtocolStrategy::Batch>::iterator AMCPProtocolStrategy::FindBatch(ClientInfoPtr& pClientInfo)
+{
+	auto it = batches_.find(pClientInfo.get());
+	if(it != batches_.end() && it->second.client.lock() != pClientInfo)
+	{
+		batches_.erase(it);
+		return batches_.end();
+	}
+
+	return it;
+}
+
 AMCPCommandPtr AMCPProtocolStrategy::InterpretCommandString(const std::wstring& message, MessageParserState* pOutState)
 {
 	std::vector<std::wstring> tokens;
@@ -214,6 +358,7 @@ AMCPCommandPtr AMCPProtocolStrategy::InterpretCommandString(const std::wstring&
 				pCommand->SetChannels(channels_);
 				pCommand->SetThumbGenerator(thumb_gen_);
 				pCommand->SetMediaInfoRepo(media_info_repo_);
+				pCommand->SetMediaLibrary(media_library_);
 				pCommand->SetOglDevice(ogl_);
 				pCommand->SetShutdownServerNow(shutdown_server_now_);
 				//Set scheduling
@@ -24,6 +24,7 @@
 #include "../util/protocolstrategy.h"
 #include <core/video_channel.h>
 #include <core/thumbnail_generator.h>
+#include <core/media_library.h>
 #include <core/producer/media_info/media_info_repository.h>
 
 #include "AMCPCommand.h"
@@ -32,6 +33,10 @@
 #include <boost/noncopyable.hpp>
 #include <boost/thread/future.hpp>
 
+#include <tbb/spin_mutex.h>
+
+#include <map>
+
 namespace caspar { namespace protocol { namespace amcp {
 
 class AMCPProtocolStrategy : public IO::IProtocolStrategy, boost::noncopyable
@@ -54,6 +59,7 @@ public:
 			const std::vector<safe_ptr<core::video_channel>>& channels,
 			const std::shared_ptr<core::thumbnail_generator>& thumb_gen,
 			const safe_ptr<core::media_info_repository>& media_info_repo,
+			const std::shared_ptr<core::media_library>& media_library,
 			const safe_ptr<core::ogl_device>& ogl_device,
 			const std::function<void (bool)>& shutdown_server_now);
 	virtual ~AMCPProtocolStrategy();
@@ -69,6 +75,8 @@ private:
 	friend class AMCPCommand;
 
 	void ProcessMessage(const std::wstring& message, IO::ClientInfoPtr& pClientInfo);
+	bool ProcessBatchMessage(const std::wstring& message, IO::ClientInfoPtr& pClientInfo);
+	bool AddToBatch(AMCPCommandPtr pCommand, IO::ClientInfoPtr& pClientInfo);
 	std::size_t TokenizeMessage(const std::wstring& message, std::vector<std::wstring>* pTokenVector);
 	AMCPCommandPtr CommandFactory(const std::wstring& str);
 
@@ -77,9 +85,22 @@ private:
 	std::vector<safe_ptr<core::video_channel>> channels_;
 	std::shared_ptr<core::thumbnail_generator> thumb_gen_;
 	safe_ptr<core::media_info_repository> media_info_repo_;
+	std::shared_ptr<core::media_library> media_library_;
 	safe_ptr<core::ogl_device> ogl_;
 	std::function<void (bool)> shutdown_server_now_;
 	std::vector<AMCPCommandQueuePtr> commandQueues_;
+
+	// Commands collected between BEGIN and COMMIT, per client.
+	struct Batch
+	{
+		std::weak_ptr<IO::ClientInfo> client;
+		std::vector<AMCPCommandPtr> commands;
+	};
+	tbb::spin_mutex batchesMutex_;
+	std::map<IO::ClientInfo*, Batch> batches_;
+
+	std::map<IO::ClientInfo*, Batch>::iterator FindBatch(IO::ClientInfoPtr& pClientInfo); // Called with batchesMutex_ held.
+
 	static const std::wstring MessageDelimiter;
 };
 
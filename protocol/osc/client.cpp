@@ -33,6 +33,7 @@
 
 #include <core/monitor/monitor.h>
 
+#include <cstring>
 #include <functional>
 #include <vector>
 #include <unordered_map>
@@ -85,12 +86,10 @@ struct param_visitor : public boost::static_visitor<void>
 	void operator()(const std::vector<int8_t>& value)	{o << ::osc::Blob(value.data(), static_cast<unsigned long>(value.size()));}
 };
 
-void write_osc_event(byte_vector& destination, const core::monitor::message& e)
+std::size_t write_osc_event(char* destination, std::size_t capacity, const char* address, const core::monitor::message& e)
 {		
-	destination.resize(4096);
-
-	::osc::OutboundPacketStream o(reinterpret_cast<char*>(destination.data()), static_cast<unsigned long>(destination.size()));
-	o << ::osc::BeginMessage(e.path().c_str());
+	::osc::OutboundPacketStream o(destination, static_cast<unsigned long>(capacity));
+	o << ::osc::BeginMessage(address);
 				
 	param_visitor<decltype(o)> param_visitor(o);
 	BOOST_FOREACH(const auto& data, e.data())
@@ -98,7 +97,7 @@ void write_osc_event(byte_vector& destination, const core::monitor::message& e)
 				
 	o << ::osc::EndMessage;
 		
-	destination.resize(o.Size());
+	return o.Size();
 }
 
 byte_vector write_osc_bundle_start()
@@ -127,6 +126,94 @@ void write_osc_bundle_element_start(byte_vector& destination, const byte_vector&
 #endif
 }
 
+// Bounded queue of encoded OSC messages, written into in place. Any number of
+// threads may write and one thread reads. Neither side locks or allocates; a
+// message is dropped when the queue is full.
+class message_queue : boost::noncopyable
+{
+public:
+	static const std::size_t capacity			= 2048; // Must be a power of two.
+	static const std::size_t max_message_size	= 1024;
+
+	message_queue()
+		: slots_(new slot[capacity])
+		, read_pos_(0)
+	{
+		for(std::size_t n = 0; n < capacity; ++n)
+			slots_[n].sequence = n;
+
+		write_pos_ = 0;
+	}
+
+	// write(char* data, std::size_t capacity) returns the size of the message, or 0 to skip it.
+	template<typename F>
+	bool try_write(const F& write)
+	{
+		std::size_t pos = write_pos_;
+
+		while(true)
+		{
+			auto diff = static_cast<std::ptrdiff_t>(slots_[pos & (capacity - 1)].sequence - pos);
+
+			if(diff < 0)
+				return false;
+
+			if(diff == 0)
+			{
+				auto previous = write_pos_.compare_and_swap(pos + 1, pos);
+
+				if(previous == pos)
+					break;
+
+				pos = previous;
+			}
+			else
+				pos = write_pos_;
+		}
+
+		auto& slot = slots_[pos & (capacity - 1)];
+		slot.size = write(slot.data, max_message_size);
+		slot.sequence = pos + 1;
+
+		return true;
+	}
+
+	// read(const char* data, std::size_t size) is called with the oldest message.
+	template<typename F>
+	bool try_read(const F& read)
+	{
+		auto& slot = slots_[read_pos_ & (capacity - 1)];
+
+		if(slot.sequence != read_pos_ + 1)
+			return false;
+
+		read(slot.data, slot.size);
+
+		slot.sequence = read_pos_ + capacity;
+		++read_pos_;
+
+		return true;
+	}
+
+	bool empty() const
+	{
+		return slots_[read_pos_ & (capacity - 1)].sequence != read_pos_ + 1;
+	}
+
+private:
+	struct slot
+	{
+		tbb::atomic<std::size_t>	sequence;
+		std::size_t					size;
+		char						data[max_message_size];
+	};
+
+	std::unique_ptr<slot[]>		slots_;
+	tbb::atomic<std::size_t>	write_pos_;
+	char						padding_[64];
+	std::size_t					read_pos_;
+};
+
 struct client::impl : public std::enable_shared_from_this<client::impl>, core::monitor::sink
 {
 	std::shared_ptr<boost::asio::io_service>		service_;
@@ -134,9 +221,10 @@ struct client::impl : public std::enable_shared_from_this<client::impl>, core::m
 	tbb::spin_mutex									endpoints_mutex_;
 	std::map<udp::endpoint, int>					reference_counts_by_endpoint_;
 
-	std::unordered_map<std::string, byte_vector>	updates_;
-	boost::mutex									updates_mutex_;								
-	boost::condition_variable						updates_cond_;
+	message_queue									messages_;
+	tbb::atomic<bool>								reader_waiting_;
+	boost::mutex									wait_mutex_;								
+	boost::condition_variable						wait_cond_;
 
 	tbb::atomic<bool>								is_running_;
 
@@ -146,15 +234,21 @@ public:
 	impl(std::shared_ptr<boost::asio::io_service> service)
 		: service_(std::move(service))
 		, socket_(*service_, udp::v4())
-		, thread_(boost::bind(&impl::run, this))
 	{
+		reader_waiting_ = false;
+		is_running_ = true;
+
+		thread_ = boost::thread(boost::bind(&impl::run, this));
 	}
 
 	~impl()
 	{
 		is_running_ = false;
 
-		updates_cond_.notify_one();
+		{
+			boost::lock_guard<boost::mutex> lock(wait_mutex_);
+			wait_cond_.notify_one();
+		}
 
 		thread_.join();
 	}
@@ -187,21 +281,43 @@ public:
 		});
 	}
 private:
-	void propagate(const core::monitor::message& msg)
+	void propagate(const core::monitor::address& path, const core::monitor::message& msg)
 	{
-		boost::lock_guard<boost::mutex> lock(updates_mutex_);
+		char address[256];
 
-		try 
+		if(!path.write(address, sizeof(address)))
+			return;
+
+		messages_.try_write([&](char* data, std::size_t capacity) -> std::size_t
 		{
-			write_osc_event(updates_[msg.path()], msg);
-		}
-		catch(...)
+			try 
+			{
+				return write_osc_event(data, capacity, address, msg);
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+				return 0;
+			}
+		});
+
+		if(reader_waiting_)
 		{
-			CASPAR_LOG_CURRENT_EXCEPTION();
-			updates_.erase(msg.path());
+			boost::lock_guard<boost::mutex> lock(wait_mutex_);
+			wait_cond_.notify_one();
 		}
+	}
+
+	void wait_for_messages()
+	{
+		boost::unique_lock<boost::mutex> lock(wait_mutex_);
 
-		updates_cond_.notify_one();
+		reader_waiting_ = true;
+
+		if(messages_.empty() && is_running_)
+			wait_cond_.timed_wait(lock, boost::posix_time::milliseconds(20));
+
+		reader_waiting_ = false;
 	}
 
 	template<typename T>
@@ -221,25 +337,61 @@ private:
 
 		try
 		{
-			is_running_ = true;
+			// The latest message for each address, kept across iterations so
+			// that only new addresses allocate.
+			std::unordered_map<std::string, std::size_t> slots_by_address;
+			std::vector<byte_vector> slots;
+			std::vector<bool> is_updated;
+			std::vector<std::size_t> updates;
+			std::string address;
 
-			std::unordered_map<std::string, byte_vector> updates;
 			std::vector<udp::endpoint> destinations;
 			const byte_vector bundle_header = write_osc_bundle_start();
 			std::vector<byte_vector> element_headers;
 
 			while (is_running_)
 			{		
+				BOOST_FOREACH(auto index, updates)
+					is_updated[index] = false;
+
 				updates.clear();
 				destinations.clear();
 
-				{			
-					boost::unique_lock<boost::mutex> cond_lock(updates_mutex_);
-
-					if (updates_.empty())
-						updates_cond_.wait(cond_lock);
+				if (messages_.empty())
+					wait_for_messages();
 
-					std::swap(updates, updates_);
+				for (std::size_t n = 0; n < message_queue::capacity; ++n)
+				{
+					bool read = messages_.try_read([&](const char* data, std::size_t size)
+					{
+						if (size == 0)
+							return;
+
+						// An OSC message starts with its null-terminated address.
+						address.assign(data);
+
+						auto it = slots_by_address.find(address);
+
+						if (it == slots_by_address.end())
+						{
+							it = slots_by_address.insert(std::make_pair(address, slots.size())).first;
+							slots.push_back(byte_vector());
+							is_updated.push_back(false);
+						}
+
+						auto index = it->second;
+						slots[index].resize(size);
+						std::memcpy(slots[index].data(), data, size);
+
+						if (!is_updated[index])
+						{
+							is_updated[index] = true;
+							updates.push_back(index);
+						}
+					});
+
+					if (!read)
+						break;
 				}
 
 				{
@@ -260,12 +412,14 @@ private:
 				int datagram_size = bundle_header.size();
 				buffers.push_back(boost::asio::buffer(bundle_header));
 
-				BOOST_FOREACH(const auto& slot, updates)
+				BOOST_FOREACH(auto index, updates)
 				{
-					write_osc_bundle_element_start(element_headers[i], slot.second);
+					const auto& slot = slots[index];
+
+					write_osc_bundle_element_start(element_headers[i], slot);
 					const auto& headers = element_headers;
 
-					auto size_of_element = headers[i].size() + slot.second.size();
+					auto size_of_element = headers[i].size() + slot.size();
 	
 					if (datagram_size + size_of_element >= SAFE_DATAGRAM_SIZE)
 					{
@@ -276,7 +430,7 @@ private:
 					}
 
 					buffers.push_back(boost::asio::buffer(headers[i]));
-					buffers.push_back(boost::asio::buffer(slot.second));
+					buffers.push_back(boost::asio::buffer(slot));
 
 					datagram_size += size_of_element;
 					++i;
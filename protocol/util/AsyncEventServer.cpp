@@ -19,297 +19,28 @@
 * Author: Nicklas P Andersson
 */
 
- 
-// AsyncEventServer.cpp: implementation of the AsyncEventServer class.
-//
-//////////////////////////////////////////////////////////////////////
-
 #include "../stdafx.h"
 
 #include "AsyncEventServer.h"
-#include "SocketInfo.h"
 
+#include <common/env.h>
+#include <common/exception/win32_exception.h>
 #include <common/log/log.h>
-#include <string>
-#include <algorithm>
-#include <boost/algorithm/string/replace.hpp>
-
-#if defined(_MSC_VER)
-#pragma warning (push, 1) // TODO: Legacy code, just disable warnings, will replace with boost::asio in future
-#endif
-
-namespace caspar { namespace IO {
-	
-#define CASPAR_MAXIMUM_SOCKET_CLIENTS	(MAXIMUM_WAIT_OBJECTS-1)	
-
-long AsyncEventServer::instanceCount_ = 0;
-//////////////////////////////
-// AsyncEventServer constructor
-// PARAMS: port(TCP-port the server should listen to)
-// COMMENT: Initializes the WinSock2 library
-AsyncEventServer::AsyncEventServer(const safe_ptr<IProtocolStrategy>& pProtocol, int port) : port_(port), pProtocolStrategy_(pProtocol)
-{
-	if(instanceCount_ == 0) {
-		WSADATA wsaData;
-		if(WSAStartup(MAKEWORD(2,2), &wsaData) != NO_ERROR)
-			throw std::exception("Error initializing WinSock2");
-		else {
-			CASPAR_LOG(info) << "WinSock2 Initialized.";
-		}
-	}
-
-	InterlockedIncrement(&instanceCount_);
-}
-
-/////////////////////////////
-// AsyncEventServer destructor
-AsyncEventServer::~AsyncEventServer() {
-	Stop();
-
-	InterlockedDecrement(&instanceCount_);
-	if(instanceCount_ == 0)
-		WSACleanup();
-}
-
-void AsyncEventServer::SetClientDisconnectHandler(ClientDisconnectEvent handler) {
-	socketInfoCollection_.onSocketInfoRemoved = handler;
-}
-
-void AsyncEventServer::add_lifecycle_factory(const lifecycle_factory_t& factory)
-{
-	tbb::mutex::scoped_lock lock(mutex_);
-
-	lifecycle_factories_.push_back(factory);
-}
-
-//////////////////////////////
-// AsyncEventServer::Start
-// RETURNS: true at successful startup
-bool AsyncEventServer::Start() {
-	if(listenThread_.IsRunning())
-		return false;
-
-	socketInfoCollection_.Clear();
-
-	sockaddr_in sockAddr;
-	ZeroMemory(&sockAddr, sizeof(sockAddr));
-	sockAddr.sin_family = AF_INET;
-	sockAddr.sin_addr.s_addr = INADDR_ANY;
-	sockAddr.sin_port = htons(port_);
-	
-	SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if(listenSocket == INVALID_SOCKET) {
-		CASPAR_LOG(error) << "Failed to create listenSocket";
-		return false;
-	}
-	
-	pListenSocketInfo_ = SocketInfoPtr(new SocketInfo(listenSocket, this));
-
-	if(WSAEventSelect(pListenSocketInfo_->socket_, pListenSocketInfo_->event_, FD_ACCEPT|FD_CLOSE) == SOCKET_ERROR) {
-		CASPAR_LOG(error) << "Failed to enter EventSelect-mode for listenSocket";
-		return false;
-	}
-
-	if(bind(pListenSocketInfo_->socket_, (sockaddr*)&sockAddr, sizeof(sockAddr)) == SOCKET_ERROR) {
-		CASPAR_LOG(error) << "Failed to bind listenSocket";
-		return false;
-	}
-
-	if(listen(pListenSocketInfo_->socket_, SOMAXCONN) == SOCKET_ERROR) {
-		CASPAR_LOG(error) << "Failed to listen";
-		return false;
-	}
-
-	socketInfoCollection_.AddSocketInfo(pListenSocketInfo_);
-
-	//start thread: the entrypoint is Run(EVENT stopEvent)
-	if(!listenThread_.Start(this)) {
-		CASPAR_LOG(error) << "Failed to create ListenThread";
-		return false;
-	}
-
-	CASPAR_LOG(info) << "Listener successfully initialized";
-	return true;
-}
-
-void AsyncEventServer::Run(HANDLE stopEvent)
-{
-	WSANETWORKEVENTS networkEvents;
-
-	HANDLE waitHandlesCopy[MAXIMUM_WAIT_OBJECTS];
-	waitHandlesCopy[0] = stopEvent;
-
-	while(true)	{
-		//Update local copy of the array of wait-handles if nessecery
-		if(socketInfoCollection_.IsDirty()) {
-			socketInfoCollection_.CopyCollectionToArray(&(waitHandlesCopy[1]), CASPAR_MAXIMUM_SOCKET_CLIENTS);
-			socketInfoCollection_.ClearDirty();
-		}
-
-		DWORD waitResult = WSAWaitForMultipleEvents(std::min<DWORD>(static_cast<DWORD>(socketInfoCollection_.Size()+1), MAXIMUM_WAIT_OBJECTS), waitHandlesCopy, FALSE, 1500, FALSE);
-		if(waitResult == WAIT_TIMEOUT)
-			continue;
-		else if(waitResult == WAIT_FAILED)
-			break;
-		else {
-			DWORD eventIndex = waitResult - WAIT_OBJECT_0;
-
-			HANDLE waitEvent = waitHandlesCopy[eventIndex];
-			SocketInfoPtr pSocketInfo;
-
-			if(eventIndex == 0)	//stopEvent
-				break;
-			else if(socketInfoCollection_.FindSocketInfo(waitEvent, pSocketInfo)) {
-				WSAEnumNetworkEvents(pSocketInfo->socket_, waitEvent, &networkEvents);
-
-				if(networkEvents.lNetworkEvents & FD_ACCEPT) {
-					if(networkEvents.iErrorCode[FD_ACCEPT_BIT] == 0)
-						OnAccept(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnAccept (ErrorCode: " << networkEvents.iErrorCode[FD_ACCEPT_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_ACCEPT_BIT]);
-					}
-				}
-
-				if(networkEvents.lNetworkEvents & FD_CLOSE) {
-					if(networkEvents.iErrorCode[FD_CLOSE_BIT] == 0)
-						OnClose(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnClose (ErrorCode: " << networkEvents.iErrorCode[FD_CLOSE_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_CLOSE_BIT]);
-					}
-					continue;
-				}
-
-				if(networkEvents.lNetworkEvents & FD_READ) {
-					if(networkEvents.iErrorCode[FD_READ_BIT] == 0)
-						OnRead(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnRead (ErrorCode: " << networkEvents.iErrorCode[FD_READ_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_READ_BIT]);
-					}
-				}
-
-				if(networkEvents.lNetworkEvents & FD_WRITE) {
-					if(networkEvents.iErrorCode[FD_WRITE_BIT] == 0)
-						OnWrite(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnWrite (ErrorCode: " << networkEvents.iErrorCode[FD_WRITE_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_WRITE_BIT]);
-					}
-				}
-			}
-			else {
-				//Could not find the waitHandle in the SocketInfoCollection.
-				//It must have been removed during the last call to WSAWaitForMultipleEvents
-			}
-		}
-	}
-}
-
-bool AsyncEventServer::OnUnhandledException(const std::exception& ex) throw() {
-	bool bDoRestart = true;
 
-	try 
-	{
-		CASPAR_LOG(fatal) << "UNHANDLED EXCEPTION in TCPServers listeningthread. Message: " << ex.what();
-	}
-	catch(...)
-	{
-		bDoRestart = false;
-	}
-
-	return bDoRestart;
-}
-
-///////////////////////////////
-// AsyncEventServer:Stop
-// COMMENT: Shuts down
-void AsyncEventServer::Stop()
-{
-	//TODO: initiate shutdown on all clients connected
-//	for(int i=0; i < _totalActiveSockets; ++i) {
-//		shutdown(_pSocketInfo[i]->_socket, SD_SEND);
-//	}
-
-	if(!listenThread_.Stop()) {
-		CASPAR_LOG(warning) << "Wait for listenThread timed out.";
-	}
-
-	socketInfoCollection_.Clear();
-}
-
-////////////////////////////////////////////////////////////////////
-//
-// MESSAGE HANDLERS   
-//
-////////////////////////////////////////////////////////////////////
-
-
-//////////////////////////////
-// AsyncEventServer::OnAccept
-// PARAMS: ...
-// COMMENT: Called when a new client connects
-bool AsyncEventServer::OnAccept(SocketInfoPtr& pSI) {
-	sockaddr_in	clientAddr;
-	int addrSize = sizeof(clientAddr);
-	SOCKET clientSocket = WSAAccept(pSI->socket_, (sockaddr*)&clientAddr, &addrSize, NULL, NULL);
-	if(clientSocket == INVALID_SOCKET) {
-		LogSocketError(TEXT("Accept"));
-		return false;
-	}
-
-	SocketInfoPtr pClientSocket(new SocketInfo(clientSocket, this));
-
-	try
-	{ // !!!!!!!!!!!!
-		if(socketInfoCollection_.Size() >= 50) 
-		{
-			HANDLE handle = nullptr;
-			{
-				tbb::mutex::scoped_lock lock(socketInfoCollection_.mutex_);				
-				handle = *(socketInfoCollection_.waitEvents_.begin()+0);
-				if(handle == pListenSocketInfo_->event_)
-					handle = *(socketInfoCollection_.waitEvents_.begin()+1);
-			}
-			socketInfoCollection_.RemoveSocketInfo(handle);
-			CASPAR_LOG(error) << " Too many connections. Removed last used connection.";
-		}
-	}catch(...){}
-
-	//Determine if we can handle one more client
-	if(socketInfoCollection_.Size() >= CASPAR_MAXIMUM_SOCKET_CLIENTS) {
-		CASPAR_LOG(error) << "Could not accept ) << too many connections).";
-		return true;
-	}
-
-	if(WSAEventSelect(pClientSocket->socket_, pClientSocket->event_, FD_READ | FD_WRITE | FD_CLOSE) == SOCKET_ERROR) {
-		LogSocketError(TEXT("Accept (failed create event for new client)"));
-		return false;
-	}
-
-	TCHAR addressBuffer[32];
-	auto ipv4_address = inet_ntoa(clientAddr.sin_addr);
-	MultiByteToWideChar(CP_ACP, 0, ipv4_address, -1, addressBuffer, 32);
-	pClientSocket->host_ = addressBuffer;
-
-	{
-		tbb::mutex::scoped_lock lock(mutex_);
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
 
-		BOOST_FOREACH(auto& lifecycle_factory, lifecycle_factories_)
-		{
-			auto lifecycle_bound = lifecycle_factory(ipv4_address);
+#include <tbb/mutex.h>
 
-			pClientSocket->bind_to_lifecycle(lifecycle_bound);
-		}
-	}
-
-	socketInfoCollection_.AddSocketInfo(pClientSocket);
+#include <array>
+#include <set>
+#include <string>
+#include <vector>
 
-	CASPAR_LOG(info) << "Accepted connection from " << pClientSocket->host_.c_str() << " " << socketInfoCollection_.Size();
+using boost::asio::ip::tcp;
 
-	return true;
-}
+namespace caspar { namespace IO {
 
 bool ConvertMultiByteToWideChar(UINT codePage, char* pSource, int sourceLength, std::vector<wchar_t>& wideBuffer, int& countLeftovers)
 {
@@ -334,7 +65,7 @@ bool ConvertMultiByteToWideChar(UINT codePage, char* pSource, int sourceLength,
 							//The sequence is incomplete. Leave the leftovers to be interpreted with the next call
 							break;
 						}
-						//The sequence is complete, there are no leftovers. 
+						//The sequence is complete, there are no leftovers.
 						//...OR...
 						//error. Let the conversion-function take the hit.
 						countLeftovers = 0;
@@ -357,10 +88,10 @@ bool ConvertMultiByteToWideChar(UINT codePage, char* pSource, int sourceLength,
 	int charsWritten = 0;
 	int sourceBytesToProcess = sourceLength-countLeftovers;
 	int wideBufferCapacity = MultiByteToWideChar(codePage, 0, pSource, sourceBytesToProcess, NULL, NULL);
-	if(wideBufferCapacity > 0) 
+	if(wideBufferCapacity > 0)
 	{
 		wideBuffer.resize(wideBufferCapacity);
-		charsWritten = MultiByteToWideChar(codePage, 0, pSource, sourceBytesToProcess, &wideBuffer[0], wideBuffer.size());
+		charsWritten = MultiByteToWideChar(codePage, 0, pSource, sourceBytesToProcess, &wideBuffer[0], static_cast<int>(wideBuffer.size()));
 	}
 	//copy the leftovers to the front of the buffer
 	if(countLeftovers > 0) {
@@ -371,265 +102,353 @@ bool ConvertMultiByteToWideChar(UINT codePage, char* pSource, int sourceLength,
 	return (charsWritten > 0);
 }
 
-//////////////////////////////
-// AsyncEventServer::OnRead
-// PARAMS: ...
-// COMMENT: Called then something arrives on the socket that has to be read
-bool AsyncEventServer::OnRead(SocketInfoPtr& pSI) {
-	int recvResult = SOCKET_ERROR;
-	
-	try
-	{ // !!!!!!!!!!!!
-		if(pSI)
-		{
-			tbb::mutex::scoped_lock lock(socketInfoCollection_.mutex_);
-			auto it = std::find(socketInfoCollection_.waitEvents_.begin(), socketInfoCollection_.waitEvents_.end(), pSI->event_);
-			if(it != socketInfoCollection_.waitEvents_.end())
-			{
-				auto handle = *it;
-				socketInfoCollection_.waitEvents_.erase(it);
-				socketInfoCollection_.waitEvents_.push_back(handle);
-			}
-		}
-	}catch(...){}
-
-	int maxRecvLength = sizeof(pSI->recvBuffer_)-pSI->recvLeftoverOffset_;
-	recvResult = recv(pSI->socket_, pSI->recvBuffer_+pSI->recvLeftoverOffset_, maxRecvLength, 0);
-	while(recvResult != SOCKET_ERROR) {
-		if(recvResult == 0) {
-			CASPAR_LOG(info) << "Client " << pSI->host_.c_str() << TEXT(" disconnected");
-
-			socketInfoCollection_.RemoveSocketInfo(pSI);
-			return true;
-		}
-
-		//Convert to widechar
-		if(ConvertMultiByteToWideChar(pProtocolStrategy_->GetCodepage(), pSI->recvBuffer_, recvResult + pSI->recvLeftoverOffset_, pSI->wideRecvBuffer_, pSI->recvLeftoverOffset_))		
-			pProtocolStrategy_->Parse(&pSI->wideRecvBuffer_[0], pSI->wideRecvBuffer_.size(), pSI);		
-		else			
-			CASPAR_LOG(error) << "Read from " << pSI->host_.c_str() << TEXT(" failed, could not convert command to UNICODE");
-			
-		maxRecvLength = sizeof(pSI->recvBuffer_)-pSI->recvLeftoverOffset_;
-		recvResult = recv(pSI->socket_, pSI->recvBuffer_+pSI->recvLeftoverOffset_, maxRecvLength, 0);
-	}
-			
-	if(recvResult == SOCKET_ERROR) {
-		int errorCode = WSAGetLastError();
-		if(errorCode == WSAEWOULDBLOCK)
-			return true;
-		else {
-			LogSocketError(TEXT("Read"), errorCode);
-			OnError(pSI->event_, errorCode);
-		}
-	}
-
-	return false;
-}
-
-//////////////////////////////
-// AsyncEventServer::OnWrite
-// PARAMS: ...
-// COMMENT: Called when the socket is ready to send more data
-void AsyncEventServer::OnWrite(SocketInfoPtr& pSI) {		
-	DoSend(*pSI);	
-}
-
 bool ConvertWideCharToMultiByte(UINT codePage, const std::wstring& wideString, std::vector<char>& destBuffer)
 {
 	int bytesWritten = 0;
 	int multibyteBufferCapacity = WideCharToMultiByte(codePage, 0, wideString.c_str(), static_cast<int>(wideString.length()), 0, 0, NULL, NULL);
-	if(multibyteBufferCapacity > 0) 
+	if(multibyteBufferCapacity > 0)
 	{
 		destBuffer.resize(multibyteBufferCapacity);
-		bytesWritten = WideCharToMultiByte(codePage, 0, wideString.c_str(), static_cast<int>(wideString.length()), &destBuffer[0], destBuffer.size(), NULL, NULL);
+		bytesWritten = WideCharToMultiByte(codePage, 0, wideString.c_str(), static_cast<int>(wideString.length()), &destBuffer[0], static_cast<int>(destBuffer.size()), NULL, NULL);
 	}
 	destBuffer.resize(bytesWritten);
 	return (bytesWritten > 0);
 }
 
-void AsyncEventServer::DoSend(SocketInfo& socketInfo) {
-	//Locks the socketInfo-object so that no one else tampers with the sendqueue at the same time
-	tbb::mutex::scoped_lock lock(socketInfo.mutex_);
+class connection;
 
-	while(!socketInfo.sendQueue_.empty() || socketInfo.currentlySending_.size() > 0) {
-		if(socketInfo.currentlySending_.size() == 0) {
-			//Read the next string in the queue and convert to UTF-8
-			if(!ConvertWideCharToMultiByte(pProtocolStrategy_->GetCodepage(), socketInfo.sendQueue_.front(), socketInfo.currentlySending_))
-			{
-				CASPAR_LOG(error) << "Send to " << socketInfo.host_.c_str() << TEXT(" failed, could not convert response to UTF-8");
-			}
-			socketInfo.currentlySendingOffset_ = 0;
-		}
+typedef std::set<std::shared_ptr<connection>> connection_set;
 
-		if(socketInfo.currentlySending_.size() > 0) {
-			int bytesToSend = static_cast<int>(socketInfo.currentlySending_.size()-socketInfo.currentlySendingOffset_);
-			int sentBytes = send(socketInfo.socket_, &socketInfo.currentlySending_[0] + socketInfo.currentlySendingOffset_, bytesToSend, 0);
-			if(sentBytes == SOCKET_ERROR) {
-				int errorCode = WSAGetLastError();
-				if(errorCode == WSAEWOULDBLOCK) {
-					CASPAR_LOG(debug) << "Send to " << socketInfo.host_.c_str() << TEXT(" would block, sending later");
-					break;
-				}
-				else {
-					LogSocketError(TEXT("Send"), errorCode);
-					OnError(socketInfo.event_, errorCode);
+// A client. Everything but Send and Disconnect runs on the reactor thread.
+class connection : public ClientInfo, public std::enable_shared_from_this<connection>
+{
+	const std::shared_ptr<boost::asio::io_service>	service_;
+	const safe_ptr<tcp::socket>				socket_;
+	const std::wstring						host_;
+	const safe_ptr<IProtocolStrategy>		protocol_;
+	const std::shared_ptr<connection_set>	connection_set_;
+	const size_t							max_send_queue_;
+
+	std::array<char, 8192>					read_buffer_;
+	int										read_leftover_;
+	std::vector<wchar_t>					wide_read_buffer_;
+
+	std::vector<std::vector<char>>			send_queue_;
+	std::vector<std::vector<char>>			sending_;
+	size_t									queued_bytes_;
+	bool									disconnect_requested_;
+
+	std::vector<std::shared_ptr<void>>		lifecycle_bound_items_;
+
+public:
+	// Protocols may keep clients around after the server is gone, so they
+	// share the io_service with it.
+	connection(
+			const std::shared_ptr<boost::asio::io_service>& service,
+			const safe_ptr<tcp::socket>& socket,
+			const safe_ptr<IProtocolStrategy>& protocol,
+			const std::shared_ptr<connection_set>& connection_set,
+			size_t max_send_queue)
+		: service_(service)
+		, socket_(socket)
+		, host_(widen(socket_->remote_endpoint().address().to_string()))
+		, protocol_(protocol)
+		, connection_set_(connection_set)
+		, max_send_queue_(max_send_queue)
+		, read_leftover_(0)
+		, queued_bytes_(0)
+		, disconnect_requested_(false)
+	{
+		boost::system::error_code ec;
+		socket_->set_option(tcp::no_delay(true), ec);
+	}
 
-					socketInfo.currentlySending_.resize(0);
-					socketInfo.currentlySendingOffset_ = 0;
-					socketInfo.sendQueue_.pop();
-					break;
-				}
-			}
-			else {
-				if(sentBytes == bytesToSend) {
-					
-					if(sentBytes < 512)
-					{
-						boost::replace_all(socketInfo.sendQueue_.front(), L"\n", L"\\n");
-						boost::replace_all(socketInfo.sendQueue_.front(), L"\r", L"\\r");
-						CASPAR_LOG(info) << L"Sent message to " << socketInfo.host_.c_str() << L": " << socketInfo.sendQueue_.front().c_str();
-					}
-					else
-						CASPAR_LOG(info) << "Sent more than 512 bytes to " << socketInfo.host_.c_str();
+	void start()
+	{
+		CASPAR_LOG(info) << L"Accepted connection from " << host_ << L" " << connection_set_->size();
 
-					socketInfo.currentlySending_.resize(0);
-					socketInfo.currentlySendingOffset_ = 0;
-					socketInfo.sendQueue_.pop();
-				}
-				else {
-					socketInfo.currentlySendingOffset_ += sentBytes;
-					CASPAR_LOG(info) << "Sent partial message to " << socketInfo.host_.c_str();
-				}
-			}
+		read_some();
+	}
+
+	void Send(const std::wstring& data) override
+	{
+		if(data.empty())
+			return;
+
+		// Converted on the calling thread to keep the reactor free for I/O.
+		std::vector<char> bytes;
+		if(!ConvertWideCharToMultiByte(protocol_->GetCodepage(), data, bytes))
+		{
+			CASPAR_LOG(error) << L"Send to " << host_ << L" failed, could not convert response to UTF-8";
+			return;
+		}
+
+		if(bytes.size() < 512)
+		{
+			auto message = data;
+			boost::replace_all(message, L"\n", L"\\n");
+			boost::replace_all(message, L"\r", L"\\r");
+			CASPAR_LOG(info) << L"Sent message to " << host_ << L": " << message;
 		}
 		else
-			socketInfo.sendQueue_.pop();
+			CASPAR_LOG(info) << L"Sent more than 512 bytes to " << host_;
+
+		auto self = shared_from_this();
+		auto shared_bytes = std::make_shared<std::vector<char>>(std::move(bytes));
+
+		service_->post([self, shared_bytes]
+		{
+			if(!self->socket_->is_open())
+				return;
+
+			// A client that does not read its replies would otherwise grow
+			// the queue without bound.
+			self->queued_bytes_ += shared_bytes->size();
+			if(self->max_send_queue_ > 0 && self->queued_bytes_ > self->max_send_queue_)
+			{
+				CASPAR_LOG(warning) << L"Disconnecting " << self->host_ << L", more than " << self->max_send_queue_ << L" bytes waiting to be sent";
+				self->remove();
+				return;
+			}
+
+			self->send_queue_.push_back(std::move(*shared_bytes));
+
+			if(self->sending_.empty())
+				self->write_queued();
+		});
 	}
-}
 
-//////////////////////////////
-// AsyncEventServer::OnClose
-// PARAMS: ...
-// COMMENT: Called when a client disconnects / is disconnected
-void AsyncEventServer::OnClose(SocketInfoPtr& pSI) {
-	CASPAR_LOG(info) << "Client " << pSI->host_.c_str() << TEXT(" was disconnected");
+	void Disconnect() override
+	{
+		auto self = shared_from_this();
 
-	socketInfoCollection_.RemoveSocketInfo(pSI);
-}
+		service_->post([self]
+		{
+			self->disconnect_requested_ = true;
+
+			if(self->sending_.empty())
+				self->shutdown();
+		});
+	}
+
+	void bind_to_lifecycle(const std::shared_ptr<void>& lifecycle_bound)
+	{
+		lifecycle_bound_items_.push_back(lifecycle_bound);
+	}
+
+	void close()
+	{
+		boost::system::error_code ec;
+		socket_->close(ec);
+	}
 
-//////////////////////////////
-// AsyncEventServer::OnError
-// PARAMS: ...
-// COMMENT: Called when an errorcode is recieved
-void AsyncEventServer::OnError(HANDLE waitEvent, int errorCode) {
-	if(errorCode == WSAENETDOWN || errorCode == WSAECONNABORTED || errorCode == WSAECONNRESET || errorCode == WSAESHUTDOWN || errorCode == WSAETIMEDOUT || errorCode == WSAENOTCONN || errorCode == WSAENETRESET) {
-		SocketInfoPtr pSocketInfo;
-		if(socketInfoCollection_.FindSocketInfo(waitEvent, pSocketInfo)) {
-			CASPAR_LOG(info) << "Client " << pSocketInfo->host_.c_str() << TEXT(" was disconnected, Errorcode ") << errorCode;
+	std::wstring print() const override
+	{
+		return host_;
+	}
+
+private:
+	void read_some()
+	{
+		auto self = shared_from_this();
+
+		socket_->async_read_some(
+				boost::asio::buffer(read_buffer_.data() + read_leftover_, read_buffer_.size() - read_leftover_),
+				[self](const boost::system::error_code& error, size_t bytes_transferred)
+				{
+					self->on_read(error, bytes_transferred);
+				});
+	}
+
+	void on_read(const boost::system::error_code& error, size_t bytes_transferred)
+	{
+		if(error)
+		{
+			if(error != boost::asio::error::operation_aborted)
+			{
+				CASPAR_LOG(info) << L"Client " << host_ << L" disconnected (" << widen(error.message()) << L")";
+				remove();
+			}
+
+			return;
 		}
 
-		socketInfoCollection_.RemoveSocketInfo(waitEvent);
+		try
+		{
+			if(ConvertMultiByteToWideChar(protocol_->GetCodepage(), read_buffer_.data(), static_cast<int>(bytes_transferred) + read_leftover_, wide_read_buffer_, read_leftover_))
+				protocol_->Parse(&wide_read_buffer_[0], static_cast<int>(wide_read_buffer_.size()), shared_from_this());
+			else
+				CASPAR_LOG(error) << L"Read from " << host_ << L" failed, could not convert command to UNICODE";
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+
+		read_some();
 	}
-}
 
-//////////////////////////////
-// AsyncEventServer::DisconnectClient
-// PARAMS: ...
-// COMMENT: The client is removed from the actual client-list when an FD_CLOSE notification is recieved
-void AsyncEventServer::DisconnectClient(SocketInfo& socketInfo) {
-	int result = shutdown(socketInfo.socket_, SD_SEND);
-	if(result == SOCKET_ERROR)
-		OnError(socketInfo.event_, result);
-}
+	// Writes everything that has been queued with one gathering write.
+	void write_queued()
+	{
+		sending_.swap(send_queue_);
 
-//////////////////////////////
-// AsyncEventServer::LogSocketError
-void AsyncEventServer::LogSocketError(const TCHAR* pStr, int socketError) {
-	if(socketError == 0)
-		socketError = WSAGetLastError();
+		std::vector<boost::asio::const_buffer> buffers;
+		buffers.reserve(sending_.size());
 
-	CASPAR_LOG(error) << "Failed to " << pStr << TEXT(" Errorcode: ") << socketError;
-}
+		BOOST_FOREACH(auto& bytes, sending_)
+			buffers.push_back(boost::asio::buffer(bytes));
+
+		auto self = shared_from_this();
 
+		boost::asio::async_write(
+				*socket_,
+				buffers,
+				[self](const boost::system::error_code& error, size_t)
+				{
+					self->on_write(error);
+				});
+	}
 
-//////////////////////////////
-//  SocketInfoCollection
-//////////////////////////////
+	void on_write(const boost::system::error_code& error)
+	{
+		BOOST_FOREACH(auto& bytes, sending_)
+			queued_bytes_ -= bytes.size();
 
-AsyncEventServer::SocketInfoCollection::SocketInfoCollection() : bDirty_(false) {
-}
+		sending_.clear();
 
-AsyncEventServer::SocketInfoCollection::~SocketInfoCollection() {
-}
+		if(error)
+		{
+			if(error != boost::asio::error::operation_aborted)
+			{
+				CASPAR_LOG(info) << L"Send to " << host_ << L" failed (" << widen(error.message()) << L")";
+				remove();
+			}
 
-bool AsyncEventServer::SocketInfoCollection::AddSocketInfo(SocketInfoPtr& pSocketInfo) {
-	tbb::mutex::scoped_lock lock(mutex_);
+			return;
+		}
 
-	waitEvents_.resize(waitEvents_.size()+1);
-	bool bSuccess = socketInfoMap_.insert(SocketInfoMap::value_type(pSocketInfo->event_, pSocketInfo)).second;
-	if(bSuccess) {
-		waitEvents_[waitEvents_.size()-1] = pSocketInfo->event_;
-		bDirty_ = true;
+		if(!send_queue_.empty())
+			write_queued();
+		else if(disconnect_requested_)
+			shutdown();
 	}
 
-	return bSuccess;
-}
+	void shutdown()
+	{
+		boost::system::error_code ec;
+		socket_->shutdown(tcp::socket::shutdown_send, ec);
+	}
 
-void AsyncEventServer::SocketInfoCollection::RemoveSocketInfo(SocketInfoPtr& pSocketInfo) {
-	if(pSocketInfo != 0) {
-		RemoveSocketInfo(pSocketInfo->event_);
+	void remove()
+	{
+		close();
+		connection_set_->erase(shared_from_this());
 	}
-}
-void AsyncEventServer::SocketInfoCollection::RemoveSocketInfo(HANDLE waitEvent) {
-	tbb::mutex::scoped_lock lock(mutex_);
+};
+
+struct AsyncEventServer::implementation : boost::noncopyable
+{
+	const std::shared_ptr<boost::asio::io_service>	service_;
+	tcp::acceptor							acceptor_;
+	const safe_ptr<IProtocolStrategy>		protocol_;
+	const std::shared_ptr<connection_set>	connection_set_;
+	const size_t							max_send_queue_;
+
+	tbb::mutex								mutex_;
+	std::vector<lifecycle_factory_t>		lifecycle_factories_;
+
+	boost::thread							thread_;
+
+	implementation(const safe_ptr<IProtocolStrategy>& protocol, unsigned short port)
+		: service_(std::make_shared<boost::asio::io_service>())
+		, acceptor_(*service_, tcp::endpoint(tcp::v4(), port))
+		, protocol_(protocol)
+		, connection_set_(std::make_shared<connection_set>())
+		, max_send_queue_(env::properties().get(L"configuration.tcp.max-send-queue", 16) * 1024 * 1024)
+	{
+		start_accept();
 
-	//Find instance
-	SocketInfoPtr pSocketInfo;
-	SocketInfoMap::iterator it = socketInfoMap_.find(waitEvent);
-	SocketInfoMap::iterator end = socketInfoMap_.end();
-	if(it != end)
-		pSocketInfo = it->second;
+		thread_ = boost::thread([this]
+		{
+			win32_exception::ensure_handler_installed_for_thread("tcp-server-thread");
 
-	if(pSocketInfo) {
-		pSocketInfo->pServer_ = NULL;
+			service_->run();
+		});
 
-		socketInfoMap_.erase(waitEvent);
+		CASPAR_LOG(info) << L"Listening on TCP port " << port << L".";
+	}
 
-		HandleVector::iterator it = std::find(waitEvents_.begin(), waitEvents_.end(), waitEvent);
-		if(it != waitEvents_.end()) {
-			std::swap((*it), waitEvents_.back());
-			waitEvents_.resize(waitEvents_.size()-1);
+	~implementation()
+	{
+		service_->post([this]
+		{
+			boost::system::error_code ec;
+			acceptor_.close(ec);
 
-			bDirty_ = true;
-		}
+			BOOST_FOREACH(auto& client, *connection_set_)
+				client->close();
+		});
+
+		thread_.join();
+
+		connection_set_->clear();
 	}
-	if(onSocketInfoRemoved)
-		onSocketInfoRemoved(pSocketInfo);
-}
 
-bool AsyncEventServer::SocketInfoCollection::FindSocketInfo(HANDLE key, SocketInfoPtr& pResult) {
-	tbb::mutex::scoped_lock lock(mutex_);
+	void start_accept()
+	{
+		auto socket = make_safe<tcp::socket>(*service_);
 
-	SocketInfoMap::iterator it = socketInfoMap_.find(key);
-	SocketInfoMap::iterator end = socketInfoMap_.end();
-	if(it != end)
-		pResult = it->second;
+		acceptor_.async_accept(*socket, [=](const boost::system::error_code& error)
+		{
+			handle_accept(socket, error);
+		});
+	}
 
-	return (it != end);
-}
+	void handle_accept(const safe_ptr<tcp::socket>& socket, const boost::system::error_code& error)
+	{
+		if(!acceptor_.is_open())
+			return;
 
-void AsyncEventServer::SocketInfoCollection::CopyCollectionToArray(HANDLE* pDest, int maxCount) {
-	tbb::mutex::scoped_lock lock(mutex_);
+		if(!error)
+		{
+			try
+			{
+				auto client = std::make_shared<connection>(service_, socket, protocol_, connection_set_, max_send_queue_);
 
-	memcpy(pDest, &(waitEvents_[0]), std::min( maxCount, static_cast<int>(waitEvents_.size()) ) * sizeof(HANDLE) );
-}
+				const auto ipv4_address = socket->remote_endpoint().address().to_string();
 
-void AsyncEventServer::SocketInfoCollection::Clear() {
-	tbb::mutex::scoped_lock lock(mutex_);
+				{
+					tbb::mutex::scoped_lock lock(mutex_);
 
-	socketInfoMap_.clear();
-	waitEvents_.clear();
-}
+					BOOST_FOREACH(auto& lifecycle_factory, lifecycle_factories_)
+						client->bind_to_lifecycle(lifecycle_factory(ipv4_address));
+				}
+
+				connection_set_->insert(client);
+				client->start();
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+			}
+		}
+		else
+			CASPAR_LOG(warning) << L"Failed to accept connection (" << widen(error.message()) << L")";
+
+		start_accept();
+	}
+
+	void add_lifecycle_factory(const lifecycle_factory_t& lifecycle_factory)
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+
+		lifecycle_factories_.push_back(lifecycle_factory);
+	}
+};
+
+AsyncEventServer::AsyncEventServer(const safe_ptr<IProtocolStrategy>& protocol, unsigned short port) : impl_(new implementation(protocol, port)){}
+AsyncEventServer::~AsyncEventServer(){}
+void AsyncEventServer::add_lifecycle_factory(const lifecycle_factory_t& lifecycle_factory){impl_->add_lifecycle_factory(lifecycle_factory);}
 
-}	//namespace IO
-}	//namespace caspar
\ No newline at end of file
+}}
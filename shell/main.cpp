@@ -57,6 +57,7 @@
 #include <modules/html/html.h>
 
 #include <common/env.h>
+#include <common/concurrency/executor.h>
 #include <common/exception/win32_exception.h>
 #include <common/exception/exceptions.h>
 #include <common/log/log.h>
@@ -74,6 +75,7 @@
 #include <boost/thread/future.hpp>
 #include <boost/locale.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/logic/tribool.hpp>
 
 #include <functional>
@@ -278,6 +280,9 @@ int main(int argc, char* argv[])
 				
 		caspar::log::set_log_level(caspar::env::properties().get(L"configuration.log-level", L"debug"));
 
+		if(boost::iequals(caspar::env::properties().get(L"configuration.executor", L"thread"), L"pool"))
+			caspar::executor::set_default_backend(caspar::pool_backend);
+
 	#ifdef _DEBUG
 		if(caspar::env::properties().get(L"configuration.debugging.remote", false))
 			MessageBox(nullptr, TEXT("Now is the time to connect for remote debugging..."), TEXT("Debug"), MB_OK | MB_TOPMOST);
@@ -33,9 +33,11 @@
 #include <core/mixer/audio/audio_util.h>
 #include <core/mixer/mixer.h>
 #include <core/video_channel.h>
+#include <core/producer/frame_producer.h>
 #include <core/producer/stage.h>
 #include <core/consumer/output.h>
 #include <core/thumbnail_generator.h>
+#include <core/media_library.h>
 #include <core/producer/media_info/media_info.h>
 #include <core/producer/media_info/media_info_repository.h>
 #include <core/producer/media_info/in_memory_media_info_repository.h>
@@ -59,6 +61,7 @@
 #include <modules/ffmpeg/consumer/streaming_consumer.h>
 
 #include <protocol/amcp/AMCPProtocolStrategy.h>
+#include <protocol/amcp/AMCPCommandsImpl.h>
 #include <protocol/cii/CIIProtocolStrategy.h>
 #include <protocol/CLK/CLKProtocolStrategy.h>
 #include <protocol/util/AsyncEventServer.h>
@@ -72,6 +75,7 @@
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/asio.hpp>
+#include <boost/thread.hpp>
 
 #include <tbb/atomic.h>
 
@@ -115,16 +119,18 @@ struct server::implementation : boost::noncopyable
 	std::vector<std::shared_ptr<void>>			predefined_osc_subscriptions_;
 	std::vector<safe_ptr<video_channel>>		channels_;
 	safe_ptr<media_info_repository>				media_info_repo_;
-	boost::thread								initial_media_info_thread_;
+	boost::thread_group							initial_media_info_threads_;
 	tbb::atomic<bool>							running_;
+	std::shared_ptr<media_library>				media_library_; // Monitors the media folder for the other two.
 	std::shared_ptr<thumbnail_generator>		thumbnail_generator_;
+	std::shared_ptr<void>						producer_resolution_cache_;
 
 	implementation(const std::function<void (bool)>& shutdown_server_now)
 		: io_service_(create_running_io_service())
 		, shutdown_server_now_(shutdown_server_now)
 		, ogl_(ogl_device::create())
 		, osc_client_(io_service_)
-		, media_info_repo_(create_in_memory_media_info_repository())
+		, media_info_repo_(create_persistent_media_info_repository(env::data_folder() + L"media-info.idx"))
 	{
 		running_ = true;
 		setup_audio(env::properties());
@@ -156,8 +162,12 @@ struct server::implementation : boost::noncopyable
 		setup_channels(env::properties());
 		CASPAR_LOG(info) << L"Initialized channels.";
 
+		setup_media_library(env::properties());
+
 		setup_thumbnail_generation(env::properties());
 
+		setup_producer_resolution_cache(env::properties());
+
 		setup_controllers(env::properties());
 		CASPAR_LOG(info) << L"Initialized controllers.";
 
@@ -172,8 +182,10 @@ struct server::implementation : boost::noncopyable
 	{
 		diagnostics::show_graphs(false);
 		running_ = false;
-		initial_media_info_thread_.join();
+		initial_media_info_threads_.join_all();
+		producer_resolution_cache_.reset();
 		thumbnail_generator_.reset();
+		media_library_.reset();
 		primary_amcp_server_.reset();
 		async_servers_.clear();
 		destroy_producers_synchronously();
@@ -211,8 +223,10 @@ struct server::implementation : boost::noncopyable
 				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Invalid video-mode."));
 			auto audio_channel_layout = default_channel_layout_repository().get_by_name(
 					boost::to_upper_copy(xml_channel.second.get(L"channel-layout", L"STEREO")));
+			auto image_mixer_backend = core::get_image_mixer_backend(xml_channel.second.get(L"image-mixer", L"gpu"));
+			auto pipeline_depth = xml_channel.second.get(L"pipeline-depth", -1);
 			
-			channels_.push_back(make_safe<video_channel>(channels_.size()+1, format_desc, ogl_, audio_channel_layout));
+			channels_.push_back(make_safe<video_channel>(channels_.size()+1, format_desc, ogl_, audio_channel_layout, image_mixer_backend, pipeline_depth));
 			
 			channels_.back()->monitor_output().attach_parent(monitor_subject_);
 			channels_.back()->mixer()->set_straight_alpha_output(
@@ -220,9 +234,12 @@ struct server::implementation : boost::noncopyable
 
 			create_consumers(
 				xml_channel.second.get_child(L"consumers"),
-				[&] (const safe_ptr<core::frame_consumer>& consumer)
+				[&] (const safe_ptr<core::frame_consumer>& consumer, const boost::property_tree::wptree& xml_consumer)
 				{
-					channels_.back()->output()->add(consumer);
+					channels_.back()->output()->add(
+							consumer,
+							core::get_consumer_send_policy(xml_consumer.get(L"send-policy", L"auto")),
+							xml_consumer.get(L"queue-depth", 2));
 				});
 		}
 
@@ -239,7 +256,7 @@ struct server::implementation : boost::noncopyable
 	{
 		std::vector<safe_ptr<Base>> consumers;
 
-		create_consumers(pt, [&] (const safe_ptr<core::frame_consumer>& consumer)
+		create_consumers(pt, [&] (const safe_ptr<core::frame_consumer>& consumer, const boost::property_tree::wptree&)
 		{
 			consumers.push_back(dynamic_pointer_cast<Base>(consumer));
 		});
@@ -257,19 +274,19 @@ struct server::implementation : boost::noncopyable
 				auto name = xml_consumer.first;
 
 				if (name == L"screen")
-					on_consumer(ogl::create_consumer(xml_consumer.second));
+					on_consumer(ogl::create_consumer(xml_consumer.second), xml_consumer.second);
 				else if (name == L"bluefish")					
-					on_consumer(bluefish::create_consumer(xml_consumer.second));					
+					on_consumer(bluefish::create_consumer(xml_consumer.second), xml_consumer.second);					
 				else if (name == L"decklink")					
-					on_consumer(decklink::create_consumer(xml_consumer.second));				
+					on_consumer(decklink::create_consumer(xml_consumer.second), xml_consumer.second);				
 				else if (name == L"newtek-ivga")					
-					on_consumer(newtek::create_ivga_consumer(xml_consumer.second));			
+					on_consumer(newtek::create_ivga_consumer(xml_consumer.second), xml_consumer.second);			
 				else if (name == L"file")					
-					on_consumer(ffmpeg::create_consumer(xml_consumer.second));						
+					on_consumer(ffmpeg::create_consumer(xml_consumer.second), xml_consumer.second);						
 				else if (name == L"stream")					
-					on_consumer(ffmpeg::create_streaming_consumer(xml_consumer.second));						
+					on_consumer(ffmpeg::create_streaming_consumer(xml_consumer.second), xml_consumer.second);						
 				else if (name == L"system-audio")
-					on_consumer(oal::create_consumer());
+					on_consumer(oal::create_consumer(), xml_consumer.second);
 				else if (name != L"<xmlcomment>")
 					CASPAR_LOG(warning) << "Invalid consumer: " << widen(name);	
 			}
@@ -292,12 +309,11 @@ struct server::implementation : boost::noncopyable
 
 				if(name == L"tcp")
 				{					
-					unsigned int port = xml_controller.second.get(L"port", 5250);
+					unsigned short port = xml_controller.second.get<unsigned short>(L"port", 5250);
 					auto asyncbootstrapper = make_safe<IO::AsyncEventServer>(create_protocol(
 							protocol,
 							L"TCP Port " + boost::lexical_cast<std::wstring>(port)),
 							port);
-					asyncbootstrapper->Start();
 					async_servers_.push_back(asyncbootstrapper);
 
 					if (!primary_amcp_server_ && boost::iequals(protocol, L"AMCP"))
@@ -361,10 +377,10 @@ struct server::implementation : boost::noncopyable
 
 		auto scan_interval_millis = pt.get(L"configuration.thumbnails.scan-interval-millis", 5000);
 
-		polling_filesystem_monitor_factory monitor_factory(
+		polling_filesystem_monitor_factory polling_monitor_factory(
 				io_service_, scan_interval_millis);
 		thumbnail_generator_.reset(new thumbnail_generator(
-				monitor_factory, 
+				media_library_ ? media_library_->monitor_factory() : polling_monitor_factory, 
 				env::media_folder(),
 				env::thumbnails_folder(),
 				pt.get(L"configuration.thumbnails.width", 256),
@@ -374,11 +390,44 @@ struct server::implementation : boost::noncopyable
 				pt.get(L"configuration.thumbnails.generate-delay-millis", 2000),
 				&image::write_cropped_png,
 				media_info_repo_,
-				pt.get(L"configuration.thumbnails.mipmap", false)));
+				pt.get(L"configuration.thumbnails.mipmap", false),
+				pt.get(L"configuration.thumbnails.workers", 2),
+				core::get_image_mixer_backend(pt.get(L"configuration.thumbnails.image-mixer", L"gpu"))));
 
 		CASPAR_LOG(info) << L"Initialized thumbnail generator.";
 	}
 
+	void setup_media_library(const boost::property_tree::wptree& pt)
+	{
+		if (!pt.get(L"configuration.media-library.enabled", true))
+			return;
+
+		polling_filesystem_monitor_factory monitor_factory(
+				io_service_, pt.get(L"configuration.media-library.scan-interval-millis", 5000));
+		media_library_.reset(new media_library(
+				monitor_factory,
+				env::media_folder(),
+				env::data_folder() + L"media-library.idx",
+				&protocol::ClipType,
+				media_info_repo_));
+
+		CASPAR_LOG(info) << L"Initialized media library.";
+	}
+
+	void setup_producer_resolution_cache(const boost::property_tree::wptree& pt)
+	{
+		if (!pt.get(L"configuration.producer-resolution-cache.enabled", true))
+			return;
+
+		polling_filesystem_monitor_factory polling_monitor_factory(
+				io_service_, pt.get(L"configuration.producer-resolution-cache.scan-interval-millis", 5000));
+		producer_resolution_cache_ = enable_producer_resolution_cache(
+				media_library_ ? media_library_->monitor_factory() : polling_monitor_factory,
+				polling_monitor_factory);
+
+		CASPAR_LOG(info) << L"Initialized producer resolution cache.";
+	}
+
 	safe_ptr<IO::IProtocolStrategy> create_protocol(const std::wstring& name, const std::wstring& port_description) const
 	{
 		if(boost::iequals(name, L"AMCP"))
@@ -387,6 +436,7 @@ struct server::implementation : boost::noncopyable
 					channels_,
 					thumbnail_generator_,
 					media_info_repo_,
+					media_library_,
 					ogl_,
 					shutdown_server_now_);
 		else if(boost::iequals(name, L"CII"))
@@ -403,24 +453,64 @@ struct server::implementation : boost::noncopyable
 
 	void start_initial_media_info_scan()
 	{
-		initial_media_info_thread_ = boost::thread([this]
+		// Probing is mostly waiting for the disk, so several files are
+		// probed at once. Files known from the persisted index are only
+		// checked for modification.
+		auto threads	= std::max(1, env::properties().get(L"configuration.media-info.warm-up-threads", 4));
+		auto files		= std::make_shared<boost::filesystem::recursive_directory_iterator>(env::media_folder());
+		auto mutex		= std::make_shared<boost::mutex>();
+		auto remaining	= std::make_shared<tbb::atomic<int>>();
+		*remaining		= threads;
+
+		for (int n = 0; n < threads; ++n)
 		{
-			for (boost::filesystem::recursive_directory_iterator iter(env::media_folder()), end; iter != end; ++iter)
+			initial_media_info_threads_.create_thread([=]
 			{
-				if (running_)
+				while (running_)
 				{
-					CASPAR_LOG(trace) << L"Retrieving information about file " << iter->path();
-					media_info_repo_->get(iter->path().wstring());
+					boost::filesystem::path file;
+
+					try
+					{
+						boost::mutex::scoped_lock lock(*mutex);
+
+						boost::filesystem::recursive_directory_iterator end;
+
+						while (*files != end && !boost::filesystem::is_regular_file((*files)->status()))
+							++*files;
+
+						if (*files == end)
+							break;
+
+						file = (*files)->path();
+						++*files;
+					}
+					catch (...)
+					{
+						CASPAR_LOG_CURRENT_EXCEPTION();
+						break;
+					}
+
+					try
+					{
+						CASPAR_LOG(trace) << L"Retrieving information about file " << file;
+						media_info_repo_->get(file.wstring());
+					}
+					catch (...)
+					{
+						CASPAR_LOG_CURRENT_EXCEPTION();
+					}
 				}
-				else
+
+				if (--*remaining == 0)
 				{
-					CASPAR_LOG(info) << L"Initial media information retrieval aborted.";
-					return;
+					if (running_)
+						CASPAR_LOG(info) << L"Initial media information retrieval finished.";
+					else
+						CASPAR_LOG(info) << L"Initial media information retrieval aborted.";
 				}
-			}
-
-			CASPAR_LOG(info) << L"Initial media information retrieval finished.";
-		});
+			});
+		}
 	}
 };
 